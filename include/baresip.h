@@ -91,6 +91,7 @@ void call_set_handlers(struct call *call, call_event_h *eh,
 uint16_t      call_scode(const struct call *call);
 uint32_t      call_duration(const struct call *call);
 uint32_t      call_setup_duration(const struct call *call);
+const char   *call_id(const struct call *call);
 const char   *call_peeruri(const struct call *call);
 const char   *call_peername(const struct call *call);
 const char   *call_localuri(const struct call *call);
@@ -102,6 +103,41 @@ bool          call_is_onhold(const struct call *call);
 bool          call_is_outgoing(const struct call *call);
 
 
+/*
+ * Media Stream
+ */
+
+struct stream;
+
+const char *stream_name(const struct stream *strm);
+const struct rtcp_stats *stream_rtcp_stats(const struct stream *strm);
+uint32_t stream_bitrate(const struct stream *strm, bool tx);
+
+
+/*
+ * Call admission control
+ */
+
+uint32_t admit_score(void);
+int      admit_debug(struct re_printf *pf, void *unused);
+
+
+/*
+ * NAT cache
+ */
+
+struct natcache_query;
+
+int natcache_server_discover(struct natcache_query **qp, struct dnsc *dnsc,
+			     const char *usage, const char *proto,
+			     int af, const char *host, uint16_t port,
+			     stun_dns_h *dnsh, void *arg);
+int natcache_prefetch(int af, const char *host, uint16_t port);
+int natcache_mapped(struct sa *map, struct sa *laddr, int af,
+		    const char *host, uint16_t port);
+int natcache_debug(struct re_printf *pf, void *unused);
+
+
 /*
  * Conf (utils)
  */
@@ -153,11 +189,18 @@ struct config_sip {
 	char uuid[64];          /**< Universally Unique Identifier  */
 	char local[64];         /**< Local SIP Address              */
 	char cert[256];         /**< SIP Certificate                */
+	uint32_t reg_rate;      /**< Max REGISTERs started per sec. */
+	uint32_t reg_inflight;  /**< Max REGISTERs in progress      */
+	uint32_t flow_keepalive;/**< Outbound flow keepalive [s]    */
 };
 
 /** Call config */
 struct config_call {
 	uint32_t local_timeout; /**< Incoming call timeout [sec] 0=off */
+	uint32_t max_streams;   /**< Max. active media streams  0=off  */
+	uint32_t max_cpu;       /**< Max. codec CPU load [%]    0=off  */
+	uint32_t max_xruns;     /**< Max. audio xruns per sec.  0=off  */
+	uint32_t retry_after;   /**< Retry-After for rejected calls [s] */
 };
 
 /** Audio */
@@ -189,6 +232,7 @@ struct config_video {
 	unsigned width, height; /**< Video resolution               */
 	uint32_t bitrate;       /**< Encoder bitrate in [bit/s]     */
 	uint32_t fps;           /**< Video framerate                */
+	bool adapt;             /**< Adapt to CPU overuse           */
 };
 #endif
 
@@ -210,6 +254,7 @@ struct config_net {
 		char addr[64];
 	} nsv[NET_MAX_NS];      /**< Configured DNS nameservers     */
 	size_t nsc;             /**< Number of DNS nameservers      */
+	bool dns_cache;         /**< Enable local DNS cache         */
 };
 
 #ifdef USE_VIDEO
@@ -523,10 +568,15 @@ enum ua_event {
 	UA_EVENT_CALL_TRANSFER_FAILED,
 	UA_EVENT_CALL_DTMF_START,
 	UA_EVENT_CALL_DTMF_END,
+	UA_EVENT_CALL_VIDEO_ADAPT,
 
 	UA_EVENT_MAX,
 };
 
+/** Event mask for filtered event handlers */
+#define UA_EVENT_MASK(ev)  (1u << (ev))
+#define UA_EVENT_MASK_ALL  (UA_EVENT_MASK(UA_EVENT_MAX) - 1)
+
 /** Video mode */
 enum vidmode {
 	VIDMODE_OFF = 0,    /**< Video disabled                */
@@ -582,13 +632,16 @@ void ua_stop_all(bool forced);
 void uag_set_exit_handler(ua_exit_h *exith, void *arg);
 int  uag_reset_transp(bool reg, bool reinvite);
 int  uag_event_register(ua_event_h *eh, void *arg);
+int  uag_event_register_async(ua_event_h *eh, void *arg, uint32_t mask);
 void uag_event_unregister(ua_event_h *eh);
 void uag_set_sub_handler(sip_msg_h *subh);
 int  ua_print_sip_status(struct re_printf *pf, void *unused);
+int  uag_memstat(struct re_printf *pf, void *unused);
 int  uag_set_extra_params(const char *eprm);
 struct ua   *uag_find(const struct pl *cuser);
 struct ua   *uag_find_aor(const char *aor);
 struct ua   *uag_find_param(const char *name, const char *val);
+struct call *uag_call_find(const struct ua *ua, const char *id);
 struct sip  *uag_sip(void);
 const char  *uag_event_str(enum ua_event ev);
 struct list *uag_list(void);
@@ -739,6 +792,14 @@ struct auenc_param {
 	uint32_t ptime;  /**< Packet time in [ms]   */
 };
 
+/** Audio Encoder feedback, from RTCP Receiver Reports */
+struct auenc_fb {
+	uint32_t loss;       /**< Packets lost since last report [%]  */
+	uint32_t jitter;     /**< Interarrival jitter in [ms]         */
+	uint32_t ptime;      /**< Packet time in [ms], may be changed */
+	uint32_t ptime_max;  /**< Max. packet time of the peer [ms]   */
+};
+
 struct auenc_state;
 struct audec_state;
 struct aucodec;
@@ -748,6 +809,7 @@ typedef int (auenc_update_h)(struct auenc_state **aesp,
 			     struct auenc_param *prm, const char *fmtp);
 typedef int (auenc_encode_h)(struct auenc_state *aes, uint8_t *buf,
 			     size_t *len, const int16_t *sampv, size_t sampc);
+typedef int (auenc_feedback_h)(struct auenc_state *aes, struct auenc_fb *fb);
 
 typedef int (audec_update_h)(struct audec_state **adsp,
 			     const struct aucodec *ac, const char *fmtp);
@@ -771,6 +833,7 @@ struct aucodec {
 	audec_plc_h    *plch;
 	sdp_fmtp_enc_h *fmtp_ench;
 	sdp_fmtp_cmp_h *fmtp_cmph;
+	auenc_feedback_h *encfbh;   /* Optional RTCP feedback handler */
 };
 
 void aucodec_register(struct aucodec *ac);
@@ -878,6 +941,32 @@ int vidfilt_dec_append(struct list *filtl, void **ctx,
 		       const struct vidfilt *vf);
 
 
+/*
+ * Video CPU-overuse adaptation
+ */
+
+/** Adaptation level, relative to the configured video parameters */
+struct vidadapt_level {
+	unsigned scale;     /**< Resolution scale in [%] */
+	unsigned fps;       /**< Framerate scale in [%]  */
+};
+
+/** CPU-overuse detector of a video encoder */
+struct vidadapt {
+	uint64_t enc_us;    /**< Encode time in window [us] */
+	unsigned frames;    /**< Frames encoded in window   */
+	unsigned usage;     /**< Last encode usage in [%]   */
+	unsigned level;     /**< Current adaptation level   */
+	unsigned headroom;  /**< Windows with headroom      */
+};
+
+void vidadapt_reset(struct vidadapt *va);
+void vidadapt_encoded(struct vidadapt *va, uint64_t enc_us);
+unsigned vidadapt_check(struct vidadapt *va, unsigned fps);
+const struct vidadapt_level *vidadapt_level(unsigned level);
+unsigned vidadapt_level_count(void);
+
+
 /*
  * Audio stream
  */
@@ -933,15 +1022,25 @@ typedef int (mnat_media_h)(struct mnat_media **mp, struct mnat_sess *sess,
 
 typedef int (mnat_update_h)(struct mnat_sess *sess);
 
+typedef int (mnat_trickle_send_h)(struct mbuf *frag, void *arg);
+
+typedef int (mnat_trickle_h)(struct mnat_sess *sess,
+			     mnat_trickle_send_h *sendh, void *arg);
+
+typedef int (mnat_sdpfrag_h)(struct mnat_sess *sess, const struct pl *frag);
+
 int mnat_register(struct mnat **mnatp, const char *id, const char *ftag,
 		  mnat_sess_h *sessh, mnat_media_h *mediah,
 		  mnat_update_h *updateh);
+int mnat_register_trickle(struct mnat *mnat, mnat_trickle_h *trickleh,
+			  mnat_sdpfrag_h *fragh);
 
 
 /*
  * Real-time
  */
 int realtime_enable(bool enable, int fps);
+uint64_t realtime_clock_us(void);
 
 
 /*
@@ -956,6 +1055,19 @@ uint32_t sdp_media_rattr_u32(const struct sdp_media *sdpm, const char *name);
 const char *sdp_rattr(const struct sdp_session *s, const struct sdp_media *m,
 		      const char *name);
 
+struct sdp_tmpl;
+
+int  sdp_tmpl_alloc(struct sdp_tmpl **tmplp, const struct list *codecl,
+		    uint32_t key);
+int  sdp_tmpl_add(struct sdp_tmpl *tmpl, const char *id, const char *name,
+		  uint32_t srate, uint8_t ch, sdp_fmtp_enc_h *ench,
+		  sdp_fmtp_cmp_h *cmph, void *data, const char *params);
+bool sdp_tmpl_isvalid(const struct sdp_tmpl *tmpl,
+		      const struct list *codecl, uint32_t key);
+int  sdp_tmpl_apply(const struct sdp_tmpl *tmpl, struct sdp_media *m);
+void sdp_tmpl_flush(void);
+uint32_t sdp_tmpl_gen(void);
+
 
 /*
  * SIP Request
@@ -963,6 +1075,9 @@ const char *sdp_rattr(const struct sdp_session *s, const struct sdp_media *m,
 
 int sip_req_send(struct ua *ua, const char *method, const char *uri,
 		 sip_resp_h *resph, void *arg, const char *fmt, ...);
+int sip_req_send_dlg(struct ua *ua, struct sip_dialog *dlg,
+		     const char *method, sip_resp_h *resph, void *arg,
+		     const char *fmt, ...);
 
 
 /*
@@ -1030,7 +1145,7 @@ int h264_fu_hdr_decode(struct h264_fu *fu, struct mbuf *mb);
 const uint8_t *h264_find_startcode(const uint8_t *p, const uint8_t *end);
 
 int h264_packetize(const uint8_t *buf, size_t len, size_t pktsize,
-		   videnc_packet_h *pkth, void *arg);
+		   unsigned pmode, videnc_packet_h *pkth, void *arg);
 int h264_nal_send(bool first, bool last,
 		  bool marker, uint32_t ihdr, const uint8_t *buf,
 		  size_t size, size_t maxsz,
@@ -1040,6 +1155,53 @@ static inline bool h264_is_keyframe(int type)
 	return type == H264_NAL_SPS;
 }
 
+struct h264_reasm;
+
+int  h264_reasm_alloc(struct h264_reasm **rap);
+int  h264_reasm_put(struct h264_reasm *ra, bool marker, uint16_t seq,
+		    const struct mbuf *src);
+unsigned h264_reasm_complete(struct h264_reasm *ra);
+void h264_reasm_packet(struct h264_reasm *ra, unsigned i, struct mbuf *mb);
+void h264_reasm_release(struct h264_reasm *ra, unsigned n);
+unsigned h264_reasm_lost(struct h264_reasm *ra);
+
+
+/*
+ * SRTP with AES-GCM (RFC 7714)
+ */
+
+struct srtp_gcm;
+
+int srtp_gcm_alloc(struct srtp_gcm **sgp, const uint8_t *key,
+		   size_t key_size);
+int srtp_gcm_alloc_session(struct srtp_gcm **sgp, const uint8_t *rtp_key,
+			   const uint8_t *rtcp_key, size_t key_size);
+int srtp_gcm_encrypt(struct srtp_gcm *sg, struct mbuf *mb);
+int srtp_gcm_decrypt(struct srtp_gcm *sg, struct mbuf *mb);
+int srtcp_gcm_encrypt(struct srtp_gcm *sg, struct mbuf *mb);
+int srtcp_gcm_decrypt(struct srtp_gcm *sg, struct mbuf *mb);
+
+
+/*
+ * JSON (flat objects, newline-delimited)
+ */
+
+enum json_type {
+	JSON_STRING,
+	JSON_LITERAL,
+};
+
+typedef int (json_member_h)(const struct pl *key, enum json_type type,
+			    const struct pl *val, void *arg);
+typedef int (json_line_h)(const struct pl *line, void *arg);
+
+int  json_decode_flat(const struct pl *pl, json_member_h *mh, void *arg);
+int  json_decode_lines(struct mbuf *mb, size_t maxlen, json_line_h *lh,
+		       void *arg);
+bool json_is_number(const struct pl *pl);
+int  json_unescape(char *buf, size_t sz, const struct pl *str);
+int  json_encode_str(struct re_printf *pf, const char *str);
+
 
 /*
  * Modules
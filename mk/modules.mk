@@ -257,7 +257,7 @@ endif
 
 MODULES   += $(EXTRA_MODULES)
 MODULES   += stun turn ice natbd auloop presence
-MODULES   += menu contact vumeter mwi account natpmp httpd
+MODULES   += menu contact vumeter mwi account natpmp httpd ctrl
 MODULES   += srtp
 MODULES   += uuid
 
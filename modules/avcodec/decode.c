@@ -28,6 +28,7 @@ struct viddec_state {
 	AVCodecContext *ctx;
 	AVFrame *pict;
 	struct mbuf *mb;
+	struct h264_reasm *reasm;
 	bool got_keyframe;
 };
 
@@ -37,6 +38,7 @@ static void destructor(void *arg)
 	struct viddec_state *st = arg;
 
 	mem_deref(st->mb);
+	mem_deref(st->reasm);
 
 	if (st->ctx) {
 		if (st->ctx->codec)
@@ -112,6 +114,13 @@ int decode_update(struct viddec_state **vdsp, const struct vidcodec *vc,
 		goto out;
 	}
 
+	if (0 == str_casecmp(vc->name, "H264")) {
+
+		err = h264_reasm_alloc(&st->reasm);
+		if (err)
+			goto out;
+	}
+
 	err = init_decoder(st, vc->name);
 	if (err) {
 		warning("avcodec: %s: could not init decoder\n", vc->name);
@@ -264,6 +273,41 @@ int h264_decode(struct viddec_state *st, struct mbuf *src)
 			err = h264_hdr_encode(&h264_hdr, st->mb);
 		}
 	}
+	else if (H264_NAL_STAP_A == h264_hdr.type) {
+
+		while (mbuf_get_left(src) >= 2) {
+
+			const uint16_t len = ntohs(mbuf_read_u16(src));
+			struct h264_hdr lhdr;
+
+			if (!len || mbuf_get_left(src) < len)
+				return EBADMSG;
+
+			err = h264_hdr_decode(&lhdr, src);
+			if (err)
+				return err;
+
+			--src->pos;
+
+			if (!st->got_keyframe) {
+				switch (lhdr.type) {
+
+				case H264_NAL_PPS:
+				case H264_NAL_SPS:
+					st->got_keyframe = true;
+					break;
+				}
+			}
+
+			/* prepend H.264 NAL start sequence */
+			err  = mbuf_write_mem(st->mb, nal_seq, 3);
+			err |= mbuf_write_mem(st->mb, mbuf_buf(src), len);
+			if (err)
+				return err;
+
+			mbuf_advance(src, len);
+		}
+	}
 	else {
 		warning("avcodec: unknown NAL type %u\n", h264_hdr.type);
 		return EBADMSG;
@@ -276,18 +320,56 @@ int h264_decode(struct viddec_state *st, struct mbuf *src)
 int decode_h264(struct viddec_state *st, struct vidframe *frame,
 		bool eof, uint16_t seq, struct mbuf *src)
 {
+	struct h264_reasm *ra;
+	unsigned i, n;
 	int err;
 
-	(void)seq;
-
 	if (!src)
 		return 0;
 
-	err = h264_decode(st, src);
+	ra = st->reasm;
+
+	err = h264_reasm_put(ra, eof, seq, src);
 	if (err)
 		return err;
 
-	return ffdecode(st, frame, eof, src);
+	mbuf_skip_to_end(src);
+
+	n = h264_reasm_complete(ra);
+	if (!n)
+		goto out;
+
+	for (i=0; i<n; i++) {
+
+		struct mbuf mb;
+
+		h264_reasm_packet(ra, i, &mb);
+
+		err = h264_decode(st, &mb);
+		if (err)
+			break;
+
+		err = mbuf_write_mem(st->mb, mbuf_buf(&mb),
+				     mbuf_get_left(&mb));
+		if (err)
+			break;
+	}
+
+	h264_reasm_release(ra, n);
+
+	if (err) {
+		mbuf_rewind(st->mb);
+		return err;
+	}
+
+	/* keep the decoder state in sync, even if packets were lost */
+	err = ffdecode(st, frame, true, src);
+
+ out:
+	if (h264_reasm_lost(ra))
+		return EPROTO;
+
+	return err;
 }
 
 
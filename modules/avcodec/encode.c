@@ -686,6 +686,7 @@ int encode(struct videnc_state *st, bool update, const struct vidframe *frame)
 	case AV_CODEC_ID_H264:
 		err = h264_packetize(st->mb->buf, st->mb->end,
 				     st->encprm.pktsize,
+				     st->u.h264.packetization_mode,
 				     st->pkth, st->arg);
 		break;
 
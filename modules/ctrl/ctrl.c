@@ -0,0 +1,1135 @@
+/**
+ * @file ctrl.c  JSON control interface over TCP and Unix sockets
+ *
+ * Copyright (C) 2010 - 2016 Creytiv.com
+ */
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+
+
+/**
+ * @defgroup ctrl ctrl
+ *
+ * Control interface using newline-delimited JSON over TCP or Unix sockets
+ *
+ * Each request is a flat JSON object on one line. Several requests may
+ * be sent without waiting for the responses, the responses are sent in
+ * the order of the requests and carry the "id" of the request.
+ *
+ \verbatim
+  {"id":1, "command":"dial", "params":"sip:bob@example.com"}
+  {"response":true, "id":1, "ok":true, "data":"<call>"}
+
+  {"id":2, "command":"hangup", "call":"<call>"}
+  {"response":true, "id":2, "ok":false, "error":"No such file or ..."}
+ \endverbatim
+ *
+ * Request members:
+ *
+ \verbatim
+  id        Request identifier, number, string or null (optional)
+  command   dial, answer, hangup, transfer, stats or subscribe
+  params    Command parameter, e.g. the URI to dial or transfer to
+  ua        Address of record of the User-Agent (default current)
+  call      Handle of the call (default current call of the UA)
+ \endverbatim
+ *
+ * Calls are identified by a handle that is assigned by this module,
+ * as the SIP Call-ID of an outgoing call is not known before the INVITE
+ * is sent. The Call-ID is reported as "callid" in events and statistics,
+ * and is null until the INVITE is sent.
+ *
+ * User-Agent events are pushed to all connections:
+ *
+ \verbatim
+  {"event":true, "type":"CALL_INCOMING", "class":"call",
+   "ua":"sip:alice@example.com", "call":"<call>", "callid":"<Call-ID>",
+   "peeruri":"sip:bob@example.com", "direction":"incoming"}
+ \endverbatim
+ *
+ * The "subscribe" command selects the events of a connection, with
+ * a comma-separated list of event types in "params", or "all".
+ *
+ * The following options can be configured:
+ *
+ \verbatim
+  ctrl_listen     127.0.0.1:4444       # TCP address and port to listen on
+  ctrl_unix       /tmp/baresip.sock    # Unix socket to listen on
+ \endverbatim
+ */
+
+
+enum {
+	CTRL_PORT    = 4444,
+	CTRL_MAXLINE = 8192,         /**< Maximum length of a request     */
+	CTRL_MAXPEND = 262144,       /**< Maximum pending output          */
+};
+
+struct ctrl {
+	struct tcp_sock *ts;
+	struct list connl;
+	struct hash *ht_handle;      /**< Call handles indexed by handle  */
+	struct hash *ht_call;        /**< Call handles indexed by call    */
+	char *upath;
+	int ufd;
+};
+
+struct ctrl_conn {
+	struct le le;
+	struct tcp_conn *tc;
+	int fd;
+	struct mbuf *mbr;            /**< Incomplete request line         */
+	struct mbuf *mbw;            /**< Pending output (Unix)           */
+	size_t txpend;               /**< Output not yet drained (TCP)    */
+	uint32_t evmask;             /**< Subscribed UA events            */
+};
+
+struct ctrl_call {
+	struct le he_handle;
+	struct le he_call;
+	const struct call *call;     /**< Call, not referenced            */
+	char handle[17];
+};
+
+struct ctrl_req {
+	struct pl id;
+	enum json_type id_type;
+	char command[32];
+	char params[512];
+	char ua[256];
+	char call[256];
+};
+
+struct ctrl_rx {
+	struct ctrl_conn *conn;
+	struct mbuf *mbo;            /**< Responses to the requests       */
+};
+
+struct ctrl_cmd {
+	const char *name;
+	int (*h)(struct re_printf *pf, struct ctrl_conn *conn,
+		 const struct ctrl_req *req);
+};
+
+
+static struct ctrl *ctrl = NULL;  /* allow only one instance */
+
+
+/*
+ * Connections
+ */
+
+#ifndef WIN32
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL  /* no SIGPIPE if the peer has gone */
+#else
+#define SEND_FLAGS 0
+#endif
+
+
+static void unix_conn_handler(int flags, void *arg);
+
+
+static int unix_send(struct ctrl_conn *conn, struct mbuf *mb)
+{
+	ssize_t n;
+
+	int err;
+
+	/* keep the order behind pending output */
+	if (conn->mbw && mbuf_get_left(conn->mbw)) {
+
+		const size_t pos = conn->mbw->pos;
+
+		if (mbuf_get_left(conn->mbw) > CTRL_MAXPEND)
+			return ENOBUFS;
+
+		conn->mbw->pos = conn->mbw->end;
+		err = mbuf_write_mem(conn->mbw, mbuf_buf(mb),
+				     mbuf_get_left(mb));
+		conn->mbw->pos = pos;
+
+		return err;
+	}
+
+	n = send(conn->fd, mbuf_buf(mb), mbuf_get_left(mb), SEND_FLAGS);
+	if (n < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			return errno;
+		n = 0;
+	}
+
+	if ((size_t)n == mbuf_get_left(mb))
+		return 0;
+
+	if (!conn->mbw) {
+		conn->mbw = mbuf_alloc(mbuf_get_left(mb));
+		if (!conn->mbw)
+			return ENOMEM;
+	}
+
+	mbuf_rewind(conn->mbw);
+	(void)mbuf_write_mem(conn->mbw, mbuf_buf(mb) + n,
+			     mbuf_get_left(mb) - n);
+	conn->mbw->pos = 0;
+
+	return fd_listen(conn->fd, FD_READ | FD_WRITE,
+			 unix_conn_handler, conn);
+}
+#endif
+
+
+/* Called when the send queue of the TCP connection is drained */
+static void tcp_send_handler(void *arg)
+{
+	struct ctrl_conn *conn = arg;
+
+	conn->txpend = 0;
+	tcp_set_send(conn->tc, NULL);
+}
+
+
+static int tcp_send_capped(struct ctrl_conn *conn, struct mbuf *mb)
+{
+	const size_t len = mbuf_get_left(mb);
+	int err;
+
+	if (conn->txpend > CTRL_MAXPEND)
+		return ENOBUFS;
+
+	err = tcp_send(conn->tc, mb);
+	if (err)
+		return err;
+
+	conn->txpend += len;
+	tcp_set_send(conn->tc, tcp_send_handler);
+
+	return 0;
+}
+
+
+static int conn_send(struct ctrl_conn *conn, struct mbuf *mb)
+{
+	mb->pos = 0;
+
+	if (conn->tc)
+		return tcp_send_capped(conn, mb);
+
+#ifndef WIN32
+	if (conn->fd >= 0)
+		return unix_send(conn, mb);
+#endif
+
+	return ENOTCONN;
+}
+
+
+static void conn_destructor(void *arg)
+{
+	struct ctrl_conn *conn = arg;
+
+	list_unlink(&conn->le);
+	mem_deref(conn->tc);
+	mem_deref(conn->mbr);
+	mem_deref(conn->mbw);
+
+#ifndef WIN32
+	if (conn->fd >= 0) {
+		fd_close(conn->fd);
+		(void)close(conn->fd);
+	}
+#endif
+}
+
+
+static int conn_alloc(struct ctrl_conn **connp)
+{
+	struct ctrl_conn *conn;
+
+	conn = mem_zalloc(sizeof(*conn), conn_destructor);
+	if (!conn)
+		return ENOMEM;
+
+	conn->fd = -1;
+	conn->evmask = UA_EVENT_MASK_ALL;
+
+	conn->mbr = mbuf_alloc(512);
+	if (!conn->mbr) {
+		mem_deref(conn);
+		return ENOMEM;
+	}
+
+	list_append(&ctrl->connl, &conn->le, conn);
+
+	*connp = conn;
+
+	return 0;
+}
+
+
+/*
+ * Call handles
+ */
+
+static void ctrl_call_destructor(void *arg)
+{
+	struct ctrl_call *cc = arg;
+
+	hash_unlink(&cc->he_handle);
+	hash_unlink(&cc->he_call);
+}
+
+
+static uint32_t hash_call(const struct call *call)
+{
+	return hash_joaat((const uint8_t *)&call, sizeof(call));
+}
+
+
+static bool handle_cmp_handler(struct le *le, void *arg)
+{
+	const struct ctrl_call *cc = le->data;
+
+	return 0 == str_cmp(cc->handle, arg);
+}
+
+
+static bool call_cmp_handler(struct le *le, void *arg)
+{
+	const struct ctrl_call *cc = le->data;
+
+	return cc->call == arg;
+}
+
+
+static bool call_is_live(const struct call *call)
+{
+	struct le *le, *lec;
+
+	for (le = list_head(uag_list()); le; le = le->next) {
+
+		for (lec = list_head(ua_calls(le->data)); lec;
+		     lec = lec->next) {
+
+			if (lec->data == call)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+
+static struct ctrl_call *ctrl_call_lookup(const struct call *call)
+{
+	struct le *le;
+
+	le = hash_lookup(ctrl->ht_call, hash_call(call),
+			 call_cmp_handler, (void *)call);
+
+	return list_ledata(le);
+}
+
+
+/* Get the handle of a call, the handle is assigned on first use */
+static const char *call_handle(const struct call *call)
+{
+	struct ctrl_call *cc;
+
+	if (!call)
+		return NULL;
+
+	cc = ctrl_call_lookup(call);
+	if (cc)
+		return cc->handle;
+
+	cc = mem_zalloc(sizeof(*cc), ctrl_call_destructor);
+	if (!cc)
+		return NULL;
+
+	cc->call = call;
+	(void)re_snprintf(cc->handle, sizeof(cc->handle), "%016llx",
+			  rand_u64());
+
+	hash_append(ctrl->ht_handle, hash_joaat_str(cc->handle),
+		    &cc->he_handle, cc);
+	hash_append(ctrl->ht_call, hash_call(call), &cc->he_call, cc);
+
+	return cc->handle;
+}
+
+
+/*
+ * Find a call from its handle. A call that is released without a
+ * CALL_CLOSED event, e.g. with its User-Agent, leaves a stale handle.
+ */
+static struct call *call_find(const char *handle)
+{
+	struct ctrl_call *cc;
+	struct le *le;
+
+	le = hash_lookup(ctrl->ht_handle, hash_joaat_str(handle),
+			 handle_cmp_handler, (void *)handle);
+	cc = list_ledata(le);
+	if (!cc)
+		return NULL;
+
+	if (!call_is_live(cc->call)) {
+		mem_deref(cc);
+		return NULL;
+	}
+
+	return (struct call *)cc->call;
+}
+
+
+/*
+ * Commands
+ */
+
+static struct ua *req_ua(const struct ctrl_req *req)
+{
+	if (str_isset(req->ua))
+		return uag_find_aor(req->ua);
+
+	return uag_current();
+}
+
+
+static struct call *req_call(const struct ctrl_req *req)
+{
+	if (str_isset(req->call))
+		return call_find(req->call);
+
+	return ua_call(req_ua(req));
+}
+
+
+static int cmd_dial(struct re_printf *pf, struct ctrl_conn *conn,
+		    const struct ctrl_req *req)
+{
+	struct call *call;
+	struct ua *ua;
+	int err;
+
+	(void)conn;
+
+	if (!str_isset(req->params))
+		return EINVAL;
+
+	ua = req_ua(req);
+	if (!ua)
+		return ENOENT;
+
+	err = ua_connect(ua, &call, NULL, req->params, NULL, VIDMODE_ON);
+	if (err)
+		return err;
+
+	return json_encode_str(pf, call_handle(call));
+}
+
+
+static int cmd_answer(struct re_printf *pf, struct ctrl_conn *conn,
+		      const struct ctrl_req *req)
+{
+	struct call *call = req_call(req);
+
+	(void)pf;
+	(void)conn;
+
+	if (!call)
+		return ENOENT;
+
+	return ua_answer(call_get_ua(call), call);
+}
+
+
+static int cmd_hangup(struct re_printf *pf, struct ctrl_conn *conn,
+		      const struct ctrl_req *req)
+{
+	struct call *call = req_call(req);
+
+	(void)pf;
+	(void)conn;
+
+	if (!call)
+		return ENOENT;
+
+	ua_hangup(call_get_ua(call), call, 0, NULL);
+
+	return 0;
+}
+
+
+static int cmd_transfer(struct re_printf *pf, struct ctrl_conn *conn,
+			const struct ctrl_req *req)
+{
+	struct call *call = req_call(req);
+
+	(void)pf;
+	(void)conn;
+
+	if (!str_isset(req->params))
+		return EINVAL;
+
+	if (!call)
+		return ENOENT;
+
+	return call_transfer(call, req->params);
+}
+
+
+static int stream_stats(struct re_printf *pf, const struct stream *strm)
+{
+	const struct rtcp_stats *rs = stream_rtcp_stats(strm);
+
+	return re_hprintf(pf, "{\"name\":%H,"
+			  "\"tx_bitrate\":%u,\"rx_bitrate\":%u,"
+			  "\"tx_sent\":%u,\"tx_lost\":%d,\"tx_jitter\":%u,"
+			  "\"rx_sent\":%u,\"rx_lost\":%d,\"rx_jitter\":%u,"
+			  "\"rtt\":%u}",
+			  json_encode_str, stream_name(strm),
+			  stream_bitrate(strm, true),
+			  stream_bitrate(strm, false),
+			  rs->tx.sent, rs->tx.lost, rs->tx.jit,
+			  rs->rx.sent, rs->rx.lost, rs->rx.jit,
+			  rs->rtt);
+}
+
+
+static int call_stats(struct re_printf *pf, const struct call *call)
+{
+	struct le *le;
+	int err;
+
+	err = re_hprintf(pf, "{\"call\":%H,\"callid\":%H,\"ua\":%H,"
+			 "\"peeruri\":%H,"
+			 "\"direction\":\"%s\",\"duration\":%u,"
+			 "\"onhold\":%s,\"streams\":[",
+			 json_encode_str, call_handle(call),
+			 json_encode_str, call_id(call),
+			 json_encode_str, ua_aor(call_get_ua(call)),
+			 json_encode_str, call_peeruri(call),
+			 call_is_outgoing(call) ? "outgoing" : "incoming",
+			 call_duration(call),
+			 call_is_onhold(call) ? "true" : "false");
+
+	for (le = list_head(call_streaml(call)); le; le = le->next) {
+
+		err |= re_hprintf(pf, "%s%H", le->prev ? "," : "",
+				  stream_stats, le->data);
+	}
+
+	err |= re_hprintf(pf, "]}");
+
+	return err;
+}
+
+
+static int cmd_stats(struct re_printf *pf, struct ctrl_conn *conn,
+		     const struct ctrl_req *req)
+{
+	struct le *le;
+	bool first = true;
+	int err;
+
+	(void)conn;
+
+	if (str_isset(req->call)) {
+		struct call *call = call_find(req->call);
+
+		if (!call)
+			return ENOENT;
+
+		return re_hprintf(pf, "{\"calls\":[%H]}", call_stats, call);
+	}
+
+	err = re_hprintf(pf, "{\"calls\":[");
+
+	for (le = list_head(uag_list()); le; le = le->next) {
+		struct le *lec;
+
+		for (lec = list_head(ua_calls(le->data)); lec;
+		     lec = lec->next) {
+
+			err |= re_hprintf(pf, "%s%H", first ? "" : ",",
+					  call_stats, lec->data);
+			first = false;
+		}
+	}
+
+	err |= re_hprintf(pf, "]}");
+
+	return err;
+}
+
+
+static int cmd_subscribe(struct re_printf *pf, struct ctrl_conn *conn,
+			 const struct ctrl_req *req)
+{
+	const char *p = req->params;
+	uint32_t mask = 0;
+
+	(void)pf;
+
+	if (!str_isset(p) || !str_casecmp(p, "all")) {
+		conn->evmask = UA_EVENT_MASK_ALL;
+		return 0;
+	}
+
+	for (;;) {
+		enum ua_event ev;
+		struct pl type;
+
+		p += strspn(p, ", ");
+
+		type.p = p;
+		type.l = strcspn(p, ", ");
+		if (!type.l)
+			break;
+
+		for (ev = 0; ev < UA_EVENT_MAX; ev++) {
+			if (!pl_strcasecmp(&type, uag_event_str(ev)))
+				break;
+		}
+
+		if (ev == UA_EVENT_MAX)
+			return EINVAL;
+
+		mask |= UA_EVENT_MASK(ev);
+		p += type.l;
+	}
+
+	conn->evmask = mask;
+
+	return 0;
+}
+
+
+static const struct ctrl_cmd cmdv[] = {
+	{"dial",      cmd_dial      },
+	{"answer",    cmd_answer    },
+	{"hangup",    cmd_hangup    },
+	{"transfer",  cmd_transfer  },
+	{"stats",     cmd_stats     },
+	{"subscribe", cmd_subscribe },
+};
+
+
+static int req_member_handler(const struct pl *key, enum json_type type,
+			      const struct pl *val, void *arg)
+{
+	struct ctrl_req *req = arg;
+
+	if (!pl_strcmp(key, "id")) {
+
+		/* the id is echoed as is, and must be valid JSON */
+		if (type == JSON_LITERAL && pl_strcmp(val, "null") &&
+		    !json_is_number(val))
+			return EBADMSG;
+
+		req->id = *val;
+		req->id_type = type;
+		return 0;
+	}
+
+	/* all other members are strings */
+	if (type != JSON_STRING)
+		return 0;
+
+	if (!pl_strcmp(key, "command"))
+		return json_unescape(req->command, sizeof(req->command), val);
+	else if (!pl_strcmp(key, "params"))
+		return json_unescape(req->params, sizeof(req->params), val);
+	else if (!pl_strcmp(key, "ua"))
+		return json_unescape(req->ua, sizeof(req->ua), val);
+	else if (!pl_strcmp(key, "call"))
+		return json_unescape(req->call, sizeof(req->call), val);
+
+	return 0;
+}
+
+
+static int print_handler(const char *p, size_t size, void *arg)
+{
+	return mbuf_write_mem(arg, (uint8_t *)p, size);
+}
+
+
+static int print_id(struct re_printf *pf, const struct ctrl_req *req)
+{
+	if (!pl_isset(&req->id))
+		return re_hprintf(pf, "null");
+
+	if (req->id_type == JSON_STRING)
+		return re_hprintf(pf, "\"%r\"", &req->id);
+
+	return re_hprintf(pf, "%r", &req->id);
+}
+
+
+static int handle_request(struct ctrl_conn *conn, struct mbuf *mbo,
+			  const struct pl *line)
+{
+	const struct ctrl_cmd *cmd = NULL;
+	struct ctrl_req req;
+	struct re_printf pf;
+	struct mbuf *mbd;
+	size_t i;
+	int err;
+
+	memset(&req, 0, sizeof(req));
+
+	mbd = mbuf_alloc(64);
+	if (!mbd)
+		return ENOMEM;
+
+	err = json_decode_flat(line, req_member_handler, &req);
+	if (err)
+		goto out;
+
+	for (i=0; i<ARRAY_SIZE(cmdv); i++) {
+		if (!str_casecmp(req.command, cmdv[i].name)) {
+			cmd = &cmdv[i];
+			break;
+		}
+	}
+
+	if (!cmd) {
+		err = ENOSYS;
+		goto out;
+	}
+
+	pf.vph = print_handler;
+	pf.arg = mbd;
+
+	err = cmd->h(&pf, conn, &req);
+	if (err)
+		warning("ctrl: command '%s' failed (%m)\n", req.command, err);
+
+ out:
+	if (err) {
+		err = mbuf_printf(mbo, "{\"response\":true,\"id\":%H,"
+				  "\"ok\":false,\"error\":\"%m\"}\n",
+				  print_id, &req, err);
+	}
+	else if (mbd->end) {
+		err = mbuf_printf(mbo, "{\"response\":true,\"id\":%H,"
+				  "\"ok\":true,\"data\":%b}\n",
+				  print_id, &req, mbd->buf, mbd->end);
+	}
+	else {
+		err = mbuf_printf(mbo, "{\"response\":true,\"id\":%H,"
+				  "\"ok\":true}\n", print_id, &req);
+	}
+
+	mem_deref(mbd);
+
+	return err;
+}
+
+
+static int line_handler(const struct pl *line, void *arg)
+{
+	struct ctrl_rx *rx = arg;
+
+	return handle_request(rx->conn, rx->mbo, line);
+}
+
+
+/*
+ * Process all complete request lines. The responses of pipelined
+ * requests are sent together, in the order of the requests.
+ *
+ * @return True if the connection was closed
+ */
+static bool conn_recv(struct ctrl_conn *conn, const uint8_t *buf, size_t len)
+{
+	struct ctrl_rx rx;
+	int err;
+
+	conn->mbr->pos = conn->mbr->end;
+	err = mbuf_write_mem(conn->mbr, buf, len);
+	if (err)
+		goto error;
+
+	rx.conn = conn;
+	rx.mbo = mbuf_alloc(256);
+	if (!rx.mbo) {
+		err = ENOMEM;
+		goto error;
+	}
+
+	/* the incomplete request is kept */
+	err = json_decode_lines(conn->mbr, CTRL_MAXLINE, line_handler, &rx);
+
+	if (rx.mbo->end) {
+		int serr = conn_send(conn, rx.mbo);
+		if (!err)
+			err = serr;
+	}
+
+	mem_deref(rx.mbo);
+
+	if (err)
+		goto error;
+
+	return false;
+
+ error:
+	warning("ctrl: closing connection (%m)\n", err);
+	mem_deref(conn);
+	return true;
+}
+
+
+static void tcp_recv_handler(struct mbuf *mb, void *arg)
+{
+	struct ctrl_conn *conn = arg;
+
+	(void)conn_recv(conn, mbuf_buf(mb), mbuf_get_left(mb));
+}
+
+
+static void tcp_close_handler(int err, void *arg)
+{
+	struct ctrl_conn *conn = arg;
+
+	debug("ctrl: TCP connection closed (%m)\n", err);
+
+	mem_deref(conn);
+}
+
+
+static void tcp_conn_handler(const struct sa *peer, void *arg)
+{
+	struct ctrl_conn *conn;
+	int err;
+
+	(void)arg;
+
+	err = conn_alloc(&conn);
+	if (err)
+		goto out;
+
+	err = tcp_accept(&conn->tc, ctrl->ts, NULL, tcp_recv_handler,
+			 tcp_close_handler, conn);
+	if (err)
+		mem_deref(conn);
+
+ out:
+	if (err) {
+		warning("ctrl: could not accept %J (%m)\n", peer, err);
+		tcp_reject(ctrl->ts);
+	}
+	else {
+		debug("ctrl: TCP connection from %J\n", peer);
+	}
+}
+
+
+#ifndef WIN32
+static void unix_conn_handler(int flags, void *arg)
+{
+	struct ctrl_conn *conn = arg;
+	uint8_t buf[4096];
+	ssize_t n;
+
+	if (flags & FD_WRITE) {
+
+		struct mbuf *mbw = conn->mbw;
+
+		n = send(conn->fd, mbuf_buf(mbw), mbuf_get_left(mbw),
+			 SEND_FLAGS);
+		if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			goto close;
+
+		if (n > 0)
+			mbuf_advance(mbw, n);
+
+		if (!mbuf_get_left(mbw)) {
+			mbuf_rewind(mbw);
+			(void)fd_listen(conn->fd, FD_READ,
+					unix_conn_handler, conn);
+		}
+	}
+
+	if (!(flags & FD_READ))
+		return;
+
+	n = read(conn->fd, buf, sizeof(buf));
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+	else if (n <= 0)
+		goto close;
+
+	(void)conn_recv(conn, buf, n);
+
+	return;
+
+ close:
+	debug("ctrl: Unix connection closed\n");
+	mem_deref(conn);
+}
+
+
+static void unix_accept_handler(int flags, void *arg)
+{
+	struct ctrl_conn *conn;
+	int fd, err;
+
+	(void)flags;
+	(void)arg;
+
+	fd = accept(ctrl->ufd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	err = net_sockopt_blocking_set(fd, false);
+	if (err)
+		goto out;
+
+	err = conn_alloc(&conn);
+	if (err)
+		goto out;
+
+	conn->fd = fd;
+
+	err = fd_listen(fd, FD_READ, unix_conn_handler, conn);
+	if (err) {
+		mem_deref(conn);
+		return;
+	}
+
+	debug("ctrl: Unix connection on %s\n", ctrl->upath);
+
+ out:
+	if (err) {
+		warning("ctrl: could not accept Unix connection (%m)\n", err);
+		(void)close(fd);
+	}
+}
+
+
+static int unix_listen(struct ctrl *st, const char *path)
+{
+	struct sockaddr_un sun;
+	int err;
+
+	if (str_len(path) >= sizeof(sun.sun_path))
+		return ENAMETOOLONG;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	str_ncpy(sun.sun_path, path, sizeof(sun.sun_path));
+
+	st->ufd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (st->ufd < 0)
+		return errno;
+
+	err = str_dup(&st->upath, path);
+	if (err)
+		return err;
+
+	(void)unlink(path);
+
+	if (bind(st->ufd, (struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+	    listen(st->ufd, 16) < 0)
+		return errno;
+
+	err = net_sockopt_blocking_set(st->ufd, false);
+	if (err)
+		return err;
+
+	return fd_listen(st->ufd, FD_READ, unix_accept_handler, st);
+}
+#endif
+
+
+static void ua_event_handler(struct ua *ua, enum ua_event ev,
+			     struct call *call, const char *prm, void *arg)
+{
+	const char *class;
+	struct mbuf *mb;
+	struct le *le;
+	int err;
+
+	(void)arg;
+
+	switch (ev) {
+
+	case UA_EVENT_REGISTERING:
+	case UA_EVENT_REGISTER_OK:
+	case UA_EVENT_REGISTER_FAIL:
+	case UA_EVENT_UNREGISTERING:
+		class = "register";
+		break;
+
+	case UA_EVENT_SHUTDOWN:
+	case UA_EVENT_EXIT:
+		class = "application";
+		break;
+
+	default:
+		class = "call";
+		break;
+	}
+
+	mb = mbuf_alloc(256);
+	if (!mb)
+		return;
+
+	err = mbuf_printf(mb, "{\"event\":true,\"type\":\"%s\","
+			  "\"class\":\"%s\"", uag_event_str(ev), class);
+
+	if (ua)
+		err |= mbuf_printf(mb, ",\"ua\":%H",
+				   json_encode_str, ua_aor(ua));
+
+	if (call) {
+		err |= mbuf_printf(mb, ",\"call\":%H,\"callid\":%H,"
+				   "\"peeruri\":%H,\"direction\":\"%s\"",
+				   json_encode_str, call_handle(call),
+				   json_encode_str, call_id(call),
+				   json_encode_str, call_peeruri(call),
+				   call_is_outgoing(call)
+				   ? "outgoing" : "incoming");
+	}
+
+	if (str_isset(prm))
+		err |= mbuf_printf(mb, ",\"param\":%H", json_encode_str, prm);
+
+	err |= mbuf_printf(mb, "}\n");
+	if (err)
+		goto out;
+
+	le = ctrl->connl.head;
+	while (le) {
+		struct ctrl_conn *conn = le->data;
+
+		le = le->next;
+
+		if (!(conn->evmask & UA_EVENT_MASK(ev)))
+			continue;
+
+		err = conn_send(conn, mb);
+		if (err == ENOBUFS) {
+			/* the client does not read its events */
+			warning("ctrl: closing connection (%m)\n", err);
+			mem_deref(conn);
+		}
+		else if (err) {
+			debug("ctrl: event not sent (%m)\n", err);
+		}
+	}
+
+ out:
+	/* the handle is not used after the call is closed */
+	if (ev == UA_EVENT_CALL_CLOSED)
+		mem_deref(ctrl_call_lookup(call));
+
+	mem_deref(mb);
+}
+
+
+static void ctrl_destructor(void *arg)
+{
+	struct ctrl *st = arg;
+
+	list_flush(&st->connl);
+	hash_flush(st->ht_handle);
+	mem_deref(st->ht_handle);
+	mem_deref(st->ht_call);
+	mem_deref(st->ts);
+
+#ifndef WIN32
+	if (st->ufd >= 0) {
+		fd_close(st->ufd);
+		(void)close(st->ufd);
+		if (st->upath)
+			(void)unlink(st->upath);
+	}
+#endif
+
+	mem_deref(st->upath);
+}
+
+
+static int ctrl_init(void)
+{
+	char path[256] = "";
+	struct sa laddr;
+	int err;
+
+	if (conf_get_sa(conf_cur(), "ctrl_listen", &laddr)) {
+		sa_set_str(&laddr, "127.0.0.1", CTRL_PORT);
+	}
+
+	ctrl = mem_zalloc(sizeof(*ctrl), ctrl_destructor);
+	if (!ctrl)
+		return ENOMEM;
+
+	ctrl->ufd = -1;
+
+	err  = hash_alloc(&ctrl->ht_handle, 16);
+	err |= hash_alloc(&ctrl->ht_call, 16);
+	if (err)
+		goto out;
+
+	err = tcp_listen(&ctrl->ts, &laddr, tcp_conn_handler, ctrl);
+	if (err) {
+		warning("ctrl: failed to listen on TCP %J (%m)\n",
+			&laddr, err);
+		goto out;
+	}
+
+	info("ctrl: listening on TCP %J\n", &laddr);
+
+	if (0 == conf_get_str(conf_cur(), "ctrl_unix", path, sizeof(path))) {
+#ifndef WIN32
+		err = unix_listen(ctrl, path);
+		if (err) {
+			warning("ctrl: failed to listen on %s (%m)\n",
+				path, err);
+			goto out;
+		}
+
+		info("ctrl: listening on %s\n", path);
+#else
+		warning("ctrl: Unix sockets not supported\n");
+#endif
+	}
+
+	err = uag_event_register_async(ua_event_handler, NULL,
+				       UA_EVENT_MASK_ALL);
+
+ out:
+	if (err)
+		ctrl = mem_deref(ctrl);
+
+	return err;
+}
+
+
+static int ctrl_close(void)
+{
+	uag_event_unregister(ua_event_handler);
+
+	ctrl = mem_deref(ctrl);
+
+	return 0;
+}
+
+
+const struct mod_export DECL_EXPORTS(ctrl) = {
+	"ctrl",
+	"application",
+	ctrl_init,
+	ctrl_close
+};
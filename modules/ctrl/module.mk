@@ -0,0 +1,10 @@
+#
+# module.mk
+#
+# Copyright (C) 2010 - 2016 Creytiv.com
+#
+
+MOD		:= ctrl
+$(MOD)_SRCS	+= ctrl.c
+
+include mk/mod.mk
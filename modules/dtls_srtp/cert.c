@@ -0,0 +1,207 @@
+/**
+ * @file dtls_srtp/cert.c  ECDSA certificate for DTLS
+ *
+ * Copyright (C) 2010 - 2016 Creytiv.com
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <openssl/opensslv.h>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <re.h>
+#include <baresip.h>
+#include "dtls_srtp.h"
+
+
+/*
+ * The self-signed certificate has an ECDSA P-256 key, which is much
+ * cheaper to sign with than RSA. The certificate and key are written
+ * to a file, and used until the certificate expires. Automatic ECDH
+ * curve selection needs OpenSSL 1.1.0 or later.
+ */
+
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+
+
+enum {
+	CERT_DAYS = 365,
+};
+
+
+static int cert_write(const char *file, X509 *x509, EVP_PKEY *pkey)
+{
+	FILE *f;
+	int fd, err = 0;
+
+	fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return errno;
+
+	f = fdopen(fd, "w");
+	if (!f) {
+		err = errno;
+		(void)close(fd);
+		return err;
+	}
+
+	if (!PEM_write_X509(f, x509) ||
+	    !PEM_write_PrivateKey(f, pkey, NULL, NULL, 0, NULL, NULL))
+		err = EIO;
+
+	if (fclose(f))
+		err = errno;
+
+	return err;
+}
+
+
+static int cert_generate(const char *file)
+{
+	EVP_PKEY_CTX *pctx;
+	EVP_PKEY *pkey = NULL;
+	X509 *x509 = NULL;
+	X509_NAME *name;
+	int err = ENOMEM;
+
+	pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+	if (!pctx)
+		goto out;
+
+	if (EVP_PKEY_keygen_init(pctx) <= 0 ||
+	    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx,
+						   NID_X9_62_prime256v1) <= 0 ||
+	    EVP_PKEY_CTX_set_ec_param_enc(pctx, OPENSSL_EC_NAMED_CURVE) <= 0 ||
+	    EVP_PKEY_keygen(pctx, &pkey) <= 0) {
+		err = EPROTO;
+		goto out;
+	}
+
+	x509 = X509_new();
+	if (!x509)
+		goto out;
+
+	name = X509_get_subject_name(x509);
+
+	if (!X509_set_version(x509, 2) ||
+	    !ASN1_INTEGER_set(X509_get_serialNumber(x509),
+			      rand_u32() & 0x7fffffff) ||
+	    !X509_gmtime_adj(X509_getm_notBefore(x509), -86400) ||
+	    !X509_gmtime_adj(X509_getm_notAfter(x509),
+			     (long)CERT_DAYS * 86400) ||
+	    !X509_set_pubkey(x509, pkey) ||
+	    !X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+				(const unsigned char *)"dtls@baresip",
+				-1, -1, 0) ||
+	    !X509_set_issuer_name(x509, name) ||
+	    !X509_sign(x509, pkey, EVP_sha256())) {
+		err = EPROTO;
+		goto out;
+	}
+
+	err = cert_write(file, x509, pkey);
+
+ out:
+	if (x509)
+		X509_free(x509);
+	if (pkey)
+		EVP_PKEY_free(pkey);
+	if (pctx)
+		EVP_PKEY_CTX_free(pctx);
+
+	return err;
+}
+
+
+/* Check that the certificate can be read and has not expired */
+static int cert_check(const char *file)
+{
+	X509 *x509;
+	FILE *f;
+	int err = 0;
+
+	f = fopen(file, "r");
+	if (!f)
+		return errno;
+
+	x509 = PEM_read_X509(f, NULL, NULL, NULL);
+	(void)fclose(f);
+	if (!x509)
+		return EBADMSG;
+
+	if (X509_cmp_current_time(X509_get0_notAfter(x509)) <= 0)
+		err = ETIMEDOUT;
+
+	X509_free(x509);
+
+	return err;
+}
+
+
+/**
+ * Load the ECDSA certificate, and create it if it does not exist
+ * or has expired
+ *
+ * @param tlsp Pointer to allocated DTLS context
+ * @param fp   Returned certificate fingerprints
+ * @param file Certificate and key file
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int cert_ecdsa_load(struct tls **tlsp, struct dtls_fp *fp, const char *file)
+{
+	struct tls *tls = NULL;
+	uint64_t t0;
+	int err;
+
+	if (!tlsp || !fp || !file)
+		return EINVAL;
+
+	if (cert_check(file)) {
+		t0 = tmr_jiffies();
+
+		err = cert_generate(file);
+		if (err)
+			return err;
+
+		info("dtls_srtp: created ECDSA certificate %s (%llu ms)\n",
+		     file, tmr_jiffies() - t0);
+	}
+
+	err = tls_alloc(&tls, TLS_METHOD_DTLSV1, file, NULL);
+	if (err)
+		return err;
+
+	/* the fingerprints must be of the certificate that is in use */
+	err = dtls_fingerprint_get(fp, tls);
+	if (err) {
+		mem_deref(tls);
+		return err;
+	}
+
+	*tlsp = tls;
+
+	return 0;
+}
+
+
+#else
+
+
+int cert_ecdsa_load(struct tls **tlsp, struct dtls_fp *fp, const char *file)
+{
+	(void)tlsp;
+	(void)fp;
+	(void)file;
+
+	return ENOSYS;
+}
+
+
+#endif
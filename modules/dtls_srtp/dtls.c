@@ -9,20 +9,37 @@
 #include "dtls_srtp.h"
 
 
-int dtls_print_sha1_fingerprint(struct re_printf *pf, const struct tls *tls)
+/**
+ * Get the fingerprints of the certificate in a TLS context
+ *
+ * @param fp  Returned certificate fingerprints
+ * @param tls TLS context
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dtls_fingerprint_get(struct dtls_fp *fp, const struct tls *tls)
 {
-	uint8_t md[20];
-	unsigned int i;
-	int err = 0;
+	int err;
 
-	if (!tls)
+	if (!fp || !tls)
 		return EINVAL;
 
-	err = tls_fingerprint(tls, TLS_FINGERPRINT_SHA1, md, sizeof(md));
-	if (err)
-		return err;
+	err  = tls_fingerprint(tls, TLS_FINGERPRINT_SHA1,
+			       fp->sha1, sizeof(fp->sha1));
+	err |= tls_fingerprint(tls, TLS_FINGERPRINT_SHA256,
+			       fp->sha256, sizeof(fp->sha256));
 
-	for (i=0; i<sizeof(md); i++) {
+	return err;
+}
+
+
+static int print_fingerprint(struct re_printf *pf, const uint8_t *md,
+			     size_t len)
+{
+	size_t i;
+	int err = 0;
+
+	for (i=0; i<len; i++) {
 		err |= re_hprintf(pf, "%s%02X", i==0 ? "" : ":", md[i]);
 	}
 
@@ -30,22 +47,21 @@ int dtls_print_sha1_fingerprint(struct re_printf *pf, const struct tls *tls)
 }
 
 
-int dtls_print_sha256_fingerprint(struct re_printf *pf, const struct tls *tls)
+int dtls_print_sha1_fingerprint(struct re_printf *pf,
+				const struct dtls_fp *fp)
 {
-	uint8_t md[32];
-	unsigned int i;
-	int err = 0;
-
-	if (!tls)
+	if (!fp)
 		return EINVAL;
 
-	err = tls_fingerprint(tls, TLS_FINGERPRINT_SHA256, md, sizeof(md));
-	if (err)
-		return err;
+	return print_fingerprint(pf, fp->sha1, sizeof(fp->sha1));
+}
 
-	for (i=0; i<sizeof(md); i++) {
-		err |= re_hprintf(pf, "%s%02X", i==0 ? "" : ":", md[i]);
-	}
 
-	return err;
+int dtls_print_sha256_fingerprint(struct re_printf *pf,
+				  const struct dtls_fp *fp)
+{
+	if (!fp)
+		return EINVAL;
+
+	return print_fingerprint(pf, fp->sha256, sizeof(fp->sha256));
 }
@@ -44,6 +44,11 @@
  *                [socket]
  \endverbatim
  *
+ * The DTLS certificate has an ECDSA P-256 key, and is stored in
+ * dtls_srtp.pem in the config directory. With RTP/RTCP multiplexing
+ * there is one DTLS handshake per media line. Without ICE the
+ * handshake starts as soon as the remote SDP is known.
+ *
  */
 
 struct menc_sess {
@@ -65,6 +70,7 @@ struct dtls_srtp {
 };
 
 static struct tls *tls;
+static struct dtls_fp fp;   /* fingerprints of our certificate */
 static const char* srtp_profiles =
 	"SRTP_AES128_CM_SHA1_80:"
 	"SRTP_AES128_CM_SHA1_32";
@@ -176,7 +182,7 @@ static int session_alloc(struct menc_sess **sessp,
 
 	/* RFC 4572 */
 	err = sdp_session_set_lattr(sdp, true, "fingerprint", "SHA-256 %H",
-				    dtls_print_sha256_fingerprint, tls);
+				    dtls_print_sha256_fingerprint, &fp);
 	if (err)
 		goto out;
 
@@ -215,9 +221,11 @@ static void dtls_estab_handler(void *arg)
 
 	comp->negotiated = true;
 
-	info("dtls_srtp: ---> DTLS-SRTP complete (%s/%s) Profile=%s\n",
+	info("dtls_srtp: ---> DTLS-SRTP complete (%s/%s) Profile=%s"
+	     " in %llu ms\n",
 	     sdp_media_name(ds->sdpm),
-	     comp->is_rtp ? "RTP" : "RTCP", srtp_suite_name(suite));
+	     comp->is_rtp ? "RTP" : "RTCP", srtp_suite_name(suite),
+	     tmr_jiffies() - comp->ts_start);
 
 	err |= srtp_stream_add(&comp->tx, suite,
 			       ds->active ? cli_key : srv_key, 30, true);
@@ -279,6 +287,8 @@ static int component_start(struct comp *comp, struct sdp_media *sdpm)
 	else
 		sdp_media_raddr_rtcp(sdpm, &raddr);
 
+	comp->ts_start = tmr_jiffies();
+
 	err = dtls_listen(&comp->dtls_sock, NULL,
 			  comp->app_sock, 2, LAYER_DTLS,
 			  dtls_conn_handler, comp);
@@ -342,6 +352,12 @@ static void timeout(void *arg)
 }
 
 
+static bool ice_used(const struct dtls_srtp *st)
+{
+	return sdp_media_rattr(st->sdpm, "candidate") != NULL;
+}
+
+
 static int media_alloc(struct menc_media **mp, struct menc_sess *sess,
 		       struct rtp_sock *rtp, int proto,
 		       void *rtpsock, void *rtcpsock,
@@ -398,8 +414,8 @@ static int media_alloc(struct menc_media **mp, struct menc_sess *sess,
 	if (setup) {
 		st->active = !(0 == str_casecmp(setup, "active"));
 
-		/* note: we need to wait for ICE to settle ... */
-		tmr_start(&st->tmr, 100, timeout, st);
+		/* note: with ICE we need to wait for it to settle ... */
+		tmr_start(&st->tmr, ice_used(st) ? 100 : 0, timeout, st);
 	}
 
 	/* SDP offer/answer on fingerprint attribute */
@@ -417,13 +433,13 @@ static int media_alloc(struct menc_media **mp, struct menc_sess *sess,
 			err = sdp_media_set_lattr(st->sdpm, true,
 						  "fingerprint", "SHA-1 %H",
 						  dtls_print_sha1_fingerprint,
-						  tls);
+						  &fp);
 		}
 		else if (0 == pl_strcasecmp(&hash, "SHA-256")) {
 			err = sdp_media_set_lattr(st->sdpm, true,
 						  "fingerprint", "SHA-256 %H",
 						 dtls_print_sha256_fingerprint,
-						  tls);
+						  &fp);
 		}
 		else {
 			info("dtls_srtp: unsupported fingerprint hash `%r'\n",
@@ -450,7 +466,8 @@ static struct menc dtls_srtp2 = {
 };
 
 
-static int module_init(void)
+/* Fallback to an RSA certificate, created at every start */
+static int rsa_selfsigned(void)
 {
 	int err;
 
@@ -468,6 +485,38 @@ static int module_init(void)
 		return err;
 	}
 
+	return dtls_fingerprint_get(&fp, tls);
+}
+
+
+static int module_init(void)
+{
+	char path[256] = "", file[256] = "";
+	int err;
+
+	err = conf_path_get(path, sizeof(path));
+	if (!err && re_snprintf(file, sizeof(file), "%s/dtls_srtp.pem",
+				path) < 0)
+		err = ENOMEM;
+
+	if (!err) {
+		(void)fs_mkdir(path, 0700);
+		err = cert_ecdsa_load(&tls, &fp, file);
+	}
+
+	if (err) {
+		if (err != ENOSYS) {
+			warning("dtls_srtp: no ECDSA certificate (%m),"
+				" using RSA\n", err);
+		}
+
+		tls = mem_deref(tls);
+
+		err = rsa_selfsigned();
+		if (err)
+			return err;
+	}
+
 	tls_set_verify_client(tls);
 
 	err = tls_set_srtp(tls, srtp_profiles);
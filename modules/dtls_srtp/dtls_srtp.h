@@ -18,13 +18,26 @@ struct comp {
 	struct srtp_stream *rx;
 	struct udp_helper *uh_srtp;
 	void *app_sock;
+	uint64_t ts_start;          /* start of DTLS handshake [ms] */
 	bool negotiated;
 	bool is_rtp;
 };
 
+/* Fingerprints of our certificate */
+struct dtls_fp {
+	uint8_t sha1[20];
+	uint8_t sha256[32];
+};
+
+/* cert.c */
+int cert_ecdsa_load(struct tls **tlsp, struct dtls_fp *fp, const char *file);
+
 /* dtls.c */
-int dtls_print_sha1_fingerprint(struct re_printf *pf, const struct tls *tls);
-int dtls_print_sha256_fingerprint(struct re_printf *pf, const struct tls *tls);
+int dtls_fingerprint_get(struct dtls_fp *fp, const struct tls *tls);
+int dtls_print_sha1_fingerprint(struct re_printf *pf,
+				const struct dtls_fp *fp);
+int dtls_print_sha256_fingerprint(struct re_printf *pf,
+				  const struct dtls_fp *fp);
 
 
 /* srtp.c */
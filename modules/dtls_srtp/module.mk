@@ -5,7 +5,7 @@
 #
 
 MOD		:= dtls_srtp
-$(MOD)_SRCS	+= dtls_srtp.c srtp.c dtls.c
-$(MOD)_LFLAGS	+=
+$(MOD)_SRCS	+= dtls_srtp.c srtp.c dtls.c cert.c
+$(MOD)_LFLAGS	+= -lcrypto
 
 include mk/mod.mk
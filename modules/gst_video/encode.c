@@ -171,7 +171,7 @@ static void internal_appsink_new_buffer(GstElement *sink,
 		guint8 *data = GST_BUFFER_DATA(buffer);
 		guint size = GST_BUFFER_SIZE(buffer);
 
-		h264_packetize(data, size, st->pktsize,
+		h264_packetize(data, size, st->pktsize, 0,
 			       st->pkth, st->pkth_arg);
 
 		gst_buffer_unref(buffer);
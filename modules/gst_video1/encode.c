@@ -128,7 +128,7 @@ static GstFlowReturn appsink_new_sample_cb(GstAppSink *sink,
 		data = info.data;
 		size = info.size;
 
-		h264_packetize(data, size, st->encoder.pktsize,
+		h264_packetize(data, size, st->encoder.pktsize, 0,
 			       st->pkth, st->arg);
 
 		gst_buffer_unmap(buffer, &info);
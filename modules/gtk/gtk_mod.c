@@ -832,7 +832,7 @@ static void *gtk_thread(void *arg)
 
 	info("gtk_menu starting\n");
 
-	uag_event_register( ua_event_handler, mod );
+	uag_event_register_async(ua_event_handler, mod, UA_EVENT_MASK_ALL);
 	mod->run = true;
 	gtk_main();
 	mod->run = false;
@@ -7,6 +7,7 @@
 #include <CoreFoundation/CoreFoundation.h>
 #include <SystemConfiguration/SCNetworkReachability.h>
 #endif
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
 
@@ -25,22 +26,36 @@
   ice_debug       {yes,no}             # Enable ICE debugging/tracing
   ice_nomination  {regular,aggressive} # Regular or aggressive nomination
   ice_mode        {full,lite}          # Full ICE-mode or ICE-lite
+  ice_trickle     {yes,no}             # Enable Trickle ICE (RFC 8840)
  \endverbatim
+ *
+ * With Trickle ICE the SDP offer or answer is sent with the host
+ * candidates only, and the STUN/TURN candidates are sent to the peer
+ * in a SIP INFO request when they have been gathered. If the peer
+ * does not support trickling, the candidates are sent in a re-INVITE.
+ * Trickle ICE is disabled by default.
  */
 
 
 struct mnat_sess {
 	struct list medial;
 	struct sa srv;
-	struct stun_dns *dnsq;
+	struct natcache_query *dnsq;
 	struct sdp_session *sdp;
 	struct ice *ice;
 	char *user;
 	char *pass;
+	struct tmr tmr_trickle;
 	int mediac;
 	bool started;
 	bool send_reinvite;
+	bool trickle;          /**< Trickle ICE is enabled                 */
+	bool peer_trickle;     /**< Peer supports Trickle ICE              */
+	bool got_rsdp;         /**< Remote SDP was received                */
+	bool gathered;         /**< All local candidates are gathered      */
 	mnat_estab_h *estabh;
+	mnat_trickle_send_h *sendh;
+	void *sendarg;
 	void *arg;
 };
 
@@ -53,6 +68,8 @@ struct mnat_media {
 	struct mnat_sess *sess;
 	struct sdp_media *sdpm;
 	struct icem *icem;
+	bool host;             /**< Host candidates are added              */
+	bool gathered;         /**< Local candidates are gathered          */
 	bool complete;
 };
 
@@ -63,10 +80,12 @@ static struct {
 	enum ice_nomination nom;
 	bool turn;
 	bool debug;
+	bool trickle;
 } ice = {
 	ICE_MODE_FULL,
 	ICE_NOMINATION_REGULAR,
 	true,
+	false,
 	false
 };
 
@@ -117,6 +136,7 @@ static void session_destructor(void *arg)
 {
 	struct mnat_sess *sess = arg;
 
+	tmr_cancel(&sess->tmr_trickle);
 	list_flush(&sess->medial);
 	mem_deref(sess->dnsq);
 	mem_deref(sess->user);
@@ -207,11 +227,21 @@ static bool if_handler(const char *ifname, const struct sa *sa, void *arg)
 }
 
 
+static void media_gather_host(struct mnat_media *m)
+{
+	if (m->host)
+		return;
+
+	net_if_apply(if_handler, m);
+	m->host = true;
+}
+
+
 static int media_start(struct mnat_sess *sess, struct mnat_media *m)
 {
 	int err = 0;
 
-	net_if_apply(if_handler, m);
+	media_gather_host(m);
 
 	switch (ice.mode) {
 
@@ -322,8 +352,9 @@ static int session_alloc(struct mnat_sess **sessp, struct dnsc *dnsc,
 
 	usage = ice.turn ? stun_usage_relay : stun_usage_binding;
 
-	err = stun_server_discover(&sess->dnsq, dnsc, usage, stun_proto_udp,
-				   af, srv, port, dns_handler, sess);
+	err = natcache_server_discover(&sess->dnsq, dnsc, usage,
+				       stun_proto_udp, af, srv, port,
+				       dns_handler, sess);
 
  out:
 	if (err)
@@ -410,14 +441,113 @@ static bool refresh_laddr(struct mnat_media *m,
 }
 
 
+static int sdpfrag_encode(struct re_printf *pf, const struct mnat_sess *sess)
+{
+	struct le *le;
+	int err;
+
+	err  = re_hprintf(pf, "a=%s:%s\r\n", ice_attr_ufrag,
+			  ice_ufrag(sess->ice));
+	err |= re_hprintf(pf, "a=%s:%s\r\n", ice_attr_pwd,
+			  ice_pwd(sess->ice));
+
+	for (le = sess->medial.head; le; le = le->next) {
+		const struct mnat_media *m = le->data;
+		struct le *lec;
+
+		err |= re_hprintf(pf, "m=%s 9 %s 0\r\n",
+				  sdp_media_name(m->sdpm),
+				  sdp_media_proto(m->sdpm));
+
+		lec = list_head(icem_lcandl(m->icem));
+		for (; lec; lec = lec->next) {
+			err |= re_hprintf(pf, "a=%s:%H\r\n", ice_attr_cand,
+					  ice_cand_encode, lec->data);
+		}
+
+		if (m->gathered)
+			err |= re_hprintf(pf, "a=end-of-candidates\r\n");
+	}
+
+	return err;
+}
+
+
+static int send_sdpfrag(struct mnat_sess *sess)
+{
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(1024);
+	if (!mb)
+		return ENOMEM;
+
+	err = mbuf_printf(mb, "%H", sdpfrag_encode, sess);
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+
+	err = sess->sendh(mb, sess->sendarg);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/*
+ * All local candidates are gathered. They are trickled to the peer,
+ * or sent in a re-INVITE if the peer does not support trickling.
+ */
+static void trickle_gathered(struct mnat_sess *sess)
+{
+	int err;
+
+	if (!sess->got_rsdp)
+		return;
+
+	if (sess->peer_trickle) {
+
+		info("ice: trickling gathered candidates\n");
+
+		err = send_sdpfrag(sess);
+		if (err) {
+			warning("ice: could not send candidates (%m)\n",
+				err);
+		}
+	}
+	else {
+		info("ice: peer does not support trickle"
+		     " -- sending Re-INVITE\n");
+
+		sdp_session_del_lattr(sess->sdp, "ice-options");
+
+		sess->estabh(0, 0, NULL, sess->arg);
+	}
+}
+
+
+static void trickle_pending_handler(void *arg)
+{
+	trickle_gathered(arg);
+}
+
+
 static void gather_handler(int err, uint16_t scode, const char *reason,
 			   void *arg)
 {
 	struct mnat_media *m = arg;
+	struct mnat_sess *sess = m->sess;
 
 	if (err || scode) {
 		warning("ice: gather error: %m (%u %s)\n",
 			err, scode, reason);
+
+		/* the call can go on with the host candidates */
+		if (!sess->trickle)
+			goto out;
 	}
 	else {
 		refresh_laddr(m,
@@ -429,12 +559,22 @@ static void gather_handler(int err, uint16_t scode, const char *reason,
 		     &m->compv[0].laddr, &m->compv[1].laddr);
 
 		(void)set_media_attributes(m);
+	}
+
+	m->gathered = true;
+
+	if (--sess->mediac)
+		return;
 
-		if (--m->sess->mediac)
-			return;
+	sess->gathered = true;
+
+	if (sess->trickle) {
+		trickle_gathered(sess);
+		return;
 	}
 
-	m->sess->estabh(err, scode, reason, m->sess->arg);
+ out:
+	sess->estabh(err, scode, reason, sess->arg);
 }
 
 
@@ -568,6 +708,17 @@ static int media_alloc(struct mnat_media **mp, struct mnat_sess *sess,
 			err |= icem_comp_add(m->icem, i+1, m->compv[i].sock);
 	}
 
+	/* The host candidates are offered while gathering */
+	if (sess->trickle) {
+		media_gather_host(m);
+
+		refresh_laddr(m,
+			      icem_cand_default(m->icem, 1),
+			      icem_cand_default(m->icem, 2));
+
+		err |= set_media_attributes(m);
+	}
+
 	if (sa_isset(&sess->srv, SA_ALL))
 		err |= media_start(sess, m);
 
@@ -583,9 +734,20 @@ static int media_alloc(struct mnat_media **mp, struct mnat_sess *sess,
 }
 
 
+static bool has_trickle(const char *name, const char *value)
+{
+	return 0 == str_casecmp(name, "ice-options") &&
+		value && strstr(value, "trickle");
+}
+
+
 static bool sdp_attr_handler(const char *name, const char *value, void *arg)
 {
 	struct mnat_sess *sess = arg;
+
+	if (has_trickle(name, value))
+		sess->peer_trickle = true;
+
 	return 0 != ice_sdp_decode(sess->ice, name, value);
 }
 
@@ -593,6 +755,10 @@ static bool sdp_attr_handler(const char *name, const char *value, void *arg)
 static bool media_attr_handler(const char *name, const char *value, void *arg)
 {
 	struct mnat_media *m = arg;
+
+	if (has_trickle(name, value))
+		m->sess->peer_trickle = true;
+
 	return 0 != icem_sdp_decode(m->icem, name, value);
 }
 
@@ -639,6 +805,12 @@ static int update(struct mnat_sess *sess)
 		sdp_media_rattr_apply(m->sdpm, NULL, media_attr_handler, m);
 	}
 
+	/* Gathering completed before the remote SDP was received */
+	if (sess->trickle && !sess->got_rsdp && sess->gathered)
+		tmr_start(&sess->tmr_trickle, 0, trickle_pending_handler, sess);
+
+	sess->got_rsdp = true;
+
 	/* 5.1.  Verifying ICE Support */
 	if (verify_peer_ice(sess)) {
 		err = ice_start(sess);
@@ -661,13 +833,149 @@ static int update(struct mnat_sess *sess)
 }
 
 
+static void trickle_estab_handler(void *arg)
+{
+	struct mnat_sess *sess = arg;
+
+	/* The peer offered without Trickle ICE, wait for gathering */
+	if (sess->got_rsdp && !sess->peer_trickle) {
+		info("ice: peer does not support trickle\n");
+		sdp_session_del_lattr(sess->sdp, "ice-options");
+		sess->trickle = false;
+		return;
+	}
+
+	info("ice: trickle -- starting with host candidates\n");
+
+	sess->estabh(0, 0, NULL, sess->arg);
+}
+
+
+static int trickle_enable(struct mnat_sess *sess,
+			  mnat_trickle_send_h *sendh, void *arg)
+{
+	int err;
+
+	if (!sess || !sendh)
+		return EINVAL;
+
+	if (!ice.trickle || ice.mode != ICE_MODE_FULL)
+		return ENOTSUP;
+
+	err = sdp_session_set_lattr(sess->sdp, true,
+				    "ice-options", "trickle");
+	if (err)
+		return err;
+
+	sess->trickle = true;
+	sess->sendh   = sendh;
+	sess->sendarg = arg;
+
+	/* called when all media lines are allocated */
+	tmr_start(&sess->tmr_trickle, 0, trickle_estab_handler, sess);
+
+	return 0;
+}
+
+
+static bool line_attr(const struct pl *line, const char *name,
+		      struct pl *val)
+{
+	const size_t n = str_len(name);
+
+	if (line->l < n || memcmp(line->p, name, n))
+		return false;
+
+	val->p = line->p + n;
+	val->l = line->l - n;
+
+	return true;
+}
+
+
+/*
+ * Decode an SDP fragment with trickled candidates from the peer. The
+ * media lines are in the same order as in the SDP.
+ */
+static int sdpfrag_handler(struct mnat_sess *sess, const struct pl *frag)
+{
+	struct mnat_media *m = NULL;
+	struct le *le = NULL;
+	struct pl pl, line, val;
+	unsigned n = 0;
+	int err = 0;
+
+	if (!sess || !frag)
+		return EINVAL;
+
+	pl = *frag;
+
+	while (pl.l && !err) {
+		const char *lb = pl_strchr(&pl, '\n');
+		char *cand;
+
+		line.p = pl.p;
+		line.l = lb ? (size_t)(lb - pl.p) : pl.l;
+		pl_advance(&pl, lb ? line.l + 1 : line.l);
+
+		if (line.l && line.p[line.l - 1] == '\r')
+			--line.l;
+
+		if (line_attr(&line, "m=", &val)) {
+			le = le ? le->next : sess->medial.head;
+			if (!le)
+				return EPROTO;
+
+			m = le->data;
+		}
+		else if (m && line_attr(&line, "a=candidate:", &val)) {
+
+			err = pl_strdup(&cand, &val);
+			if (err)
+				break;
+
+			err = icem_sdp_decode(m->icem, ice_attr_cand, cand);
+			mem_deref(cand);
+			++n;
+		}
+		else if (m && line_attr(&line, "a=end-of-candidates", &val)) {
+			ice_printf(m, "end of remote candidates\n");
+		}
+	}
+
+	if (err)
+		return err;
+
+	info("ice: received %u trickled candidates\n", n);
+
+	if (!n || !sess->started || ice.mode != ICE_MODE_FULL)
+		return 0;
+
+	/* Form the candidate pairs with the new remote candidates */
+	LIST_FOREACH(&sess->medial, le) {
+		struct mnat_media *mx = le->data;
+
+		if (mx->complete || !sdp_media_has_media(mx->sdpm))
+			continue;
+
+		err = icem_conncheck_start(mx->icem);
+		if (err)
+			break;
+	}
+
+	return err;
+}
+
+
 static int module_init(void)
 {
+	int err;
 #ifdef MODULE_CONF
 	struct pl pl;
 
 	conf_get_bool(conf_cur(), "ice_turn", &ice.turn);
 	conf_get_bool(conf_cur(), "ice_debug", &ice.debug);
+	conf_get_bool(conf_cur(), "ice_trickle", &ice.trickle);
 
 	if (!conf_get(conf_cur(), "ice_nomination", &pl)) {
 		if (0 == pl_strcasecmp(&pl, "regular"))
@@ -689,8 +997,12 @@ static int module_init(void)
 	}
 #endif
 
-	return mnat_register(&mnat, "ice", "+sip.ice",
-			     session_alloc, media_alloc, update);
+	err = mnat_register(&mnat, "ice", "+sip.ice",
+			    session_alloc, media_alloc, update);
+	if (err)
+		return err;
+
+	return mnat_register_trickle(mnat, trickle_enable, sdpfrag_handler);
 }
 
 
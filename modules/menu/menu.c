@@ -454,6 +454,9 @@ static const struct cmd cmdv[] = {
 	{'t',       0, "Timer debug",              tmr_status           },
 	{'u',       0, "UA debug",                 cmd_ua_debug         },
 	{'y',       0, "Memory status",            mem_status           },
+	{'Y',       0, "Memory per call",          uag_memstat          },
+	{'W',       0, "Call admission status",    admit_debug          },
+	{'N',       0, "NAT cache status",         natcache_debug       },
 	{0x1b,      0, "Hangup call",              cmd_hangup           },
 	{' ',       0, "Toggle UAs",               cmd_ua_next          },
 	{'T',       0, "Toggle UAs",               cmd_ua_next          },
@@ -25,7 +25,7 @@ struct natbd {
 	struct nat_lifetime *nl;
 	struct nat_mapping *nm;
 	struct nat_genalg *ga;
-	struct stun_dns *dns;
+	struct natcache_query *dns;
 	struct sa stun_srv;
 	struct tmr tmr;
 	char host[256];
@@ -372,11 +372,12 @@ static void timeout_init(void *arg)
 		goto out;
 	}
 
-	err = stun_server_discover(&natbd->dns, net_dnsc(baresip_network()),
-				   stun_usage_binding,
-				   proto_str, net_af(baresip_network()),
-				   natbd->host, natbd->port,
-				   dns_handler, natbd);
+	err = natcache_server_discover(&natbd->dns,
+				       net_dnsc(baresip_network()),
+				       stun_usage_binding,
+				       proto_str, net_af(baresip_network()),
+				       natbd->host, natbd->port,
+				       dns_handler, natbd);
 	if (err)
 		goto out;
 
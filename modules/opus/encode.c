@@ -10,11 +10,58 @@
 #include "opus.h"
 
 
+/*
+ * Encoder control
+ *
+ * The encoder adapts to the RTCP Receiver Reports from the peer. In-band
+ * FEC is enabled when packets are lost, and the expected loss is set
+ * so that the encoder spends the right amount of bits on FEC. The
+ * bitrate is lowered when the loss is high, and raised back to the
+ * negotiated bitrate when there is no loss and little jitter. At a low
+ * bitrate the packet time is doubled, to cut the packet overhead.
+ *
+ * The encode time of all encoders is measured, and the complexity is
+ * lowered for all of them when it exceeds the CPU budget.
+ */
+
+
+enum {
+	FEC_ON         =     2,  /**< Enable FEC at this loss [%]         */
+	FEC_OFF        =     1,  /**< Disable FEC below this loss [%]     */
+	LOSS_HIGH      =    10,  /**< Lower the bitrate at this loss [%]  */
+	LOSS_MAX       =    50,  /**< Max expected packet loss [%]        */
+	JITTER_HIGH    =    40,  /**< No bitrate increase above [ms]      */
+	BITRATE_MIN    = 12000,  /**< Lowest adapted bitrate [bit/s]      */
+	BITRATE_LONG   = 24000,  /**< Longer packets below [bit/s]        */
+	BITRATE_SHORT  = 32000,  /**< Shorter packets again above [bit/s] */
+	PTIME_BASE     =    20,  /**< Packet time that may be doubled     */
+	CPU_WINDOW     =  1000,  /**< CPU usage measurement window [ms]   */
+	COMPLEXITY_MIN =     1,
+};
+
 struct auenc_state {
 	OpusEncoder *enc;
+	struct lock *lock;         /**< Protects the adapted parameters   */
 	unsigned ch;
+	opus_int32 bitrate_max;    /**< Negotiated bitrate [bit/s]        */
+	opus_int32 bitrate;        /**< Adapted bitrate [bit/s]           */
+	opus_int32 complexity;     /**< Current encoder complexity        */
+	uint32_t loss;             /**< Smoothed packet loss [%]          */
+	bool fec_fmtp;             /**< FEC enabled by the fmtp           */
+	bool fec;                  /**< FEC is enabled                    */
+	bool ptime_long;           /**< Packet time was doubled           */
+	bool update;               /**< Apply parameters before encoding  */
 };
 
+static struct {
+	struct opus_ctrl ctrl;     /**< Encoder control configuration     */
+	struct lock *lock;
+	uint64_t win_start;        /**< Start of measurement window [ms]  */
+	uint64_t us;               /**< Encode time in window [us]        */
+	uint32_t usage;            /**< Encode CPU usage [%] of one core  */
+	opus_int32 complexity;     /**< Complexity for all encoders       */
+} cpu;
+
 
 static void destructor(void *arg)
 {
@@ -22,6 +69,59 @@ static void destructor(void *arg)
 
 	if (aes->enc)
 		opus_encoder_destroy(aes->enc);
+
+	mem_deref(aes->lock);
+}
+
+
+/*
+ * Add the encode time of one frame, and return the complexity
+ * for all encoders. This is called from the audio transmit threads.
+ */
+static opus_int32 cpu_account(uint64_t us)
+{
+	const uint64_t now = tmr_jiffies();
+	opus_int32 complexity;
+
+	lock_write_get(cpu.lock);
+
+	cpu.us += us;
+
+	if (now - cpu.win_start >= CPU_WINDOW) {
+
+		const uint32_t budget = cpu.ctrl.cpu_budget;
+
+		cpu.usage = (uint32_t)(cpu.us / (10 * (now - cpu.win_start)));
+
+		if (cpu.usage > budget && cpu.complexity > COMPLEXITY_MIN)
+			--cpu.complexity;
+		else if (cpu.usage < budget * 3 / 4 &&
+			 cpu.complexity < cpu.ctrl.complexity)
+			++cpu.complexity;
+
+		cpu.win_start = now;
+		cpu.us = 0;
+	}
+
+	complexity = cpu.complexity;
+
+	lock_rel(cpu.lock);
+
+	return complexity;
+}
+
+
+/* Speech is coded better with VOIP, music needs stereo and bitrate */
+static opus_int32 application(const struct opus_param *prm)
+{
+	if (cpu.ctrl.application != OPUS_AUTO)
+		return cpu.ctrl.application;
+
+	if (prm->stereo && !prm->inband_fec &&
+	    (prm->bitrate == OPUS_AUTO || prm->bitrate >= BITRATE_SHORT))
+		return OPUS_APPLICATION_AUDIO;
+
+	return OPUS_APPLICATION_VOIP;
 }
 
 
@@ -79,21 +179,44 @@ int opus_encode_update(struct auenc_state **aesp, const struct aucodec *ac,
 	if (!aesp || !ac || !ac->ch)
 		return EINVAL;
 
+	prm.srate      = 48000;
+	prm.bitrate    = OPUS_AUTO;
+	prm.stereo     = 1;
+	prm.cbr        = 0;
+	prm.inband_fec = 0;
+	prm.dtx        = 0;
+
+	opus_decode_fmtp(&prm, fmtp);
+
+	conf_prm.bitrate = OPUS_AUTO;
+	opus_decode_fmtp(&conf_prm, auc->fmtp);
+
+	if ((prm.bitrate == OPUS_AUTO) ||
+	    ((conf_prm.bitrate != OPUS_AUTO) &&
+	     (conf_prm.bitrate < prm.bitrate)))
+		prm.bitrate = conf_prm.bitrate;
+
 	aes = *aesp;
 
 	if (!aes) {
-		const opus_int32 complex = 10;
-		int opuserr;
+		const opus_int32 app = application(&prm);
+		int opuserr, err;
 
 		aes = mem_zalloc(sizeof(*aes), destructor);
 		if (!aes)
 			return ENOMEM;
 
+		err = lock_alloc(&aes->lock);
+		if (err) {
+			mem_deref(aes);
+			return err;
+		}
+
 		aes->ch = ac->ch;
 
-		aes->enc = opus_encoder_create(ac->srate, ac->ch,
-					       /* this has big impact on cpu */
-					       OPUS_APPLICATION_AUDIO,
+		/* the application can not be changed after the first frame,
+		   so it is chosen once per call */
+		aes->enc = opus_encoder_create(ac->srate, ac->ch, app,
 					       &opuserr);
 		if (!aes->enc) {
 			warning("opus: encoder create: %s\n",
@@ -102,30 +225,32 @@ int opus_encode_update(struct auenc_state **aesp, const struct aucodec *ac,
 			return ENOMEM;
 		}
 
-		(void)opus_encoder_ctl(aes->enc, OPUS_SET_COMPLEXITY(complex));
+		debug("opus: encoder application=%s\n",
+		      app == OPUS_APPLICATION_VOIP ? "voip" : "audio");
+
+		aes->complexity = cpu.complexity;
+		(void)opus_encoder_ctl(aes->enc,
+				       OPUS_SET_COMPLEXITY(aes->complexity));
 
 		*aesp = aes;
 	}
 
-	prm.srate      = 48000;
-	prm.bitrate    = OPUS_AUTO;
-	prm.stereo     = 1;
-	prm.cbr        = 0;
-	prm.inband_fec = 0;
-	prm.dtx        = 0;
+	fch = prm.stereo ? OPUS_AUTO : 1;
+	vbr = prm.cbr ? 0 : 1;
 
-	opus_decode_fmtp(&prm, fmtp);
+	/* libopus default bitrate, for a 20 ms packet time */
+	if (prm.bitrate == OPUS_AUTO)
+		aes->bitrate_max = 3000 + prm.srate * (prm.stereo ? 2 : 1);
+	else
+		aes->bitrate_max = prm.bitrate;
 
-	conf_prm.bitrate = OPUS_AUTO;
-	opus_decode_fmtp(&conf_prm, auc->fmtp);
+	lock_write_get(aes->lock);
 
-	if ((prm.bitrate == OPUS_AUTO) ||
-	    ((conf_prm.bitrate != OPUS_AUTO) &&
-	     (conf_prm.bitrate < prm.bitrate)))
-		prm.bitrate = conf_prm.bitrate;
+	aes->bitrate  = prm.bitrate;
+	aes->fec_fmtp = prm.inband_fec != 0;
+	aes->fec      = aes->fec_fmtp;
 
-	fch = prm.stereo ? OPUS_AUTO : 1;
-	vbr = prm.cbr ? 0 : 1;
+	lock_rel(aes->lock);
 
 	(void)opus_encoder_ctl(aes->enc,
 			       OPUS_SET_MAX_BANDWIDTH(srate2bw(prm.srate)));
@@ -159,14 +284,113 @@ int opus_encode_update(struct auenc_state **aesp, const struct aucodec *ac,
 }
 
 
+/**
+ * Adapt the encoder to the packet loss and jitter reported by the peer
+ *
+ * @param aes Opus encoder state
+ * @param fb  Feedback from the peer, the packet time may be changed
+ *            up to the maximum packet time
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int opus_encode_feedback(struct auenc_state *aes, struct auenc_fb *fb)
+{
+	opus_int32 bitrate;
+
+	if (!aes || !fb)
+		return EINVAL;
+
+	if (!cpu.ctrl.adapt)
+		return 0;
+
+	lock_write_get(aes->lock);
+
+	/* react fast to loss, and recover slowly */
+	if (fb->loss > aes->loss)
+		aes->loss = (aes->loss + fb->loss + 1) / 2;
+	else
+		aes->loss = (3 * aes->loss + fb->loss) / 4;
+
+	aes->fec = aes->fec_fmtp || aes->loss >= FEC_ON ||
+		(aes->fec && aes->loss >= FEC_OFF);
+
+	bitrate = aes->bitrate == OPUS_AUTO ? aes->bitrate_max : aes->bitrate;
+
+	if (aes->loss >= LOSS_HIGH)
+		bitrate -= bitrate * (opus_int32)min(aes->loss, LOSS_MAX) / 200;
+	else if (aes->loss < FEC_ON && fb->jitter < JITTER_HIGH)
+		bitrate += bitrate / 12;
+
+	bitrate = max(bitrate, BITRATE_MIN);
+	bitrate = min(bitrate, aes->bitrate_max);
+
+	/* keep the libopus default if there is nothing to adapt to */
+	if (aes->bitrate != OPUS_AUTO || bitrate != aes->bitrate_max)
+		aes->bitrate = bitrate;
+
+	aes->update = true;
+
+	/* the packet overhead matters at a low bitrate */
+	if (!aes->ptime_long && fb->ptime == PTIME_BASE &&
+	    2 * PTIME_BASE <= fb->ptime_max &&
+	    bitrate < BITRATE_LONG && aes->loss < FEC_ON) {
+
+		fb->ptime = 2 * PTIME_BASE;
+		aes->ptime_long = true;
+	}
+	else if (aes->ptime_long && fb->ptime == 2 * PTIME_BASE &&
+		 (bitrate >= BITRATE_SHORT || aes->loss >= LOSS_HIGH)) {
+
+		fb->ptime = PTIME_BASE;
+		aes->ptime_long = false;
+	}
+
+	debug("opus: feedback loss=%u%% jitter=%ums -> bitrate=%i fec=%d"
+	      " loss_perc=%u ptime=%u complexity=%i (cpu %u%%)\n",
+	      fb->loss, fb->jitter, aes->bitrate, aes->fec, aes->loss,
+	      fb->ptime, aes->complexity, cpu.usage);
+
+	lock_rel(aes->lock);
+
+	return 0;
+}
+
+
+/* Apply the adapted parameters, from the audio transmit thread */
+static void encoder_apply(struct auenc_state *aes)
+{
+	lock_write_get(aes->lock);
+
+	if (aes->update) {
+		const opus_int32 loss = min(aes->loss, LOSS_MAX);
+
+		(void)opus_encoder_ctl(aes->enc,
+				       OPUS_SET_BITRATE(aes->bitrate));
+		(void)opus_encoder_ctl(aes->enc,
+				       OPUS_SET_INBAND_FEC(aes->fec));
+		(void)opus_encoder_ctl(aes->enc,
+				       OPUS_SET_PACKET_LOSS_PERC(loss));
+
+		aes->update = false;
+	}
+
+	lock_rel(aes->lock);
+}
+
+
 int opus_encode_frm(struct auenc_state *aes, uint8_t *buf, size_t *len,
 		    const int16_t *sampv, size_t sampc)
 {
-	opus_int32 n;
+	opus_int32 n, complexity;
+	uint64_t t0;
 
 	if (!aes || !buf || !len || !sampv)
 		return EINVAL;
 
+	encoder_apply(aes);
+
+	t0 = realtime_clock_us();
+
 	n = opus_encode(aes->enc, sampv, (int)(sampc/aes->ch),
 			buf, (opus_int32)(*len));
 	if (n < 0) {
@@ -174,7 +398,36 @@ int opus_encode_frm(struct auenc_state *aes, uint8_t *buf, size_t *len,
 		return EPROTO;
 	}
 
+	if (cpu.ctrl.adapt) {
+		complexity = cpu_account(realtime_clock_us() - t0);
+
+		if (complexity != aes->complexity) {
+			(void)opus_encoder_ctl(aes->enc,
+					     OPUS_SET_COMPLEXITY(complexity));
+			aes->complexity = complexity;
+		}
+	}
+
 	*len = n;
 
 	return 0;
 }
+
+
+int opus_encode_init(const struct opus_ctrl *ctrl)
+{
+	if (!ctrl)
+		return EINVAL;
+
+	cpu.ctrl       = *ctrl;
+	cpu.complexity = ctrl->complexity;
+	cpu.win_start  = tmr_jiffies();
+
+	return lock_alloc(&cpu.lock);
+}
+
+
+void opus_encode_close(void)
+{
+	cpu.lock = mem_deref(cpu.lock);
+}
@@ -24,6 +24,11 @@
   opus_cbr        {yes,no}   # Constant Bitrate (inverse of VBR)
   opus_inbandfec  {yes,no}   # Enable inband Forward Error Correction (FEC)
   opus_dtx        {yes,no}   # Enable Discontinuous Transmission (DTX)
+  opus_application {auto,voip,audio} # Encoder mode, auto is per call
+  opus_complexity 10         # Maximum encoder complexity (0-10)
+  opus_adapt      {yes,no}   # Adapt FEC, bitrate, packet time and
+                             # complexity to RTCP reports and CPU usage
+  opus_cpu_budget 50         # Encode CPU budget, percent of one core
  \endverbatim
  *
  * References:
@@ -46,17 +51,52 @@ static struct aucodec opus = {
 	.decupdh   = opus_decode_update,
 	.dech      = opus_decode_frm,
 	.plch      = opus_decode_pkloss,
+	.encfbh    = opus_encode_feedback,
 };
 
 
+static int ctrl_decode(struct opus_ctrl *ctrl, struct conf *conf)
+{
+	struct pl pl;
+	uint32_t value;
+
+	ctrl->application = OPUS_AUTO;
+	ctrl->complexity  = 10;
+	ctrl->cpu_budget  = 50;
+	ctrl->adapt       = true;
+
+	if (0 == conf_get(conf, "opus_application", &pl)) {
+
+		if (0 == pl_strcasecmp(&pl, "voip"))
+			ctrl->application = OPUS_APPLICATION_VOIP;
+		else if (0 == pl_strcasecmp(&pl, "audio"))
+			ctrl->application = OPUS_APPLICATION_AUDIO;
+		else if (pl_strcasecmp(&pl, "auto")) {
+			warning("opus: unknown application: %r\n", &pl);
+			return EINVAL;
+		}
+	}
+
+	if (0 == conf_get_u32(conf, "opus_complexity", &value))
+		ctrl->complexity = min(value, 10);
+
+	(void)conf_get_u32(conf, "opus_cpu_budget", &ctrl->cpu_budget);
+	(void)conf_get_bool(conf, "opus_adapt", &ctrl->adapt);
+
+	return 0;
+}
+
+
 static int module_init(void)
 {
 	struct conf *conf = conf_cur();
+	struct opus_ctrl ctrl;
 	uint32_t value;
 	static char fmtp[256] = "stereo=1;sprop-stereo=1";
 	char *p = fmtp + str_len(fmtp);
 	bool b;
 	int n = 0;
+	int err;
 
 	if (0 == conf_get_u32(conf, "opus_bitrate", &value)) {
 
@@ -102,6 +142,14 @@ static int module_init(void)
 
 	debug("opus: fmtp=\"%s\"\n", fmtp);
 
+	err = ctrl_decode(&ctrl, conf);
+	if (err)
+		return err;
+
+	err = opus_encode_init(&ctrl);
+	if (err)
+		return err;
+
 	aucodec_register(&opus);
 
 	return 0;
@@ -111,6 +159,7 @@ static int module_init(void)
 static int module_close(void)
 {
 	aucodec_unregister(&opus);
+	opus_encode_close();
 
 	return 0;
 }
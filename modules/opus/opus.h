@@ -14,12 +14,23 @@ struct opus_param {
 	opus_int32 dtx;
 };
 
+/** Encoder control configuration */
+struct opus_ctrl {
+	opus_int32 application;  /**< OPUS_APPLICATION_x or OPUS_AUTO   */
+	opus_int32 complexity;   /**< Maximum encoder complexity        */
+	uint32_t cpu_budget;     /**< Encode CPU budget [%] of one core */
+	bool adapt;              /**< Adapt to the network and the CPU  */
+};
+
 
 /* Encode */
 int opus_encode_update(struct auenc_state **aesp, const struct aucodec *ac,
 		       struct auenc_param *prm, const char *fmtp);
 int opus_encode_frm(struct auenc_state *aes, uint8_t *buf, size_t *len,
 		    const int16_t *sampv, size_t sampc);
+int opus_encode_feedback(struct auenc_state *aes, struct auenc_fb *fb);
+int opus_encode_init(const struct opus_ctrl *ctrl);
+void opus_encode_close(void);
 
 
 /* Decode */
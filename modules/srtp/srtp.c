@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
 #include "sdes.h"
@@ -22,19 +23,49 @@
   <sip:user@domain.com>;mediaenc=srtp-mand
  \endverbatim
  *
+ * When built with OpenSSL, the AEAD_AES_128_GCM and AEAD_AES_256_GCM
+ * crypto-suites (RFC 7714) are offered first. They encrypt and
+ * authenticate each packet in a single pass.
  */
 
 
-#define SRTP_MASTER_KEY_LEN  30
+enum {
+	MAX_KEY_LEN = 46,      /**< Longest master key and salt, in bytes */
+};
+
+struct suite {
+	const char *name;      /**< Crypto-suite name                     */
+	size_t key_len;        /**< Length of master key and salt         */
+	bool aead;             /**< AES-GCM authenticated encryption      */
+};
+
+
+static const char aes_cm_128_hmac_sha1_32[] = "AES_CM_128_HMAC_SHA1_32";
+static const char aes_cm_128_hmac_sha1_80[] = "AES_CM_128_HMAC_SHA1_80";
+#ifdef USE_OPENSSL
+static const char aead_aes_128_gcm[] = "AEAD_AES_128_GCM";
+static const char aead_aes_256_gcm[] = "AEAD_AES_256_GCM";
+#endif
+
+/* Supported crypto-suites, in order of preference */
+static const struct suite suitev[] = {
+#ifdef USE_OPENSSL
+	{aead_aes_128_gcm,        28, true },
+	{aead_aes_256_gcm,        44, true },
+#endif
+	{aes_cm_128_hmac_sha1_80, 30, false},
+	{aes_cm_128_hmac_sha1_32, 30, false},
+};
 
 
 struct menc_st {
 	/* one SRTP session per media line */
-	uint8_t key_tx[32];
-	uint8_t key_rx[32];
+	uint8_t key_tx[ARRAY_SIZE(suitev)][MAX_KEY_LEN];
+	uint8_t key_rx[MAX_KEY_LEN];
 	struct srtp *srtp_tx, *srtp_rx;
+	struct srtp_gcm *gcm_tx, *gcm_rx;
 	bool use_srtp;
-	char *crypto_suite;
+	const struct suite *suite;
 
 	void *rtpsock;
 	void *rtcpsock;
@@ -44,18 +75,11 @@ struct menc_st {
 };
 
 
-static const char aes_cm_128_hmac_sha1_32[] = "AES_CM_128_HMAC_SHA1_32";
-static const char aes_cm_128_hmac_sha1_80[] = "AES_CM_128_HMAC_SHA1_80";
-
-static const char *preferred_suite = aes_cm_128_hmac_sha1_80;
-
-
 static void destructor(void *arg)
 {
 	struct menc_st *st = arg;
 
 	mem_deref(st->sdpm);
-	mem_deref(st->crypto_suite);
 
 	/* note: must be done before freeing socket */
 	mem_deref(st->uh_rtp);
@@ -65,15 +89,22 @@ static void destructor(void *arg)
 
 	mem_deref(st->srtp_tx);
 	mem_deref(st->srtp_rx);
+	mem_deref(st->gcm_tx);
+	mem_deref(st->gcm_rx);
 }
 
 
-static bool cryptosuite_issupported(const struct pl *suite)
+static const struct suite *suite_find(const struct pl *name)
 {
-	if (0 == pl_strcasecmp(suite, aes_cm_128_hmac_sha1_32)) return true;
-	if (0 == pl_strcasecmp(suite, aes_cm_128_hmac_sha1_80)) return true;
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(suitev); i++) {
 
-	return false;
+		if (0 == pl_strcasecmp(name, suitev[i].name))
+			return &suitev[i];
+	}
+
+	return NULL;
 }
 
 
@@ -126,16 +157,18 @@ static enum srtp_suite resolve_suite(const char *suite)
 }
 
 
-static int start_srtp(struct menc_st *st, const char *suite_name)
+static int start_aes_cm(struct menc_st *st, const struct suite *suite)
 {
-	enum srtp_suite suite;
+	const uint8_t *key_tx = st->key_tx[suite - suitev];
+	enum srtp_suite srtp_suite;
 	int err;
 
-	suite = resolve_suite(suite_name);
+	srtp_suite = resolve_suite(suite->name);
 
 	/* allocate and initialize the SRTP session */
 	if (!st->srtp_tx) {
-		err = srtp_alloc(&st->srtp_tx, suite, st->key_tx, 30, 0);
+		err = srtp_alloc(&st->srtp_tx, srtp_suite, key_tx,
+				 suite->key_len, 0);
 		if (err) {
 			warning("srtp: srtp_alloc TX failed (%m)\n", err);
 			return err;
@@ -143,13 +176,61 @@ static int start_srtp(struct menc_st *st, const char *suite_name)
 	}
 
 	if (!st->srtp_rx) {
-		err = srtp_alloc(&st->srtp_rx, suite, st->key_rx, 30, 0);
+		err = srtp_alloc(&st->srtp_rx, srtp_suite, st->key_rx,
+				 suite->key_len, 0);
 		if (err) {
 			warning("srtp: srtp_alloc RX failed (%m)\n", err);
 			return err;
 		}
 	}
 
+	return 0;
+}
+
+
+static int start_gcm(struct menc_st *st, const struct suite *suite)
+{
+#ifdef USE_OPENSSL
+	const uint8_t *key_tx = st->key_tx[suite - suitev];
+	int err;
+
+	if (!st->gcm_tx) {
+		err = srtp_gcm_alloc(&st->gcm_tx, key_tx, suite->key_len);
+		if (err) {
+			warning("srtp: srtp_gcm_alloc TX failed (%m)\n", err);
+			return err;
+		}
+	}
+
+	if (!st->gcm_rx) {
+		err = srtp_gcm_alloc(&st->gcm_rx, st->key_rx, suite->key_len);
+		if (err) {
+			warning("srtp: srtp_gcm_alloc RX failed (%m)\n", err);
+			return err;
+		}
+	}
+
+	return 0;
+#else
+	(void)st;
+	(void)suite;
+
+	return ENOSYS;
+#endif
+}
+
+
+static int start_srtp(struct menc_st *st, const struct suite *suite)
+{
+	int err;
+
+	if (suite->aead)
+		err = start_gcm(st, suite);
+	else
+		err = start_aes_cm(st, suite);
+	if (err)
+		return err;
+
 	/* use SRTP for this stream/session */
 	st->use_srtp = true;
 
@@ -157,27 +238,52 @@ static int start_srtp(struct menc_st *st, const char *suite_name)
 }
 
 
+static int encrypt_packet(struct menc_st *st, bool rtcp, struct mbuf *mb)
+{
+#ifdef USE_OPENSSL
+	if (st->suite->aead) {
+		return rtcp ? srtcp_gcm_encrypt(st->gcm_tx, mb)
+			    : srtp_gcm_encrypt(st->gcm_tx, mb);
+	}
+#endif
+
+	return rtcp ? srtcp_encrypt(st->srtp_tx, mb)
+		    : srtp_encrypt(st->srtp_tx, mb);
+}
+
+
+static int decrypt_packet(struct menc_st *st, bool rtcp, struct mbuf *mb)
+{
+#ifdef USE_OPENSSL
+	if (st->suite->aead) {
+		return rtcp ? srtcp_gcm_decrypt(st->gcm_rx, mb)
+			    : srtp_gcm_decrypt(st->gcm_rx, mb);
+	}
+#endif
+
+	return rtcp ? srtcp_decrypt(st->srtp_rx, mb)
+		    : srtp_decrypt(st->srtp_rx, mb);
+}
+
+
 static bool send_handler(int *err, struct sa *dst, struct mbuf *mb, void *arg)
 {
 	struct menc_st *st = arg;
 	size_t len = mbuf_get_left(mb);
+	bool rtcp;
 	int lerr = 0;
 	(void)dst;
 
 	if (!st->use_srtp || !is_rtp_or_rtcp(mb))
 		return false;
 
-	if (is_rtcp_packet(mb)) {
-		lerr = srtcp_encrypt(st->srtp_tx, mb);
-	}
-	else {
-		lerr = srtp_encrypt(st->srtp_tx, mb);
-	}
+	rtcp = is_rtcp_packet(mb);
 
+	lerr = encrypt_packet(st, rtcp, mb);
 	if (lerr) {
 		warning("srtp: failed to encrypt %s-packet"
 			      " with %zu bytes (%m)\n",
-			      is_rtcp_packet(mb) ? "RTCP" : "RTP",
+			      rtcp ? "RTCP" : "RTP",
 			      len, lerr);
 		*err = lerr;
 		return false;
@@ -191,25 +297,20 @@ static bool recv_handler(struct sa *src, struct mbuf *mb, void *arg)
 {
 	struct menc_st *st = arg;
 	size_t len = mbuf_get_left(mb);
+	bool rtcp;
 	int err = 0;
 	(void)src;
 
 	if (!st->use_srtp || !is_rtp_or_rtcp(mb))
 		return false;
 
-	if (is_rtcp_packet(mb)) {
-		err = srtcp_decrypt(st->srtp_rx, mb);
-		if (err) {
-			warning("srtp: failed to decrypt RTCP packet"
-				" with %zu bytes (%m)\n", len, err);
-		}
-	}
-	else {
-		err = srtp_decrypt(st->srtp_rx, mb);
-		if (err) {
-			warning("srtp: failed to decrypt RTP packet"
-				" with %zu bytes (%m)\n", len, err);
-		}
+	rtcp = is_rtcp_packet(mb);
+
+	err = decrypt_packet(st, rtcp, mb);
+	if (err) {
+		warning("srtp: failed to decrypt %s packet"
+			" with %zu bytes (%m)\n",
+			rtcp ? "RTCP" : "RTP", len, err);
 	}
 
 	return err ? true : false;
@@ -217,44 +318,88 @@ static bool recv_handler(struct sa *src, struct mbuf *mb, void *arg)
 
 
 /* a=crypto:<tag> <crypto-suite> <key-params> [<session-params>] */
-static int sdp_enc(struct menc_st *st, struct sdp_media *m,
-		   uint32_t tag, const char *suite)
+static int sdp_enc(struct menc_st *st, struct sdp_media *m, bool replace,
+		   uint32_t tag, const struct suite *suite)
 {
 	char key[128] = "";
 	size_t olen;
 	int err;
 
 	olen = sizeof(key);
-	err = base64_encode(st->key_tx, SRTP_MASTER_KEY_LEN, key, &olen);
+	err = base64_encode(st->key_tx[suite - suitev], suite->key_len,
+			    key, &olen);
 	if (err)
 		return err;
 
-	return sdes_encode_crypto(m, tag, suite, key, olen);
+	return sdes_encode_crypto(m, replace, tag, suite->name, key, olen);
+}
+
+
+/* Offer all crypto-suites, each with its own key */
+static int sdp_offer(struct menc_st *st, struct sdp_media *m)
+{
+	size_t i;
+	int err = 0;
+
+	for (i=0; i<ARRAY_SIZE(suitev); i++)
+		err |= sdp_enc(st, m, i == 0, (uint32_t)i + 1, &suitev[i]);
+
+	return err;
+}
+
+
+/*
+ * The sessions are kept over a Re-INVITE with the same crypto-suite and
+ * key, with their rollover counters. A new suite or key starts over.
+ */
+static void stop_srtp(struct menc_st *st, bool tx)
+{
+	st->use_srtp = false;
+
+	if (tx) {
+		st->srtp_tx = mem_deref(st->srtp_tx);
+		st->gcm_tx  = mem_deref(st->gcm_tx);
+	}
+
+	st->srtp_rx = mem_deref(st->srtp_rx);
+	st->gcm_rx  = mem_deref(st->gcm_rx);
 }
 
 
-static int start_crypto(struct menc_st *st, const struct pl *key_info)
+static int start_crypto(struct menc_st *st, const struct suite *suite,
+			const struct pl *key_info)
 {
+	uint8_t key_rx[MAX_KEY_LEN];
 	size_t olen;
 	int err;
 
 	/* key-info is BASE64 encoded */
 
-	olen = sizeof(st->key_rx);
-	err = base64_decode(key_info->p, key_info->l, st->key_rx, &olen);
+	memset(key_rx, 0, sizeof(key_rx));
+	olen = sizeof(key_rx);
+	err = base64_decode(key_info->p, key_info->l, key_rx, &olen);
 	if (err)
 		return err;
 
-	if (SRTP_MASTER_KEY_LEN != olen) {
-		warning("srtp: srtp keylen is %u (should be 30)\n", olen);
+	if (suite->key_len != olen) {
+		warning("srtp: srtp keylen is %zu (should be %zu)\n",
+			olen, suite->key_len);
 	}
 
-	err = start_srtp(st, st->crypto_suite);
+	if (suite != st->suite)
+		stop_srtp(st, true);
+	else if (memcmp(key_rx, st->key_rx, sizeof(key_rx)))
+		stop_srtp(st, false);
+
+	memcpy(st->key_rx, key_rx, sizeof(st->key_rx));
+	st->suite = suite;
+
+	err = start_srtp(st, suite);
 	if (err)
 		return err;
 
 	info("srtp: %s: SRTP is Enabled (cryptosuite=%s)\n",
-	     sdp_media_name(st->sdpm), st->crypto_suite);
+	     sdp_media_name(st->sdpm), st->suite->name);
 
 	return 0;
 }
@@ -263,6 +408,7 @@ static int start_crypto(struct menc_st *st, const struct pl *key_info)
 static bool sdp_attr_handler(const char *name, const char *value, void *arg)
 {
 	struct menc_st *st = arg;
+	const struct suite *suite;
 	struct crypto c;
 	(void)name;
 
@@ -272,16 +418,14 @@ static bool sdp_attr_handler(const char *name, const char *value, void *arg)
 	if (0 != pl_strcmp(&c.key_method, "inline"))
 		return false;
 
-	if (!cryptosuite_issupported(&c.suite))
+	suite = suite_find(&c.suite);
+	if (!suite)
 		return false;
 
-	st->crypto_suite = mem_deref(st->crypto_suite);
-	pl_strdup(&st->crypto_suite, &c.suite);
-
-	if (start_crypto(st, &c.key_info))
+	if (start_crypto(st, suite, &c.key_info))
 		return false;
 
-	sdp_enc(st, st->sdpm, c.tag, st->crypto_suite);
+	sdp_enc(st, st->sdpm, true, c.tag, suite);
 
 	return true;
 }
@@ -337,12 +481,7 @@ static int alloc(struct menc_media **stp, struct menc_sess *sess,
 		if (err)
 			goto out;
 
-		/* set our preferred crypto-suite */
-		err |= str_dup(&st->crypto_suite, preferred_suite);
-		if (err)
-			goto out;
-
-		rand_bytes(st->key_tx, SRTP_MASTER_KEY_LEN);
+		rand_bytes((uint8_t *)st->key_tx, sizeof(st->key_tx));
 	}
 
 	/* SDP handling */
@@ -358,7 +497,7 @@ static int alloc(struct menc_media **stp, struct menc_sess *sess,
 	}
 
 	if (!rattr)
-		err = sdp_enc(st, sdpm, 0, st->crypto_suite);
+		err = sdp_offer(st, sdpm);
 
  out:
 	if (err)
@@ -19,7 +19,8 @@ enum {LAYER = 0, INTERVAL = 30};
 struct mnat_sess {
 	struct list medial;
 	struct sa srv;
-	struct stun_dns *dnsq;
+	struct natcache_query *dnsq;
+	struct tmr tmr;
 	mnat_estab_h *estabh;
 	void *arg;
 	int mediac;
@@ -47,6 +48,7 @@ static void session_destructor(void *arg)
 {
 	struct mnat_sess *sess = arg;
 
+	tmr_cancel(&sess->tmr);
 	list_flush(&sess->medial);
 	mem_deref(sess->dnsq);
 }
@@ -157,6 +159,14 @@ static void dns_handler(int err, const struct sa *srv, void *arg)
 }
 
 
+static void estab_handler(void *arg)
+{
+	struct mnat_sess *sess = arg;
+
+	sess->estabh(0, 0, NULL, sess->arg);
+}
+
+
 static int session_alloc(struct mnat_sess **sessp, struct dnsc *dnsc,
 			 int af, const char *srv, uint16_t port,
 			 const char *user, const char *pass,
@@ -164,7 +174,8 @@ static int session_alloc(struct mnat_sess **sessp, struct dnsc *dnsc,
 			 mnat_estab_h *estabh, void *arg)
 {
 	struct mnat_sess *sess;
-	int err;
+	struct sa map, laddr;
+	int err = 0;
 	(void)user;
 	(void)pass;
 	(void)ss;
@@ -180,10 +191,22 @@ static int session_alloc(struct mnat_sess **sessp, struct dnsc *dnsc,
 	sess->estabh = estabh;
 	sess->arg    = arg;
 
-	err = stun_server_discover(&sess->dnsq, dnsc,
-				   stun_usage_binding, stun_proto_udp,
-				   af, srv, port, dns_handler, sess);
+	/* The local interface is not behind a NAT, use the local
+	   addresses without asking the STUN server */
+	if (0 == natcache_mapped(&map, &laddr, af, srv, port) &&
+	    sa_cmp(&map, &laddr, SA_ALL)) {
 
+		info("stun: no NAT on %J -- using local addresses\n", &laddr);
+
+		tmr_start(&sess->tmr, 0, estab_handler, sess);
+		goto out;
+	}
+
+	err = natcache_server_discover(&sess->dnsq, dnsc,
+				       stun_usage_binding, stun_proto_udp,
+				       af, srv, port, dns_handler, sess);
+
+ out:
 	if (err)
 		mem_deref(sess);
 	else
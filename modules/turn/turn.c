@@ -22,7 +22,7 @@ enum {LAYER = 0};
 struct mnat_sess {
 	struct list medial;
 	struct sa srv;
-	struct stun_dns *dnsq;
+	struct natcache_query *dnsq;
 	char *user;
 	char *pass;
 	mnat_estab_h *estabh;
@@ -201,9 +201,9 @@ static int session_alloc(struct mnat_sess **sessp, struct dnsc *dnsc,
 	sess->estabh = estabh;
 	sess->arg    = arg;
 
-	err = stun_server_discover(&sess->dnsq, dnsc,
-				   stun_usage_relay, stun_proto_udp,
-				   af, srv, port, dns_handler, sess);
+	err = natcache_server_discover(&sess->dnsq, dnsc,
+				       stun_usage_relay, stun_proto_udp,
+				       af, srv, port, dns_handler, sess);
 
  out:
 	if (err)
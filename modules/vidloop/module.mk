@@ -6,5 +6,6 @@
 
 MOD		:= vidloop
 $(MOD)_SRCS	+= vidloop.c
+$(MOD)_LFLAGS	+= -lm
 
 include mk/mod.mk
@@ -6,6 +6,8 @@
 #define _DEFAULT_SOURCE 1
 #define _BSD_SOURCE 1
 #include <string.h>
+#include <stdlib.h>
+#include <math.h>
 #include <time.h>
 #include <re.h>
 #include <rem.h>
@@ -29,6 +31,13 @@
  \verbatim
   baresip -evv
  \endverbatim
+ *
+ * Codec benchmark, with a synthetic video source and no display.
+ * The picture size is taken from the video_size config. A target fps
+ * of 0 (the default) encodes the frames as fast as possible:
+ \verbatim
+  /B <codec> [frames] [fps]
+ \endverbatim
  */
 
 
@@ -67,7 +76,35 @@ struct video_loop {
 };
 
 
+/** Video codec benchmark */
+struct bench {
+	const struct vidcodec *vc_enc;
+	const struct vidcodec *vc_dec;
+	struct videnc_state *enc;
+	struct viddec_state *dec;
+	struct vidframe *frame;   /**< Synthetic source frame         */
+	struct vidframe *ref;     /**< Source frame of decoded frame  */
+	struct mbuf *mb;          /**< Packet buffer                  */
+	struct tmr tmr;
+	uint32_t *latv;           /**< Per-frame latency in [us]      */
+	uint64_t *tv;             /**< Per-frame encode start in [us] */
+	unsigned nframes;         /**< Number of frames to encode     */
+	unsigned fps;             /**< Target fps, 0 for unlimited    */
+	unsigned n_enc;           /**< Frames encoded                 */
+	unsigned n_dec;           /**< Frames decoded                 */
+	unsigned n_err;           /**< Decode errors                  */
+	uint64_t t_start;         /**< Start time in [ms]             */
+	uint64_t t_enc;           /**< Total encode time in [us]      */
+	uint64_t t_dec;           /**< Total decode time in [us]      */
+	uint64_t bytes;           /**< Total encoded bytes            */
+	double psnr;              /**< Sum of luma PSNR in [dB]       */
+	unsigned n_psnr;          /**< Frames compared for PSNR       */
+	uint16_t seq;
+};
+
+
 static struct video_loop *gvl;
+static struct bench *gbench;
 
 
 static int display(struct video_loop *vl, struct vidframe *frame)
@@ -468,9 +505,386 @@ static int vidloop_stop(struct re_printf *pf, void *arg)
 }
 
 
+static uint64_t time_usec(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/* Moving diagonal gradient with a bright box, in YUV420P */
+static void pattern_draw(struct vidframe *f, unsigned n)
+{
+	const unsigned bw = f->size.w / 4, bh = f->size.h / 4;
+	const unsigned bx = (n * 4) % (f->size.w - bw);
+	const unsigned by = f->size.h / 2 - bh / 2;
+	unsigned x, y;
+
+	for (y=0; y<f->size.h; y++) {
+
+		uint8_t *p = f->data[0] + y * f->linesize[0];
+
+		for (x=0; x<f->size.w; x++) {
+
+			if (x >= bx && x < bx + bw && y >= by && y < by + bh)
+				p[x] = 235;
+			else
+				p[x] = (uint8_t)(16 + (x + y + 2*n) % 220);
+		}
+	}
+
+	for (y=0; y<f->size.h/2; y++) {
+
+		uint8_t *u = f->data[1] + y * f->linesize[1];
+		uint8_t *v = f->data[2] + y * f->linesize[2];
+
+		for (x=0; x<f->size.w/2; x++) {
+			u[x] = (uint8_t)(16 + (x + n) % 224);
+			v[x] = (uint8_t)(16 + (y + n) % 224);
+		}
+	}
+}
+
+
+/* Luma PSNR in [dB] */
+static double psnr_y(const struct vidframe *a, const struct vidframe *b)
+{
+	uint64_t sse = 0;
+	double mse;
+	unsigned x, y;
+
+	for (y=0; y<a->size.h; y++) {
+
+		const uint8_t *pa = a->data[0] + y * a->linesize[0];
+		const uint8_t *pb = b->data[0] + y * b->linesize[0];
+
+		for (x=0; x<a->size.w; x++) {
+			const int d = pa[x] - pb[x];
+			sse += d * d;
+		}
+	}
+
+	if (!sse)
+		return 99.0;
+
+	mse = (double)sse / (a->size.w * a->size.h);
+
+	return 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+
+static int bench_packet_handler(bool marker, const uint8_t *hdr,
+				size_t hdr_len, const uint8_t *pld,
+				size_t pld_len, void *arg)
+{
+	struct bench *b = arg;
+	struct vidframe frame;
+	uint64_t t0, t1;
+	int err;
+
+	mbuf_rewind(b->mb);
+
+	err  = mbuf_write_mem(b->mb, hdr, hdr_len);
+	err |= mbuf_write_mem(b->mb, pld, pld_len);
+	if (err)
+		return err;
+
+	b->mb->pos = 0;
+	b->bytes += hdr_len + pld_len;
+
+	frame.data[0] = NULL;
+
+	t0 = time_usec();
+	err = b->vc_dec->dech(b->dec, &frame, marker, b->seq++, b->mb);
+	t1 = time_usec();
+
+	b->t_dec += t1 - t0;
+
+	if (err) {
+		++b->n_err;
+		return 0;
+	}
+
+	if (!vidframe_isvalid(&frame))
+		return 0;
+
+	/*
+	 * Frames are decoded in encoding order, so the n-th decoded frame
+	 * is the n-th source frame, also with a decoder delay
+	 */
+	if (b->n_dec < b->nframes) {
+
+		b->latv[b->n_dec] = (uint32_t)(t1 - b->tv[b->n_dec]);
+
+		if (frame.fmt == VID_FMT_YUV420P &&
+		    vidsz_cmp(&frame.size, &b->ref->size)) {
+
+			pattern_draw(b->ref, b->n_dec);
+
+			b->psnr += psnr_y(b->ref, &frame);
+			++b->n_psnr;
+		}
+	}
+
+	++b->n_dec;
+
+	return 0;
+}
+
+
+static int bench_encode(struct bench *b)
+{
+	uint64_t t0, t_dec;
+	int err;
+
+	pattern_draw(b->frame, b->n_enc);
+
+	t_dec = b->t_dec;
+	b->tv[b->n_enc] = t0 = time_usec();
+
+	err = b->vc_enc->ench(b->enc, false, b->frame);
+
+	/* the decoder is called from the packet handler */
+	b->t_enc += time_usec() - t0 - (b->t_dec - t_dec);
+	++b->n_enc;
+
+	return err;
+}
+
+
+static int cmp_u32(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+static int bench_print(struct re_printf *pf, struct bench *b)
+{
+	const unsigned fps = b->fps ? b->fps : conf_config()->video.fps;
+	const unsigned n = min(b->n_dec, b->nframes);
+	int err = 0;
+
+	err |= re_hprintf(pf, "vidloop benchmark: %s/%s %u x %u\n",
+			  b->vc_enc->name, b->vc_dec->name,
+			  b->frame->size.w, b->frame->size.h);
+	err |= re_hprintf(pf, "  encode:   %u frames, %.1f fps\n",
+			  b->n_enc, 1e6 * b->n_enc / max(b->t_enc, 1));
+	err |= re_hprintf(pf, "  decode:   %u frames, %.1f fps"
+			  " (%u errors)\n",
+			  b->n_dec, 1e6 * b->n_dec / max(b->t_dec, 1),
+			  b->n_err);
+
+	if (n) {
+		qsort(b->latv, n, sizeof(*b->latv), cmp_u32);
+
+		err |= re_hprintf(pf, "  latency:  p50=%.2fms p90=%.2fms"
+				  " p99=%.2fms max=%.2fms\n",
+				  b->latv[n * 50 / 100] / 1000.0,
+				  b->latv[n * 90 / 100] / 1000.0,
+				  b->latv[n * 99 / 100] / 1000.0,
+				  b->latv[n - 1] / 1000.0);
+	}
+
+	if (b->n_psnr) {
+		err |= re_hprintf(pf, "  psnr:     %.2f dB (%u frames)\n",
+				  b->psnr / b->n_psnr, b->n_psnr);
+	}
+
+	if (b->n_enc) {
+		err |= re_hprintf(pf, "  bitrate:  %u kbit/s at %u fps\n",
+				  (unsigned)(8 * b->bytes * fps
+					     / b->n_enc / 1000),
+				  fps);
+	}
+
+	return err;
+}
+
+
+static void bench_destructor(void *arg)
+{
+	struct bench *b = arg;
+
+	tmr_cancel(&b->tmr);
+	mem_deref(b->enc);
+	mem_deref(b->dec);
+	mem_deref(b->frame);
+	mem_deref(b->ref);
+	mem_deref(b->mb);
+	mem_deref(b->latv);
+	mem_deref(b->tv);
+}
+
+
+static void bench_timeout(void *arg)
+{
+	struct bench *b = arg;
+	uint64_t next;
+	int err;
+
+	err = bench_encode(b);
+	if (err || b->n_enc >= b->nframes) {
+		if (err)
+			warning("vidloop: benchmark encode: %m\n", err);
+
+		info("%H", bench_print, b);
+		gbench = mem_deref(gbench);
+		return;
+	}
+
+	next = b->t_start + (uint64_t)b->n_enc * 1000 / b->fps;
+	tmr_start(&b->tmr, next > tmr_jiffies() ? next - tmr_jiffies() : 0,
+		  bench_timeout, b);
+}
+
+
+static int bench_alloc(struct bench **bp, const char *name,
+		       unsigned nframes, unsigned fps)
+{
+	struct config *cfg = conf_config();
+	struct videnc_param prm;
+	struct vidsz size;
+	struct bench *b;
+	int err;
+
+	b = mem_zalloc(sizeof(*b), bench_destructor);
+	if (!b)
+		return ENOMEM;
+
+	tmr_init(&b->tmr);
+	b->nframes = nframes;
+	b->fps     = fps;
+
+	b->vc_enc = vidcodec_find_encoder(name);
+	b->vc_dec = vidcodec_find_decoder(name);
+	if (!b->vc_enc || !b->vc_dec || !b->vc_dec->decupdh) {
+		warning("vidloop: codec not found (%s)\n", name);
+		err = ENOENT;
+		goto out;
+	}
+
+	size.w = cfg->video.width;
+	size.h = cfg->video.height;
+
+	b->latv = mem_zalloc(nframes * sizeof(*b->latv), NULL);
+	b->tv   = mem_zalloc(nframes * sizeof(*b->tv), NULL);
+	b->mb   = mbuf_alloc(1500);
+	if (!b->latv || !b->tv || !b->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err  = vidframe_alloc(&b->frame, VID_FMT_YUV420P, &size);
+	err |= vidframe_alloc(&b->ref, VID_FMT_YUV420P, &size);
+	if (err)
+		goto out;
+
+	prm.fps     = fps ? fps : cfg->video.fps;
+	prm.pktsize = 1480;
+	prm.bitrate = cfg->video.bitrate;
+	prm.max_fs  = -1;
+
+	err = b->vc_enc->encupdh(&b->enc, b->vc_enc, &prm, NULL,
+				 bench_packet_handler, b);
+	if (err)
+		goto out;
+
+	err = b->vc_dec->decupdh(&b->dec, b->vc_dec, NULL);
+	if (err)
+		goto out;
+
+ out:
+	if (err)
+		mem_deref(b);
+	else
+		*bp = b;
+
+	return err;
+}
+
+
+/**
+ * Run a video codec benchmark, with a synthetic source and no display
+ */
+static int vidloop_bench(struct re_printf *pf, void *arg)
+{
+	const struct cmd_arg *carg = arg;
+	struct pl codec, frames, fps;
+	char name[64] = "";
+	unsigned nframes = 300, nfps = 0;
+	int err;
+
+	if (gbench) {
+		(void)re_hprintf(pf, "Stopping benchmark\n%H",
+				 bench_print, gbench);
+		gbench = mem_deref(gbench);
+		return 0;
+	}
+
+	if (str_isset(carg->prm) &&
+	    0 == re_regex(carg->prm, str_len(carg->prm),
+			  "[^ ]+[ ]*[0-9]*[ ]*[0-9]*",
+			  &codec, NULL, &frames, NULL, &fps)) {
+
+		(void)pl_strcpy(&codec, name, sizeof(name));
+
+		if (pl_isset(&frames))
+			nframes = pl_u32(&frames);
+		if (pl_isset(&fps))
+			nfps = pl_u32(&fps);
+	}
+
+	if (!nframes)
+		return EINVAL;
+
+	err = bench_alloc(&gbench, str_isset(name) ? name : NULL,
+			  nframes, nfps);
+	if (err) {
+		warning("vidloop: benchmark: %m\n", err);
+		return err;
+	}
+
+	(void)re_hprintf(pf, "Benchmark %s: %u frames at %u x %u",
+			 gbench->vc_enc->name, nframes,
+			 gbench->frame->size.w, gbench->frame->size.h);
+	if (nfps)
+		(void)re_hprintf(pf, ", %u fps\n", nfps);
+	else
+		(void)re_hprintf(pf, ", unlimited fps\n");
+
+	if (nfps) {
+		gbench->t_start = tmr_jiffies();
+		tmr_start(&gbench->tmr, 0, bench_timeout, gbench);
+		return 0;
+	}
+
+	while (gbench->n_enc < nframes) {
+
+		err = bench_encode(gbench);
+		if (err) {
+			warning("vidloop: benchmark encode: %m\n", err);
+			break;
+		}
+	}
+
+	(void)re_hprintf(pf, "%H", bench_print, gbench);
+
+	gbench = mem_deref(gbench);
+
+	return err;
+}
+
+
 static const struct cmd cmdv[] = {
-	{'v', 0, "Start video-loop", vidloop_start },
-	{'V', 0, "Stop video-loop",  vidloop_stop  },
+	{'v', 0,       "Start video-loop",      vidloop_start },
+	{'V', 0,       "Stop video-loop",       vidloop_stop  },
+	{'B', CMD_PRM, "Video codec benchmark", vidloop_bench },
 };
 
 
@@ -483,6 +897,7 @@ static int module_init(void)
 static int module_close(void)
 {
 	vidloop_stop(NULL, NULL);
+	gbench = mem_deref(gbench);
 	cmd_unregister(cmdv);
 	return 0;
 }
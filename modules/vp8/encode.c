@@ -5,6 +5,9 @@
  */
 
 #include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
@@ -14,10 +17,53 @@
 
 
 enum {
-	HDR_SIZE = 4,
+	HDR_SIZE = 6,  /* with TL0PICIDX and TID */
 };
 
 
+#define TL_REF_LAST (VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF)
+#define TL_NO_UPD   (VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_GF | \
+		     VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_UPD_ENTROPY)
+
+
+/*
+ * Temporal layer patterns. Base layer frames only reference the
+ * previous base layer frame, so that a forwarding node can drop the
+ * enhancement layers without re-encoding.
+ */
+struct tl_frame {
+	unsigned tid;                  /**< Temporal layer index          */
+	bool sync;                     /**< Depends on base layer only    */
+	vpx_enc_frame_flags_t flags;   /**< Reference and update flags    */
+};
+
+static const struct tl_mode {
+	unsigned layers;
+	unsigned period;
+	unsigned rate[3];              /**< Cumulative bitrate in [%]     */
+	struct tl_frame framev[4];
+} tl_modes[] = {
+	{2, 2, {60, 100}, {
+		{0, false, TL_REF_LAST | VP8_EFLAG_NO_UPD_GF |
+			   VP8_EFLAG_NO_UPD_ARF},
+		{1, true,  TL_REF_LAST | TL_NO_UPD},
+	}},
+	{3, 4, {40, 60, 100}, {
+		{0, false, TL_REF_LAST | VP8_EFLAG_NO_UPD_GF |
+			   VP8_EFLAG_NO_UPD_ARF},
+		{2, true,  TL_REF_LAST | TL_NO_UPD},
+		{1, true,  TL_REF_LAST | VP8_EFLAG_NO_UPD_LAST |
+			   VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_UPD_ENTROPY},
+		{2, false, VP8_EFLAG_NO_REF_ARF | TL_NO_UPD},
+	}},
+};
+
+struct tl_hdr {
+	uint8_t tl0picidx;
+	unsigned tid;
+	bool y;
+};
+
 struct videnc_state {
 	vpx_codec_ctx_t ctx;
 	struct vidsz size;
@@ -25,8 +71,12 @@ struct videnc_state {
 	unsigned fps;
 	unsigned bitrate;
 	unsigned pktsize;
+	unsigned threads;
 	bool ctxup;
 	uint16_t picid;
+	const struct tl_mode *tlm;
+	unsigned tl_idx;
+	uint8_t tl0picidx;
 	videnc_packet_h *pkth;
 	void *arg;
 };
@@ -41,6 +91,62 @@ static void destructor(void *arg)
 }
 
 
+static const struct tl_mode *tl_mode_find(unsigned layers)
+{
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(tl_modes); i++) {
+
+		if (tl_modes[i].layers == layers)
+			return &tl_modes[i];
+	}
+
+	return NULL;
+}
+
+
+/* Number of encoder threads, based on picture size and cores */
+static unsigned encoder_threads(const struct vidsz *size)
+{
+	const unsigned pixels = size->w * size->h;
+	unsigned cores = 1, threads;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	{
+		const long n = sysconf(_SC_NPROCESSORS_ONLN);
+		if (n > 0)
+			cores = (unsigned)n;
+	}
+#endif
+
+	if (pixels >= 1920 * 1080)
+		threads = 8;
+	else if (pixels >= 1280 * 720)
+		threads = 4;
+	else if (pixels >= 640 * 480)
+		threads = 2;
+	else
+		threads = 1;
+
+	return min(threads, cores);
+}
+
+
+/*
+ * One token partition per thread, limited to four partitions since
+ * the payload descriptor has room for partition index 0-7
+ */
+static int token_partitions(unsigned threads)
+{
+	if (threads >= 4)
+		return VP8_FOUR_TOKENPARTITION;
+	else if (threads >= 2)
+		return VP8_TWO_TOKENPARTITION;
+	else
+		return VP8_ONE_TOKENPARTITION;
+}
+
+
 int vp8_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 		      struct videnc_param *prm, const char *fmtp,
 		      videnc_packet_h *pkth, void *arg)
@@ -48,7 +154,6 @@ int vp8_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 	const struct vp8_vidcodec *vp8 = (struct vp8_vidcodec *)vc;
 	struct videnc_state *ves;
 	uint32_t max_fs;
-	(void)vp8;
 
 	if (!vesp || !vc || !prm || prm->pktsize < (HDR_SIZE + 1))
 		return EINVAL;
@@ -61,7 +166,10 @@ int vp8_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 		if (!ves)
 			return ENOMEM;
 
-		ves->picid = rand_u16();
+		ves->picid     = rand_u16();
+		ves->tl0picidx = (uint8_t)rand_u16();
+		ves->threads   = vp8->threads;
+		ves->tlm       = tl_mode_find(vp8->layers);
 
 		*vesp = ves;
 	}
@@ -108,6 +216,27 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 	cfg.rc_end_usage      = VPX_VBR;
 	cfg.rc_target_bitrate = ves->bitrate;
 	cfg.kf_mode           = VPX_KF_AUTO;
+	cfg.g_threads         = ves->threads;
+
+	if (!cfg.g_threads)
+		cfg.g_threads = encoder_threads(size);
+
+	if (ves->tlm) {
+		const struct tl_mode *tlm = ves->tlm;
+		unsigned i;
+
+		cfg.ts_number_layers = tlm->layers;
+		cfg.ts_periodicity   = tlm->period;
+
+		for (i=0; i<tlm->layers; i++) {
+			cfg.ts_target_bitrate[i] =
+				cfg.rc_target_bitrate * tlm->rate[i] / 100;
+			cfg.ts_rate_decimator[i] = 1 << (tlm->layers - i - 1);
+		}
+
+		for (i=0; i<tlm->period; i++)
+			cfg.ts_layer_id[i] = tlm->framev[i].tid;
+	}
 
 	if (ves->ctxup) {
 		debug("vp8: re-opening encoder\n");
@@ -122,7 +251,12 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 		return EPROTO;
 	}
 
-	ves->ctxup = true;
+	ves->ctxup  = true;
+	ves->tl_idx = 0;
+
+	debug("vp8: encoder opened (%u x %u, %u threads, %u layers)\n",
+	      size->w, size->h, cfg.g_threads,
+	      ves->tlm ? ves->tlm->layers : 1);
 
 	res = vpx_codec_control(&ves->ctx, VP8E_SET_CPUUSED, 16);
 	if (res) {
@@ -134,44 +268,64 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 		warning("vp8: codec ctrl: %s\n", vpx_codec_err_to_string(res));
 	}
 
+	res = vpx_codec_control(&ves->ctx, VP8E_SET_TOKEN_PARTITIONS,
+				token_partitions(cfg.g_threads));
+	if (res) {
+		warning("vp8: codec ctrl: %s\n", vpx_codec_err_to_string(res));
+	}
+
 	return 0;
 }
 
 
-static inline void hdr_encode(uint8_t hdr[HDR_SIZE], bool noref, bool start,
-			      uint8_t partid, uint16_t picid)
+static inline size_t hdr_encode(uint8_t hdr[HDR_SIZE], bool noref,
+				bool start, uint8_t partid, uint16_t picid,
+				const struct tl_hdr *tl)
 {
 	hdr[0] = 1<<7 | noref<<5 | start<<4 | (partid & 0x7);
 	hdr[1] = 1<<7;
 	hdr[2] = 1<<7 | (picid>>8 & 0x7f);
 	hdr[3] = picid & 0xff;
+
+	if (!tl)
+		return 4;
+
+	hdr[1] |= 1<<6 | 1<<5;
+	hdr[4]  = tl->tl0picidx;
+	hdr[5]  = (tl->tid & 0x3)<<6 | tl->y<<5;
+
+	return 6;
 }
 
 
 static inline int packetize(bool marker, const uint8_t *buf, size_t len,
 			    size_t maxlen, bool noref, uint8_t partid,
-			    uint16_t picid, videnc_packet_h *pkth, void *arg)
+			    uint16_t picid, const struct tl_hdr *tl,
+			    videnc_packet_h *pkth, void *arg)
 {
 	uint8_t hdr[HDR_SIZE];
 	bool start = true;
+	size_t hdr_len;
 	int err = 0;
 
-	maxlen -= sizeof(hdr);
+	hdr_len = hdr_encode(hdr, noref, start, partid, picid, tl);
+
+	maxlen -= hdr_len;
 
 	while (len > maxlen) {
 
-		hdr_encode(hdr, noref, start, partid, picid);
+		hdr_encode(hdr, noref, start, partid, picid, tl);
 
-		err |= pkth(false, hdr, sizeof(hdr), buf, maxlen, arg);
+		err |= pkth(false, hdr, hdr_len, buf, maxlen, arg);
 
 		buf  += maxlen;
 		len  -= maxlen;
 		start = false;
 	}
 
-	hdr_encode(hdr, noref, start, partid, picid);
+	hdr_encode(hdr, noref, start, partid, picid, tl);
 
-	err |= pkth(marker, hdr, sizeof(hdr), buf, len, arg);
+	err |= pkth(marker, hdr, hdr_len, buf, len, arg);
 
 	return err;
 }
@@ -182,6 +336,8 @@ int vp8_encode(struct videnc_state *ves, bool update,
 {
 	vpx_enc_frame_flags_t flags = 0;
 	vpx_codec_iter_t iter = NULL;
+	const struct tl_frame *tlf = NULL;
+	struct tl_hdr tl, *tlp = NULL;
 	vpx_codec_err_t res;
 	vpx_image_t img;
 	int err, i;
@@ -201,6 +357,19 @@ int vp8_encode(struct videnc_state *ves, bool update,
 	if (update) {
 		/* debug("vp8: picture update\n"); */
 		flags |= VPX_EFLAG_FORCE_KF;
+		ves->tl_idx = 0;
+	}
+
+	if (ves->tlm) {
+		tlf = &ves->tlm->framev[ves->tl_idx % ves->tlm->period];
+		flags |= tlf->flags;
+
+		res = vpx_codec_control(&ves->ctx, VP8E_SET_TEMPORAL_LAYER_ID,
+					tlf->tid);
+		if (res) {
+			warning("vp8: codec ctrl: %s\n",
+				vpx_codec_err_to_string(res));
+		}
 	}
 
 	memset(&img, 0, sizeof(img));
@@ -222,6 +391,7 @@ int vp8_encode(struct videnc_state *ves, bool update,
 	}
 
 	++ves->picid;
+	++ves->tl_idx;
 
 	for (;;) {
 		bool keyframe = false, marker = true;
@@ -244,11 +414,27 @@ int vp8_encode(struct videnc_state *ves, bool update,
 		if (pkt->data.frame.partition_id >= 0)
 			partid = pkt->data.frame.partition_id;
 
+		/* a key frame restarts the layer pattern */
+		if (tlf && !tlp) {
+
+			if (keyframe)
+				ves->tl_idx = 1;
+
+			tl.tid = keyframe ? 0 : tlf->tid;
+			tl.y   = !keyframe && tlf->sync;
+
+			if (tl.tid == 0)
+				++ves->tl0picidx;
+
+			tl.tl0picidx = ves->tl0picidx;
+			tlp = &tl;
+		}
+
 		err = packetize(marker,
 				pkt->data.frame.buf,
 				pkt->data.frame.sz,
 				ves->pktsize, !keyframe, partid, ves->picid,
-				ves->pkth, ves->arg);
+				tlp, ves->pkth, ves->arg);
 		if (err)
 			return err;
 	}
@@ -17,6 +17,13 @@
  * This module implements the VP8 video codec that is compatible
  * with the WebRTC standard.
  *
+ * Configuration options:
+ *
+ \verbatim
+  vp8_threads          0       # Encoder threads, 0 is based on CPU cores
+  vp8_temporal_layers  1       # Number of temporal layers (1-3)
+ \endverbatim
+ *
  * References:
  *
  *     http://www.webmproject.org/
@@ -35,11 +42,23 @@ static struct vp8_vidcodec vp8 = {
 		.fmtp_ench = vp8_fmtp_enc,
 	},
 	.max_fs   = 3600,
+	.layers   = 1,
 };
 
 
 static int module_init(void)
 {
+	struct conf *conf = conf_cur();
+
+	(void)conf_get_u32(conf, "vp8_threads", &vp8.threads);
+	(void)conf_get_u32(conf, "vp8_temporal_layers", &vp8.layers);
+
+	if (vp8.layers < 1 || vp8.layers > 3) {
+		warning("vp8: invalid number of temporal layers (%u)\n",
+			vp8.layers);
+		return EINVAL;
+	}
+
 	vidcodec_register((struct vidcodec *)&vp8);
 
 	return 0;
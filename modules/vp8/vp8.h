@@ -7,6 +7,8 @@
 struct vp8_vidcodec {
 	struct vidcodec vc;
 	uint32_t max_fs;
+	uint32_t threads;    /* Encoder threads, 0 for automatic     */
+	uint32_t layers;     /* Number of temporal layers (1-3)      */
 };
 
 /* Encode */
@@ -3,6 +3,8 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
+#include <pthread.h>
 #include <re.h>
 #include <baresip.h>
 #include <zrtp.h>
@@ -25,6 +27,15 @@
  * Thanks:
  *
  *   Ingo Feinerer
+ *
+ * The ephemeral DH/ECDH keypairs are taken from a pool, which is
+ * refilled by a worker thread. The pool of a key
+ * type is filled after the first use, the DH-3072 pool from the start.
+ * The following option can be configured:
+ *
+ \verbatim
+  zrtp_pool_depth  4  # Keypairs per key type, 0 to disable
+ \endverbatim
  */
 
 
@@ -32,6 +43,31 @@ enum {
 	PRESZ = 36  /* Preamble size for TURN/STUN header */
 };
 
+enum {
+	POOL_DEPTH    = 4,   /* Default number of keypairs per key type */
+	POOL_TICK     = 50,  /* Idle interval of the pool thread [ms]   */
+};
+
+/** A precomputed DH/ECDH keypair */
+struct dh_key {
+	struct le le;
+	struct BigNum sv;            /**< Secret value                  */
+	struct BigNum pv;            /**< Public value                  */
+};
+
+/** Keypair pool of one public-key type */
+struct dh_pool {
+	zrtp_pk_scheme_t *scheme;
+	zrtp_status_t (*initialize)(zrtp_pk_scheme_t *self,
+				    zrtp_dh_crypto_context_t *dh_cc);
+	struct list keyl;            /**< Precomputed keypairs          */
+	bool active;                 /**< Refill this pool              */
+	uint64_t gen_us;             /**< Total generation time [us]    */
+	uint32_t genc;               /**< Number of generated keypairs  */
+	uint32_t hits;
+	uint32_t misses;
+};
+
 struct menc_sess {
 	zrtp_session_t *zrtp_session;
 };
@@ -48,6 +84,265 @@ struct menc_media {
 static zrtp_global_t *zrtp_global;
 static zrtp_config_t zrtp_config;
 
+static const uint8_t pool_typev[] = {
+	ZRTP_PKTYPE_DH2048,
+	ZRTP_PKTYPE_DH3072,
+	ZRTP_PKTYPE_EC256P,
+	ZRTP_PKTYPE_EC384P,
+	ZRTP_PKTYPE_EC521P,
+};
+
+static struct {
+	struct dh_pool poolv[ARRAY_SIZE(pool_typev)];
+	struct lock *lock;           /* libzrtp may call from its thread */
+	pthread_t thread;            /* Refills the pools               */
+	volatile bool run;
+	uint32_t depth;
+} pool;
+
+
+static void key_destructor(void *arg)
+{
+	struct dh_key *key = arg;
+
+	bnEnd(&key->sv);
+	bnEnd(&key->pv);
+}
+
+
+static struct dh_pool *pool_find(const zrtp_pk_scheme_t *scheme)
+{
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(pool.poolv); i++) {
+		if (pool.poolv[i].scheme == scheme)
+			return &pool.poolv[i];
+	}
+
+	return NULL;
+}
+
+
+/* Generate a keypair with the original libzrtp function */
+static zrtp_status_t pool_generate(struct dh_pool *p,
+				   zrtp_dh_crypto_context_t *dh_cc)
+{
+	const uint64_t t0 = realtime_clock_us();
+	zrtp_status_t s;
+
+	s = p->initialize(p->scheme, dh_cc);
+
+	lock_write_get(pool.lock);
+	p->gen_us += realtime_clock_us() - t0;
+	++p->genc;
+	lock_rel(pool.lock);
+
+	return s;
+}
+
+
+/* Replaces the initialize function of the libzrtp public-key schemes */
+static zrtp_status_t pool_initialize(zrtp_pk_scheme_t *self,
+				     zrtp_dh_crypto_context_t *dh_cc)
+{
+	struct dh_pool *p = pool_find(self);
+	struct dh_key *key;
+
+	if (!p)
+		return zrtp_status_fail;
+
+	lock_write_get(pool.lock);
+
+	p->active = true;
+
+	key = list_ledata(list_head(&p->keyl));
+	if (key) {
+		list_unlink(&key->le);
+		++p->hits;
+	}
+	else {
+		++p->misses;
+	}
+
+	lock_rel(pool.lock);
+
+	if (!key)
+		return pool_generate(p, dh_cc);
+
+	/* move the bignums to the stream */
+	dh_cc->sv = key->sv;
+	dh_cc->pv = key->pv;
+	bnBegin(&key->sv);
+	bnBegin(&key->pv);
+
+	mem_deref(key);
+
+	return zrtp_status_ok;
+}
+
+
+static bool pool_refill(struct dh_pool *p)
+{
+	zrtp_dh_crypto_context_t dh_cc;
+	struct dh_key *key;
+	bool full;
+
+	lock_write_get(pool.lock);
+	full = !p->active || list_count(&p->keyl) >= pool.depth;
+	lock_rel(pool.lock);
+
+	if (full)
+		return false;
+
+	key = mem_zalloc(sizeof(*key), key_destructor);
+	if (!key)
+		return false;
+
+	memset(&dh_cc, 0, sizeof(dh_cc));
+
+	if (zrtp_status_ok != pool_generate(p, &dh_cc)) {
+		warning("zrtp: could not generate %b keypair\n",
+			p->scheme->base.type, sizeof(p->scheme->base.type));
+		mem_deref(key);
+		return false;
+	}
+
+	key->sv = dh_cc.sv;
+	key->pv = dh_cc.pv;
+
+	lock_write_get(pool.lock);
+	list_append(&p->keyl, &key->le, key);
+	lock_rel(pool.lock);
+
+	return true;
+}
+
+
+/* The keypairs are generated outside of the main loop */
+static void *pool_thread(void *arg)
+{
+	size_t i;
+	(void)arg;
+
+	while (pool.run) {
+
+		bool more = false;
+
+		for (i=0; i<ARRAY_SIZE(pool.poolv) && pool.run; i++)
+			more |= pool_refill(&pool.poolv[i]);
+
+		/* all active pools are full */
+		if (!more)
+			sys_msleep(POOL_TICK);
+	}
+
+	return NULL;
+}
+
+
+static void pool_close(void)
+{
+	size_t i;
+
+	if (pool.run) {
+		pool.run = false;
+		pthread_join(pool.thread, NULL);
+	}
+
+	for (i=0; i<ARRAY_SIZE(pool.poolv); i++) {
+
+		struct dh_pool *p = &pool.poolv[i];
+
+		if (p->scheme)
+			p->scheme->initialize = p->initialize;
+
+		list_flush(&p->keyl);
+		memset(p, 0, sizeof(*p));
+	}
+
+	pool.lock = mem_deref(pool.lock);
+}
+
+
+static int pool_init(void)
+{
+	size_t i;
+	int err;
+
+	if (!pool.depth)
+		return 0;
+
+	err = lock_alloc(&pool.lock);
+	if (err)
+		return err;
+
+	for (i=0; i<ARRAY_SIZE(pool_typev); i++) {
+
+		struct dh_pool *p = &pool.poolv[i];
+		zrtp_pk_scheme_t *scheme;
+
+		scheme = zrtp_comp_find(ZRTP_CC_PKT, pool_typev[i],
+					zrtp_global);
+		if (!scheme || !scheme->initialize)
+			continue;
+
+		p->scheme     = scheme;
+		p->initialize = scheme->initialize;
+		p->active     = pool_typev[i] == ZRTP_PKTYPE_DH3072;
+
+		scheme->initialize = pool_initialize;
+	}
+
+	pool.run = true;
+	err = pthread_create(&pool.thread, NULL, pool_thread, NULL);
+	if (err) {
+		pool.run = false;
+		pool_close();
+		return err;
+	}
+
+	return 0;
+}
+
+
+static int pool_debug(struct re_printf *pf)
+{
+	size_t i;
+	int err = 0;
+
+	if (!pool.lock)
+		return re_hprintf(pf, "zrtp: keypair pool is disabled\n");
+
+	err |= re_hprintf(pf, "zrtp: keypair pool (depth %u)\n", pool.depth);
+
+	lock_write_get(pool.lock);
+
+	for (i=0; i<ARRAY_SIZE(pool.poolv); i++) {
+
+		const struct dh_pool *p = &pool.poolv[i];
+		uint64_t avg_us;
+
+		if (!p->scheme || !p->genc)
+			continue;
+
+		avg_us = p->gen_us / p->genc;
+
+		err |= re_hprintf(pf, "  %b: %u/%u keys, %u hits, %u misses,"
+				  " %llu us saved per call\n",
+				  p->scheme->base.type,
+				  sizeof(p->scheme->base.type),
+				  list_count(&p->keyl), pool.depth,
+				  p->hits, p->misses,
+				  p->hits + p->misses ?
+				  avg_us * p->hits / (p->hits + p->misses)
+				  : 0ULL);
+	}
+
+	lock_rel(pool.lock);
+
+	return err;
+}
+
 
 static void session_destructor(void *arg)
 {
@@ -277,7 +572,6 @@ static struct menc menc_zrtp = {
 static int verify_sas(struct re_printf *pf, void *arg)
 {
 	const struct cmd_arg *carg = arg;
-	(void)pf;
 
 	if (str_isset(carg->prm)) {
 		char rzid[ZRTP_STRING16] = "";
@@ -305,13 +599,17 @@ static int verify_sas(struct re_printf *pf, void *arg)
 			return EINVAL;
 		}
 	}
+	else {
+		/* without a ZID, show the keypair pool */
+		return pool_debug(pf);
+	}
 
 	return 0;
 }
 
 
 static const struct cmd cmdv[] = {
-	{'Z', CMD_PRM, "Verify ZRTP SAS", verify_sas },
+	{'Z', CMD_PRM, "Verify ZRTP SAS / keypair pool", verify_sas },
 };
 
 
@@ -368,6 +666,9 @@ static int module_init(void)
 		 sizeof(zrtp_config.client_id));
 	zrtp_config.lic_mode = ZRTP_LICENSE_MODE_UNLIMITED;
 
+	pool.depth = POOL_DEPTH;
+	(void)conf_get_u32(conf_cur(), "zrtp_pool_depth", &pool.depth);
+
 	zrtp_config.cb.misc_cb.on_send_packet = on_send_packet;
 	zrtp_config.cb.event_cb.on_zrtp_secure = on_zrtp_secure;
 
@@ -377,6 +678,12 @@ static int module_init(void)
 		return ENOSYS;
 	}
 
+	err = pool_init();
+	if (err) {
+		warning("zrtp: keypair pool: %m\n", err);
+		return err;
+	}
+
 	menc_register(&menc_zrtp);
 
 	debug("zrtp:  cache_file:  %s\n",
@@ -393,6 +700,7 @@ static int module_close(void)
 {
 	cmd_unregister(cmdv);
 	menc_unregister(&menc_zrtp);
+	pool_close();
 
 	if (zrtp_global) {
 		zrtp_down(zrtp_global);
@@ -21,6 +21,8 @@ static void destructor(void *arg)
 
 	list_clear(&acc->aucodecl);
 	list_clear(&acc->vidcodecl);
+	mem_deref(acc->autmpl);
+	mem_deref(acc->vidtmpl);
 	mem_deref(acc->auth_user);
 	mem_deref(acc->auth_pass);
 	for (i=0; i<ARRAY_SIZE(acc->outbound); i++)
@@ -387,6 +389,10 @@ int account_alloc(struct account **accp, const char *sipaddr)
 		if (err)
 			goto out;
 
+		/* the first call uses the cached STUN server */
+		(void)natcache_prefetch(net_af(baresip_network()),
+					acc->stun_host, acc->stun_port);
+
 		acc->mnat = mnat_find(acc->mnatid);
 		if (!acc->mnat) {
 			warning("account: medianat not found: `%s'\n",
@@ -461,6 +467,8 @@ int account_auth(const struct account *acc, char **username, char **password,
 
 struct list *account_aucodecl(const struct account *acc)
 {
+	module_lazy_load("aucodec");
+
 	return (acc && !list_isempty(&acc->aucodecl))
 		? (struct list *)&acc->aucodecl : aucodec_list();
 }
@@ -469,6 +477,8 @@ struct list *account_aucodecl(const struct account *acc)
 #ifdef USE_VIDEO
 struct list *account_vidcodecl(const struct account *acc)
 {
+	module_lazy_load("vidcodec");
+
 	return (acc && !list_isempty(&acc->vidcodecl))
 		? (struct list *)&acc->vidcodecl : vidcodec_list();
 }
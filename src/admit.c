@@ -0,0 +1,231 @@
+/**
+ * @file admit.c  Load-aware call admission control
+ *
+ * Copyright (C) 2010 - 2016 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The media load is sampled once per second, from the counters of all
+ * media streams: the number of active streams, the time spent in the
+ * encoders and decoders, and the audio buffer under/overruns. Each
+ * metric is compared to its configured maximum, and the highest ratio
+ * in percent is the load score. New incoming calls are rejected with
+ * 503 and Retry-After while the score is 100 or more.
+ */
+
+
+enum {
+	ADMIT_INTERVAL = 1000,      /**< Sampling interval [ms]          */
+};
+
+static struct {
+	struct config_call cfg;     /**< Admission thresholds            */
+	struct tmr tmr;             /**< Sampling timer                  */
+	uint64_t ts;                /**< Time of last sample [ms]        */
+	uint64_t cpu_us;            /**< Codec time of all streams [us]  */
+	uint64_t xruns;             /**< Under/overruns of all streams   */
+	uint64_t closed_us;         /**< Codec time of closed streams    */
+	uint64_t closed_xruns;      /**< Under/overruns of closed streams*/
+	uint32_t nstreams;          /**< Number of active media streams  */
+	uint32_t cpu;               /**< Codec CPU load [%]              */
+	uint32_t xrate;             /**< Under/overruns per second       */
+	uint32_t nrejected;         /**< Number of rejected calls        */
+} admit;
+
+
+static bool admit_enabled(void)
+{
+	return admit.cfg.max_streams || admit.cfg.max_cpu ||
+		admit.cfg.max_xruns;
+}
+
+
+/* Sum the counters of all active media streams */
+static void stream_totals(uint32_t *nstreams, uint64_t *cpu_us,
+			  uint64_t *xruns)
+{
+	struct le *le;
+
+	*nstreams = 0;
+	*cpu_us   = admit.closed_us;
+	*xruns    = admit.closed_xruns;
+
+	for (le = list_head(uag_list()); le; le = le->next) {
+		struct le *lec;
+
+		for (lec = list_head(ua_calls(le->data)); lec;
+		     lec = lec->next) {
+			struct le *les;
+
+			les = list_head(call_streaml(lec->data));
+			for (; les; les = les->next) {
+				uint64_t us = 0;
+				uint32_t n = 0;
+
+				stream_load_get(les->data, &us, &n);
+
+				++*nstreams;
+				*cpu_us += us;
+				*xruns  += n;
+			}
+		}
+	}
+}
+
+
+static void tmr_handler(void *arg)
+{
+	const uint64_t now = tmr_jiffies();
+	uint64_t cpu_us, xruns, dt;
+
+	(void)arg;
+
+	tmr_start(&admit.tmr, ADMIT_INTERVAL, tmr_handler, NULL);
+
+	stream_totals(&admit.nstreams, &cpu_us, &xruns);
+
+	dt = now - admit.ts;
+	if (admit.ts && dt) {
+		admit.cpu   = (uint32_t)((cpu_us - admit.cpu_us) / (dt * 10));
+		admit.xrate = (uint32_t)((xruns - admit.xruns) * 1000 / dt);
+	}
+
+	admit.ts     = now;
+	admit.cpu_us = cpu_us;
+	admit.xruns  = xruns;
+}
+
+
+static uint32_t ratio(uint32_t val, uint32_t max)
+{
+	return max ? val * 100 / max : 0;
+}
+
+
+/**
+ * Get the current load score of the media processing
+ *
+ * @return Load score in percent of the configured maximum
+ */
+uint32_t admit_score(void)
+{
+	uint32_t score;
+
+	score = ratio(admit.nstreams, admit.cfg.max_streams);
+	score = max(score, ratio(admit.cpu, admit.cfg.max_cpu));
+	score = max(score, ratio(admit.xrate, admit.cfg.max_xruns));
+
+	return score;
+}
+
+
+/**
+ * Check if a new incoming call can be admitted
+ *
+ * @param retry_after Returned number of seconds before retrying
+ *
+ * @return True to admit the call, false to reject it
+ */
+bool admit_check(uint32_t *retry_after)
+{
+	uint64_t cpu_us, xruns;
+
+	if (!admit_enabled())
+		return true;
+
+	/* the number of streams is always current */
+	stream_totals(&admit.nstreams, &cpu_us, &xruns);
+
+	if (admit_score() < 100)
+		return true;
+
+	++admit.nrejected;
+
+	if (retry_after)
+		*retry_after = admit.cfg.retry_after;
+
+	return false;
+}
+
+
+/**
+ * Keep the counters of a media stream that is closed, so that
+ * the totals do not decrease
+ *
+ * @param strm Media stream
+ */
+void admit_stream_close(const struct stream *strm)
+{
+	uint64_t us = 0;
+	uint32_t n = 0;
+
+	if (!strm)
+		return;
+
+	stream_load_get(strm, &us, &n);
+
+	admit.closed_us    += us;
+	admit.closed_xruns += n;
+}
+
+
+int admit_init(const struct config_call *cfg)
+{
+	if (!cfg)
+		return EINVAL;
+
+	memset(&admit, 0, sizeof(admit));
+	admit.cfg = *cfg;
+
+	if (admit_enabled()) {
+		info("admit: max %u streams, %u%% cpu, %u xruns/sec\n",
+		     cfg->max_streams, cfg->max_cpu, cfg->max_xruns);
+
+		tmr_start(&admit.tmr, ADMIT_INTERVAL, tmr_handler, NULL);
+	}
+
+	return 0;
+}
+
+
+void admit_close(void)
+{
+	tmr_cancel(&admit.tmr);
+}
+
+
+/**
+ * Print the status of the call admission control
+ *
+ * @param pf     Print handler for debug output
+ * @param unused Unused parameter
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int admit_debug(struct re_printf *pf, void *unused)
+{
+	int err;
+
+	(void)unused;
+
+	err  = re_hprintf(pf, "--- Call admission ---\n");
+
+	if (!admit_enabled())
+		return err | re_hprintf(pf, " disabled\n");
+
+	err |= re_hprintf(pf, " score:    %u%%\n", admit_score());
+	err |= re_hprintf(pf, " streams:  %u (max %u)\n",
+			  admit.nstreams, admit.cfg.max_streams);
+	err |= re_hprintf(pf, " cpu:      %u%% (max %u%%)\n",
+			  admit.cpu, admit.cfg.max_cpu);
+	err |= re_hprintf(pf, " xruns:    %u/sec (max %u)\n",
+			  admit.xrate, admit.cfg.max_xruns);
+	err |= re_hprintf(pf, " rejected: %u calls\n", admit.nrejected);
+
+	return err;
+}
@@ -23,6 +23,7 @@ void aucodec_register(struct aucodec *ac)
 		return;
 
 	list_append(&aucodecl, &ac->le, ac);
+	sdp_tmpl_flush();
 
 	info("aucodec: %s/%u/%u\n", ac->name, ac->srate, ac->ch);
 }
@@ -39,6 +40,7 @@ void aucodec_unregister(struct aucodec *ac)
 		return;
 
 	list_unlink(&ac->le);
+	sdp_tmpl_flush();
 }
 
 
@@ -47,6 +49,8 @@ const struct aucodec *aucodec_find(const char *name, uint32_t srate,
 {
 	struct le *le;
 
+	module_lazy_load("aucodec");
+
 	for (le=aucodecl.head; le; le=le->next) {
 
 		struct aucodec *ac = le->data;
@@ -53,7 +53,10 @@
  */
 
 enum {
-	AUDIO_SAMPSZ    = 3*1920  /* Max samples, 48000Hz 2ch at 60ms */
+	AUDIO_SAMPSZ    = 3*1920, /* Max samples, 48000Hz 2ch at 60ms */
+	AUDIO_PTIME_MAX = 60,     /* Max packet time in [ms]          */
+	AUDIO_PTIME_RX  = 120,    /* Max packet time received [ms]    */
+	AUDIO_MBSZ      = STREAM_PRESZ + 4096,
 };
 
 
@@ -80,6 +83,7 @@ struct autx {
 	const struct aucodec *ac;     /**< Current audio encoder           */
 	struct auenc_state *enc;      /**< Audio encoder state (optional)  */
 	struct aubuf *aubuf;          /**< Packetize outgoing stream       */
+	size_t aubuf_maxsz;           /**< Maximum size of audio buffer    */
 	struct auresamp resamp;       /**< Optional resampler for DSP      */
 	struct list filtl;            /**< Audio filters in encoding order */
 	struct mbuf *mb;              /**< Buffer for outgoing RTP packets */
@@ -87,6 +91,8 @@ struct autx {
 	int16_t *sampv;               /**< Sample buffer                   */
 	int16_t *sampv_rs;            /**< Sample buffer for resampler     */
 	uint32_t ptime;               /**< Packet time for sending         */
+	uint32_t ptime_next;          /**< Packet time set by the encoder  */
+	struct lock *lock;            /**< Lock for ptime_next             */
 	uint32_t ts;                  /**< Timestamp for outgoing RTP      */
 	uint32_t ts_tel;              /**< Timestamp for Telephony Events  */
 	size_t psize;                 /**< Packet size for sending         */
@@ -127,13 +133,16 @@ struct aurx {
 	const struct aucodec *ac;     /**< Current audio decoder           */
 	struct audec_state *dec;      /**< Audio decoder state (optional)  */
 	struct aubuf *aubuf;          /**< Incoming audio buffer           */
+	size_t aubuf_maxsz;           /**< Maximum size of audio buffer    */
 	struct auresamp resamp;       /**< Optional resampler for DSP      */
 	struct list filtl;            /**< Audio filters in decoding order */
 	char device[64];              /**< Audio player device name        */
 	int16_t *sampv;               /**< Sample buffer                   */
 	int16_t *sampv_rs;            /**< Sample buffer for resampler     */
+	size_t sampvsz;               /**< Size of sample buffer           */
 	uint32_t ptime;               /**< Packet time for receiving       */
 	int pt;                       /**< Payload type for incoming RTP   */
+	bool playing;                 /**< Audio buffer had enough samples */
 };
 
 
@@ -205,6 +214,7 @@ static void audio_destructor(void *arg)
 	stop_rx(&a->rx);
 
 	mem_deref(a->tx.enc);
+	mem_deref(a->tx.lock);
 	mem_deref(a->rx.dec);
 	mem_deref(a->tx.aubuf);
 	mem_deref(a->tx.mb);
@@ -238,6 +248,26 @@ static inline uint32_t calc_nsamp(uint32_t srate, uint8_t channels,
 }
 
 
+/**
+ * Check if writing to an audio buffer overruns it
+ *
+ * The audio buffer drops its oldest frame on overrun, without telling
+ * the writer. The writer is the only one adding samples, so a frame
+ * that fits now still fits when it is written, even if the reader runs
+ * in between.
+ *
+ * @param ab    Audio buffer
+ * @param maxsz Maximum size of the audio buffer in [bytes]
+ * @param sz    Number of bytes to write
+ *
+ * @return True if the write overruns the buffer, otherwise false
+ */
+static inline bool aubuf_overrun(struct aubuf *ab, size_t maxsz, size_t sz)
+{
+	return aubuf_cur_size(ab) + sz > maxsz;
+}
+
+
 /**
  * Get the DSP samplerate for an audio-codec (exception for G.722 and MPA)
  */
@@ -281,18 +311,18 @@ static bool aucodec_equal(const struct aucodec *a, const struct aucodec *b)
 }
 
 
-static int add_audio_codec(struct audio *a, struct sdp_media *m,
-			   struct aucodec *ac)
+static int add_audio_codec(struct sdp_tmpl *tmpl,
+			   const struct config_audio *cfg, struct aucodec *ac)
 {
-	if (!in_range(&a->cfg.srate, get_srate(ac))) {
+	if (!in_range(&cfg->srate, get_srate(ac))) {
 		debug("audio: skip %uHz codec (audio range %uHz - %uHz)\n",
-		      get_srate(ac), a->cfg.srate.min, a->cfg.srate.max);
+		      get_srate(ac), cfg->srate.min, cfg->srate.max);
 		return 0;
 	}
 
-	if (!in_range(&a->cfg.channels, get_ch(ac))) {
+	if (!in_range(&cfg->channels, get_ch(ac))) {
 		debug("audio: skip codec with %uch (audio range %uch-%uch)\n",
-		      get_ch(ac), a->cfg.channels.min, a->cfg.channels.max);
+		      get_ch(ac), cfg->channels.min, cfg->channels.max);
 		return 0;
 	}
 
@@ -301,9 +331,49 @@ static int add_audio_codec(struct audio *a, struct sdp_media *m,
 		return EINVAL;
 	}
 
-	return sdp_format_add(NULL, m, false, ac->pt, ac->name, ac->crate,
-			      ac->ch, ac->fmtp_ench, ac->fmtp_cmph, ac, false,
-			      "%s", ac->fmtp);
+	return sdp_tmpl_add(tmpl, ac->pt, ac->name, ac->crate, ac->ch,
+			    ac->fmtp_ench, ac->fmtp_cmph, ac, ac->fmtp);
+}
+
+
+/*
+ * Get the SDP template with the audio codecs that fit the configured
+ * samplerate and channels. The cached template is updated if it is
+ * no longer valid.
+ */
+static int audio_sdp_tmpl(struct sdp_tmpl **tmplp,
+			  const struct config_audio *cfg,
+			  const struct list *aucodecl)
+{
+	const uint32_t rangev[4] = {
+		cfg->srate.min, cfg->srate.max,
+		cfg->channels.min, cfg->channels.max
+	};
+	const uint32_t key = hash_joaat((const uint8_t *)rangev,
+					sizeof(rangev));
+	struct sdp_tmpl *tmpl;
+	struct le *le;
+	int err;
+
+	if (sdp_tmpl_isvalid(*tmplp, aucodecl, key))
+		return 0;
+
+	err = sdp_tmpl_alloc(&tmpl, aucodecl, key);
+	if (err)
+		return err;
+
+	for (le = list_head(aucodecl); le; le = le->next) {
+		err = add_audio_codec(tmpl, cfg, le->data);
+		if (err) {
+			mem_deref(tmpl);
+			return err;
+		}
+	}
+
+	mem_deref(*tmplp);
+	*tmplp = tmpl;
+
+	return 0;
 }
 
 
@@ -322,6 +392,7 @@ static void encode_rtp_send(struct audio *a, struct autx *tx,
 {
 	size_t frame_size;  /* number of samples per channel */
 	size_t sampc_rtp;
+	uint64_t t0;
 	size_t len;
 	int err;
 
@@ -331,7 +402,9 @@ static void encode_rtp_send(struct audio *a, struct autx *tx,
 	tx->mb->pos = tx->mb->end = STREAM_PRESZ;
 	len = mbuf_get_space(tx->mb);
 
+	t0 = realtime_clock_us();
 	err = tx->ac->ench(tx->enc, mbuf_buf(tx->mb), &len, sampv, sampc);
+	stream_cpu_add(a->strm, true, realtime_clock_us() - t0);
 	if ((err & 0xffff0000) == 0x00010000) {
 		/* MPA needs some special treatment here */
 		tx->ts = err & 0xffff;
@@ -372,6 +445,24 @@ static void encode_rtp_send(struct audio *a, struct autx *tx,
 }
 
 
+/*
+ * Apply a packet time change from the encoder, between two packets.
+ * The packet size is only used by the thread that sends the packets.
+ */
+static void tx_ptime_apply(struct autx *tx)
+{
+	lock_write_get(tx->lock);
+
+	if (tx->ptime_next) {
+		tx->psize = tx->psize * tx->ptime_next / tx->ptime;
+		tx->ptime = tx->ptime_next;
+		tx->ptime_next = 0;
+	}
+
+	lock_rel(tx->lock);
+}
+
+
 /*
  * @note This function has REAL-TIME properties
  */
@@ -415,6 +506,8 @@ static void poll_aubuf_tx(struct audio *a)
 
 	/* Encode and send */
 	encode_rtp_send(a, tx, sampv, sampc);
+
+	tx_ptime_apply(tx);
 }
 
 
@@ -424,6 +517,9 @@ static void check_telev(struct audio *a, struct autx *tx)
 	bool marker = false;
 	int err;
 
+	if (!a->telev || !tx->mb)
+		return;
+
 	tx->mb->pos = tx->mb->end = STREAM_PRESZ;
 
 	err = telev_poll(a->telev, &marker, tx->mb);
@@ -461,7 +557,17 @@ static void check_telev(struct audio *a, struct autx *tx)
  */
 static void auplay_write_handler(int16_t *sampv, size_t sampc, void *arg)
 {
-	struct aurx *rx = arg;
+	struct audio *a = arg;
+	struct aurx *rx = &a->rx;
+
+	/* count an underrun once, not every packet of silence */
+	if (aubuf_cur_size(rx->aubuf) >= sampc * 2) {
+		rx->playing = true;
+	}
+	else if (rx->playing) {
+		rx->playing = false;
+		stream_xrun(a->strm);
+	}
 
 	aubuf_read_samp(rx->aubuf, sampv, sampc);
 }
@@ -486,6 +592,9 @@ static void ausrc_read_handler(const int16_t *sampv, size_t sampc, void *arg)
 	if (tx->muted)
 		memset((void *)sampv, 0, sampc*2);
 
+	if (aubuf_overrun(tx->aubuf, tx->aubuf_maxsz, sampc*2))
+		stream_xrun(a->strm);
+
 	(void)aubuf_write_samp(tx->aubuf, sampv, sampc);
 
 	if (a->cfg.txmode == AUDIO_MODE_POLL) {
@@ -534,11 +643,24 @@ static int pt_handler(struct audio *a, uint8_t pt_old, uint8_t pt_new)
 }
 
 
+/* The telephony events state is allocated when first used */
+static int audio_telev(struct audio *a)
+{
+	if (a->telev)
+		return 0;
+
+	return telev_alloc(&a->telev, TELEV_PTIME);
+}
+
+
 static void handle_telev(struct audio *a, struct mbuf *mb)
 {
 	int event, digit;
 	bool end;
 
+	if (audio_telev(a))
+		return;
+
 	if (telev_recv(a->telev, mb, &event, &end))
 		return;
 
@@ -548,23 +670,28 @@ static void handle_telev(struct audio *a, struct mbuf *mb)
 }
 
 
-static int aurx_stream_decode(struct aurx *rx, struct mbuf *mb)
+static int aurx_stream_decode(struct aurx *rx, struct stream *strm,
+			      struct mbuf *mb)
 {
-	size_t sampc = AUDIO_SAMPSZ;
+	size_t sampc = rx->sampvsz;
 	int16_t *sampv;
 	struct le *le;
+	uint64_t t0;
 	int err = 0;
 
 	/* No decoder set */
-	if (!rx->ac)
+	if (!rx->ac || !rx->sampv)
 		return 0;
 
+	t0 = realtime_clock_us();
+
 	if (mbuf_get_left(mb)) {
 		err = rx->ac->dech(rx->dec, rx->sampv, &sampc,
 				   mbuf_buf(mb), mbuf_get_left(mb));
 	}
 	else if (rx->ac->plch) {
 		sampc = rx->ac->srate * rx->ac->ch * rx->ptime / 1000;
+		sampc = min(sampc, rx->sampvsz);
 
 		err = rx->ac->plch(rx->dec, rx->sampv, &sampc);
 	}
@@ -573,6 +700,8 @@ static int aurx_stream_decode(struct aurx *rx, struct mbuf *mb)
 		sampc = 0;
 	}
 
+	stream_cpu_add(strm, false, realtime_clock_us() - t0);
+
 	if (err) {
 		warning("audio: %s codec decode %u bytes: %m\n",
 			rx->ac->name, mbuf_get_left(mb), err);
@@ -606,6 +735,9 @@ static int aurx_stream_decode(struct aurx *rx, struct mbuf *mb)
 		sampc = sampc_rs;
 	}
 
+	if (aubuf_overrun(rx->aubuf, rx->aubuf_maxsz, sampc*2))
+		stream_xrun(strm);
+
 	err = aubuf_write_samp(rx->aubuf, sampv, sampc);
 	if (err)
 		goto out;
@@ -652,7 +784,91 @@ static void stream_recv_handler(const struct rtp_header *hdr,
 	}
 
  out:
-	(void)aurx_stream_decode(&a->rx, mb);
+	(void)aurx_stream_decode(&a->rx, a->strm, mb);
+}
+
+
+/*
+ * The encoder may adapt to the packet loss and jitter reported by
+ * the peer, and may change the packet time within the peer's maxptime
+ */
+static void encoder_feedback(struct audio *a, const struct rtcp_rr *rr)
+{
+	struct autx *tx = &a->tx;
+	struct auenc_fb fb;
+	const char *attr;
+	uint32_t ptime_max = AUDIO_PTIME_MAX;
+	uint32_t ptime;
+	int err;
+
+	if (!tx->ac || !tx->ac->encfbh || !tx->enc)
+		return;
+
+	lock_read_get(tx->lock);
+	ptime = tx->ptime_next ? tx->ptime_next : tx->ptime;
+	lock_rel(tx->lock);
+
+	attr = sdp_media_rattr(stream_sdpmedia(a->strm), "maxptime");
+	if (attr && atoi(attr) > 0)
+		ptime_max = min(ptime_max, (uint32_t)atoi(attr));
+
+	fb.loss      = rr->fraction * 100 / 256;
+	fb.jitter    = (uint32_t)(rr->jitter * 1000ULL / tx->ac->crate);
+	fb.ptime     = ptime;
+	fb.ptime_max = ptime_max;
+
+	err = tx->ac->encfbh(tx->enc, &fb);
+	if (err || !fb.ptime || fb.ptime == ptime)
+		return;
+
+	/* the encoder must choose within the limit */
+	if (fb.ptime > ptime_max) {
+		warning("audio: encoder ptime %ums exceeds maxptime %ums\n",
+			fb.ptime, ptime_max);
+		return;
+	}
+
+	info("audio: encoder changed ptime_tx %ums -> %ums"
+	     " (loss %u%%, jitter %ums)\n",
+	     ptime, fb.ptime, fb.loss, fb.jitter);
+
+	/* the transmit thread applies it between two packets */
+	lock_write_get(tx->lock);
+	tx->ptime_next = fb.ptime;
+	lock_rel(tx->lock);
+}
+
+
+static void stream_rtcp_handler(struct rtcp_msg *msg, void *arg)
+{
+	struct audio *a = arg;
+	const struct rtcp_rr *rrv;
+	uint32_t ssrc;
+	int i;
+
+	switch (msg->hdr.pt) {
+
+	case RTCP_SR:
+		rrv = msg->r.sr.rrv;
+		break;
+
+	case RTCP_RR:
+		rrv = msg->r.rr.rrv;
+		break;
+
+	default:
+		return;
+	}
+
+	ssrc = rtp_sess_ssrc(a->strm->rtp);
+
+	for (i=0; i<msg->hdr.count; i++) {
+
+		if (rrv[i].ssrc == ssrc) {
+			encoder_feedback(a, &rrv[i]);
+			break;
+		}
+	}
 }
 
 
@@ -679,12 +895,13 @@ int audio_alloc(struct audio **ap, const struct config *cfg,
 		const struct mnat *mnat, struct mnat_sess *mnat_sess,
 		const struct menc *menc, struct menc_sess *menc_sess,
 		uint32_t ptime, const struct list *aucodecl,
+		struct sdp_tmpl **tmplp,
 		audio_event_h *eventh, audio_err_h *errh, void *arg)
 {
+	struct sdp_tmpl *tmpl = NULL;
 	struct audio *a;
 	struct autx *tx;
 	struct aurx *rx;
-	struct le *le;
 	int err;
 
 	if (!ap || !cfg)
@@ -704,7 +921,7 @@ int audio_alloc(struct audio **ap, const struct config *cfg,
 			   "audio", label,
 			   mnat, mnat_sess, menc, menc_sess,
 			   call_localuri(call),
-			   stream_recv_handler, NULL, a);
+			   stream_recv_handler, stream_rtcp_handler, a);
 	if (err)
 		goto out;
 
@@ -718,28 +935,28 @@ int audio_alloc(struct audio **ap, const struct config *cfg,
 		goto out;
 
 	/* Audio codecs */
-	for (le = list_head(aucodecl); le; le = le->next) {
-		err = add_audio_codec(a, stream_sdpmedia(a->strm), le->data);
-		if (err)
-			goto out;
-	}
+	if (!tmplp)
+		tmplp = &tmpl;
 
-	tx->mb = mbuf_alloc(STREAM_PRESZ + 4096);
-	tx->sampv = mem_zalloc(AUDIO_SAMPSZ * 2, NULL);
-	rx->sampv = mem_zalloc(AUDIO_SAMPSZ * 2, NULL);
-	if (!tx->mb || !tx->sampv || !rx->sampv) {
-		err = ENOMEM;
+	err = audio_sdp_tmpl(tmplp, &a->cfg, aucodecl);
+	if (err)
 		goto out;
-	}
 
-	err = telev_alloc(&a->telev, TELEV_PTIME);
+	err = sdp_tmpl_apply(*tmplp, stream_sdpmedia(a->strm));
 	if (err)
 		goto out;
 
+	/* NOTE: sample buffers and telephony events are allocated
+	 *       when first needed
+	 */
 	err = add_telev_codec(a);
 	if (err)
 		goto out;
 
+	err = lock_alloc(&tx->lock);
+	if (err)
+		goto out;
+
 	auresamp_init(&tx->resamp);
 	str_ncpy(tx->device, a->cfg.src_dev, sizeof(tx->device));
 	tx->ptime  = ptime;
@@ -759,6 +976,8 @@ int audio_alloc(struct audio **ap, const struct config *cfg,
 		tmr_init(&tx->u.tmr);
 
  out:
+	mem_deref(tmpl);
+
 	if (err)
 		mem_deref(a);
 	else
@@ -1002,11 +1221,13 @@ static int start_player(struct aurx *rx, struct audio *a)
 			err = aubuf_alloc(&rx->aubuf, psize * 1, psize * 8);
 			if (err)
 				return err;
+
+			rx->aubuf_maxsz = psize * 8;
 		}
 
 		err = auplay_alloc(&rx->auplay, a->cfg.play_mod,
 				   &prm, rx->device,
-				   auplay_write_handler, rx);
+				   auplay_write_handler, a);
 		if (err) {
 			warning("audio: start_player failed (%s.%s): %m\n",
 				a->cfg.play_mod, rx->device, err);
@@ -1068,6 +1289,14 @@ static int start_source(struct autx *tx, struct audio *a)
 
 		struct ausrc_prm prm;
 
+		/* The transmit thread may outlive an encoder change,
+		   so this buffer is allocated once with the max size */
+		if (!tx->sampv) {
+			tx->sampv = mem_zalloc(AUDIO_SAMPSZ * 2, NULL);
+			if (!tx->sampv)
+				return ENOMEM;
+		}
+
 		prm.srate      = srate_dsp;
 		prm.ch         = channels_dsp;
 		prm.ptime      = tx->ptime;
@@ -1079,6 +1308,8 @@ static int start_source(struct autx *tx, struct audio *a)
 					  tx->psize * 30);
 			if (err)
 				return err;
+
+			tx->aubuf_maxsz = tx->psize * 30;
 		}
 
 		err = ausrc_alloc(&tx->ausrc, NULL, a->cfg.src_mod,
@@ -1211,6 +1442,12 @@ int audio_encoder_set(struct audio *a, const struct aucodec *ac,
 		tx->ac = ac;
 	}
 
+	if (!tx->mb) {
+		tx->mb = mbuf_alloc(AUDIO_MBSZ);
+		if (!tx->mb)
+			return ENOMEM;
+	}
+
 	if (ac->encupdh) {
 		struct auenc_param prm;
 
@@ -1234,11 +1471,34 @@ int audio_encoder_set(struct audio *a, const struct aucodec *ac,
 }
 
 
+/*
+ * The longest packet that the peer may send. Codecs such as Opus and
+ * G.711 allow up to 120 ms frames, and the peer may ask for more.
+ */
+static uint32_t rx_ptime_max(const struct audio *a)
+{
+	const struct sdp_media *m = stream_sdpmedia(a->strm);
+	uint32_t ptime = max((uint32_t)AUDIO_PTIME_RX, a->rx.ptime);
+	const char *attr;
+
+	attr = sdp_media_rattr(m, "ptime");
+	if (attr && atoi(attr) > 0)
+		ptime = max(ptime, (uint32_t)atoi(attr));
+
+	attr = sdp_media_rattr(m, "maxptime");
+	if (attr && atoi(attr) > 0)
+		ptime = max(ptime, (uint32_t)atoi(attr));
+
+	return ptime;
+}
+
+
 int audio_decoder_set(struct audio *a, const struct aucodec *ac,
 		      int pt_rx, const char *params)
 {
 	struct aurx *rx;
 	bool reset = false;
+	uint32_t sampc;
 	int err = 0;
 
 	if (!a || !ac)
@@ -1258,6 +1518,20 @@ int audio_decoder_set(struct audio *a, const struct aucodec *ac,
 		rx->dec = mem_deref(rx->dec);
 	}
 
+	/* Sample buffer sized for the longest packet of the decoder */
+	sampc = calc_nsamp(get_srate(ac), get_ch(ac), rx_ptime_max(a));
+	if (sampc > rx->sampvsz) {
+
+		rx->sampvsz = sampc;
+
+		mem_deref(rx->sampv);
+		rx->sampv = mem_zalloc(rx->sampvsz * 2, NULL);
+		if (!rx->sampv) {
+			rx->sampvsz = 0;
+			return ENOMEM;
+		}
+	}
+
 	if (ac->decupdh) {
 		err = ac->decupdh(&rx->dec, ac, params);
 		if (err) {
@@ -1304,6 +1578,35 @@ void audio_encoder_cycle(struct audio *audio)
 }
 
 
+/**
+ * Add the memory usage of an audio object
+ *
+ * @param a  Audio object
+ * @param ms Memory statistics to add to
+ */
+void audio_memstat(const struct audio *a, struct call_memstat *ms)
+{
+	if (!a || !ms)
+		return;
+
+	ms->audio += sizeof(*a);
+
+	if (a->tx.sampv)
+		ms->aubuf += AUDIO_SAMPSZ * 2;
+	if (a->tx.sampv_rs)
+		ms->aubuf += AUDIO_SAMPSZ * 2;
+	if (a->rx.sampv)
+		ms->aubuf += a->rx.sampvsz * 2;
+	if (a->rx.sampv_rs)
+		ms->aubuf += AUDIO_SAMPSZ * 2;
+	if (a->tx.mb)
+		ms->aubuf += a->tx.mb->size;
+
+	ms->aubuf += aubuf_cur_size(a->tx.aubuf);
+	ms->aubuf += aubuf_cur_size(a->rx.aubuf);
+}
+
+
 struct stream *audio_strm(const struct audio *a)
 {
 	return a ? a->strm : NULL;
@@ -1317,6 +1620,10 @@ int audio_send_digit(struct audio *a, char key)
 	if (!a)
 		return EINVAL;
 
+	err = audio_telev(a);
+	if (err)
+		return err;
+
 	if (key > 0) {
 		info("audio: send DTMF digit: '%c'\n", key);
 		err = telev_send(a->telev, telev_digit2code(key), false);
@@ -1490,7 +1797,7 @@ int audio_set_player(struct audio *au, const char *mod, const char *device)
 	rx->auplay = mem_deref(rx->auplay);
 
 	err = auplay_alloc(&rx->auplay, mod, &rx->auplay_prm, device,
-			   auplay_write_handler, rx);
+			   auplay_write_handler, au);
 	if (err) {
 		warning("audio: set_player failed (%s.%s): %m\n",
 			mod, device, err);
@@ -65,6 +65,8 @@ const struct auplay *auplay_find(const char *name)
 {
 	struct le *le;
 
+	module_lazy_load("auplay");
+
 	for (le=auplayl.head; le; le=le->next) {
 
 		struct auplay *ap = le->data;
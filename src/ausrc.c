@@ -64,6 +64,8 @@ const struct ausrc *ausrc_find(const char *name)
 {
 	struct le *le;
 
+	module_lazy_load("ausrc");
+
 	for (le=ausrcl.head; le; le=le->next) {
 
 		struct ausrc *as = le->data;
@@ -42,6 +42,7 @@ enum state {
 struct call {
 	MAGIC_DECL                /**< Magic number for debugging           */
 	struct le le;             /**< Linked list element                  */
+	struct le he;             /**< Hash element, indexed by Call-ID     */
 	struct ua *ua;            /**< SIP User-agent                       */
 	struct account *acc;      /**< Account (ref.)                       */
 	struct sipsess *sess;     /**< SIP Session                          */
@@ -69,6 +70,10 @@ struct call {
 	bool on_hold;             /**< True if call is on hold              */
 	struct mnat_sess *mnats;  /**< Media NAT session                    */
 	bool mnat_wait;           /**< Waiting for MNAT to establish        */
+	bool mnat_update;         /**< Re-INVITE when established           */
+	bool trickle_ice;         /**< Trickle ICE is used                  */
+	bool peer_trickle;        /**< Peer receives Trickle ICE INFOs      */
+	struct mbuf *trickle;     /**< Pending Trickle ICE SDP fragment     */
 	struct menc_sess *mencs;  /**< Media encryption session state       */
 	int af;                   /**< Preferred Address Family             */
 	uint16_t scode;           /**< Termination status code              */
@@ -247,6 +252,13 @@ static void mnat_handler(int err, uint16_t scode, const char *reason,
 
 	/* Re-INVITE */
 	if (!call->mnat_wait) {
+
+		/* the INVITE was sent early for Trickle ICE */
+		if (call->state != STATE_ESTABLISHED) {
+			call->mnat_update = true;
+			return;
+		}
+
 		info("call: medianat established -- sending Re-INVITE\n");
 		(void)call_modify(call);
 		return;
@@ -270,6 +282,105 @@ static void mnat_handler(int err, uint16_t scode, const char *reason,
 }
 
 
+static void trickle_resp_handler(int err, const struct sip_msg *msg,
+				 void *arg)
+{
+	(void)arg;
+
+	if (err)
+		warning("call: trickle ice: INFO failed (%m)\n", err);
+	else if (msg && msg->scode >= 300)
+		warning("call: trickle ice: INFO failed: %u %r\n",
+			msg->scode, &msg->reason);
+}
+
+
+/* Trickle ICE INFO package (RFC 8840 and RFC 6086) */
+static int send_trickle(struct call *call, struct mbuf *frag)
+{
+	int err;
+
+	err = sip_req_send_dlg(call->ua, sipsess_dialog(call->sess), "INFO",
+			       trickle_resp_handler, NULL,
+			       "Info-Package: trickle-ice\r\n"
+			       "Content-Type: application/"
+			       "trickle-ice-sdpfrag\r\n"
+			       "Content-Disposition: Info-Package\r\n"
+			       "Content-Length: %zu\r\n"
+			       "\r\n"
+			       "%b",
+			       mbuf_get_left(frag),
+			       mbuf_buf(frag), mbuf_get_left(frag));
+	if (err) {
+		warning("call: trickle ice: INFO not sent (%m)\n", err);
+	}
+
+	return err;
+}
+
+
+static bool recv_info_handler(const struct sip_hdr *hdr,
+			      const struct sip_msg *msg, void *arg)
+{
+	const char *p = hdr->val.p, *end = hdr->val.p + hdr->val.l;
+	struct pl pkg;
+
+	(void)msg;
+	(void)arg;
+
+	while (!re_regex(p, end - p, "[^ \t,]+", &pkg)) {
+
+		if (!pl_strcasecmp(&pkg, "trickle-ice"))
+			return true;
+
+		p = pkg.p + pkg.l;
+	}
+
+	return false;
+}
+
+
+/* Check if the peer lists trickle-ice in its Recv-Info */
+static bool peer_recv_trickle(const struct sip_msg *msg)
+{
+	return NULL != sip_msg_xhdr_apply(msg, true, "Recv-Info",
+					  recv_info_handler, NULL);
+}
+
+
+static const char *recv_info(const struct call *call)
+{
+	return call->trickle_ice ? "Recv-Info: trickle-ice\r\n" : "";
+}
+
+
+/*
+ * New local candidates from the medianat, they are sent in a SIP INFO
+ * request. The INFO can only be sent within an established dialog, so
+ * the latest fragment is kept until then. If the peer does not receive
+ * Trickle ICE INFOs, all candidates are sent in a Re-INVITE instead.
+ */
+static int mnat_trickle_handler(struct mbuf *frag, void *arg)
+{
+	struct call *call = arg;
+	MAGIC_CHECK(call);
+
+	if (call->state != STATE_ESTABLISHED) {
+		mem_deref(call->trickle);
+		call->trickle = mem_ref(frag);
+		return 0;
+	}
+
+	if (!call->peer_trickle) {
+		info("call: peer does not receive trickle-ice"
+		     " -- sending Re-INVITE\n");
+		return call_modify(call);
+	}
+
+	return send_trickle(call, frag);
+}
+
+
 static int update_media(struct call *call)
 {
 	const struct sdp_format *sc;
@@ -347,6 +458,7 @@ static void call_destructor(void *arg)
 
 	call_stream_stop(call);
 	list_unlink(&call->le);
+	hash_unlink(&call->he);
 	tmr_cancel(&call->tmr_dtmf);
 
 	mem_deref(call->sess);
@@ -361,6 +473,7 @@ static void call_destructor(void *arg)
 #endif
 	mem_deref(call->sdp);
 	mem_deref(call->mnats);
+	mem_deref(call->trickle);
 	mem_deref(call->mencs);
 	mem_deref(call->sub);
 	mem_deref(call->not);
@@ -504,6 +617,21 @@ int call_alloc(struct call **callp, const struct config *cfg, struct list *lst,
 			warning("call: medianat session: %m\n", err);
 			goto out;
 		}
+
+		if (acc->mnat->trickleh) {
+			err = acc->mnat->trickleh(call->mnats,
+						  mnat_trickle_handler, call);
+			if (err == ENOTSUP) {
+				err = 0;
+			}
+			else if (err) {
+				warning("call: medianat trickle: %m\n", err);
+				goto out;
+			}
+			else {
+				call->trickle_ice = true;
+			}
+		}
 	}
 	call->mnat_wait = true;
 
@@ -525,6 +653,7 @@ int call_alloc(struct call **callp, const struct config *cfg, struct list *lst,
 			  call->sdp, ++label,
 			  acc->mnat, call->mnats, acc->menc, call->mencs,
 			  acc->ptime, account_aucodecl(call->acc),
+			  &acc->autmpl,
 			  audio_event_handler, audio_error_handler, call);
 	if (err)
 		goto out;
@@ -544,6 +673,7 @@ int call_alloc(struct call **callp, const struct config *cfg, struct list *lst,
 				  acc->menc, call->mencs,
 				  "main",
 				  account_vidcodecl(call->acc),
+				  &acc->vidtmpl,
 				  video_error_handler, call);
 		if (err)
 			goto out;
@@ -693,7 +823,8 @@ int call_progress(struct call *call)
 		return err;
 
 	err = sipsess_progress(call->sess, 183, "Session Progress",
-			       desc, "Allow: %s\r\n", uag_allowed_methods());
+			       desc, "Allow: %s\r\n%s", uag_allowed_methods(),
+			       recv_info(call));
 
 	if (!err)
 		call_stream_start(call, false);
@@ -732,7 +863,8 @@ int call_answer(struct call *call, uint16_t scode)
 		return err;
 
 	err = sipsess_answer(call->sess, scode, "Answering", desc,
-			     "Allow: %s\r\n", uag_allowed_methods());
+			     "Allow: %s\r\n%s", uag_allowed_methods(),
+			     recv_info(call));
 
 	mem_deref(desc);
 
@@ -811,6 +943,19 @@ int call_sdp_get(const struct call *call, struct mbuf **descp, bool offer)
 }
 
 
+/**
+ * Get the SIP Call-ID of a call
+ *
+ * @param call Call object
+ *
+ * @return SIP Call-ID, NULL if the SIP session is not yet created
+ */
+const char *call_id(const struct call *call)
+{
+	return call ? sip_dialog_callid(sipsess_dialog(call->sess)) : NULL;
+}
+
+
 const char *call_peeruri(const struct call *call)
 {
 	return call ? call->peer_uri : NULL;
@@ -1024,15 +1169,35 @@ static void sipsess_estab_handler(const struct sip_msg *msg, void *arg)
 
 	MAGIC_CHECK(call);
 
-	(void)msg;
-
 	if (call->state == STATE_ESTABLISHED)
 		return;
 
+	sipflow_msg(ua_outbound(call->ua), msg);
+
+	/* the Recv-Info of the callee is in the 200 OK */
+	if (call->outgoing)
+		call->peer_trickle = peer_recv_trickle(msg);
+
 	set_state(call, STATE_ESTABLISHED);
 
 	call_stream_start(call, true);
 
+	if (call->trickle) {
+		if (call->peer_trickle)
+			(void)send_trickle(call, call->trickle);
+		else
+			call->mnat_update = true;
+
+		call->trickle = mem_deref(call->trickle);
+	}
+
+	/* full ICE, all candidates are in the offer */
+	if (call->mnat_update) {
+		info("call: medianat established -- sending Re-INVITE\n");
+		call->mnat_update = false;
+		(void)call_modify(call);
+	}
+
 	/* the transferor will hangup this call */
 	if (call->not) {
 		(void)call_notify_sipfrag(call, 200, "OK");
@@ -1114,6 +1279,21 @@ static void sipsess_info_handler(struct sip *sip, const struct sip_msg *msg,
 		(void)sip_reply(sip, msg, 200, "OK");
 	}
 #endif
+	else if (msg_ctype_cmp(&msg->ctyp,
+			       "application", "trickle-ice-sdpfrag")) {
+
+		const struct mnat *mnat = call->acc->mnat;
+		struct pl body;
+
+		pl_set_mbuf(&body, msg->mb);
+
+		if (!call->trickle_ice || !mnat->fragh)
+			(void)sip_reply(sip, msg, 469, "Bad Info Package");
+		else if (mnat->fragh(call->mnats, &body))
+			(void)sip_reply(sip, msg, 400, "Bad Request");
+		else
+			(void)sip_reply(sip, msg, 200, "OK");
+	}
 	else {
 		(void)sip_reply(sip, msg, 488, "Not Acceptable Here");
 	}
@@ -1236,6 +1416,7 @@ int call_accept(struct call *call, struct sipsess_sock *sess_sock,
 		return EINVAL;
 
 	call->outgoing = false;
+	call->peer_trickle = peer_recv_trickle(msg);
 
 	got_offer = (mbuf_get_left(msg->mb) > 0);
 
@@ -1305,12 +1486,15 @@ int call_accept(struct call *call, struct sipsess_sock *sess_sock,
 			     sipsess_offer_handler, sipsess_answer_handler,
 			     sipsess_estab_handler, sipsess_info_handler,
 			     sipsess_refer_handler, sipsess_close_handler,
-			     call, "Allow: %s\r\n", uag_allowed_methods());
+			     call, "Allow: %s\r\n%s", uag_allowed_methods(),
+			     recv_info(call));
 	if (err) {
 		warning("call: sipsess_accept: %m\n", err);
 		return err;
 	}
 
+	uag_call_index(&call->he, call);
+
 	set_state(call, STATE_INCOMING);
 
 	/* New call */
@@ -1408,11 +1592,15 @@ static int send_invite(struct call *call)
 			      sipsess_progr_handler, sipsess_estab_handler,
 			      sipsess_info_handler, sipsess_refer_handler,
 			      sipsess_close_handler, call,
-			      "Allow: %s\r\n%H", uag_allowed_methods(),
-			      ua_print_supported, call->ua);
+			      "Allow: %s\r\n%H%s", uag_allowed_methods(),
+			      ua_print_supported, call->ua, recv_info(call));
 	if (err) {
 		warning("call: sipsess_connect: %m\n", err);
 	}
+	else {
+		/* the Call-ID is known once the INVITE is created */
+		uag_call_index(&call->he, call);
+	}
 
 	/* save call setup timer */
 	call->time_conn = time(NULL);
@@ -1468,6 +1656,38 @@ struct audio *call_audio(const struct call *call)
 }
 
 
+/**
+ * Add the memory usage of a call, by component
+ *
+ * @param call Call object
+ * @param ms   Memory statistics to add to
+ */
+void call_memstat(const struct call *call, struct call_memstat *ms)
+{
+	struct le *le;
+
+	if (!call || !ms)
+		return;
+
+	ms->call += sizeof(*call);
+	ms->call += str_len(call->local_uri) + str_len(call->local_name);
+	ms->call += str_len(call->peer_uri) + str_len(call->peer_name);
+
+	FOREACH_STREAM {
+		const struct stream *s = le->data;
+
+		ms->stream += sizeof(*s) + str_len(s->cname);
+		if (s->jbuf)
+			++ms->jbufc;
+	}
+
+	audio_memstat(call->audio, ms);
+#ifdef USE_VIDEO
+	video_memstat(call->video, ms);
+#endif
+}
+
+
 /**
  * Get the video object for the current call
  *
@@ -27,12 +27,19 @@ static struct config core_config = {
 		16,
 		"",
 		"",
-		""
+		"",
+		50,
+		20,
+		120
 	},
 
 	/** Call config */
 	{
-		120
+		120,
+		0,
+		0,
+		0,
+		30
 	},
 
 	/** Audio */
@@ -59,6 +66,7 @@ static struct config core_config = {
 		352, 288,
 		500000,
 		25,
+		true,
 	},
 #endif
 
@@ -77,7 +85,8 @@ static struct config core_config = {
 	{
 		"",
 		{ {""} },
-		0
+		0,
+		false
 	},
 
 #ifdef USE_VIDEO
@@ -156,10 +165,17 @@ int config_parse_conf(struct config *cfg, const struct conf *conf)
 			   sizeof(cfg->sip.local));
 	(void)conf_get_str(conf, "sip_certificate", cfg->sip.cert,
 			   sizeof(cfg->sip.cert));
+	(void)conf_get_u32(conf, "sip_reg_rate", &cfg->sip.reg_rate);
+	(void)conf_get_u32(conf, "sip_reg_inflight", &cfg->sip.reg_inflight);
+	(void)conf_get_u32(conf, "sip_keepalive", &cfg->sip.flow_keepalive);
 
 	/* Call */
 	(void)conf_get_u32(conf, "call_local_timeout",
 			   &cfg->call.local_timeout);
+	(void)conf_get_u32(conf, "call_max_streams", &cfg->call.max_streams);
+	(void)conf_get_u32(conf, "call_max_cpu", &cfg->call.max_cpu);
+	(void)conf_get_u32(conf, "call_max_xruns", &cfg->call.max_xruns);
+	(void)conf_get_u32(conf, "call_retry_after", &cfg->call.retry_after);
 
 	/* Audio */
 	(void)conf_get_str(conf, "audio_path", cfg->audio.audio_path,
@@ -205,6 +221,7 @@ int config_parse_conf(struct config *cfg, const struct conf *conf)
 	}
 	(void)conf_get_u32(conf, "video_bitrate", &cfg->video.bitrate);
 	(void)conf_get_u32(conf, "video_fps", &cfg->video.fps);
+	(void)conf_get_bool(conf, "video_adapt", &cfg->video.adapt);
 #else
 	(void)size;
 #endif
@@ -232,6 +249,7 @@ int config_parse_conf(struct config *cfg, const struct conf *conf)
 	(void)conf_apply(conf, "dns_server", dns_server_handler, &cfg->net);
 	(void)conf_get_str(conf, "net_interface",
 			   cfg->net.ifname, sizeof(cfg->net.ifname));
+	(void)conf_get_bool(conf, "dns_cache", &cfg->net.dns_cache);
 
 #ifdef USE_VIDEO
 	/* BFCP */
@@ -256,9 +274,16 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 "sip_trans_bsize\t\t%u\n"
 			 "sip_listen\t\t%s\n"
 			 "sip_certificate\t%s\n"
+			 "sip_reg_rate\t\t%u\n"
+			 "sip_reg_inflight\t%u\n"
+			 "sip_keepalive\t\t%u\n"
 			 "\n"
 			 "# Call\n"
 			 "call_local_timeout\t%u\n"
+			 "call_max_streams\t%u\n"
+			 "call_max_cpu\t\t%u\n"
+			 "call_max_xruns\t\t%u\n"
+			 "call_retry_after\t%u\n"
 			 "\n"
 			 "# Audio\n"
 			 "audio_path\t\t%s\n"
@@ -279,6 +304,7 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 "video_size\t\t\"%ux%u\"\n"
 			 "video_bitrate\t\t%u\n"
 			 "video_fps\t\t%u\n"
+			 "video_adapt\t\t%s\n"
 			 "\n"
 #endif
 			 "# AVT\n"
@@ -292,6 +318,7 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 "\n"
 			 "# Network\n"
 			 "net_interface\t\t%s\n"
+			 "dns_cache\t\t%s\n"
 			 "\n"
 #ifdef USE_VIDEO
 			 "# BFCP\n"
@@ -301,8 +328,12 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 ,
 
 			 cfg->sip.trans_bsize, cfg->sip.local, cfg->sip.cert,
+			 cfg->sip.reg_rate, cfg->sip.reg_inflight,
+			 cfg->sip.flow_keepalive,
 
 			 cfg->call.local_timeout,
+			 cfg->call.max_streams, cfg->call.max_cpu,
+			 cfg->call.max_xruns, cfg->call.retry_after,
 
 			 cfg->audio.audio_path,
 			 cfg->audio.play_mod,  cfg->audio.play_dev,
@@ -318,6 +349,7 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 cfg->video.disp_mod, cfg->video.disp_dev,
 			 cfg->video.width, cfg->video.height,
 			 cfg->video.bitrate, cfg->video.fps,
+			 cfg->video.adapt ? "yes" : "no",
 #endif
 
 			 cfg->avt.rtp_tos,
@@ -328,7 +360,8 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 range_print, &cfg->avt.jbuf_del,
 			 cfg->avt.rtp_stats ? "yes" : "no",
 
-			 cfg->net.ifname
+			 cfg->net.ifname,
+			 cfg->net.dns_cache ? "yes" : "no"
 
 #ifdef USE_VIDEO
 			 ,cfg->bfcp.proto
@@ -418,9 +451,16 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 			  "sip_trans_bsize\t\t128\n"
 			  "#sip_listen\t\t0.0.0.0:5060\n"
 			  "#sip_certificate\tcert.pem\n"
+			  "sip_reg_rate\t\t50\t\t# REGISTERs per second\n"
+			  "sip_reg_inflight\t20\n"
+			  "sip_keepalive\t\t120\t\t# seconds, 0 = off\n"
 			  "\n"
 			  "# Call\n"
 			  "call_local_timeout\t%u\n"
+			  "#call_max_streams\t0\t\t# 0 = no limit\n"
+			  "#call_max_cpu\t\t0\t\t# percent of one core\n"
+			  "#call_max_xruns\t\t0\t\t# per second\n"
+			  "#call_retry_after\t30\t\t# seconds\n"
 			  "\n"
 			  "# Audio\n"
 			  "#audio_path\t\t/usr/share/baresip\n"
@@ -449,7 +489,8 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 			  "#video_display\t\t%s\n"
 			  "video_size\t\t%dx%d\n"
 			  "video_bitrate\t\t%u\n"
-			  "video_fps\t\t%u\n",
+			  "video_fps\t\t%u\n"
+			  "video_adapt\t\tyes\t\t# Adapt to CPU overuse\n",
 			  default_video_device(),
 			  default_video_display(),
 			  cfg->video.width, cfg->video.height,
@@ -467,6 +508,7 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 			  "rtp_stats\t\tno\n"
 			  "\n# Network\n"
 			  "#dns_server\t\t10.0.0.1:53\n"
+			  "dns_cache\t\tno\n"
 			  "#net_interface\t\t%H\n",
 			  cfg->avt.jbuf_del.min, cfg->avt.jbuf_del.max,
 			  default_interface_print, NULL);
@@ -589,6 +631,7 @@ int config_write_template(const char *file, const struct config *cfg)
 	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "cons" MOD_EXT "\n");
 	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "evdev" MOD_EXT "\n");
 	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "httpd" MOD_EXT "\n");
+	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "ctrl" MOD_EXT "\n");
 
 	(void)re_fprintf(f, "\n# Audio codec Modules (in order)\n");
 	(void)re_fprintf(f, "#module\t\t\t" MOD_PRE "opus" MOD_EXT "\n");
@@ -694,6 +737,20 @@ int config_write_template(const char *file, const struct config *cfg)
 	(void)re_fprintf(f, "module_tmp\t\t" MOD_PRE "account" MOD_EXT "\n");
 	(void)re_fprintf(f, "\n");
 
+	(void)re_fprintf(f, "\n#------------------------------------"
+			 "------------------------------------------\n");
+	(void)re_fprintf(f, "# Lazy Modules (loaded when first needed)\n");
+	(void)re_fprintf(f, "#\n");
+	(void)re_fprintf(f, "# module_lazy <module> <type>[,<type>...]\n");
+	(void)re_fprintf(f, "# types: aucodec, auplay, ausrc, vidcodec,"
+			 " vidisp, vidsrc\n");
+	(void)re_fprintf(f, "\n");
+	(void)re_fprintf(f, "#module_lazy\t\t" MOD_PRE "x11" MOD_EXT
+			 "\t\tvidisp\n");
+	(void)re_fprintf(f, "#module_lazy\t\t" MOD_PRE "gst" MOD_EXT
+			 "\t\tausrc\n");
+	(void)re_fprintf(f, "\n");
+
 	(void)re_fprintf(f, "\n#------------------------------------"
 			 "------------------------------------------\n");
 	(void)re_fprintf(f, "# Application Modules\n");
@@ -721,6 +778,10 @@ int config_write_template(const char *file, const struct config *cfg)
 	(void)re_fprintf(f, "\n");
 	(void)re_fprintf(f, "http_listen\t\t0.0.0.0:8000\n");
 
+	(void)re_fprintf(f, "\n");
+	(void)re_fprintf(f, "ctrl_listen\t\t127.0.0.1:4444\n");
+	(void)re_fprintf(f, "#ctrl_unix\t\t/tmp/baresip.sock\n");
+
 	(void)re_fprintf(f, "\n");
 	(void)re_fprintf(f, "evdev_device\t\t/dev/input/event0\n");
 
@@ -736,6 +797,14 @@ int config_write_template(const char *file, const struct config *cfg)
 
 	(void)re_fprintf(f, "\n# Opus codec parameters\n");
 	(void)re_fprintf(f, "opus_bitrate\t\t28000 # 6000-510000\n");
+	(void)re_fprintf(f, "#opus_application\tauto # auto,voip,audio\n");
+	(void)re_fprintf(f, "#opus_complexity\t10 # 0-10\n");
+	(void)re_fprintf(f, "#opus_adapt\t\tyes # adapt to loss and CPU\n");
+	(void)re_fprintf(f, "#opus_cpu_budget\t50 # percent of one core\n");
+
+	(void)re_fprintf(f, "\n# VP8 codec parameters\n");
+	(void)re_fprintf(f, "vp8_threads\t\t0 # 0 is based on CPU cores\n");
+	(void)re_fprintf(f, "vp8_temporal_layers\t1 # 1-3\n");
 
 	(void)re_fprintf(f,
 			"\n# Selfview\n"
@@ -747,7 +816,8 @@ int config_write_template(const char *file, const struct config *cfg)
 			"ice_turn\t\tno\n"
 			"ice_debug\t\tno\n"
 			"ice_nomination\t\tregular\t# {regular,aggressive}\n"
-			"ice_mode\t\tfull\t# {full,lite}\n");
+			"ice_mode\t\tfull\t# {full,lite}\n"
+			"ice_trickle\t\tno\n");
 
 	if (f)
 		(void)fclose(f);
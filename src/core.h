@@ -61,9 +61,54 @@ struct account {
 	uint16_t stun_port;          /**< STUN Port number                   */
 	struct le vcv[4];            /**< List elements for vidcodecl        */
 	struct list vidcodecl;       /**< List of preferred video-codecs     */
+	struct sdp_tmpl *autmpl;     /**< Cached SDP template for audio      */
+	struct sdp_tmpl *vidtmpl;    /**< Cached SDP template for video      */
 };
 
 
+/*
+ * Call admission control
+ */
+
+int      admit_init(const struct config_call *cfg);
+void     admit_close(void);
+bool     admit_check(uint32_t *retry_after);
+void     admit_stream_close(const struct stream *strm);
+
+
+/*
+ * SIP flows to outbound proxies
+ */
+
+int  sipflow_init(const struct config_sip *cfg);
+void sipflow_close(void);
+void sipflow_reset(void);
+void sipflow_msg(const char *proxy, const struct sip_msg *msg);
+int  sipflow_debug(struct re_printf *pf, void *unused);
+
+
+/*
+ * DNS cache
+ */
+
+struct dnscache;
+
+int  dnscache_alloc(struct dnscache **dcp, const struct sa *srvv,
+		    uint32_t srvc);
+int  dnscache_srv_set(struct dnscache *dc, const struct sa *srvv,
+		      uint32_t srvc);
+const struct sa *dnscache_addr(const struct dnscache *dc);
+int  dnscache_debug(struct re_printf *pf, const struct dnscache *dc);
+
+
+/*
+ * NAT cache
+ */
+
+void natcache_net_change(void);
+void natcache_close(void);
+
+
 /*
  * Audio Player
  */
@@ -99,6 +144,7 @@ struct ausrc {
  */
 
 struct audio;
+struct call_memstat;
 
 typedef void (audio_event_h)(int key, bool end, void *arg);
 typedef void (audio_err_h)(int err, const char *str, void *arg);
@@ -108,6 +154,7 @@ int audio_alloc(struct audio **ap, const struct config *cfg,
 		const struct mnat *mnat, struct mnat_sess *mnat_sess,
 		const struct menc *menc, struct menc_sess *menc_sess,
 		uint32_t ptime, const struct list *aucodecl,
+		struct sdp_tmpl **tmplp,
 		audio_event_h *eventh, audio_err_h *errh, void *arg);
 int  audio_start(struct audio *a);
 void audio_stop(struct audio *a);
@@ -119,6 +166,7 @@ struct stream *audio_strm(const struct audio *a);
 int  audio_send_digit(struct audio *a, char key);
 void audio_sdp_attr_decode(struct audio *a);
 int  audio_print_rtpstat(struct re_printf *pf, const struct audio *au);
+void audio_memstat(const struct audio *a, struct call_memstat *ms);
 
 
 /*
@@ -165,6 +213,19 @@ int  call_notify_sipfrag(struct call *call, uint16_t scode,
 int  call_af(const struct call *call);
 void call_set_xrtpstat(struct call *call);
 
+/** Memory usage of calls, in bytes unless noted */
+struct call_memstat {
+	size_t call;      /**< Call objects                        */
+	size_t audio;     /**< Audio objects                       */
+	size_t aubuf;     /**< Audio sample and packet buffers     */
+	size_t video;     /**< Video objects                       */
+	size_t vidbuf;    /**< Video frame and send-queue buffers  */
+	size_t stream;    /**< Media stream objects                */
+	uint32_t jbufc;   /**< Jitter buffer count, bytes unknown  */
+};
+
+void call_memstat(const struct call *call, struct call_memstat *ms);
+
 
 /*
  * Conf
@@ -194,6 +255,8 @@ struct mnat {
 	mnat_sess_h *sessh;
 	mnat_media_h *mediah;
 	mnat_update_h *updateh;
+	mnat_trickle_h *trickleh;
+	mnat_sdpfrag_h *fragh;
 };
 
 const struct mnat *mnat_find(const char *id);
@@ -230,8 +293,9 @@ uint32_t metric_avg_bitrate(const struct metric *metric);
  * Module
  */
 
-int module_init(const struct conf *conf);
+int  module_init(const struct conf *conf);
 void module_app_unload(void);
+void module_lazy_load(const char *type);
 
 
 /*
@@ -248,6 +312,7 @@ bool reg_isok(const struct reg *reg);
 int  reg_sipfd(const struct reg *reg);
 int  reg_debug(struct re_printf *pf, const struct reg *reg);
 int  reg_status(struct re_printf *pf, const struct reg *reg);
+int  reg_sched_debug(struct re_printf *pf, void *unused);
 
 
 /*
@@ -297,6 +362,10 @@ struct stream {
 	struct menc_media *mes;  /**< Media Encryption media state          */
 	struct metric metric_tx; /**< Metrics for transmit                  */
 	struct metric metric_rx; /**< Metrics for receiving                 */
+	struct lock *lock;       /**< Lock for the load counters            */
+	uint64_t cpu_tx_us;      /**< Time spent in encoder [us]            */
+	uint64_t cpu_rx_us;      /**< Time spent in decoder [us]            */
+	uint32_t xruns;          /**< Audio buffer under/overruns           */
 	char *cname;             /**< RTCP Canonical end-point identifier   */
 	uint32_t ssrc_rx;        /**< Incoming syncronizing source          */
 	uint32_t pseq;           /**< Sequence number for incoming RTP      */
@@ -327,6 +396,10 @@ void stream_set_srate(struct stream *s, uint32_t srate_tx, uint32_t srate_rx);
 void stream_send_fir(struct stream *s, bool pli);
 void stream_reset(struct stream *s);
 void stream_set_bw(struct stream *s, uint32_t bps);
+void stream_cpu_add(struct stream *s, bool tx, uint64_t us);
+void stream_xrun(struct stream *s);
+void stream_load_get(const struct stream *s, uint64_t *cpu_us,
+		     uint32_t *xruns);
 int  stream_debug(struct re_printf *pf, const struct stream *s);
 int  stream_print(struct re_printf *pf, const struct stream *s);
 
@@ -343,6 +416,7 @@ void         ua_printf(const struct ua *ua, const char *fmt, ...);
 
 struct tls  *uag_tls(void);
 const char  *uag_allowed_methods(void);
+void         uag_call_index(struct le *he, struct call *call);
 
 
 /*
@@ -388,6 +462,7 @@ int  video_alloc(struct video **vp, const struct config *cfg,
 		 const struct mnat *mnat, struct mnat_sess *mnat_sess,
 		 const struct menc *menc, struct menc_sess *menc_sess,
 		 const char *content, const struct list *vidcodecl,
+		 struct sdp_tmpl **tmplp,
 		 video_err_h *errh, void *arg);
 int  video_start(struct video *v, const char *peer);
 void video_stop(struct video *v);
@@ -399,3 +474,4 @@ struct stream *video_strm(const struct video *v);
 void video_update_picture(struct video *v);
 void video_sdp_attr_decode(struct video *v);
 int  video_print(struct re_printf *pf, const struct video *v);
+void video_memstat(const struct video *v, struct call_memstat *ms);
@@ -0,0 +1,756 @@
+/**
+ * @file dnscache.c  Local DNS cache
+ *
+ * Copyright (C) 2010 - 2016 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The DNS client in libre has no cache, so the cache is a small DNS
+ * forwarder on the loopback interface. The DNS client of the network
+ * instance uses it as the only nameserver, and the cache resolves the
+ * queries with its own DNS client and the real nameservers.
+ *
+ * Answers are cached for the lowest TTL of the answer records, and
+ * empty answers (NXDOMAIN or NODATA) for the SOA minimum TTL. Entries
+ * with hits are refreshed before they expire, and identical queries
+ * are sent to the nameserver only once.
+ */
+
+
+enum {
+	DNSCACHE_TICK     = 1000,   /**< Expiry check interval [ms]        */
+	DNSCACHE_HASH     = 64,     /**< Hash table size                   */
+	DNSCACHE_POPULAR  = 2,      /**< Hits before an entry is refreshed */
+	DNSCACHE_MAX_TTL  = 86400,  /**< Maximum positive TTL [s]          */
+	DNSCACHE_NEG_TTL  = 60,     /**< Default negative TTL [s]          */
+	DNSCACHE_NEG_MAX  = 300,    /**< Maximum negative TTL [s]          */
+	DNSCACHE_BUFSIZE  = 512,
+};
+
+/** Local DNS cache */
+struct dnscache {
+	struct udp_sock *us;        /**< Loopback socket                   */
+	struct sa laddr;            /**< Loopback address of the cache     */
+	struct dnsc *dnsc;          /**< DNS client for the nameservers    */
+	struct sa srvv[NET_MAX_NS]; /**< Upstream nameservers              */
+	uint32_t srvc;              /**< Number of upstream nameservers    */
+	struct hash *ht;            /**< Cache entries, by name and type   */
+	struct tmr tmr;
+	uint32_t n;                 /**< Number of cache entries           */
+
+	struct {
+		uint32_t hits;
+		uint32_t neg_hits;
+		uint32_t misses;
+		uint32_t coalesced;
+		uint32_t prefetch;
+		uint32_t errors;
+	} stats;
+};
+
+/** A cached question and its answer */
+struct dnsent {
+	struct le he;
+	struct dnscache *dc;
+	struct dns_query *q;
+	struct list rrlv[3];        /**< Answer, authority and additional  */
+	struct list waitl;          /**< Requests waiting for the answer   */
+	char *name;
+	uint16_t type;
+	uint16_t dnsclass;
+	uint8_t rcode;
+	uint64_t stored;            /**< Time of the answer [ms]           */
+	uint64_t expires;           /**< Expiry time [ms]                  */
+	uint32_t ttl;               /**< TTL of the answer [s]             */
+	uint32_t hits;              /**< Hits since the answer was stored  */
+	bool valid;                 /**< An answer is stored               */
+	bool pending;               /**< Query to the nameserver is sent   */
+};
+
+/** A request waiting for the answer from the nameserver */
+struct dnswait {
+	struct le le;
+	struct sa src;
+	uint16_t id;
+	bool rd;
+};
+
+struct lookup {
+	const char *name;
+	uint16_t type;
+	uint16_t dnsclass;
+};
+
+
+static void entry_destructor(void *arg)
+{
+	struct dnsent *e = arg;
+	size_t i;
+
+	if (e->he.list) {
+		hash_unlink(&e->he);
+		--e->dc->n;
+	}
+
+	mem_deref(e->q);
+
+	for (i=0; i<ARRAY_SIZE(e->rrlv); i++)
+		list_flush(&e->rrlv[i]);
+
+	list_flush(&e->waitl);
+	mem_deref(e->name);
+}
+
+
+static void destructor(void *arg)
+{
+	struct dnscache *dc = arg;
+
+	tmr_cancel(&dc->tmr);
+	hash_flush(dc->ht);
+	mem_deref(dc->ht);
+	mem_deref(dc->us);
+	mem_deref(dc->dnsc);
+}
+
+
+static uint32_t entry_key(const char *name, uint16_t type)
+{
+	return hash_joaat_str_ci(name) + type;
+}
+
+
+static bool entry_cmp_handler(struct le *le, void *arg)
+{
+	const struct dnsent *e = le->data;
+	const struct lookup *lk = arg;
+
+	return e->type == lk->type && e->dnsclass == lk->dnsclass &&
+		0 == str_casecmp(e->name, lk->name);
+}
+
+
+static bool entry_expired(const struct dnsent *e, uint64_t now)
+{
+	return !e->valid || now >= e->expires;
+}
+
+
+static bool entry_negative(const struct dnsent *e)
+{
+	return e->rcode != DNS_RCODE_OK || list_isempty(&e->rrlv[0]);
+}
+
+
+/*
+ * Encode a reply to a request. The records are encoded with the TTL
+ * that is left, and records that can not be encoded are skipped.
+ */
+static int reply_send(struct dnscache *dc, const struct sa *dst,
+		      uint16_t id, bool rd, const struct dnsent *e,
+		      uint8_t rcode)
+{
+	struct dnshdr hdr;
+	struct mbuf *mb;
+	int64_t age = 0;
+	uint16_t nv[3] = {0, 0, 0};
+	size_t i;
+	int err;
+
+	mb = mbuf_alloc(DNSCACHE_BUFSIZE);
+	if (!mb)
+		return ENOMEM;
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	hdr.id     = id;
+	hdr.qr     = true;
+	hdr.opcode = DNS_OPCODE_QUERY;
+	hdr.rd     = rd;
+	hdr.ra     = true;
+	hdr.rcode  = rcode;
+	hdr.nq     = 1;
+
+	err  = dns_hdr_encode(mb, &hdr);
+	err |= dns_dname_encode(mb, e->name, NULL, 0, false);
+	err |= mbuf_write_u16(mb, htons(e->type));
+	err |= mbuf_write_u16(mb, htons(e->dnsclass));
+	if (err)
+		goto out;
+
+	if (e->valid && rcode == e->rcode) {
+
+		age = (int64_t)(tmr_jiffies() - e->stored) / 1000;
+
+		for (i=0; i<ARRAY_SIZE(e->rrlv); i++) {
+
+			struct le *le;
+
+			for (le = e->rrlv[i].head; le; le = le->next) {
+
+				const struct dnsrr *rr = le->data;
+				const size_t pos = mb->pos;
+
+				if (dns_rr_encode(mb, rr, age, NULL, 0)) {
+					mb->pos = mb->end = pos;
+					continue;
+				}
+
+				++nv[i];
+			}
+		}
+	}
+
+	hdr.nans  = nv[0];
+	hdr.nauth = nv[1];
+	hdr.nadd  = nv[2];
+
+	mb->pos = 0;
+	err = dns_hdr_encode(mb, &hdr);
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+	err = udp_send(dc->us, dst, mb);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+static void waiters_reply(struct dnsent *e, uint8_t rcode)
+{
+	struct le *le;
+
+	while ((le = list_head(&e->waitl))) {
+
+		struct dnswait *w = le->data;
+
+		(void)reply_send(e->dc, &w->src, w->id, w->rd, e, rcode);
+
+		list_unlink(le);
+		mem_deref(w);
+	}
+}
+
+
+static int waiter_add(struct dnsent *e, const struct sa *src,
+		      uint16_t id, bool rd)
+{
+	struct dnswait *w;
+	struct le *le;
+
+	/* a retransmitted request */
+	for (le = e->waitl.head; le; le = le->next) {
+
+		w = le->data;
+
+		if (w->id == id && sa_cmp(&w->src, src, SA_ALL))
+			return 0;
+	}
+
+	w = mem_zalloc(sizeof(*w), NULL);
+	if (!w)
+		return ENOMEM;
+
+	w->src = *src;
+	w->id  = id;
+	w->rd  = rd;
+
+	list_append(&e->waitl, &w->le, w);
+
+	return 0;
+}
+
+
+static uint32_t ttl_min(const struct list *rrl, uint32_t ttl)
+{
+	struct le *le;
+
+	for (le = list_head(rrl); le; le = le->next) {
+
+		const struct dnsrr *rr = le->data;
+
+		if (rr->ttl < ttl)
+			ttl = (uint32_t)rr->ttl;
+	}
+
+	return ttl;
+}
+
+
+/* RFC 2308: the negative TTL is the SOA minimum, or the SOA TTL */
+static uint32_t ttl_negative(const struct list *authl)
+{
+	struct le *le;
+
+	for (le = list_head(authl); le; le = le->next) {
+
+		const struct dnsrr *rr = le->data;
+
+		if (rr->type != DNS_TYPE_SOA)
+			continue;
+
+		return min((uint32_t)rr->ttl, rr->rdata.soa.ttlmin);
+	}
+
+	return DNSCACHE_NEG_TTL;
+}
+
+
+static void rrl_move(struct list *dst, struct list *src)
+{
+	struct le *le;
+
+	list_flush(dst);
+
+	while ((le = list_head(src))) {
+		list_unlink(le);
+		list_append(dst, le, le->data);
+	}
+}
+
+
+static void entry_store(struct dnsent *e, uint8_t rcode, struct list *ansl,
+			struct list *authl, struct list *addl)
+{
+	rrl_move(&e->rrlv[0], ansl);
+	rrl_move(&e->rrlv[1], authl);
+	rrl_move(&e->rrlv[2], addl);
+
+	e->rcode = rcode;
+
+	if (entry_negative(e)) {
+		e->ttl = min(ttl_negative(&e->rrlv[1]), DNSCACHE_NEG_MAX);
+	}
+	else {
+		e->ttl = ttl_min(&e->rrlv[0], DNSCACHE_MAX_TTL);
+		e->ttl = ttl_min(&e->rrlv[1], e->ttl);
+		e->ttl = ttl_min(&e->rrlv[2], e->ttl);
+	}
+
+	e->stored  = tmr_jiffies();
+	e->expires = e->stored + e->ttl * 1000ULL;
+	e->hits    = 0;
+	e->valid   = true;
+}
+
+
+static void query_handler(int err, const struct dnshdr *hdr,
+			  struct list *ansl, struct list *authl,
+			  struct list *addl, void *arg)
+{
+	struct dnsent *e = arg;
+
+	e->pending = false;
+
+	if (hdr && (hdr->rcode == DNS_RCODE_OK ||
+		    hdr->rcode == DNS_RCODE_NAME_ERR)) {
+
+		entry_store(e, hdr->rcode, ansl, authl, addl);
+	}
+	else {
+		++e->dc->stats.errors;
+
+		debug("dnscache: %s %s: query failed (%m)\n",
+		      dns_rr_typename(e->type), e->name, err);
+	}
+
+	/* a failed refresh keeps the old answer until it expires */
+	if (entry_expired(e, tmr_jiffies()))
+		waiters_reply(e, DNS_RCODE_SRV_FAIL);
+	else
+		waiters_reply(e, e->rcode);
+}
+
+
+static int entry_query(struct dnsent *e)
+{
+	int err;
+
+	e->q = mem_deref(e->q);
+
+	err = dnsc_query(&e->q, e->dc->dnsc, e->name, e->type, e->dnsclass,
+			 true, query_handler, e);
+	if (err)
+		return err;
+
+	e->pending = true;
+
+	return 0;
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct dnscache *dc = arg;
+	const uint64_t now = tmr_jiffies();
+	uint32_t i, bsize = hash_bsize(dc->ht);
+
+	for (i=0; i<bsize; i++) {
+
+		struct le *le = list_head(hash_list(dc->ht, i));
+
+		while (le) {
+
+			struct dnsent *e = le->data;
+			uint64_t left;
+
+			le = le->next;
+
+			if (e->pending)
+				continue;
+
+			if (entry_expired(e, now)) {
+				mem_deref(e);
+				continue;
+			}
+
+			/* refresh popular entries when 90% of the TTL
+			   has passed, before the next tick */
+			left = e->expires - now;
+
+			if (e->hits >= DNSCACHE_POPULAR &&
+			    left < e->ttl * 100ULL + DNSCACHE_TICK) {
+
+				if (0 == entry_query(e))
+					++dc->stats.prefetch;
+			}
+		}
+	}
+
+	if (dc->n)
+		tmr_start(&dc->tmr, DNSCACHE_TICK, tmr_handler, dc);
+}
+
+
+static int entry_alloc(struct dnsent **ep, struct dnscache *dc,
+		       const char *name, uint16_t type, uint16_t dnsclass)
+{
+	struct dnsent *e;
+	int err;
+
+	e = mem_zalloc(sizeof(*e), entry_destructor);
+	if (!e)
+		return ENOMEM;
+
+	err = str_dup(&e->name, name);
+	if (err)
+		goto out;
+
+	e->dc       = dc;
+	e->type     = type;
+	e->dnsclass = dnsclass;
+
+	hash_append(dc->ht, entry_key(name, type), &e->he, e);
+	++dc->n;
+
+	if (!tmr_isrunning(&dc->tmr))
+		tmr_start(&dc->tmr, DNSCACHE_TICK, tmr_handler, dc);
+
+ out:
+	if (err)
+		mem_deref(e);
+	else
+		*ep = e;
+
+	return err;
+}
+
+
+static void udp_recv_handler(const struct sa *src, struct mbuf *mb,
+			     void *arg)
+{
+	struct dnscache *dc = arg;
+	struct lookup lk;
+	struct dnshdr hdr;
+	struct dnsent *e;
+	struct le *le;
+	char *name = NULL;
+	size_t start = mb->pos;
+	int err;
+
+	if (dns_hdr_decode(mb, &hdr) || hdr.qr || hdr.nq != 1 ||
+	    hdr.opcode != DNS_OPCODE_QUERY)
+		return;
+
+	if (dns_dname_decode(mb, &name, start) || mbuf_get_left(mb) < 4)
+		goto out;
+
+	lk.name     = name;
+	lk.type     = ntohs(mbuf_read_u16(mb));
+	lk.dnsclass = ntohs(mbuf_read_u16(mb));
+
+	le = hash_lookup(dc->ht, entry_key(name, lk.type),
+			 entry_cmp_handler, &lk);
+	e = le ? le->data : NULL;
+
+	if (e && !entry_expired(e, tmr_jiffies())) {
+
+		++e->hits;
+
+		if (entry_negative(e))
+			++dc->stats.neg_hits;
+		else
+			++dc->stats.hits;
+
+		(void)reply_send(dc, src, hdr.id, hdr.rd, e, e->rcode);
+		goto out;
+	}
+
+	++dc->stats.misses;
+
+	if (!e) {
+		err = entry_alloc(&e, dc, name, lk.type, lk.dnsclass);
+		if (err)
+			goto out;
+	}
+
+	err = waiter_add(e, src, hdr.id, hdr.rd);
+	if (err)
+		goto out;
+
+	if (e->pending) {
+		++dc->stats.coalesced;
+		goto out;
+	}
+
+	err = entry_query(e);
+	if (err) {
+		warning("dnscache: %s %s: query failed (%m)\n",
+			dns_rr_typename(lk.type), name, err);
+		++dc->stats.errors;
+		waiters_reply(e, DNS_RCODE_SRV_FAIL);
+	}
+
+ out:
+	mem_deref(name);
+}
+
+
+/**
+ * Allocate a local DNS cache
+ *
+ * @param dcp  Pointer to allocated DNS cache
+ * @param srvv Upstream nameservers
+ * @param srvc Number of upstream nameservers
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dnscache_alloc(struct dnscache **dcp, const struct sa *srvv,
+		   uint32_t srvc)
+{
+	struct dnscache *dc;
+	int err;
+
+	if (!dcp)
+		return EINVAL;
+
+	dc = mem_zalloc(sizeof(*dc), destructor);
+	if (!dc)
+		return ENOMEM;
+
+	tmr_init(&dc->tmr);
+
+	err = hash_alloc(&dc->ht, DNSCACHE_HASH);
+	if (err)
+		goto out;
+
+	err = dnscache_srv_set(dc, srvv, srvc);
+	if (err)
+		goto out;
+
+	err = dnsc_alloc(&dc->dnsc, NULL, dc->srvv, dc->srvc);
+	if (err)
+		goto out;
+
+	err = sa_set_str(&dc->laddr, "127.0.0.1", 0);
+	if (err)
+		goto out;
+
+	err = udp_listen(&dc->us, &dc->laddr, udp_recv_handler, dc);
+	if (err)
+		goto out;
+
+	err = udp_local_get(dc->us, &dc->laddr);
+	if (err)
+		goto out;
+
+ out:
+	if (err)
+		mem_deref(dc);
+	else
+		*dcp = dc;
+
+	return err;
+}
+
+
+/*
+ * Drop all answers. Entries with requests waiting for the answer are
+ * kept, and are queried again from the new nameservers.
+ */
+static void cache_reset(struct dnscache *dc)
+{
+	uint32_t i, bsize = hash_bsize(dc->ht);
+	size_t j;
+
+	for (i=0; i<bsize; i++) {
+
+		struct le *le = list_head(hash_list(dc->ht, i));
+
+		while (le) {
+
+			struct dnsent *e = le->data;
+
+			le = le->next;
+
+			if (list_isempty(&e->waitl)) {
+				mem_deref(e);
+				continue;
+			}
+
+			for (j=0; j<ARRAY_SIZE(e->rrlv); j++)
+				list_flush(&e->rrlv[j]);
+
+			e->valid = false;
+			e->hits  = 0;
+
+			if (entry_query(e)) {
+				waiters_reply(e, DNS_RCODE_SRV_FAIL);
+				mem_deref(e);
+			}
+		}
+	}
+}
+
+
+/**
+ * Set the upstream nameservers of the DNS cache. The cache is flushed
+ * if the nameservers changed.
+ *
+ * @param dc   DNS cache
+ * @param srvv Upstream nameservers
+ * @param srvc Number of upstream nameservers
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dnscache_srv_set(struct dnscache *dc, const struct sa *srvv,
+		     uint32_t srvc)
+{
+	uint32_t i;
+
+	if (!dc || (!srvv && srvc))
+		return EINVAL;
+
+	if (srvc > ARRAY_SIZE(dc->srvv))
+		return E2BIG;
+
+	if (srvc == dc->srvc) {
+
+		for (i=0; i<srvc; i++) {
+			if (!sa_cmp(&srvv[i], &dc->srvv[i], SA_ALL))
+				break;
+		}
+
+		if (i == srvc)
+			return 0;
+	}
+
+	for (i=0; i<srvc; i++)
+		dc->srvv[i] = srvv[i];
+
+	dc->srvc = srvc;
+
+	if (dc->dnsc) {
+		int err = dnsc_srv_set(dc->dnsc, dc->srvv, dc->srvc);
+		if (err)
+			return err;
+	}
+
+	/* the answers may be different from the new nameservers */
+	if (dc->n) {
+		info("dnscache: nameservers changed, flushing %u entries\n",
+		     dc->n);
+		cache_reset(dc);
+	}
+
+	return 0;
+}
+
+
+/**
+ * Get the loopback address of the DNS cache, to be used as the
+ * nameserver of a DNS client
+ *
+ * @param dc DNS cache
+ *
+ * @return Address of the DNS cache
+ */
+const struct sa *dnscache_addr(const struct dnscache *dc)
+{
+	return dc ? &dc->laddr : NULL;
+}
+
+
+/**
+ * Print the DNS cache statistics and entries
+ *
+ * @param pf Print handler for debug output
+ * @param dc DNS cache
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dnscache_debug(struct re_printf *pf, const struct dnscache *dc)
+{
+	const uint64_t now = tmr_jiffies();
+	uint32_t i, bsize;
+	int err;
+
+	if (!dc)
+		return 0;
+
+	err  = re_hprintf(pf, " DNS cache on %J: (%u entries)\n",
+			  &dc->laddr, dc->n);
+	err |= re_hprintf(pf, "   hits=%u negative_hits=%u misses=%u"
+			  " coalesced=%u prefetch=%u errors=%u\n",
+			  dc->stats.hits, dc->stats.neg_hits,
+			  dc->stats.misses, dc->stats.coalesced,
+			  dc->stats.prefetch, dc->stats.errors);
+
+	bsize = hash_bsize(dc->ht);
+
+	for (i=0; i<bsize; i++) {
+
+		struct le *le;
+
+		for (le = list_head(hash_list(dc->ht, i)); le; le = le->next) {
+
+			const struct dnsent *e = le->data;
+
+			err |= re_hprintf(pf, "   %-5s %s:",
+					  dns_rr_typename(e->type), e->name);
+
+			if (entry_expired(e, now)) {
+				err |= re_hprintf(pf, " (%s)\n", e->pending
+						  ? "resolving" : "expired");
+				continue;
+			}
+
+			err |= re_hprintf(pf, " %s ttl=%u/%u hits=%u\n",
+					  entry_negative(e) ? "negative"
+					  : "answer",
+					  (uint32_t)((e->expires - now) / 1000),
+					  e->ttl, e->hits);
+		}
+	}
+
+	return err;
+}
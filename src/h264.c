@@ -4,11 +4,37 @@
  * Copyright (C) 2010 - 2015 Creytiv.com
  */
 #include <string.h>
+#if defined (__AVX2__)
+#include <immintrin.h>
+#elif defined (__SSE2__)
+#include <emmintrin.h>
+#elif defined (__ARM_NEON) && defined (__aarch64__)
+#include <arm_neon.h>
+#endif
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
 
 
+enum {
+	STAP_MAXSZ = 1500,  /**< Maximum size of a STAP-A payload */
+	NALU_SIZE  = 2,     /**< Size of the STAP-A NAL unit size */
+};
+
+
+/** Single-time aggregation packet (STAP-A) under construction */
+struct stap {
+	uint8_t buf[STAP_MAXSZ];  /**< Aggregated NAL units         */
+	size_t len;               /**< Number of bytes in buffer    */
+	size_t maxsz;             /**< Maximum packet size          */
+	const uint8_t *nal;       /**< First NAL unit in the packet */
+	size_t nal_sz;            /**< Size of first NAL unit       */
+	unsigned count;           /**< Number of NAL units          */
+	uint8_t f;                /**< OR of all forbidden bits     */
+	uint8_t nri;              /**< Maximum NRI value            */
+};
+
+
 int h264_hdr_encode(const struct h264_hdr *hdr, struct mbuf *mb)
 {
 	uint8_t v;
@@ -66,7 +92,7 @@ int h264_fu_hdr_decode(struct h264_fu *fu, struct mbuf *mb)
  *
  * @note: copied from ffmpeg source
  */
-const uint8_t *h264_find_startcode(const uint8_t *p, const uint8_t *end)
+static const uint8_t *find_startcode(const uint8_t *p, const uint8_t *end)
 {
 	const uint8_t *a = p + 4 - ((long)p & 3);
 
@@ -102,6 +128,96 @@ const uint8_t *h264_find_startcode(const uint8_t *p, const uint8_t *end)
 }
 
 
+/*
+ * Vectorized scanning for two consecutive zero bytes. The SIMD loop is
+ * only a filter, blocks with a candidate are checked byte-by-byte.
+ *
+ * Returns a pointer to the first start code found, or a pointer to the
+ * remaining bytes that must be scanned by find_startcode().
+ */
+#if defined (__AVX2__)
+#define HAVE_STARTCODE_SIMD 1
+enum {SIMD_BLOCK = 32};
+
+static inline bool block_has_zeros(const uint8_t *p)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i a = _mm256_loadu_si256((const __m256i *)(void *)p);
+	const __m256i b = _mm256_loadu_si256((const __m256i *)(void *)(p+1));
+
+	return 0 != _mm256_movemask_epi8(
+		_mm256_and_si256(_mm256_cmpeq_epi8(a, zero),
+				 _mm256_cmpeq_epi8(b, zero)));
+}
+#elif defined (__SSE2__)
+#define HAVE_STARTCODE_SIMD 1
+enum {SIMD_BLOCK = 16};
+
+static inline bool block_has_zeros(const uint8_t *p)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i a = _mm_loadu_si128((const __m128i *)(void *)p);
+	const __m128i b = _mm_loadu_si128((const __m128i *)(void *)(p+1));
+
+	return 0 != _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, zero),
+						    _mm_cmpeq_epi8(b, zero)));
+}
+#elif defined (__ARM_NEON) && defined (__aarch64__)
+#define HAVE_STARTCODE_SIMD 1
+enum {SIMD_BLOCK = 16};
+
+static inline bool block_has_zeros(const uint8_t *p)
+{
+	const uint8x16_t a = vld1q_u8(p);
+	const uint8x16_t b = vld1q_u8(p+1);
+
+	return 0 != vmaxvq_u8(vandq_u8(vceqzq_u8(a), vceqzq_u8(b)));
+}
+#endif
+
+
+#ifdef HAVE_STARTCODE_SIMD
+static const uint8_t *find_startcode_simd(const uint8_t *p,
+					  const uint8_t *end)
+{
+	/* the last byte of a start code may be outside the block */
+	while (end - p >= SIMD_BLOCK + 2) {
+
+		if (block_has_zeros(p)) {
+			int i;
+
+			for (i=0; i<SIMD_BLOCK; i++) {
+				if (p[i] == 0 && p[i+1] == 0 && p[i+2] == 1)
+					return &p[i];
+			}
+		}
+
+		p += SIMD_BLOCK;
+	}
+
+	return p;
+}
+#endif
+
+
+/**
+ * Find the NAL start sequence (0x000001) in a H.264 byte stream
+ *
+ * @param p   Start of the byte stream
+ * @param end End of the byte stream
+ *
+ * @return Pointer to the start sequence, or end if not found
+ */
+const uint8_t *h264_find_startcode(const uint8_t *p, const uint8_t *end)
+{
+#ifdef HAVE_STARTCODE_SIMD
+	p = find_startcode_simd(p, end);
+#endif
+
+	return find_startcode(p, end);
+}
+
+
 static int rtp_send_data(const uint8_t *hdr, size_t hdr_sz,
 			 const uint8_t *buf, size_t sz, bool eof,
 			 videnc_packet_h *pkth, void *arg)
@@ -150,30 +266,410 @@ int h264_nal_send(bool first, bool last,
 }
 
 
+static int stap_flush(struct stap *stap, bool marker,
+		      videnc_packet_h *pkth, void *arg)
+{
+	uint8_t hdr;
+	int err;
+
+	if (!stap->count)
+		return 0;
+
+	/* a single NAL unit is sent as-is */
+	if (stap->count == 1) {
+		err = h264_nal_send(true, true, marker, stap->nal[0],
+				    stap->nal + 1, stap->nal_sz - 1,
+				    stap->maxsz, pkth, arg);
+	}
+	else {
+		hdr = stap->f<<7 | stap->nri<<5 | H264_NAL_STAP_A;
+
+		err = rtp_send_data(&hdr, 1, stap->buf, stap->len, marker,
+				    pkth, arg);
+	}
+
+	stap->len   = 0;
+	stap->count = 0;
+	stap->f     = 0;
+	stap->nri   = 0;
+
+	return err;
+}
+
+
+/* Check if the NAL unit is small enough to be aggregated */
+static inline bool stap_candidate(const struct stap *stap, size_t nal_sz)
+{
+	return 1 + NALU_SIZE + nal_sz <= stap->maxsz;
+}
+
+
+static int stap_append(struct stap *stap, const uint8_t *nal, size_t nal_sz,
+		       videnc_packet_h *pkth, void *arg)
+{
+	int err = 0;
+
+	if (1 + stap->len + NALU_SIZE + nal_sz > stap->maxsz)
+		err = stap_flush(stap, false, pkth, arg);
+
+	if (!stap->count) {
+		stap->nal    = nal;
+		stap->nal_sz = nal_sz;
+	}
+
+	stap->buf[stap->len++] = (uint8_t)(nal_sz >> 8);
+	stap->buf[stap->len++] = (uint8_t)(nal_sz & 0xff);
+	memcpy(&stap->buf[stap->len], nal, nal_sz);
+	stap->len += nal_sz;
+
+	stap->f  |= nal[0]>>7 & 0x1;
+	stap->nri = max(stap->nri, nal[0]>>5 & 0x3);
+	++stap->count;
+
+	return err;
+}
+
+
+/**
+ * Packetize a H.264 byte stream into RTP packets
+ *
+ * With packetization-mode 1, consecutive small NAL units (e.g.
+ * SPS/PPS/SEI) are aggregated into STAP-A packets. Large NAL units are
+ * fragmented into FU-A packets.
+ *
+ * @param buf     H.264 byte stream (Annex B) with one access unit
+ * @param len     Number of bytes
+ * @param pktsize Maximum RTP payload size
+ * @param pmode   Negotiated packetization-mode (RFC 6184 8.1)
+ * @param pkth    Packet handler
+ * @param arg     Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
 int h264_packetize(const uint8_t *buf, size_t len, size_t pktsize,
-		   videnc_packet_h *pkth, void *arg)
+		   unsigned pmode, videnc_packet_h *pkth, void *arg)
 {
 	const uint8_t *start = buf;
 	const uint8_t *end   = buf + len;
 	const uint8_t *r;
+	struct stap stap;
 	int err = 0;
 
+	stap.len   = 0;
+	stap.maxsz = min(pktsize, sizeof(stap.buf));
+	stap.count = 0;
+	stap.f     = 0;
+	stap.nri   = 0;
+
 	r = h264_find_startcode(start, end);
 
 	while (r < end) {
 		const uint8_t *r1;
+		size_t nal_sz;
 
 		/* skip zeros */
 		while (!*(r++))
 			;
 
 		r1 = h264_find_startcode(r, end);
+		nal_sz = r1 - r;
+
+		/* aggregation packets are not allowed in mode 0 */
+		if (pmode == 1 && stap_candidate(&stap, nal_sz)) {
+			err |= stap_append(&stap, r, nal_sz, pkth, arg);
+		}
+		else {
+			err |= stap_flush(&stap, false, pkth, arg);
+			err |= h264_nal_send(true, true, (r1 >= end), r[0],
+					     r+1, nal_sz-1, pktsize,
+					     pkth, arg);
+		}
 
-		err |= h264_nal_send(true, true, (r1 >= end), r[0],
-				     r+1, r1-r-1, pktsize,
-				     pkth, arg);
 		r = r1;
 	}
 
+	err |= stap_flush(&stap, true, pkth, arg);
+
 	return err;
 }
+
+
+/*
+ * H.264 reassembly buffer
+ *
+ * Incoming RTP packets are copied into a fixed ring of slots, indexed
+ * by the RTP sequence number. An access unit is passed to the decoder
+ * once all packets from the head of the ring up to the marker bit are
+ * present. A missing packet is declared lost when a packet more than
+ * REASM_WINDOW sequence numbers ahead of it has been received.
+ *
+ * A jump of the sequence number forward or backward by more than the
+ * size of the ring, or a run of late packets, means that the sender
+ * restarted, and the ring starts over.
+ */
+enum {
+	REASM_SLOTS  = 64,    /**< Number of slots, must be a power of two */
+	REASM_WINDOW = 16,    /**< Reordering tolerance in packets         */
+	REASM_PKTSZ  = 1500,  /**< Maximum payload size                    */
+};
+
+struct reasm_slot {
+	uint8_t buf[REASM_PKTSZ];
+	size_t len;
+	bool marker;
+	bool used;
+};
+
+/** H.264 reassembly buffer */
+struct h264_reasm {
+	struct reasm_slot slotv[REASM_SLOTS];
+	uint16_t head;      /**< Sequence number of first packet in AU   */
+	uint16_t last;      /**< Highest sequence number received        */
+	unsigned lost;      /**< Access units discarded since last report */
+	unsigned late;      /**< Number of late packets in a row         */
+	bool started;
+	bool resync;        /**< Waiting for the marker of a broken AU   */
+};
+
+
+static inline struct reasm_slot *reasm_slot(struct h264_reasm *ra,
+					    uint16_t seq)
+{
+	return &ra->slotv[seq & (REASM_SLOTS - 1)];
+}
+
+
+static void reasm_reset(struct h264_reasm *ra, uint16_t seq)
+{
+	unsigned i;
+
+	for (i=0; i<REASM_SLOTS; i++)
+		ra->slotv[i].used = false;
+
+	ra->head   = seq;
+	ra->last   = seq;
+	ra->late   = 0;
+	ra->resync = false;
+}
+
+
+/**
+ * Allocate an H.264 reassembly buffer
+ *
+ * @param rap Pointer to allocated reassembly buffer
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int h264_reasm_alloc(struct h264_reasm **rap)
+{
+	struct h264_reasm *ra;
+
+	if (!rap)
+		return EINVAL;
+
+	ra = mem_zalloc(sizeof(*ra), NULL);
+	if (!ra)
+		return ENOMEM;
+
+	*rap = ra;
+
+	return 0;
+}
+
+
+/**
+ * Add an RTP packet to the reassembly buffer
+ *
+ * @param ra     Reassembly buffer
+ * @param marker RTP marker bit, set for the last packet of an AU
+ * @param seq    RTP sequence number
+ * @param src    RTP payload
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int h264_reasm_put(struct h264_reasm *ra, bool marker, uint16_t seq,
+		   const struct mbuf *src)
+{
+	struct reasm_slot *slot;
+	size_t len;
+	int16_t d;
+
+	if (!ra || !src)
+		return EINVAL;
+
+	len = mbuf_get_left(src);
+	if (len > REASM_PKTSZ)
+		return EOVERFLOW;
+
+	if (!ra->started) {
+		reasm_reset(ra, seq);
+		ra->started = true;
+	}
+
+	d = (int16_t)(seq - ra->head);
+
+	/* the sender restarted, or changed its sequence numbers */
+	if (d <= -REASM_SLOTS || d >= REASM_SLOTS) {
+		reasm_reset(ra, seq);
+		++ra->lost;
+		d = 0;
+	}
+	else if (d < 0) {
+
+		/* late packet, the access unit is already gone */
+		if (++ra->late < REASM_WINDOW)
+			return 0;
+
+		reasm_reset(ra, seq);
+		++ra->lost;
+		d = 0;
+	}
+	else {
+		ra->late = 0;
+	}
+
+	if (ra->resync) {
+		if (marker) {
+			ra->head   = seq + 1;
+			ra->last   = seq;
+			ra->resync = false;
+		}
+		return 0;
+	}
+
+	slot = reasm_slot(ra, seq);
+	if (slot->used)
+		return 0;
+
+	memcpy(slot->buf, mbuf_buf(src), len);
+	slot->len    = len;
+	slot->marker = marker;
+	slot->used   = true;
+
+	if ((int16_t)(seq - ra->last) > 0)
+		ra->last = seq;
+
+	return 0;
+}
+
+
+/**
+ * Release the first packets of the reassembly buffer
+ *
+ * @param ra Reassembly buffer
+ * @param n  Number of packets, see h264_reasm_complete()
+ */
+void h264_reasm_release(struct h264_reasm *ra, unsigned n)
+{
+	if (!ra)
+		return;
+
+	while (n--)
+		reasm_slot(ra, ra->head++)->used = false;
+}
+
+
+/**
+ * Get the number of packets in the complete access unit at the head,
+ * or 0 if it is not complete yet. Access units with lost packets are
+ * discarded.
+ *
+ * @param ra Reassembly buffer
+ *
+ * @return Number of packets in the access unit
+ */
+unsigned h264_reasm_complete(struct h264_reasm *ra)
+{
+	if (!ra)
+		return 0;
+
+	while (!ra->resync && ra->started) {
+
+		const unsigned span = (uint16_t)(ra->last - ra->head) + 1;
+		unsigned i, j;
+
+		if (span > REASM_SLOTS)
+			return 0;
+
+		for (i=0; i<span; i++) {
+
+			const struct reasm_slot *slot;
+
+			slot = reasm_slot(ra, ra->head + i);
+			if (!slot->used)
+				break;
+
+			if (slot->marker)
+				return i + 1;
+		}
+
+		if (span - i <= REASM_WINDOW)
+			return 0;
+
+		/* packet is lost, drop until the end of its access unit */
+		for (j=i+1; j<span; j++) {
+
+			const struct reasm_slot *slot;
+
+			slot = reasm_slot(ra, ra->head + j);
+			if (slot->used && slot->marker)
+				break;
+		}
+
+		++ra->lost;
+
+		if (j < span) {
+			h264_reasm_release(ra, j + 1);
+		}
+		else {
+			h264_reasm_release(ra, span);
+			ra->resync = true;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Get a packet of the complete access unit at the head. The buffer
+ * is valid until the packet is released.
+ *
+ * @param ra Reassembly buffer
+ * @param i  Packet index, less than h264_reasm_complete()
+ * @param mb Returned packet payload
+ */
+void h264_reasm_packet(struct h264_reasm *ra, unsigned i, struct mbuf *mb)
+{
+	struct reasm_slot *slot;
+
+	if (!ra || !mb)
+		return;
+
+	slot = reasm_slot(ra, ra->head + i);
+
+	mb->buf = slot->buf;
+	mb->pos = 0;
+	mb->end = mb->size = slot->len;
+}
+
+
+/**
+ * Get and clear the number of access units that were discarded
+ *
+ * @param ra Reassembly buffer
+ *
+ * @return Number of discarded access units
+ */
+unsigned h264_reasm_lost(struct h264_reasm *ra)
+{
+	unsigned lost;
+
+	if (!ra)
+		return 0;
+
+	lost = ra->lost;
+	ra->lost = 0;
+
+	return lost;
+}
@@ -0,0 +1,387 @@
+/**
+ * @file src/json.c  Minimal JSON support, for flat objects
+ *
+ * Copyright (C) 2010 - 2016 Creytiv.com
+ */
+#include <ctype.h>
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+
+
+static const char *json_skip_ws(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' ||
+			   *p == '\r' || *p == '\n'))
+		++p;
+
+	return p;
+}
+
+
+/* Get the escaped content of a JSON string */
+static int json_string(const char **pp, const char *end, struct pl *str)
+{
+	const char *p = *pp;
+
+	if (p >= end || *p != '"')
+		return EBADMSG;
+
+	str->p = ++p;
+
+	while (p < end && *p != '"') {
+
+		if (*p == '\\')
+			++p;
+
+		++p;
+	}
+
+	if (p >= end)
+		return EBADMSG;
+
+	str->l = p - str->p;
+	*pp = p + 1;
+
+	return 0;
+}
+
+
+/**
+ * Check that a literal value is a JSON number
+ *
+ * @param pl Literal value
+ *
+ * @return True if a valid number, otherwise false
+ */
+bool json_is_number(const struct pl *pl)
+{
+	const char *p = pl->p, *end = pl->p + pl->l;
+	const char *d;
+
+	if (p < end && *p == '-')
+		++p;
+
+	/* integer part, without leading zeros */
+	for (d = p; p < end && isdigit((unsigned char)*p); ++p)
+		;
+	if (p == d || (*d == '0' && p - d > 1))
+		return false;
+
+	if (p < end && *p == '.') {
+		for (d = ++p; p < end && isdigit((unsigned char)*p); ++p)
+			;
+		if (p == d)
+			return false;
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		++p;
+		if (p < end && (*p == '+' || *p == '-'))
+			++p;
+		for (d = p; p < end && isdigit((unsigned char)*p); ++p)
+			;
+		if (p == d)
+			return false;
+	}
+
+	return p == end;
+}
+
+
+static bool json_is_literal(const struct pl *pl)
+{
+	return json_is_number(pl) || !pl_strcmp(pl, "true") ||
+		!pl_strcmp(pl, "false") || !pl_strcmp(pl, "null");
+}
+
+
+/**
+ * Decode a flat JSON object. Values that are objects or arrays are not
+ * supported. String values are passed to the handler with their escapes,
+ * see json_unescape().
+ *
+ * @param pl  JSON text
+ * @param mh  Handler called for each member
+ * @param arg Handler argument
+ *
+ * @return 0 if success, EPROTO if nested, otherwise errorcode
+ */
+int json_decode_flat(const struct pl *pl, json_member_h *mh, void *arg)
+{
+	const char *p = pl->p, *end = pl->p + pl->l;
+	int err;
+
+	p = json_skip_ws(p, end);
+	if (p >= end || *p++ != '{')
+		return EBADMSG;
+
+	p = json_skip_ws(p, end);
+	if (p < end && *p == '}') {
+		++p;
+		goto out;
+	}
+
+	for (;;) {
+		enum json_type type;
+		struct pl key, val;
+
+		err = json_string(&p, end, &key);
+		if (err)
+			return err;
+
+		p = json_skip_ws(p, end);
+		if (p >= end || *p++ != ':')
+			return EBADMSG;
+
+		p = json_skip_ws(p, end);
+		if (p >= end)
+			return EBADMSG;
+
+		if (*p == '"') {
+			type = JSON_STRING;
+			err = json_string(&p, end, &val);
+			if (err)
+				return err;
+		}
+		else if (*p == '{' || *p == '[') {
+			return EPROTO;
+		}
+		else {
+			type = JSON_LITERAL;
+			val.p = p;
+			while (p < end && !strchr(",} \t\r\n", *p))
+				++p;
+			val.l = p - val.p;
+
+			if (!json_is_literal(&val))
+				return EBADMSG;
+		}
+
+		err = mh(&key, type, &val, arg);
+		if (err)
+			return err;
+
+		p = json_skip_ws(p, end);
+		if (p >= end)
+			return EBADMSG;
+
+		if (*p == '}') {
+			++p;
+			break;
+		}
+		else if (*p++ != ',') {
+			return EBADMSG;
+		}
+
+		p = json_skip_ws(p, end);
+	}
+
+ out:
+	return json_skip_ws(p, end) == end ? 0 : EBADMSG;
+}
+
+
+static int utf8_write(char **pp, char *end, uint32_t u)
+{
+	char *p = *pp;
+
+	if (u < 0x80) {
+		if (end - p < 1)
+			return ENOMEM;
+		*p++ = (char)u;
+	}
+	else if (u < 0x800) {
+		if (end - p < 2)
+			return ENOMEM;
+		*p++ = (char)(0xc0 | (u >> 6));
+		*p++ = (char)(0x80 | (u & 0x3f));
+	}
+	else {
+		if (end - p < 3)
+			return ENOMEM;
+		*p++ = (char)(0xe0 | (u >> 12));
+		*p++ = (char)(0x80 | ((u >> 6) & 0x3f));
+		*p++ = (char)(0x80 | (u & 0x3f));
+	}
+
+	*pp = p;
+
+	return 0;
+}
+
+
+/**
+ * Unescape a JSON string into a NULL-terminated buffer
+ *
+ * @param buf Buffer for the unescaped string
+ * @param sz  Size of the buffer
+ * @param str Escaped content of the JSON string
+ *
+ * @return 0 if success, ENOMEM if too long, otherwise errorcode
+ */
+int json_unescape(char *buf, size_t sz, const struct pl *str)
+{
+	const char *s = str->p, *send = str->p + str->l;
+	char *p = buf, *end = buf + sz - 1;
+	struct pl hex;
+	uint32_t u;
+	int i, err;
+
+	if (!sz)
+		return EINVAL;
+
+	while (s < send) {
+
+		char ch = *s++;
+
+		if (ch == '\\') {
+
+			if (s >= send)
+				return EBADMSG;
+
+			switch (ch = *s++) {
+
+			case 'b': ch = '\b'; break;
+			case 'f': ch = '\f'; break;
+			case 'n': ch = '\n'; break;
+			case 'r': ch = '\r'; break;
+			case 't': ch = '\t'; break;
+			case '"':
+			case '\\':
+			case '/':
+				break;
+
+			case 'u':
+				if (send - s < 4)
+					return EBADMSG;
+
+				for (i=0; i<4; i++) {
+					if (!isxdigit((unsigned char)s[i]))
+						return EBADMSG;
+				}
+
+				hex.p = s;
+				hex.l = 4;
+				u = pl_x32(&hex);
+
+				/* U+0000 would truncate the string */
+				if (!u)
+					return EBADMSG;
+
+				err = utf8_write(&p, end, u);
+				if (err)
+					return err;
+
+				s += 4;
+				continue;
+
+			default:
+				return EBADMSG;
+			}
+		}
+
+		if (p >= end)
+			return ENOMEM;
+
+		*p++ = ch;
+	}
+
+	*p = '\0';
+
+	return 0;
+}
+
+
+/**
+ * Print a string as a JSON string, or null
+ *
+ * @param pf  Print function
+ * @param str NULL-terminated string, or NULL
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int json_encode_str(struct re_printf *pf, const char *str)
+{
+	int err = 0;
+
+	if (!str)
+		return re_hprintf(pf, "null");
+
+	err |= re_hprintf(pf, "\"");
+
+	for (; *str && !err; str++) {
+
+		const unsigned char ch = *str;
+
+		switch (ch) {
+
+		case '"':  err = re_hprintf(pf, "\\\""); break;
+		case '\\': err = re_hprintf(pf, "\\\\"); break;
+		case '\n': err = re_hprintf(pf, "\\n");  break;
+		case '\r': err = re_hprintf(pf, "\\r");  break;
+		case '\t': err = re_hprintf(pf, "\\t");  break;
+
+		default:
+			if (ch < 0x20)
+				err = re_hprintf(pf, "\\u%04x", ch);
+			else
+				err = re_hprintf(pf, "%c", ch);
+			break;
+		}
+	}
+
+	err |= re_hprintf(pf, "\"");
+
+	return err;
+}
+
+
+/**
+ * Decode the complete lines of newline-delimited JSON in a buffer.
+ * Blank lines are skipped, and the incomplete last line is kept at
+ * the start of the buffer.
+ *
+ * @param mb     Buffer with received data, from the start
+ * @param maxlen Maximum length of the incomplete line
+ * @param lh     Handler called for each line
+ * @param arg    Handler argument
+ *
+ * @return 0 if success, EOVERFLOW if the incomplete line is too long,
+ *         otherwise the error of the line handler
+ */
+int json_decode_lines(struct mbuf *mb, size_t maxlen, json_line_h *lh,
+		      void *arg)
+{
+	size_t start = 0;
+	uint8_t *nl;
+	int err = 0;
+
+	if (!mb || !lh)
+		return EINVAL;
+
+	while ((nl = memchr(mb->buf + start, '\n', mb->end - start))) {
+
+		struct pl line;
+
+		line.p = (char *)mb->buf + start;
+		line.l = nl - (mb->buf + start);
+		start += line.l + 1;
+
+		if (json_skip_ws(line.p, line.p + line.l) == line.p + line.l)
+			continue;
+
+		err = lh(&line, arg);
+		if (err)
+			return err;
+	}
+
+	memmove(mb->buf, mb->buf + start, mb->end - start);
+	mb->end -= start;
+	mb->pos = 0;
+
+	if (mb->end > maxlen)
+		return EOVERFLOW;
+
+	return 0;
+}
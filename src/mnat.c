@@ -61,6 +61,29 @@ int mnat_register(struct mnat **mnatp, const char *id, const char *ftag,
 }
 
 
+/**
+ * Enable Trickle ICE (RFC 8840) for a Media NAT module
+ *
+ * @param mnat     Media NAT module
+ * @param trickleh Handler to enable trickling for a session, returns
+ *                 ENOTSUP if trickling is not used for the session
+ * @param fragh    Handler for incoming SDP fragments from the peer
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mnat_register_trickle(struct mnat *mnat, mnat_trickle_h *trickleh,
+			  mnat_sdpfrag_h *fragh)
+{
+	if (!mnat || !trickleh || !fragh)
+		return EINVAL;
+
+	mnat->trickleh = trickleh;
+	mnat->fragh    = fragh;
+
+	return 0;
+}
+
+
 /**
  * Find a Media NAT module by name
  *
@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
 #include "core.h"
@@ -13,8 +14,17 @@ struct modapp {
 	struct le le;
 };
 
+/** Module that is loaded the first time one of its types is needed */
+struct modlazy {
+	struct le le;
+	char *path;     /**< Module path                         */
+	char *name;     /**< Module name                         */
+	char *types;    /**< Comma-separated list of module types */
+};
+
 
 static struct list modappl;
+static struct list lazyl;
 
 
 static void modapp_destructor(void *arg)
@@ -25,6 +35,17 @@ static void modapp_destructor(void *arg)
 }
 
 
+static void modlazy_destructor(void *arg)
+{
+	struct modlazy *ml = arg;
+
+	list_unlink(&ml->le);
+	mem_deref(ml->path);
+	mem_deref(ml->name);
+	mem_deref(ml->types);
+}
+
+
 #ifdef STATIC
 
 /* Declared in static.c */
@@ -54,6 +75,7 @@ static const struct mod_export *find_module(const struct pl *pl)
 static int load_module(struct mod **modp, const struct pl *modpath,
 		       const struct pl *name)
 {
+	const uint64_t t0 = tmr_jiffies();
 	char file[256];
 	struct mod *m = NULL;
 	int err = 0;
@@ -81,8 +103,13 @@ static int load_module(struct mod **modp, const struct pl *modpath,
 	if (err) {
 		warning("module %r: %m\n", name, err);
 	}
-	else if (modp)
-		*modp = m;
+	else {
+		debug("module %r: loaded in %u ms\n", name,
+		      (unsigned)(tmr_jiffies() - t0));
+
+		if (modp)
+			*modp = m;
+	}
 
 	return err;
 }
@@ -123,8 +150,101 @@ static int module_app_handler(const struct pl *val, void *arg)
 }
 
 
+/*
+ * Register a module to be loaded later, format:
+ *
+ *   module_lazy  <module>  <type>[,<type>...]
+ */
+static int module_lazy_handler(const struct pl *val, void *arg)
+{
+	const struct pl *path = arg;
+	struct pl name, types;
+	struct modlazy *ml;
+	int err;
+
+	if (re_regex(val->p, val->l, "[^ \t]+[ \t]+[^ \t]+",
+		     &name, NULL, &types)) {
+		warning("module: invalid module_lazy: %r\n", val);
+		return 0;
+	}
+
+	ml = mem_zalloc(sizeof(*ml), modlazy_destructor);
+	if (!ml)
+		return ENOMEM;
+
+	err  = pl_strdup(&ml->path, path);
+	err |= pl_strdup(&ml->name, &name);
+	err |= pl_strdup(&ml->types, &types);
+	if (err) {
+		mem_deref(ml);
+		return err;
+	}
+
+	list_append(&lazyl, &ml->le, ml);
+
+	return 0;
+}
+
+
+static bool has_type(const char *types, const char *type)
+{
+	const size_t len = str_len(type);
+	const char *p = types;
+
+	while (p) {
+
+		if (0 == strncmp(p, type, len) &&
+		    (p[len] == ',' || p[len] == '\0'))
+			return true;
+
+		p = strchr(p, ',');
+		if (p)
+			++p;
+	}
+
+	return false;
+}
+
+
+/**
+ * Load all lazy modules that provide a module type. Must be called
+ * before looking up an object of that type.
+ *
+ * @param type Module type, e.g. "vidcodec" or "ausrc"
+ */
+void module_lazy_load(const char *type)
+{
+	struct le *le = lazyl.head;
+
+	while (le) {
+
+		struct modlazy *ml = le->data;
+		struct pl path, name;
+
+		if (!has_type(ml->types, type)) {
+			le = le->next;
+			continue;
+		}
+
+		/* unlink first, the module init may do lookups */
+		list_unlink(&ml->le);
+
+		debug("module: loading %s for %s\n", ml->name, type);
+
+		pl_set_str(&path, ml->path);
+		pl_set_str(&name, ml->name);
+		(void)load_module(NULL, &path, &name);
+
+		mem_deref(ml);
+
+		le = lazyl.head;
+	}
+}
+
+
 int module_init(const struct conf *conf)
 {
+	const uint64_t t0 = tmr_jiffies();
 	struct pl path;
 	int err;
 
@@ -138,6 +258,10 @@ int module_init(const struct conf *conf)
 	if (err)
 		return err;
 
+	err = conf_apply(conf, "module_lazy", module_lazy_handler, &path);
+	if (err)
+		return err;
+
 	err = conf_apply(conf, "module_tmp", module_tmp_handler, &path);
 	if (err)
 		return err;
@@ -146,6 +270,9 @@ int module_init(const struct conf *conf)
 	if (err)
 		return err;
 
+	debug("module: startup in %u ms (%u lazy modules)\n",
+	      (unsigned)(tmr_jiffies() - t0), list_count(&lazyl));
+
 	return 0;
 }
 
@@ -153,6 +280,7 @@ int module_init(const struct conf *conf)
 void module_app_unload(void)
 {
 	list_flush(&modappl);
+	list_flush(&lazyl);
 }
 
 
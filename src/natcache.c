@@ -0,0 +1,534 @@
+/**
+ * @file natcache.c  Cache of NAT discovery and server resolution
+ *
+ * Copyright (C) 2010 - 2016 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The STUN/TURN servers used by the media NAT modules are resolved
+ * once, and kept for all calls. The cache is keyed by the server name,
+ * port, usage, transport and address family. For STUN servers the
+ * mapped address of the local interface is also kept, with a STUN
+ * keepalive from a socket bound to that interface.
+ *
+ * All entries are refreshed in the background with a timer, and
+ * when the local network changes. Callers that look up a server which
+ * is still being resolved wait for the query of the cache. Entries
+ * that are not used for a refresh interval are dropped.
+ */
+
+
+enum {
+	NATCACHE_REFRESH  = 600,  /**< Refresh interval [s]              */
+	NATCACHE_KEEPALIVE = 120, /**< Mapped address refresh [s]        */
+};
+
+/** A cached server */
+struct natcache_srv {
+	struct le le;
+	char *host;                 /**< Server name                     */
+	const char *usage;          /**< STUN usage                      */
+	const char *proto;          /**< STUN transport                  */
+	uint16_t port;              /**< Server port (optional)          */
+	int af;                     /**< Address family                  */
+	struct sa srv;              /**< Resolved server address         */
+	bool valid;                 /**< Server address is resolved      */
+	struct stun_dns *dnsq;      /**< Pending DNS query               */
+	struct list queryl;         /**< Waiting callers                 */
+	bool resolving;             /**< DNS query is running            */
+	uint64_t used;              /**< Time of last use [ms]           */
+	struct udp_sock *us;        /**< Socket on the local interface   */
+	struct stun_keepalive *ska; /**< Mapped address discovery        */
+	struct sa laddr;            /**< Local address of the socket     */
+	struct sa map;              /**< Mapped address of the socket    */
+	uint32_t hits;
+	uint32_t misses;
+};
+
+/** A caller waiting for a server to be resolved */
+struct natcache_query {
+	struct le le;
+	stun_dns_h *dnsh;
+	void *arg;
+};
+
+static struct {
+	struct list srvl;
+	struct tmr tmr;
+} natcache;
+
+
+static void query_destructor(void *arg)
+{
+	struct natcache_query *q = arg;
+
+	list_unlink(&q->le);
+}
+
+
+static void srv_destructor(void *arg)
+{
+	struct natcache_srv *e = arg;
+	struct le *le;
+
+	/* the queries are owned by the callers */
+	while ((le = e->queryl.head))
+		list_unlink(le);
+
+	list_unlink(&e->le);
+	mem_deref(e->ska);
+	mem_deref(e->us);
+	mem_deref(e->dnsq);
+	mem_deref(e->host);
+}
+
+
+static struct natcache_srv *srv_find(const char *usage, const char *proto,
+				     int af, const char *host,
+				     uint16_t port)
+{
+	struct le *le;
+
+	for (le = natcache.srvl.head; le; le = le->next) {
+		struct natcache_srv *e = le->data;
+
+		if (e->af == af && e->port == port &&
+		    0 == str_casecmp(e->host, host) &&
+		    0 == str_casecmp(e->usage, usage) &&
+		    0 == str_casecmp(e->proto, proto))
+			return e;
+	}
+
+	return NULL;
+}
+
+
+static void udp_recv_handler(const struct sa *src, struct mbuf *mb,
+			     void *arg)
+{
+	(void)src;
+	(void)mb;
+	(void)arg;
+}
+
+
+static void mapped_handler(int err, const struct sa *map, void *arg)
+{
+	struct natcache_srv *e = arg;
+
+	if (err) {
+		warning("natcache: %s: mapped address: %m\n", e->host, err);
+		sa_init(&e->map, AF_UNSPEC);
+		return;
+	}
+
+	if (!sa_cmp(&e->map, map, SA_ALL)) {
+		info("natcache: %s: mapped address %J (local %J)\n",
+		     e->host, map, &e->laddr);
+	}
+
+	e->map = *map;
+}
+
+
+/* Discover the mapped address of the current local interface */
+static int map_start(struct natcache_srv *e)
+{
+	const struct sa *laddr;
+	struct sa local;
+	int err;
+
+	e->ska = mem_deref(e->ska);
+	e->us  = mem_deref(e->us);
+	sa_init(&e->map, AF_UNSPEC);
+
+	if (str_casecmp(e->usage, stun_usage_binding) ||
+	    str_casecmp(e->proto, stun_proto_udp))
+		return 0;
+
+	laddr = net_laddr_af(baresip_network(), e->af);
+	if (!sa_isset(laddr, SA_ADDR))
+		return EADDRNOTAVAIL;
+
+	sa_cpy(&local, laddr);
+	sa_set_port(&local, 0);
+
+	err = udp_listen(&e->us, &local, udp_recv_handler, e);
+	if (err)
+		return err;
+
+	err = udp_local_get(e->us, &e->laddr);
+	if (err)
+		return err;
+
+	err = stun_keepalive_alloc(&e->ska, IPPROTO_UDP, e->us, 0,
+				   &e->srv, NULL, mapped_handler, e);
+	if (err)
+		return err;
+
+	stun_keepalive_enable(e->ska, NATCACHE_KEEPALIVE);
+
+	return 0;
+}
+
+
+/* Answer all waiting callers, they may deref the query in the handler */
+static void query_complete(struct natcache_srv *e, int err)
+{
+	struct le *le;
+
+	while ((le = e->queryl.head)) {
+		struct natcache_query *q = le->data;
+
+		list_unlink(le);
+		q->dnsh(err, err ? NULL : &e->srv, q->arg);
+	}
+}
+
+
+static void dns_handler(int err, const struct sa *srv, void *arg)
+{
+	struct natcache_srv *e = arg;
+
+	e->resolving = false;
+
+	if (err) {
+		warning("natcache: could not resolve %s (%m)\n",
+			e->host, err);
+		query_complete(e, err);
+		return;
+	}
+
+	if (e->valid && sa_cmp(&e->srv, srv, SA_ALL) && e->ska &&
+	    sa_cmp(&e->laddr, net_laddr_af(baresip_network(), e->af),
+		   SA_ADDR)) {
+		/* no change, the keepalive refreshes the mapping */
+		query_complete(e, 0);
+		return;
+	}
+
+	info("natcache: %s: %s-server at %J\n", e->host, e->usage, srv);
+
+	e->srv   = *srv;
+	e->valid = true;
+
+	err = map_start(e);
+	if (err) {
+		warning("natcache: %s: mapped address discovery failed"
+			" (%m)\n", e->host, err);
+	}
+
+	query_complete(e, 0);
+}
+
+
+static int srv_resolve(struct natcache_srv *e, struct dnsc *dnsc)
+{
+	int err;
+
+	if (!dnsc)
+		return ENOENT;
+
+	e->dnsq = mem_deref(e->dnsq);
+	e->resolving = true;
+
+	/* the handler may be called directly for a numeric host */
+	err = stun_server_discover(&e->dnsq, dnsc, e->usage, e->proto,
+				   e->af, e->host, e->port,
+				   dns_handler, e);
+	if (err)
+		e->resolving = false;
+
+	return err;
+}
+
+
+static void refresh(bool netchange)
+{
+	struct le *le;
+
+	for (le = natcache.srvl.head; le; le = le->next) {
+		struct natcache_srv *e = le->data;
+
+		/* the old mapping is not valid for a new interface */
+		if (netchange)
+			sa_init(&e->map, AF_UNSPEC);
+
+		(void)srv_resolve(e, net_dnsc(baresip_network()));
+	}
+}
+
+
+/* Drop the servers that were not used since the last refresh */
+static void expire(void)
+{
+	const uint64_t now = tmr_jiffies();
+	struct le *le = natcache.srvl.head;
+
+	while (le) {
+		struct natcache_srv *e = le->data;
+
+		le = le->next;
+
+		if (list_isempty(&e->queryl) &&
+		    now - e->used >= NATCACHE_REFRESH * 1000) {
+			debug("natcache: %s: unused, dropped\n", e->host);
+			mem_deref(e);
+		}
+	}
+}
+
+
+static void tmr_handler(void *arg)
+{
+	(void)arg;
+
+	expire();
+
+	if (list_isempty(&natcache.srvl))
+		return;
+
+	tmr_start(&natcache.tmr, NATCACHE_REFRESH * 1000, tmr_handler, NULL);
+
+	refresh(false);
+}
+
+
+static int srv_alloc(struct natcache_srv **ep, const char *usage,
+		     const char *proto, int af, const char *host,
+		     uint16_t port)
+{
+	struct natcache_srv *e;
+	int err;
+
+	e = mem_zalloc(sizeof(*e), srv_destructor);
+	if (!e)
+		return ENOMEM;
+
+	err = str_dup(&e->host, host);
+	if (err)
+		goto out;
+
+	e->usage = usage;
+	e->proto = proto;
+	e->af    = af;
+	e->port  = port;
+	e->used  = tmr_jiffies();
+
+	list_append(&natcache.srvl, &e->le, e);
+
+	if (!tmr_isrunning(&natcache.tmr))
+		tmr_start(&natcache.tmr, NATCACHE_REFRESH * 1000,
+			  tmr_handler, NULL);
+
+ out:
+	if (err)
+		mem_deref(e);
+	else
+		*ep = e;
+
+	return err;
+}
+
+
+/**
+ * Resolve a STUN/TURN server, using the cached address if possible.
+ * For a cached server the handler is called directly, and no query is
+ * returned. Otherwise the caller waits for the query of the cache,
+ * until the returned query is dereferenced.
+ *
+ * @param qp      Pointer to allocated query (if not cached)
+ * @param dnsc    DNS client
+ * @param usage   STUN usage
+ * @param proto   STUN transport
+ * @param af      Address family
+ * @param host    Server name or address
+ * @param port    Server port (optional)
+ * @param dnsh    Handler called with the server address
+ * @param arg     Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int natcache_server_discover(struct natcache_query **qp, struct dnsc *dnsc,
+			     const char *usage, const char *proto,
+			     int af, const char *host, uint16_t port,
+			     stun_dns_h *dnsh, void *arg)
+{
+	struct natcache_query *q;
+	struct natcache_srv *e;
+	int err;
+
+	if (!qp || !usage || !proto || !host || !dnsh)
+		return EINVAL;
+
+	e = srv_find(usage, proto, af, host, port);
+	if (e && e->valid) {
+		++e->hits;
+		e->used = tmr_jiffies();
+		dnsh(0, &e->srv, arg);
+		return 0;
+	}
+
+	if (!e) {
+		err = srv_alloc(&e, usage, proto, af, host, port);
+		if (err)
+			return err;
+	}
+
+	++e->misses;
+	e->used = tmr_jiffies();
+
+	q = mem_zalloc(sizeof(*q), query_destructor);
+	if (!q)
+		return ENOMEM;
+
+	q->dnsh = dnsh;
+	q->arg  = arg;
+
+	list_append(&e->queryl, &q->le, q);
+	*qp = q;
+
+	if (!e->resolving) {
+		err = srv_resolve(e, dnsc);
+		if (err) {
+			*qp = mem_deref(q);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Resolve a STUN server in the background, so that the first call
+ * can use the cached server and mapped address
+ *
+ * @param af   Address family
+ * @param host STUN server name or address
+ * @param port STUN server port (optional)
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int natcache_prefetch(int af, const char *host, uint16_t port)
+{
+	struct natcache_srv *e;
+	int err;
+
+	if (!host)
+		return EINVAL;
+
+	if (srv_find(stun_usage_binding, stun_proto_udp, af, host, port))
+		return 0;
+
+	err = srv_alloc(&e, stun_usage_binding, stun_proto_udp,
+			af, host, port);
+	if (err)
+		return err;
+
+	return srv_resolve(e, net_dnsc(baresip_network()));
+}
+
+
+/**
+ * Get the cached mapped address of the local interface, as seen by
+ * a STUN server
+ *
+ * @param map   Returned mapped address
+ * @param laddr Returned local address, the same as map if there is no NAT
+ * @param af    Address family
+ * @param host  STUN server name or address
+ * @param port  STUN server port (optional)
+ *
+ * @return 0 if success, ENOENT if not known
+ */
+int natcache_mapped(struct sa *map, struct sa *laddr, int af,
+		    const char *host, uint16_t port)
+{
+	struct natcache_srv *e;
+
+	if (!map || !laddr || !host)
+		return EINVAL;
+
+	e = srv_find(stun_usage_binding, stun_proto_udp, af, host, port);
+	if (!e)
+		return ENOENT;
+
+	e->used = tmr_jiffies();
+
+	if (!sa_isset(&e->map, SA_ALL))
+		return ENOENT;
+
+	/* the mapping is only valid for the current interface */
+	if (!sa_cmp(&e->laddr, net_laddr_af(baresip_network(), af), SA_ADDR))
+		return ENOENT;
+
+	*map   = e->map;
+	*laddr = e->laddr;
+
+	return 0;
+}
+
+
+/**
+ * Refresh all cached servers and mapped addresses, when the local
+ * network has changed
+ */
+void natcache_net_change(void)
+{
+	refresh(true);
+}
+
+
+void natcache_close(void)
+{
+	tmr_cancel(&natcache.tmr);
+	list_flush(&natcache.srvl);
+}
+
+
+/**
+ * Print the NAT cache
+ *
+ * @param pf     Print handler for debug output
+ * @param unused Unused parameter
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int natcache_debug(struct re_printf *pf, void *unused)
+{
+	struct le *le;
+	int err;
+
+	(void)unused;
+
+	err = re_hprintf(pf, "--- NAT cache (%u) ---\n",
+			 list_count(&natcache.srvl));
+
+	for (le = natcache.srvl.head; le; le = le->next) {
+		const struct natcache_srv *e = le->data;
+
+		err |= re_hprintf(pf, " %s:%u (%s/%s)\n", e->host, e->port,
+				  e->usage, e->proto);
+
+		if (e->valid)
+			err |= re_hprintf(pf, "   server: %J\n", &e->srv);
+		else
+			err |= re_hprintf(pf, "   server: (resolving)\n");
+
+		if (sa_isset(&e->map, SA_ALL)) {
+			err |= re_hprintf(pf, "   mapped: %J (local %J)\n",
+					  &e->map, &e->laddr);
+		}
+
+		err |= re_hprintf(pf, "   hits:   %u, misses %u\n",
+				  e->hits, e->misses);
+	}
+
+	return err;
+}
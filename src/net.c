@@ -18,6 +18,7 @@ struct network {
 #endif
 	struct tmr tmr;
 	struct dnsc *dnsc;
+	struct dnscache *cache; /**< Local DNS cache (optional)     */
 	struct sa nsv[NET_MAX_NS];/**< Configured name servers      */
 	uint32_t nsn;        /**< Number of configured name servers */
 	uint32_t interval;
@@ -101,7 +102,10 @@ static void dns_refresh(struct network *net)
 	if (err)
 		return;
 
-	(void)dnsc_srv_set(net->dnsc, nsv, nsn);
+	if (net->cache)
+		(void)dnscache_srv_set(net->cache, nsv, nsn);
+	else
+		(void)dnsc_srv_set(net->dnsc, nsv, nsn);
 }
 
 
@@ -189,6 +193,17 @@ static int dns_init(struct network *net)
 	if (err)
 		return err;
 
+	if (net->cfg.dns_cache) {
+
+		err = dnscache_alloc(&net->cache, nsv, nsn);
+		if (!err) {
+			return dnsc_alloc(&net->dnsc, NULL,
+					  dnscache_addr(net->cache), 1);
+		}
+
+		warning("net: dns cache disabled (%m)\n", err);
+	}
+
 	return dnsc_alloc(&net->dnsc, NULL, nsv, nsn);
 }
 
@@ -210,6 +225,7 @@ static void net_destructor(void *data)
 
 	tmr_cancel(&net->tmr);
 	mem_deref(net->dnsc);
+	mem_deref(net->cache);
 }
 
 
@@ -376,7 +392,8 @@ int net_alloc(struct network **netp, const struct config_net *cfg, int af)
 
 
 /**
- * Use a specific DNS server
+ * Use a specific DNS server. The DNS cache is kept, and uses the
+ * DNS server for new queries.
  *
  * @param net Network instance
  * @param ns  DNS Server IP address and port
@@ -391,6 +408,9 @@ int net_use_nameserver(struct network *net, const struct sa *ns)
 	if (!net || !ns)
 		return EINVAL;
 
+	if (net->cache)
+		return dnscache_srv_set(net->cache, ns, 1);
+
 	err = dnsc_alloc(&dnsc, NULL, ns, 1);
 	if (err)
 		return err;
@@ -498,6 +518,8 @@ int net_debug(struct re_printf *pf, const struct network *net)
 
 	err |= dns_debug(pf, net);
 
+	err |= dnscache_debug(pf, net->cache);
+
 	return err;
 }
 
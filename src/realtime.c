@@ -3,6 +3,9 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#ifndef WIN32
+#include <time.h>
+#endif
 #include <re.h>
 #include <baresip.h>
 #ifdef DARWIN
@@ -98,3 +101,22 @@ int realtime_enable(bool enable, int fps)
 	return ENOSYS;
 #endif
 }
+
+
+/**
+ * Get a monotonic timestamp with microsecond resolution, e.g. for
+ * measuring the processing time of a codec
+ *
+ * @return Timestamp in [us]
+ */
+uint64_t realtime_clock_us(void)
+{
+#if defined (CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	if (0 == clock_gettime(CLOCK_MONOTONIC, &ts))
+		return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+
+	return tmr_jiffies() * 1000;
+}
@@ -20,16 +20,108 @@ struct reg {
 	char *srv;                   /**< SIP Server id                      */
 	int sipfd;                   /**< Cached file-descr. for SIP conn    */
 	int af;                      /**< Cached address family for SIP conn */
+
+	/* scheduler: */
+	struct le sched_le;          /**< Element in scheduler queue         */
+	char *uri;                   /**< Registrar URI                      */
+	char *params;                /**< Contact parameters                 */
+	char *outbound;              /**< Outbound proxy (optional)          */
+	uint32_t regint;             /**< Registration interval in [seconds] */
+	uint64_t queued;             /**< Time when queued in [ms]           */
+	uint64_t due;                /**< Scheduled start time in [ms]       */
+	uint64_t sent;               /**< Time when started in [ms]          */
+	uint64_t expires;            /**< Expiry of current binding in [ms]  */
+	bool inflight;               /**< Waiting for the first response     */
 };
 
 
+/**
+ * Registration scheduler
+ *
+ * All REGISTER requests started by reg_register() are queued, and
+ * started in order of their due time. The number of REGISTER requests
+ * waiting for a response, and the number of requests started per
+ * second, are limited by the sip_reg_inflight and sip_reg_rate config.
+ * Queued requests are spread out with a random delay that grows with
+ * the backlog, and a client whose binding is about to expire is moved
+ * to the front.
+ */
+static struct {
+	struct list pendl;           /**< Queued register clients            */
+	struct tmr tmr;              /**< Scheduler timer                    */
+	uint32_t pending;            /**< Number of queued register clients  */
+	uint32_t inflight;           /**< REGISTERs waiting for a response   */
+	uint64_t win_start;          /**< Start of current rate window [ms]  */
+	uint32_t win_count;          /**< REGISTERs started in rate window   */
+	uint32_t started;            /**< Total REGISTERs started            */
+	uint32_t completed;          /**< Total REGISTERs completed          */
+	uint64_t lat_sum;            /**< Sum of REGISTER latency in [ms]    */
+	uint32_t lat_max;            /**< Max REGISTER latency in [ms]       */
+	uint32_t wait_max;           /**< Max time in queue in [ms]          */
+} sched;
+
+
+static void sched_timeout(void *arg);
+
+
+static void sched_kick(void)
+{
+	if (sched.pendl.head)
+		tmr_start(&sched.tmr, 0, sched_timeout, NULL);
+}
+
+
+/* Remove a register client from the queue and the in-flight count */
+static void sched_remove(struct reg *reg)
+{
+	if (reg->sched_le.list) {
+		list_unlink(&reg->sched_le);
+		--sched.pending;
+	}
+
+	if (reg->inflight) {
+		reg->inflight = false;
+		--sched.inflight;
+		sched_kick();
+	}
+
+	if (!sched.pendl.head)
+		tmr_cancel(&sched.tmr);
+}
+
+
+static void sched_insert(struct reg *reg)
+{
+	struct le *le;
+
+	++sched.pending;
+
+	for (le = sched.pendl.tail; le; le = le->prev) {
+
+		const struct reg *r = le->data;
+
+		if (r->due <= reg->due) {
+			list_insert_after(&sched.pendl, le,
+					  &reg->sched_le, reg);
+			return;
+		}
+	}
+
+	list_prepend(&sched.pendl, &reg->sched_le, reg);
+}
+
+
 static void destructor(void *arg)
 {
 	struct reg *reg = arg;
 
 	list_unlink(&reg->le);
+	sched_remove(reg);
 	mem_deref(reg->sipreg);
 	mem_deref(reg->srv);
+	mem_deref(reg->uri);
+	mem_deref(reg->params);
+	mem_deref(reg->outbound);
 }
 
 
@@ -119,15 +211,30 @@ static void register_handler(int err, const struct sip_msg *msg, void *arg)
 	struct reg *reg = arg;
 	const struct sip_hdr *hdr;
 
+	if (reg->inflight) {
+		const uint32_t lat = (uint32_t)(tmr_jiffies() - reg->sent);
+
+		reg->inflight = false;
+		--sched.inflight;
+		++sched.completed;
+		sched.lat_sum += lat;
+		sched.lat_max  = max(sched.lat_max, lat);
+
+		sched_kick();
+	}
+
 	if (err) {
 		warning("reg: %s: Register: %m\n", ua_aor(reg->ua), err);
 
-		reg->scode = 999;
+		reg->scode   = 999;
+		reg->expires = 0;
 
 		ua_event(reg->ua, UA_EVENT_REGISTER_FAIL, NULL, "%m", err);
 		return;
 	}
 
+	sipflow_msg(reg->outbound, msg);
+
 	hdr = sip_msg_hdr(msg, SIP_HDR_SERVER);
 	if (hdr) {
 		reg->srv = mem_deref(reg->srv);
@@ -151,7 +258,8 @@ static void register_handler(int err, const struct sip_msg *msg, void *arg)
 				  1==n_bindings?"":"s");
 		}
 
-		reg->scode = msg->scode;
+		reg->scode   = msg->scode;
+		reg->expires = tmr_jiffies() + reg->regint * 1000ULL;
 
 		hdr = sip_msg_hdr_apply(msg, true, SIP_HDR_CONTACT,
 					contact_handler, reg);
@@ -174,8 +282,9 @@ static void register_handler(int err, const struct sip_msg *msg, void *arg)
 		warning("reg: %s: %u %r (%s)\n", ua_aor(reg->ua),
 			msg->scode, &msg->reason, reg->srv);
 
-		reg->scode = msg->scode;
-		reg->sipfd = -1;
+		reg->scode   = msg->scode;
+		reg->sipfd   = -1;
+		reg->expires = 0;
 
 		ua_event(reg->ua, UA_EVENT_REGISTER_FAIL, NULL, "%u %r",
 			 msg->scode, &msg->reason);
@@ -204,32 +313,149 @@ int reg_add(struct list *lst, struct ua *ua, int regid)
 }
 
 
-int reg_register(struct reg *reg, const char *reg_uri, const char *params,
-		 uint32_t regint, const char *outbound)
+static void reg_start(struct reg *reg, uint64_t now)
 {
 	const char *routev[1];
 	int err;
 
-	if (!reg || !reg_uri)
-		return EINVAL;
+	sched.wait_max = max(sched.wait_max, (uint32_t)(now - reg->queued));
 
-	reg->scode = 0;
-	routev[0] = outbound;
+	routev[0] = reg->outbound;
 
 	reg->sipreg = mem_deref(reg->sipreg);
-	err = sipreg_register(&reg->sipreg, uag_sip(), reg_uri,
+	err = sipreg_register(&reg->sipreg, uag_sip(), reg->uri,
 			      ua_aor(reg->ua), ua_aor(reg->ua),
-			      regint, ua_local_cuser(reg->ua),
+			      reg->regint, ua_local_cuser(reg->ua),
 			      routev[0] ? routev : NULL,
 			      routev[0] ? 1 : 0,
 			      reg->id,
 			      sip_auth_handler, ua_prm(reg->ua), true,
 			      register_handler, reg,
-			      params[0] ? &params[1] : NULL,
+			      reg->params[0] ? &reg->params[1] : NULL,
 			      "Allow: %s\r\n", uag_allowed_methods());
+	if (err) {
+		warning("reg: %s: SIP register failed: %m\n",
+			ua_aor(reg->ua), err);
+
+		reg->scode = 999;
+
+		ua_event(reg->ua, UA_EVENT_REGISTER_FAIL, NULL, "%m", err);
+		return;
+	}
+
+	if (!reg->inflight) {
+		reg->inflight = true;
+		++sched.inflight;
+	}
+
+	reg->sent = now;
+	++sched.started;
+}
+
+
+static void sched_timeout(void *arg)
+{
+	const struct config_sip *cfg = &conf_config()->sip;
+	const uint64_t now = tmr_jiffies();
+	(void)arg;
+
+	while (sched.pendl.head) {
+
+		struct reg *reg = sched.pendl.head->data;
+
+		if (reg->due > now) {
+			tmr_start(&sched.tmr, reg->due - now,
+				  sched_timeout, NULL);
+			return;
+		}
+
+		/* restarted when a REGISTER completes */
+		if (cfg->reg_inflight && sched.inflight >= cfg->reg_inflight)
+			return;
+
+		if (now >= sched.win_start + 1000) {
+			sched.win_start = now;
+			sched.win_count = 0;
+		}
+
+		if (cfg->reg_rate && sched.win_count >= cfg->reg_rate) {
+			tmr_start(&sched.tmr, sched.win_start + 1000 - now,
+				  sched_timeout, NULL);
+			return;
+		}
+
+		list_unlink(&reg->sched_le);
+		--sched.pending;
+		++sched.win_count;
+
+		reg_start(reg, now);
+	}
+}
+
+
+/**
+ * Queue a register client for registration
+ *
+ * @param reg      Register client
+ * @param reg_uri  Registrar URI
+ * @param params   Contact parameters
+ * @param regint   Registration interval in [seconds]
+ * @param outbound Outbound proxy (optional)
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int reg_register(struct reg *reg, const char *reg_uri, const char *params,
+		 uint32_t regint, const char *outbound)
+{
+	const struct config_sip *cfg = &conf_config()->sip;
+	const uint64_t now = tmr_jiffies();
+	uint64_t spread = 0;
+	int err;
+
+	if (!reg || !reg_uri)
+		return EINVAL;
+
+	reg->uri      = mem_deref(reg->uri);
+	reg->params   = mem_deref(reg->params);
+	reg->outbound = mem_deref(reg->outbound);
+
+	err  = str_dup(&reg->uri, reg_uri);
+	err |= str_dup(&reg->params, params ? params : "");
+	if (outbound)
+		err |= str_dup(&reg->outbound, outbound);
 	if (err)
 		return err;
 
+	if (reg->sched_le.list) {
+		list_unlink(&reg->sched_le);
+		--sched.pending;
+	}
+
+	reg->scode  = 0;
+	reg->regint = regint;
+	reg->queued = now;
+
+	/* spread out the backlog, at most over half the interval */
+	if (cfg->reg_rate) {
+		spread = min(1000ULL * sched.pending / cfg->reg_rate,
+			     500ULL * regint);
+	}
+
+	reg->due = now + (spread ? rand_u32() % spread : 0);
+
+	/* a binding that is about to expire goes first */
+	if (reg->expires) {
+		const uint64_t margin = 100ULL * regint;
+
+		if (reg->expires < reg->due + margin)
+			reg->due = now;
+	}
+
+	sched_insert(reg);
+
+	if (sched.pendl.head == &reg->sched_le)
+		tmr_start(&sched.tmr, reg->due - now, sched_timeout, NULL);
+
 	return 0;
 }
 
@@ -239,9 +465,12 @@ void reg_unregister(struct reg *reg)
 	if (!reg)
 		return;
 
-	reg->scode = 0;
-	reg->sipfd = -1;
-	reg->af    = 0;
+	reg->scode   = 0;
+	reg->sipfd   = -1;
+	reg->af      = 0;
+	reg->expires = 0;
+
+	sched_remove(reg);
 
 	reg->sipreg = mem_deref(reg->sipreg);
 }
@@ -295,3 +524,34 @@ int reg_status(struct re_printf *pf, const struct reg *reg)
 
 	return re_hprintf(pf, " %s %s", print_scode(reg->scode), reg->srv);
 }
+
+
+/**
+ * Print the status of the registration scheduler
+ *
+ * @param pf     Print handler for debug output
+ * @param unused Unused parameter
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int reg_sched_debug(struct re_printf *pf, void *unused)
+{
+	const struct config_sip *cfg = &conf_config()->sip;
+	int err = 0;
+	(void)unused;
+
+	err |= re_hprintf(pf, "\nRegistration scheduler:\n");
+	err |= re_hprintf(pf, " backlog:   %u\n", sched.pending);
+	err |= re_hprintf(pf, " in-flight: %u (max %u)\n",
+			  sched.inflight, cfg->reg_inflight);
+	err |= re_hprintf(pf, " rate:      %u/s\n", cfg->reg_rate);
+	err |= re_hprintf(pf, " started:   %u\n", sched.started);
+	err |= re_hprintf(pf, " completed: %u\n", sched.completed);
+	err |= re_hprintf(pf, " latency:   avg %u ms, max %u ms\n",
+			  sched.completed ?
+			  (uint32_t)(sched.lat_sum / sched.completed) : 0,
+			  sched.lat_max);
+	err |= re_hprintf(pf, " queued:    max %u ms\n", sched.wait_max);
+
+	return err;
+}
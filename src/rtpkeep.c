@@ -23,94 +23,203 @@ enum {
 	Tr_TCP = 7200
 };
 
+enum {
+	WHEEL_TICK  = 1000,  /**< Keepalive wheel resolution [ms]         */
+	LAYER_KEEP  = 50,    /**< Sees all packets, before any encryption */
+};
+
+enum rtpkeep_method {
+	RTPKEEP_ZERO,
+	RTPKEEP_RTCP,
+	RTPKEEP_STUN,
+	RTPKEEP_DYNA,
+};
+
 /** RTP Keepalive */
 struct rtpkeep {
+	struct le le;
 	struct rtp_sock *rtp;
 	struct sdp_media *sdp;
-	struct tmr tmr;
-	char *method;
+	struct udp_helper *uh;
+	struct tmr tmr;              /**< First keepalive               */
+	struct mbuf *mb;             /**< Preallocated keepalive packet */
+	enum rtpkeep_method method;
+	size_t len;
 	uint32_t ts;
 	bool flag;
 };
 
 
+/*
+ * One timer for all RTP keepalives. The wheel has one slot per second
+ * of the keepalive interval, and the timer checks one slot per tick.
+ */
+static struct {
+	struct list slotv[Tr_UDP];
+	struct tmr tmr;
+	unsigned cur;
+	unsigned n;
+} wheel;
+
+
 static void destructor(void *arg)
 {
 	struct rtpkeep *rk = arg;
 
+	if (rk->le.list) {
+		list_unlink(&rk->le);
+
+		if (--wheel.n == 0)
+			tmr_cancel(&wheel.tmr);
+	}
+
 	tmr_cancel(&rk->tmr);
-	mem_deref(rk->method);
+	mem_deref(rk->uh);
+	mem_deref(rk->mb);
 }
 
 
-static int send_keepalive(struct rtpkeep *rk)
+static int method_decode(enum rtpkeep_method *methodp, const char *method)
+{
+	if (!str_casecmp(method, "zero"))
+		*methodp = RTPKEEP_ZERO;
+	else if (!str_casecmp(method, "rtcp"))
+		*methodp = RTPKEEP_RTCP;
+	else if (!str_casecmp(method, "stun"))
+		*methodp = RTPKEEP_STUN;
+	else if (!str_casecmp(method, "dyna"))
+		*methodp = RTPKEEP_DYNA;
+	else
+		return ENOSYS;
+
+	return 0;
+}
+
+
+/* Build the keepalive packet once, it is resent as it is */
+static int packet_alloc(struct rtpkeep *rk)
 {
+	uint8_t tid[STUN_TID_SIZE];
 	int err = 0;
 
-	if (!str_casecmp(rk->method, "zero")) {
-		struct mbuf *mb = mbuf_alloc(1);
-		if (!mb)
+	switch (rk->method) {
+
+	case RTPKEEP_ZERO:
+		rk->mb = mbuf_alloc(1);
+		if (!rk->mb)
 			return ENOMEM;
-		err = udp_send(rtp_sock(rk->rtp),
-			       sdp_media_raddr(rk->sdp), mb);
-		mem_deref(mb);
-	}
-	else if (!str_casecmp(rk->method, "stun")) {
-		err = stun_indication(IPPROTO_UDP, rtp_sock(rk->rtp),
-				      sdp_media_raddr(rk->sdp), 0,
-				      STUN_METHOD_BINDING, NULL, 0, false, 0);
-	}
-	else if (!str_casecmp(rk->method, "dyna")) {
-		struct mbuf *mb = mbuf_alloc(RTP_HEADER_SIZE);
-		int pt = sdp_media_find_unused_pt(rk->sdp);
-		if (!mb)
+		break;
+
+	case RTPKEEP_STUN:
+		rk->mb = mbuf_alloc(STUN_HEADER_SIZE);
+		if (!rk->mb)
 			return ENOMEM;
-		if (pt == -1)
-			return ENOENT;
-		mb->pos = mb->end = RTP_HEADER_SIZE;
 
-		err = rtp_send(rk->rtp, sdp_media_raddr(rk->sdp), false,
-			       pt, rk->ts, mb);
+		rand_bytes(tid, sizeof(tid));
 
-		mem_deref(mb);
-	}
-	else if (!str_casecmp(rk->method, "rtcp")) {
+		err = stun_msg_encode(rk->mb, STUN_METHOD_BINDING,
+				      STUN_CLASS_INDICATION, tid, NULL,
+				      NULL, 0, false, 0x00, 0);
+		break;
+
+	case RTPKEEP_DYNA:
+		rk->mb = mbuf_alloc(RTP_HEADER_SIZE);
+		if (!rk->mb)
+			return ENOMEM;
+		break;
 
-		if (sdp_media_rattr(rk->sdp, "rtcp-mux")) {
-			/* do nothing */
-			;
-		}
-		else {
+	case RTPKEEP_RTCP:
+		/* RTCP reports keep the binding open */
+		if (!sdp_media_rattr(rk->sdp, "rtcp-mux"))
 			warning("rtpkeep: rtcp-mux is disabled\n");
-		}
+		break;
 	}
-	else {
-		warning("rtpkeep: unknown method: %s\n", rk->method);
-		return ENOSYS;
+
+	if (rk->mb)
+		rk->len = rk->mb->end;
+
+	return err;
+}
+
+
+static int send_keepalive(struct rtpkeep *rk)
+{
+	const struct sa *raddr = sdp_media_raddr(rk->sdp);
+	int pt, err = 0;
+
+	/* The packet may be modified by the UDP helpers */
+	switch (rk->method) {
+
+	case RTPKEEP_ZERO:
+	case RTPKEEP_STUN:
+		rk->mb->pos = 0;
+		rk->mb->end = rk->len;
+
+		err = udp_send(rtp_sock(rk->rtp), raddr, rk->mb);
+		break;
+
+	case RTPKEEP_DYNA:
+		/* the unused payload type may change with each SDP update */
+		pt = sdp_media_find_unused_pt(rk->sdp);
+		if (pt == -1)
+			return ENOENT;
+
+		rk->mb->pos = rk->mb->end = RTP_HEADER_SIZE;
+
+		err = rtp_send(rk->rtp, raddr, false, pt, rk->ts, rk->mb);
+		break;
+
+	case RTPKEEP_RTCP:
+		break;
 	}
 
 	return err;
 }
 
 
+/*
+ * Any packet sent on the same 5-tuple refreshes the NAT binding, this
+ * includes the STUN checks and keepalives done by ICE.
+ */
+static bool send_handler(int *err, struct sa *dst, struct mbuf *mb,
+			 void *arg)
+{
+	struct rtpkeep *rk = arg;
+	(void)err;
+	(void)mb;
+
+	if (sa_cmp(dst, sdp_media_raddr(rk->sdp), SA_ALL))
+		rk->flag = true;
+
+	return false;
+}
+
+
+static bool recv_handler(struct sa *src, struct mbuf *mb, void *arg)
+{
+	(void)src;
+	(void)mb;
+	(void)arg;
+
+	return false;
+}
+
+
 /**
  * Logic:
  *
  * We check for RTP activity every 15 seconds, and clear the flag.
- * The flag is set for every transmitted RTP packet. If the flag
- * is not set, it means that we have not sent any RTP packet in the
+ * The flag is set for every packet sent to the remote address. If the
+ * flag is not set, it means that we have not sent any packet in the
  * last period of 0 - 15 seconds. Start transmitting RTP keepalives
  * now and every 15 seconds after that.
  *
- * @param arg Handler argument
+ * @param rk RTP Keepalive
  */
-static void timeout(void *arg)
+static void timeout(struct rtpkeep *rk)
 {
-	struct rtpkeep *rk = arg;
 	int err;
 
-	tmr_start(&rk->tmr, Tr_UDP * 1000, timeout, rk);
-
 	if (rk->flag) {
 		rk->flag = false;
 		return;
@@ -120,6 +229,35 @@ static void timeout(void *arg)
 	if (err) {
 		warning("rtpkeep: send keepalive failed: %m\n", err);
 	}
+
+	/* our own keepalive does not count as activity */
+	rk->flag = false;
+}
+
+
+static void first_timeout(void *arg)
+{
+	timeout(arg);
+}
+
+
+static void wheel_tick(void *arg)
+{
+	struct le *le;
+	(void)arg;
+
+	tmr_start(&wheel.tmr, WHEEL_TICK, wheel_tick, NULL);
+
+	wheel.cur = (wheel.cur + 1) % Tr_UDP;
+
+	le = wheel.slotv[wheel.cur].head;
+	while (le) {
+		struct rtpkeep *rk = le->data;
+
+		le = le->next;
+
+		timeout(rk);
+	}
 }
 
 
@@ -139,11 +277,29 @@ int rtpkeep_alloc(struct rtpkeep **rkp, const char *method, int proto,
 	rk->rtp = rtp;
 	rk->sdp = sdp;
 
-	err = str_dup(&rk->method, method);
+	/* An unknown method is not fatal, no keepalives are sent */
+	if (method_decode(&rk->method, method)) {
+		warning("rtpkeep: unknown method: %s\n", method);
+		goto out;
+	}
+
+	err = packet_alloc(rk);
+	if (err || rk->method == RTPKEEP_RTCP)
+		goto out;
+
+	err = udp_register_helper(&rk->uh, rtp_sock(rtp), LAYER_KEEP,
+				  send_handler, recv_handler, rk);
 	if (err)
 		goto out;
 
-	tmr_start(&rk->tmr, 20, timeout, rk);
+	/* The first keepalive is sent right away, and the next check is
+	   one keepalive interval later */
+	list_append(&wheel.slotv[wheel.cur], &rk->le, rk);
+
+	if (wheel.n++ == 0)
+		tmr_start(&wheel.tmr, WHEEL_TICK, wheel_tick, NULL);
+
+	tmr_start(&rk->tmr, 20, first_timeout, rk);
 
  out:
 	if (err)
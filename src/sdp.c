@@ -124,6 +124,203 @@ const struct sdp_format *sdp_media_format_cycle(struct sdp_media *m)
 }
 
 
+/** Payload format of an SDP template */
+struct sdp_tmpl_fmt {
+	const char *id;           /**< Payload type                       */
+	const char *name;         /**< Encoding name                      */
+	uint32_t srate;           /**< Clock rate                         */
+	uint8_t ch;               /**< Number of channels                 */
+	sdp_fmtp_enc_h *ench;     /**< Optional fmtp encode handler       */
+	sdp_fmtp_cmp_h *cmph;     /**< Optional fmtp compare handler      */
+	void *data;               /**< Codec object                       */
+	const char *params;       /**< Format parameters                  */
+};
+
+/**
+ * SDP template -- the payload formats of one media line, selected
+ * from a codec list. A template is valid until a codec is registered
+ * or unregistered, or until the selection key changes.
+ *
+ * Only the codec selection is cached, the SDP text of each offer is
+ * still encoded by sdp_encode().
+ */
+struct sdp_tmpl {
+	struct sdp_tmpl_fmt *fmtv;  /**< Selected payload formats         */
+	uint32_t fmtc;              /**< Number of payload formats        */
+	uint32_t fmtsz;             /**< Size of the format vector        */
+	const struct list *codecl;  /**< Codec list (ref.)                */
+	uint32_t key;               /**< Selection key, e.g. media config */
+	uint32_t gen;               /**< Codec generation                 */
+};
+
+
+static uint32_t tmpl_gen;
+
+
+static void tmpl_destructor(void *arg)
+{
+	struct sdp_tmpl *tmpl = arg;
+
+	mem_deref(tmpl->fmtv);
+}
+
+
+/**
+ * Allocate an empty SDP template for a codec list
+ *
+ * @param tmplp  Pointer to allocated SDP template
+ * @param codecl List of codecs
+ * @param key    Key of the codec selection
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sdp_tmpl_alloc(struct sdp_tmpl **tmplp, const struct list *codecl,
+		   uint32_t key)
+{
+	struct sdp_tmpl *tmpl;
+
+	if (!tmplp)
+		return EINVAL;
+
+	tmpl = mem_zalloc(sizeof(*tmpl), tmpl_destructor);
+	if (!tmpl)
+		return ENOMEM;
+
+	tmpl->fmtsz = (uint32_t)list_count(codecl) + 1;
+	tmpl->fmtv  = mem_zalloc(tmpl->fmtsz * sizeof(*tmpl->fmtv), NULL);
+	if (!tmpl->fmtv) {
+		mem_deref(tmpl);
+		return ENOMEM;
+	}
+
+	tmpl->codecl = codecl;
+	tmpl->key    = key;
+	tmpl->gen    = tmpl_gen;
+
+	*tmplp = tmpl;
+
+	return 0;
+}
+
+
+/**
+ * Add a payload format to an SDP template. The strings and the codec
+ * object are referenced, and must be valid while the codec is
+ * registered.
+ *
+ * @param tmpl   SDP template
+ * @param id     Payload type
+ * @param name   Encoding name
+ * @param srate  Clock rate
+ * @param ch     Number of channels
+ * @param ench   Optional fmtp encode handler
+ * @param cmph   Optional fmtp compare handler
+ * @param data   Codec object
+ * @param params Optional format parameters
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sdp_tmpl_add(struct sdp_tmpl *tmpl, const char *id, const char *name,
+		 uint32_t srate, uint8_t ch, sdp_fmtp_enc_h *ench,
+		 sdp_fmtp_cmp_h *cmph, void *data, const char *params)
+{
+	struct sdp_tmpl_fmt *fmt;
+
+	if (!tmpl || !name)
+		return EINVAL;
+
+	if (tmpl->fmtc >= tmpl->fmtsz)
+		return EOVERFLOW;
+
+	fmt = &tmpl->fmtv[tmpl->fmtc++];
+
+	fmt->id     = id;
+	fmt->name   = name;
+	fmt->srate  = srate;
+	fmt->ch     = ch;
+	fmt->ench   = ench;
+	fmt->cmph   = cmph;
+	fmt->data   = data;
+	fmt->params = params;
+
+	return 0;
+}
+
+
+/**
+ * Check if an SDP template is valid for a codec list
+ *
+ * @param tmpl   SDP template
+ * @param codecl List of codecs
+ * @param key    Key of the codec selection
+ *
+ * @return True if valid, otherwise false
+ */
+bool sdp_tmpl_isvalid(const struct sdp_tmpl *tmpl, const struct list *codecl,
+		      uint32_t key)
+{
+	if (!tmpl)
+		return false;
+
+	return tmpl->codecl == codecl && tmpl->key == key &&
+		tmpl->gen == tmpl_gen;
+}
+
+
+/**
+ * Add the payload formats of an SDP template to an SDP media line
+ *
+ * @param tmpl SDP template
+ * @param m    SDP Media line
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sdp_tmpl_apply(const struct sdp_tmpl *tmpl, struct sdp_media *m)
+{
+	uint32_t i;
+	int err;
+
+	if (!tmpl || !m)
+		return EINVAL;
+
+	for (i=0; i<tmpl->fmtc; i++) {
+
+		const struct sdp_tmpl_fmt *fmt = &tmpl->fmtv[i];
+
+		err = sdp_format_add(NULL, m, false, fmt->id, fmt->name,
+				     fmt->srate, fmt->ch, fmt->ench,
+				     fmt->cmph, fmt->data, false,
+				     "%s", fmt->params);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Invalidate all SDP templates, must be called when a codec is
+ * registered or unregistered
+ */
+void sdp_tmpl_flush(void)
+{
+	++tmpl_gen;
+}
+
+
+/**
+ * Get the codec generation, it changes when a codec is registered or
+ * unregistered
+ *
+ * @return Codec generation
+ */
+uint32_t sdp_tmpl_gen(void)
+{
+	return tmpl_gen;
+}
+
+
 static void decode_part(const struct pl *part, struct mbuf *mb)
 {
 	struct pl hdrs, body;
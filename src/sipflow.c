@@ -0,0 +1,270 @@
+/**
+ * @file sipflow.c  Persistent SIP flows to outbound proxies
+ *
+ * Copyright (C) 2010 - 2016 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The SIP stack reuses an open TCP/TLS connection for all requests to
+ * the same peer, but closes it when it has been idle for a while. For
+ * each outbound proxy the connection used by the last response is kept
+ * open with CRLF keepalives (RFC 5626), shared by all User-Agents with
+ * that proxy. A REGISTER refresh or a new call then finds the
+ * connection open, and no TCP or TLS handshake is needed.
+ *
+ * A proxy that does not support RFC 5626 does not answer the CRLF
+ * keepalives, and the connection would be closed as failed. The
+ * keepalives are only started when the response shows that the proxy
+ * supports outbound.
+ *
+ * The connections are counted per proxy, a new connection over TLS is
+ * one full TLS handshake.
+ */
+
+
+/** A flow to an outbound proxy */
+struct sipflow {
+	struct le le;
+	char *proxy;                /**< Outbound proxy URI                */
+	struct sip_keepalive *ka;   /**< Keepalive of the current flow     */
+	struct sa laddr;            /**< Local address of the connection   */
+	struct sa paddr;            /**< Address of the proxy              */
+	enum sip_transp tp;
+	uint32_t conns;             /**< New connections                   */
+	uint32_t reused;            /**< Responses on an open connection   */
+	uint32_t failed;            /**< Flows closed by keepalive failure */
+};
+
+static struct {
+	struct list flowl;
+	uint32_t interval;          /**< Keepalive interval in [seconds]   */
+} pool;
+
+
+static void destructor(void *arg)
+{
+	struct sipflow *flow = arg;
+
+	list_unlink(&flow->le);
+	mem_deref(flow->ka);
+	mem_deref(flow->proxy);
+}
+
+
+static struct sipflow *flow_find(const char *proxy)
+{
+	struct le *le;
+
+	for (le = pool.flowl.head; le; le = le->next) {
+		struct sipflow *flow = le->data;
+
+		if (0 == str_casecmp(flow->proxy, proxy))
+			return flow;
+	}
+
+	return NULL;
+}
+
+
+static void flow_close(struct sipflow *flow)
+{
+	flow->ka = mem_deref(flow->ka);
+	sa_init(&flow->laddr, AF_UNSPEC);
+}
+
+
+/* The proxy supports outbound (RFC 5626 section 5.1) */
+static bool outbound_supported(const struct sip_msg *msg)
+{
+	return sip_msg_hdr_has_value(msg, SIP_HDR_REQUIRE, "outbound") ||
+		sip_msg_hdr_has_value(msg, SIP_HDR_SUPPORTED, "outbound") ||
+		sip_msg_xhdr(msg, "Flow-Timer") != NULL;
+}
+
+
+static void keepalive_handler(int err, void *arg)
+{
+	struct sipflow *flow = arg;
+
+	info("sipflow: %s: flow to %J closed (%m)\n",
+	     flow->proxy, &flow->paddr, err);
+
+	++flow->failed;
+
+	flow_close(flow);
+}
+
+
+static int flow_alloc(struct sipflow **flowp, const char *proxy)
+{
+	struct sipflow *flow;
+	int err;
+
+	flow = mem_zalloc(sizeof(*flow), destructor);
+	if (!flow)
+		return ENOMEM;
+
+	err = str_dup(&flow->proxy, proxy);
+	if (err)
+		goto out;
+
+	list_append(&pool.flowl, &flow->le, flow);
+
+ out:
+	if (err)
+		mem_deref(flow);
+	else
+		*flowp = flow;
+
+	return err;
+}
+
+
+/**
+ * Keep the connection of a SIP response from an outbound proxy open
+ *
+ * @param proxy Outbound proxy URI
+ * @param msg   SIP response received from the proxy
+ */
+void sipflow_msg(const char *proxy, const struct sip_msg *msg)
+{
+	const struct tcp_conn *tc;
+	const struct sip_hdr *hdr;
+	struct sipflow *flow;
+	uint32_t interval;
+	struct sa laddr;
+	int err;
+
+	if (!pool.interval || !proxy || !msg)
+		return;
+
+	if (msg->tp != SIP_TRANSP_TCP && msg->tp != SIP_TRANSP_TLS)
+		return;
+
+	tc = sip_msg_tcpconn(msg);
+	if (!tc || tcp_conn_local_get(tc, &laddr))
+		return;
+
+	flow = flow_find(proxy);
+
+	/* a new connection to the same proxy has a new local port */
+	if (flow && flow->ka &&
+	    sa_cmp(&laddr, &flow->laddr, SA_ALL) &&
+	    sa_cmp(&msg->src, &flow->paddr, SA_ALL)) {
+		++flow->reused;
+		return;
+	}
+
+	if (!outbound_supported(msg))
+		return;
+
+	if (!flow) {
+		if (flow_alloc(&flow, proxy))
+			return;
+	}
+
+	flow_close(flow);
+
+	++flow->conns;
+
+	flow->laddr = laddr;
+	flow->paddr = msg->src;
+	flow->tp    = msg->tp;
+
+	/* keepalives must be sent before the flow timer of the proxy */
+	interval = pool.interval;
+	hdr = sip_msg_xhdr(msg, "Flow-Timer");
+	if (hdr && pl_u32(&hdr->val))
+		interval = min(interval, pl_u32(&hdr->val));
+
+	err = sip_keepalive_start(&flow->ka, uag_sip(), msg, interval,
+				  keepalive_handler, flow);
+	if (err) {
+		warning("sipflow: %s: keepalive failed (%m)\n",
+			proxy, err);
+		flow_close(flow);
+	}
+}
+
+
+/**
+ * Stop the keepalives of all flows, when the SIP transports are reset
+ */
+void sipflow_reset(void)
+{
+	struct le *le;
+
+	for (le = pool.flowl.head; le; le = le->next)
+		flow_close(le->data);
+}
+
+
+int sipflow_init(const struct config_sip *cfg)
+{
+	if (!cfg)
+		return EINVAL;
+
+	pool.interval = cfg->flow_keepalive;
+
+	return 0;
+}
+
+
+void sipflow_close(void)
+{
+	list_flush(&pool.flowl);
+}
+
+
+/**
+ * Print the status of the flows to the outbound proxies
+ *
+ * @param pf     Print handler for debug output
+ * @param unused Unused parameter
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sipflow_debug(struct re_printf *pf, void *unused)
+{
+	uint32_t conns = 0, tls = 0, reused = 0;
+	struct le *le;
+	int err;
+	(void)unused;
+
+	err = re_hprintf(pf, "\nOutbound flows: (keepalive %u s)\n",
+			 pool.interval);
+
+	for (le = pool.flowl.head; le; le = le->next) {
+		const struct sipflow *flow = le->data;
+
+		err |= re_hprintf(pf, " %s: %s %J", flow->proxy,
+				  sip_transp_name(flow->tp), &flow->paddr);
+
+		if (flow->ka)
+			err |= re_hprintf(pf, " (local %J)", &flow->laddr);
+		else
+			err |= re_hprintf(pf, " (closed)");
+
+		err |= re_hprintf(pf, " connections=%u reused=%u"
+				  " failed=%u\n",
+				  flow->conns, flow->reused, flow->failed);
+
+		conns  += flow->conns;
+		reused += flow->reused;
+
+		if (flow->tp == SIP_TRANSP_TLS)
+			tls += flow->conns;
+	}
+
+	err |= re_hprintf(pf, " connections: %u (TLS handshakes: %u)\n",
+			  conns, tls);
+	err |= re_hprintf(pf, " reuse:       %u/%u (%u%%)\n",
+			  reused, conns + reused,
+			  conns + reused ? 100 * reused / (conns + reused) : 0);
+
+	return err;
+}
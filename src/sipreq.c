@@ -98,18 +98,13 @@ static int request(struct sip_req *sr)
 }
 
 
-int sip_req_send(struct ua *ua, const char *method, const char *uri,
-		 sip_resp_h *resph, void *arg, const char *fmt, ...)
+static int sip_req_alloc(struct sip_req **srp, const char *method,
+			 sip_resp_h *resph, void *arg,
+			 const char *fmt, va_list ap)
 {
-	const char *routev[1];
 	struct sip_req *sr;
 	int err;
 
-	if (!ua || !method || !uri || !fmt)
-		return EINVAL;
-
-	routev[0] = ua_outbound(ua);
-
 	sr = mem_zalloc(sizeof(*sr), destructor);
 	if (!sr)
 		return ENOMEM;
@@ -117,18 +112,36 @@ int sip_req_send(struct ua *ua, const char *method, const char *uri,
 	sr->resph = resph;
 	sr->arg   = arg;
 
-	err = str_dup(&sr->method, method);
+	err  = str_dup(&sr->method, method);
+	err |= re_vsdprintf(&sr->fmt, fmt, ap);
 
-	if (fmt) {
-		va_list ap;
+	if (err)
+		mem_deref(sr);
+	else
+		*srp = sr;
+
+	return err;
+}
 
-		va_start(ap, fmt);
-		err |= re_vsdprintf(&sr->fmt, fmt, ap);
-		va_end(ap);
-	}
 
+int sip_req_send(struct ua *ua, const char *method, const char *uri,
+		 sip_resp_h *resph, void *arg, const char *fmt, ...)
+{
+	const char *routev[1];
+	struct sip_req *sr;
+	va_list ap;
+	int err;
+
+	if (!ua || !method || !uri || !fmt)
+		return EINVAL;
+
+	routev[0] = ua_outbound(ua);
+
+	va_start(ap, fmt);
+	err = sip_req_alloc(&sr, method, resph, arg, fmt, ap);
+	va_end(ap);
 	if (err)
-		goto out;
+		return err;
 
 	err = sip_dialog_alloc(&sr->dlg, uri, uri, NULL, ua_aor(ua),
 			       routev[0] ? routev : NULL,
@@ -148,3 +161,48 @@ int sip_req_send(struct ua *ua, const char *method, const char *uri,
 
 	return err;
 }
+
+
+/**
+ * Send an authenticated SIP request within a dialog
+ *
+ * @param ua     User-Agent
+ * @param dlg    SIP Dialog
+ * @param method SIP Method
+ * @param resph  Response handler
+ * @param arg    Handler argument
+ * @param fmt    Formatted SIP headers and body
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sip_req_send_dlg(struct ua *ua, struct sip_dialog *dlg,
+		     const char *method, sip_resp_h *resph, void *arg,
+		     const char *fmt, ...)
+{
+	struct sip_req *sr;
+	va_list ap;
+	int err;
+
+	if (!ua || !dlg || !method || !fmt)
+		return EINVAL;
+
+	va_start(ap, fmt);
+	err = sip_req_alloc(&sr, method, resph, arg, fmt, ap);
+	va_end(ap);
+	if (err)
+		return err;
+
+	sr->dlg = mem_ref(dlg);
+
+	err = sip_auth_alloc(&sr->auth, auth_handler, ua_prm(ua), true);
+	if (err)
+		goto out;
+
+	err = request(sr);
+
+ out:
+	if (err)
+		mem_deref(sr);
+
+	return err;
+}
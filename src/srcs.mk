@@ -5,6 +5,7 @@
 #
 
 SRCS	+= account.c
+SRCS	+= admit.c
 SRCS	+= aucodec.c
 SRCS	+= audio.c
 SRCS	+= aufilt.c
@@ -16,6 +17,8 @@ SRCS	+= cmd.c
 SRCS	+= conf.c
 SRCS	+= config.c
 SRCS	+= contact.c
+SRCS	+= dnscache.c
+SRCS	+= json.c
 SRCS	+= log.c
 SRCS	+= menc.c
 SRCS	+= message.c
@@ -23,12 +26,14 @@ SRCS	+= metric.c
 SRCS	+= mnat.c
 SRCS	+= module.c
 SRCS	+= mos.c
+SRCS	+= natcache.c
 SRCS	+= net.c
 SRCS	+= play.c
 SRCS	+= realtime.c
 SRCS	+= reg.c
 SRCS	+= rtpkeep.c
 SRCS	+= sdp.c
+SRCS	+= sipflow.c
 SRCS	+= sipreq.c
 SRCS	+= stream.c
 SRCS	+= ua.c
@@ -39,12 +44,17 @@ SRCS	+= bfcp.c
 SRCS	+= h264.c
 SRCS	+= mctrl.c
 SRCS	+= video.c
+SRCS	+= vidadapt.c
 SRCS	+= vidcodec.c
 SRCS	+= vidfilt.c
 SRCS	+= vidisp.c
 SRCS	+= vidsrc.c
 endif
 
+ifneq ($(USE_OPENSSL),)
+SRCS	+= srtp_gcm.c
+endif
+
 ifneq ($(STATIC),)
 SRCS	+= static.c
 endif
@@ -0,0 +1,743 @@
+/**
+ * @file srtp_gcm.c  SRTP with AES-GCM authenticated encryption (RFC 7714)
+ *
+ * Copyright (C) 2010 - 2016 Creytiv.com
+ */
+#include <string.h>
+#include <openssl/evp.h>
+#include <re.h>
+#include <baresip.h>
+
+
+/*
+ * AES-GCM encrypts and authenticates a packet in a single pass. OpenSSL
+ * uses the AES-NI and carry-less multiplication instructions for it,
+ * when the CPU has them.
+ */
+
+
+enum {
+	GCM_SALT_LEN = 12,
+	GCM_TAG_LEN  = 16,
+	GCM_IV_LEN   = 12,
+	RTP_HDR_LEN  = 12,
+	RTCP_HDR_LEN = 8,
+	SRTCP_TRAILER_LEN = 4,
+	REPLAY_WINDOW = 64,
+};
+
+/* KDF labels, RFC 3711 section 4.3.2 */
+enum {
+	LABEL_RTP_KEY   = 0x00,
+	LABEL_RTP_SALT  = 0x02,
+	LABEL_RTCP_KEY  = 0x03,
+	LABEL_RTCP_SALT = 0x05,
+};
+
+struct replay {
+	uint64_t top;                   /**< Highest authenticated index   */
+	uint64_t bits;                  /**< Bitmask of received indices   */
+	bool init;
+};
+
+struct gcm_key {
+	EVP_CIPHER_CTX *ctx;            /**< Cipher with the session key   */
+	uint8_t salt[GCM_SALT_LEN];     /**< Session salt                  */
+};
+
+struct gcm_ssrc {
+	struct le le;
+	uint32_t ssrc;                  /**< Synchronization source        */
+	uint32_t roc;                   /**< Rollover counter              */
+	uint16_t s_l;                   /**< Highest sequence number       */
+	bool seq_init;
+	struct replay rtp;              /**< SRTP replay window            */
+	struct replay rtcp;             /**< SRTCP replay window           */
+	uint32_t rtcp_index;            /**< Next SRTCP index to send      */
+};
+
+struct srtp_gcm {
+	struct gcm_key rtp;             /**< SRTP session key              */
+	struct gcm_key rtcp;            /**< SRTCP session key             */
+	struct list ssrcl;              /**< State per SSRC                */
+};
+
+
+static void destructor(void *arg)
+{
+	struct srtp_gcm *sg = arg;
+
+	if (sg->rtp.ctx)
+		EVP_CIPHER_CTX_free(sg->rtp.ctx);
+	if (sg->rtcp.ctx)
+		EVP_CIPHER_CTX_free(sg->rtcp.ctx);
+
+	list_flush(&sg->ssrcl);
+}
+
+
+/* AES-CM key derivation, with the 96-bit master salt padded to 112 bits */
+static int kdf(uint8_t *out, size_t len, const EVP_CIPHER *ctr,
+	       const uint8_t *mkey, const uint8_t *msalt, uint8_t label)
+{
+	static const uint8_t zero[32];
+	uint8_t iv[16];
+	EVP_CIPHER_CTX *ctx;
+	int n, err = 0;
+
+	if (len > sizeof(zero))
+		return EINVAL;
+
+	memset(iv, 0, sizeof(iv));
+	memcpy(iv, msalt, GCM_SALT_LEN);
+	iv[7] ^= label;
+
+	ctx = EVP_CIPHER_CTX_new();
+	if (!ctx)
+		return ENOMEM;
+
+	if (!EVP_EncryptInit_ex(ctx, ctr, NULL, mkey, iv) ||
+	    !EVP_EncryptUpdate(ctx, out, &n, zero, (int)len))
+		err = EPROTO;
+
+	EVP_CIPHER_CTX_free(ctx);
+
+	return err;
+}
+
+
+static int key_set(struct gcm_key *k, const EVP_CIPHER *gcm,
+		   const uint8_t *key, const uint8_t *salt)
+{
+	memcpy(k->salt, salt, sizeof(k->salt));
+
+	k->ctx = EVP_CIPHER_CTX_new();
+	if (!k->ctx)
+		return ENOMEM;
+
+	if (!EVP_CipherInit_ex(k->ctx, gcm, NULL, key, NULL, 1))
+		return EPROTO;
+
+	return 0;
+}
+
+
+static int key_init(struct gcm_key *k, const EVP_CIPHER *gcm,
+		    const EVP_CIPHER *ctr, const uint8_t *mkey,
+		    const uint8_t *msalt, uint8_t label_key,
+		    uint8_t label_salt)
+{
+	uint8_t key[32], salt[GCM_SALT_LEN];
+	int err;
+
+	err  = kdf(key, EVP_CIPHER_key_length(gcm), ctr, mkey, msalt,
+		   label_key);
+	err |= kdf(salt, sizeof(salt), ctr, mkey, msalt, label_salt);
+	if (!err)
+		err = key_set(k, gcm, key, salt);
+
+	memset(key, 0, sizeof(key));
+
+	return err;
+}
+
+
+static int cipher_get(const EVP_CIPHER **gcm, const EVP_CIPHER **ctr,
+		      size_t key_size)
+{
+	switch (key_size) {
+
+	case 16 + GCM_SALT_LEN:
+		*gcm = EVP_aes_128_gcm();
+		*ctr = EVP_aes_128_ctr();
+		return 0;
+
+	case 32 + GCM_SALT_LEN:
+		*gcm = EVP_aes_256_gcm();
+		*ctr = EVP_aes_256_ctr();
+		return 0;
+
+	default:
+		return EINVAL;
+	}
+}
+
+
+/**
+ * Allocate an SRTP session with AES-GCM
+ *
+ * @param sgp      Pointer to allocated session
+ * @param key      Master key followed by the 96-bit master salt
+ * @param key_size 28 bytes for AES-128-GCM, 44 bytes for AES-256-GCM
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int srtp_gcm_alloc(struct srtp_gcm **sgp, const uint8_t *key,
+		   size_t key_size)
+{
+	const EVP_CIPHER *gcm, *ctr;
+	const uint8_t *msalt;
+	struct srtp_gcm *sg;
+	int err;
+
+	if (!sgp || !key)
+		return EINVAL;
+
+	err = cipher_get(&gcm, &ctr, key_size);
+	if (err)
+		return err;
+
+	sg = mem_zalloc(sizeof(*sg), destructor);
+	if (!sg)
+		return ENOMEM;
+
+	msalt = key + key_size - GCM_SALT_LEN;
+
+	err  = key_init(&sg->rtp, gcm, ctr, key, msalt,
+			LABEL_RTP_KEY, LABEL_RTP_SALT);
+	err |= key_init(&sg->rtcp, gcm, ctr, key, msalt,
+			LABEL_RTCP_KEY, LABEL_RTCP_SALT);
+
+	if (err)
+		mem_deref(sg);
+	else
+		*sgp = sg;
+
+	return err;
+}
+
+
+/**
+ * Allocate an SRTP session with AES-GCM from the session keys, without
+ * key derivation. This is used with the test vectors of RFC 7714.
+ *
+ * @param sgp      Pointer to allocated session
+ * @param rtp_key  SRTP session key followed by the 96-bit session salt
+ * @param rtcp_key SRTCP session key followed by the 96-bit session salt
+ * @param key_size 28 bytes for AES-128-GCM, 44 bytes for AES-256-GCM
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int srtp_gcm_alloc_session(struct srtp_gcm **sgp, const uint8_t *rtp_key,
+			   const uint8_t *rtcp_key, size_t key_size)
+{
+	const EVP_CIPHER *gcm, *ctr;
+	const size_t klen = key_size - GCM_SALT_LEN;
+	struct srtp_gcm *sg;
+	int err;
+
+	if (!sgp || !rtp_key || !rtcp_key)
+		return EINVAL;
+
+	err = cipher_get(&gcm, &ctr, key_size);
+	if (err)
+		return err;
+
+	sg = mem_zalloc(sizeof(*sg), destructor);
+	if (!sg)
+		return ENOMEM;
+
+	err  = key_set(&sg->rtp, gcm, rtp_key, rtp_key + klen);
+	err |= key_set(&sg->rtcp, gcm, rtcp_key, rtcp_key + klen);
+
+	if (err)
+		mem_deref(sg);
+	else
+		*sgp = sg;
+
+	return err;
+}
+
+
+static struct gcm_ssrc *ssrc_find(const struct srtp_gcm *sg, uint32_t ssrc)
+{
+	struct le *le;
+
+	for (le = sg->ssrcl.head; le; le = le->next) {
+		struct gcm_ssrc *s = le->data;
+
+		if (s->ssrc == ssrc)
+			return s;
+	}
+
+	return NULL;
+}
+
+
+static struct gcm_ssrc *ssrc_add(struct srtp_gcm *sg,
+				 const struct gcm_ssrc *state)
+{
+	struct gcm_ssrc *s;
+
+	s = mem_zalloc(sizeof(*s), NULL);
+	if (!s)
+		return NULL;
+
+	*s = *state;
+	memset(&s->le, 0, sizeof(s->le));
+	list_append(&sg->ssrcl, &s->le, s);
+
+	return s;
+}
+
+
+/* Get the state of a local SSRC, it is created on the first packet */
+static struct gcm_ssrc *ssrc_get(struct srtp_gcm *sg, uint32_t ssrc)
+{
+	struct gcm_ssrc *s, st;
+
+	s = ssrc_find(sg, ssrc);
+	if (s)
+		return s;
+
+	memset(&st, 0, sizeof(st));
+	st.ssrc = ssrc;
+
+	return ssrc_add(sg, &st);
+}
+
+
+/*
+ * Get the state of a remote SSRC. A new SSRC gets temporary state,
+ * which is only stored when the packet has been authenticated.
+ */
+static struct gcm_ssrc *ssrc_lookup(struct srtp_gcm *sg,
+				    struct gcm_ssrc *tmp, uint32_t ssrc)
+{
+	struct gcm_ssrc *s;
+
+	s = ssrc_find(sg, ssrc);
+	if (s)
+		return s;
+
+	memset(tmp, 0, sizeof(*tmp));
+	tmp->ssrc = ssrc;
+
+	return tmp;
+}
+
+
+/* Estimate the rollover counter, RFC 3711 appendix A */
+static uint32_t roc_estimate(const struct gcm_ssrc *s, uint16_t seq)
+{
+	if (!s->seq_init)
+		return s->roc;
+
+	if (s->s_l < 32768) {
+		if ((int)seq - (int)s->s_l > 32768 && s->roc)
+			return s->roc - 1;
+	}
+	else {
+		if ((int)s->s_l - 32768 > (int)seq)
+			return s->roc + 1;
+	}
+
+	return s->roc;
+}
+
+
+static void roc_update(struct gcm_ssrc *s, uint32_t v, uint16_t seq)
+{
+	if (!s->seq_init) {
+		s->seq_init = true;
+		s->roc = v;
+		s->s_l = seq;
+	}
+	else if (v == s->roc && seq > s->s_l) {
+		s->s_l = seq;
+	}
+	else if (v == s->roc + 1) {
+		s->roc = v;
+		s->s_l = seq;
+	}
+}
+
+
+static bool replay_check(const struct replay *r, uint64_t ix)
+{
+	uint64_t d;
+
+	if (!r->init || ix > r->top)
+		return true;
+
+	d = r->top - ix;
+	if (d >= REPLAY_WINDOW)
+		return false;
+
+	return !(r->bits & (1ULL << d));
+}
+
+
+static void replay_update(struct replay *r, uint64_t ix)
+{
+	uint64_t d;
+
+	if (!r->init) {
+		r->init = true;
+		r->top  = ix;
+		r->bits = 1;
+	}
+	else if (ix > r->top) {
+		d = ix - r->top;
+		r->bits = d >= REPLAY_WINDOW ? 0 : r->bits << d;
+		r->bits |= 1;
+		r->top = ix;
+	}
+	else {
+		r->bits |= 1ULL << (r->top - ix);
+	}
+}
+
+
+static int gcm_crypt(struct gcm_key *k, bool enc, const uint8_t *iv,
+		     const uint8_t *aad1, size_t aad1_len,
+		     const uint8_t *aad2, size_t aad2_len,
+		     uint8_t *data, size_t len, uint8_t *tag)
+{
+	EVP_CIPHER_CTX *ctx = k->ctx;
+	int n;
+
+	if (!EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, enc))
+		return EPROTO;
+
+	if (!EVP_CipherUpdate(ctx, NULL, &n, aad1, (int)aad1_len))
+		return EPROTO;
+
+	if (aad2_len && !EVP_CipherUpdate(ctx, NULL, &n, aad2, (int)aad2_len))
+		return EPROTO;
+
+	if (len && !EVP_CipherUpdate(ctx, data, &n, data, (int)len))
+		return EPROTO;
+
+	if (!enc && !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG,
+					 GCM_TAG_LEN, tag))
+		return EPROTO;
+
+	/* verifies the tag when decrypting */
+	if (EVP_CipherFinal_ex(ctx, data + len, &n) <= 0)
+		return EBADMSG;
+
+	if (enc && !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG,
+					GCM_TAG_LEN, tag))
+		return EPROTO;
+
+	return 0;
+}
+
+
+static void iv_calc(uint8_t *iv, const uint8_t *salt, const uint8_t *in)
+{
+	size_t i;
+
+	for (i=0; i<GCM_IV_LEN; i++)
+		iv[i] = in[i] ^ salt[i];
+}
+
+
+/* Length of the RTP header, with CSRCs and header extension */
+static int rtp_hdr_len(const uint8_t *p, size_t len)
+{
+	size_t hlen;
+
+	if (len < RTP_HDR_LEN || (p[0] >> 6) != 2)
+		return -1;
+
+	hlen = RTP_HDR_LEN + 4 * (p[0] & 0x0f);
+
+	if (p[0] & 0x10) {
+		if (len < hlen + 4)
+			return -1;
+
+		hlen += 4 + 4 * (p[hlen + 2] << 8 | p[hlen + 3]);
+	}
+
+	return hlen <= len ? (int)hlen : -1;
+}
+
+
+static void rtp_iv(uint8_t *iv, const struct gcm_key *k, uint32_t ssrc,
+		   uint32_t roc, uint16_t seq)
+{
+	uint8_t in[GCM_IV_LEN];
+
+	in[0]  = 0;
+	in[1]  = 0;
+	in[2]  = ssrc >> 24;
+	in[3]  = ssrc >> 16;
+	in[4]  = ssrc >> 8;
+	in[5]  = ssrc;
+	in[6]  = roc >> 24;
+	in[7]  = roc >> 16;
+	in[8]  = roc >> 8;
+	in[9]  = roc;
+	in[10] = seq >> 8;
+	in[11] = seq;
+
+	iv_calc(iv, k->salt, in);
+}
+
+
+static void rtcp_iv(uint8_t *iv, const struct gcm_key *k, uint32_t ssrc,
+		    uint32_t index)
+{
+	uint8_t in[GCM_IV_LEN];
+
+	in[0]  = 0;
+	in[1]  = 0;
+	in[2]  = ssrc >> 24;
+	in[3]  = ssrc >> 16;
+	in[4]  = ssrc >> 8;
+	in[5]  = ssrc;
+	in[6]  = 0;
+	in[7]  = 0;
+	in[8]  = (index >> 24) & 0x7f;
+	in[9]  = index >> 16;
+	in[10] = index >> 8;
+	in[11] = index;
+
+	iv_calc(iv, k->salt, in);
+}
+
+
+static inline uint32_t get_u32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+
+/**
+ * Encrypt an RTP packet, and append the authentication tag
+ *
+ * @param sg SRTP session
+ * @param mb Buffer with the RTP packet
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int srtp_gcm_encrypt(struct srtp_gcm *sg, struct mbuf *mb)
+{
+	uint8_t iv[GCM_IV_LEN], tag[GCM_TAG_LEN];
+	const size_t start = mb ? mb->pos : 0;
+	struct gcm_ssrc *s;
+	uint32_t ssrc, v;
+	uint16_t seq;
+	uint8_t *p;
+	int hlen, err;
+
+	if (!sg || !mb)
+		return EINVAL;
+
+	p = mbuf_buf(mb);
+	hlen = rtp_hdr_len(p, mbuf_get_left(mb));
+	if (hlen < 0)
+		return EBADMSG;
+
+	seq  = p[2] << 8 | p[3];
+	ssrc = get_u32(p + 8);
+
+	s = ssrc_get(sg, ssrc);
+	if (!s)
+		return ENOMEM;
+
+	v = roc_estimate(s, seq);
+	roc_update(s, v, seq);
+
+	rtp_iv(iv, &sg->rtp, ssrc, v, seq);
+
+	err = gcm_crypt(&sg->rtp, true, iv, p, hlen, NULL, 0,
+			p + hlen, mbuf_get_left(mb) - hlen, tag);
+	if (err)
+		return err;
+
+	mb->pos = mb->end;
+	err = mbuf_write_mem(mb, tag, sizeof(tag));
+	mb->pos = start;
+
+	return err;
+}
+
+
+/**
+ * Authenticate and decrypt an SRTP packet
+ *
+ * @param sg SRTP session
+ * @param mb Buffer with the SRTP packet
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int srtp_gcm_decrypt(struct srtp_gcm *sg, struct mbuf *mb)
+{
+	uint8_t iv[GCM_IV_LEN];
+	struct gcm_ssrc *s, tmp;
+	uint32_t ssrc, v;
+	uint64_t ix;
+	uint16_t seq;
+	size_t len;
+	uint8_t *p;
+	int hlen, err;
+
+	if (!sg || !mb)
+		return EINVAL;
+
+	p = mbuf_buf(mb);
+	len = mbuf_get_left(mb);
+	if (len < RTP_HDR_LEN + GCM_TAG_LEN)
+		return EBADMSG;
+
+	len -= GCM_TAG_LEN;
+
+	hlen = rtp_hdr_len(p, len);
+	if (hlen < 0)
+		return EBADMSG;
+
+	seq  = p[2] << 8 | p[3];
+	ssrc = get_u32(p + 8);
+
+	s = ssrc_lookup(sg, &tmp, ssrc);
+
+	v  = roc_estimate(s, seq);
+	ix = (uint64_t)v << 16 | seq;
+
+	if (!replay_check(&s->rtp, ix))
+		return EALREADY;
+
+	rtp_iv(iv, &sg->rtp, ssrc, v, seq);
+
+	err = gcm_crypt(&sg->rtp, false, iv, p, hlen, NULL, 0,
+			p + hlen, len - hlen, p + len);
+	if (err)
+		return err;
+
+	roc_update(s, v, seq);
+	replay_update(&s->rtp, ix);
+
+	if (s == &tmp && !ssrc_add(sg, &tmp))
+		return ENOMEM;
+
+	mb->end = mb->pos + len;
+
+	return 0;
+}
+
+
+/**
+ * Encrypt an RTCP packet, and append the authentication tag
+ * and the SRTCP index
+ *
+ * @param sg SRTP session
+ * @param mb Buffer with the RTCP packet
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int srtcp_gcm_encrypt(struct srtp_gcm *sg, struct mbuf *mb)
+{
+	uint8_t iv[GCM_IV_LEN], tag[GCM_TAG_LEN];
+	uint8_t trailer[SRTCP_TRAILER_LEN];
+	const size_t start = mb ? mb->pos : 0;
+	struct gcm_ssrc *s;
+	uint32_t ssrc, index;
+	uint8_t *p;
+	int err;
+
+	if (!sg || !mb)
+		return EINVAL;
+
+	if (mbuf_get_left(mb) < RTCP_HDR_LEN)
+		return EBADMSG;
+
+	p = mbuf_buf(mb);
+	ssrc = get_u32(p + 4);
+
+	s = ssrc_get(sg, ssrc);
+	if (!s)
+		return ENOMEM;
+
+	index = s->rtcp_index;
+	s->rtcp_index = (index + 1) & 0x7fffffff;
+
+	/* E-flag is set, the packet is encrypted */
+	trailer[0] = 0x80 | ((index >> 24) & 0x7f);
+	trailer[1] = index >> 16;
+	trailer[2] = index >> 8;
+	trailer[3] = index;
+
+	rtcp_iv(iv, &sg->rtcp, ssrc, index);
+
+	err = gcm_crypt(&sg->rtcp, true, iv, p, RTCP_HDR_LEN,
+			trailer, sizeof(trailer), p + RTCP_HDR_LEN,
+			mbuf_get_left(mb) - RTCP_HDR_LEN, tag);
+	if (err)
+		return err;
+
+	mb->pos = mb->end;
+	err  = mbuf_write_mem(mb, tag, sizeof(tag));
+	err |= mbuf_write_mem(mb, trailer, sizeof(trailer));
+	mb->pos = start;
+
+	return err;
+}
+
+
+/**
+ * Authenticate and decrypt an SRTCP packet
+ *
+ * @param sg SRTP session
+ * @param mb Buffer with the SRTCP packet
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int srtcp_gcm_decrypt(struct srtp_gcm *sg, struct mbuf *mb)
+{
+	uint8_t iv[GCM_IV_LEN];
+	const uint8_t *trailer;
+	struct gcm_ssrc *s, tmp;
+	uint32_t ssrc, index;
+	uint8_t *p, *tag;
+	size_t len;
+	bool e;
+	int err;
+
+	if (!sg || !mb)
+		return EINVAL;
+
+	p = mbuf_buf(mb);
+	len = mbuf_get_left(mb);
+	if (len < RTCP_HDR_LEN + GCM_TAG_LEN + SRTCP_TRAILER_LEN)
+		return EBADMSG;
+
+	len -= GCM_TAG_LEN + SRTCP_TRAILER_LEN;
+	tag = p + len;
+	trailer = tag + GCM_TAG_LEN;
+
+	e     = (trailer[0] & 0x80) != 0;
+	index = get_u32(trailer) & 0x7fffffff;
+	ssrc  = get_u32(p + 4);
+
+	s = ssrc_lookup(sg, &tmp, ssrc);
+
+	if (!replay_check(&s->rtcp, index))
+		return EALREADY;
+
+	rtcp_iv(iv, &sg->rtcp, ssrc, index);
+
+	/* without the E-flag the whole packet is authenticated only */
+	if (e) {
+		err = gcm_crypt(&sg->rtcp, false, iv, p, RTCP_HDR_LEN,
+				trailer, SRTCP_TRAILER_LEN,
+				p + RTCP_HDR_LEN, len - RTCP_HDR_LEN, tag);
+	}
+	else {
+		err = gcm_crypt(&sg->rtcp, false, iv, p, len,
+				trailer, SRTCP_TRAILER_LEN, NULL, 0, tag);
+	}
+	if (err)
+		return err;
+
+	replay_update(&s->rtcp, index);
+
+	if (s == &tmp && !ssrc_add(sg, &tmp))
+		return ENOMEM;
+
+	mb->end = mb->pos + len;
+
+	return 0;
+}
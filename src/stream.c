@@ -76,10 +76,13 @@ static void stream_destructor(void *arg)
 	if (s->cfg.rtp_stats)
 		print_rtp_stats(s);
 
+	admit_stream_close(s);
+
 	metric_reset(&s->metric_tx);
 	metric_reset(&s->metric_rx);
 
 	list_unlink(&s->le);
+	mem_deref(s->lock);
 	mem_deref(s->rtpkeep);
 	mem_deref(s->sdp);
 	mem_deref(s->mes);
@@ -117,6 +120,17 @@ static void rtp_recv(const struct sa *src, const struct rtp_header *hdr,
 		s->ssrc_rx = hdr->ssrc;
 	}
 
+	/* Jitter buffer, allocated when the first packet is received */
+	if (!s->jbuf && s->cfg.jbuf_del.min && s->cfg.jbuf_del.max) {
+
+		err = jbuf_alloc(&s->jbuf, s->cfg.jbuf_del.min,
+				 s->cfg.jbuf_del.max);
+		if (err) {
+			warning("stream: jbuf alloc failed (%m)\n", err);
+			return;
+		}
+	}
+
 	if (s->jbuf) {
 
 		struct rtp_header hdr2;
@@ -240,6 +254,10 @@ int stream_alloc(struct stream **sp, const struct config_avt *cfg,
 	s->pseq  = -1;
 	s->rtcp  = s->cfg.rtcp_enable;
 
+	err = lock_alloc(&s->lock);
+	if (err)
+		goto out;
+
 	err = stream_sock_alloc(s, call_af(call));
 	if (err) {
 		warning("stream: failed to create socket for media '%s'"
@@ -251,15 +269,6 @@ int stream_alloc(struct stream **sp, const struct config_avt *cfg,
 	if (err)
 		goto out;
 
-	/* Jitter buffer */
-	if (cfg->jbuf_del.min && cfg->jbuf_del.max) {
-
-		err = jbuf_alloc(&s->jbuf, cfg->jbuf_del.min,
-				 cfg->jbuf_del.max);
-		if (err)
-			goto out;
-	}
-
 	err = sdp_media_add(&s->sdp, sdp_sess, name,
 			    sa_port(rtp_local(s->rtp)),
 			    (menc && menc->sdp_proto) ? menc->sdp_proto :
@@ -419,6 +428,7 @@ static void stream_remote_set(struct stream *s)
 void stream_update(struct stream *s)
 {
 	const struct sdp_format *fmt;
+	void *rtcpsock;
 	int err = 0;
 
 	if (!s)
@@ -431,11 +441,17 @@ void stream_update(struct stream *s)
 	if (sdp_media_has_media(s->sdp))
 		stream_remote_set(s);
 
+	/* with RTP/RTCP multiplexing there is one transport to secure */
+	if (s->rtcp_mux)
+		rtcpsock = rtp_sock(s->rtp);
+	else
+		rtcpsock = s->rtcp ? rtcp_sock(s->rtp) : NULL;
+
 	if (s->menc && s->menc->mediah) {
 		err = s->menc->mediah(&s->mes, s->mencs, s->rtp,
 				      IPPROTO_UDP,
 				      rtp_sock(s->rtp),
-				      s->rtcp ? rtcp_sock(s->rtp) : NULL,
+				      rtcpsock,
 				      s->sdp);
 		if (err) {
 			warning("stream: mediaenc update: %m\n", err);
@@ -534,6 +550,69 @@ void stream_set_bw(struct stream *s, uint32_t bps)
 }
 
 
+/**
+ * Add the time spent in the encoder or decoder of a media stream
+ *
+ * @note This function may be called from any thread
+ *
+ * @param s  Media stream
+ * @param tx True for the encoder, false for the decoder
+ * @param us Time spent in [us]
+ */
+void stream_cpu_add(struct stream *s, bool tx, uint64_t us)
+{
+	if (!s)
+		return;
+
+	lock_write_get(s->lock);
+
+	if (tx)
+		s->cpu_tx_us += us;
+	else
+		s->cpu_rx_us += us;
+
+	lock_rel(s->lock);
+}
+
+
+/**
+ * Count an audio buffer underrun or overrun of a media stream
+ *
+ * @note This function may be called from any thread
+ *
+ * @param s Media stream
+ */
+void stream_xrun(struct stream *s)
+{
+	if (!s)
+		return;
+
+	lock_write_get(s->lock);
+	++s->xruns;
+	lock_rel(s->lock);
+}
+
+
+/**
+ * Get the load counters of a media stream
+ *
+ * @param s      Media stream
+ * @param cpu_us Returned time spent in the encoder and decoder [us]
+ * @param xruns  Returned number of audio buffer under/overruns
+ */
+void stream_load_get(const struct stream *s, uint64_t *cpu_us,
+		     uint32_t *xruns)
+{
+	if (!s || !cpu_us || !xruns)
+		return;
+
+	lock_read_get(s->lock);
+	*cpu_us = s->cpu_tx_us + s->cpu_rx_us;
+	*xruns  = s->xruns;
+	lock_rel(s->lock);
+}
+
+
 int stream_debug(struct re_printf *pf, const struct stream *s)
 {
 	struct sa rrtcp;
@@ -558,6 +637,49 @@ int stream_debug(struct re_printf *pf, const struct stream *s)
 }
 
 
+/**
+ * Get the name of a media stream
+ *
+ * @param strm Media stream
+ *
+ * @return Media name, e.g. "audio" or "video"
+ */
+const char *stream_name(const struct stream *strm)
+{
+	return strm ? sdp_media_name(strm->sdp) : NULL;
+}
+
+
+/**
+ * Get the RTCP statistics of a media stream
+ *
+ * @param strm Media stream
+ *
+ * @return RTCP statistics
+ */
+const struct rtcp_stats *stream_rtcp_stats(const struct stream *strm)
+{
+	return strm ? &strm->rtcp_stats : NULL;
+}
+
+
+/**
+ * Get the current bitrate of a media stream
+ *
+ * @param strm Media stream
+ * @param tx   True for transmit, false for receive
+ *
+ * @return Bitrate in bits per second
+ */
+uint32_t stream_bitrate(const struct stream *strm, bool tx)
+{
+	if (!strm)
+		return 0;
+
+	return tx ? strm->metric_tx.cur_bitrate : strm->metric_rx.cur_bitrate;
+}
+
+
 int stream_print(struct re_printf *pf, const struct stream *s)
 {
 	if (!s)
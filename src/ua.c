@@ -25,6 +25,9 @@ struct ua {
 	MAGIC_DECL                   /**< Magic number for struct ua         */
 	struct ua **uap;             /**< Pointer to application's ua        */
 	struct le le;                /**< Linked list element                */
+	struct le he_cuser;          /**< Hash element for contact username  */
+	struct le he_user;           /**< Hash element for AOR username      */
+	struct le he_aor;            /**< Hash element for AOR               */
 	struct account *acc;         /**< Account Parameters                 */
 	struct list regl;            /**< List of Register clients           */
 	struct list calls;           /**< List of active calls (struct call) */
@@ -32,6 +35,9 @@ struct ua {
 	size_t    extensionc;        /**< Number of SIP extensions           */
 	char *cuser;                 /**< SIP Contact username               */
 	char *pub_gruu;              /**< SIP Public GRUU                    */
+	struct mbuf *opt_sdp;        /**< Cached SDP for OPTIONS replies     */
+	struct sa opt_laddr;         /**< Local address of cached SDP        */
+	uint32_t opt_gen;            /**< Codec generation of cached SDP     */
 	int af;                      /**< Preferred Address Family           */
 	int af_media;
 	enum presence_status my_status; /**< Presence Status                 */
@@ -41,11 +47,42 @@ struct ua_eh {
 	struct le le;
 	ua_event_h *h;
 	void *arg;
+	uint32_t mask;                 /**< Subscribed events               */
+	bool async;                    /**< Delivered from the event queue  */
+	uint64_t ndrop;                /**< Events dropped for this handler */
 };
 
+enum {
+	UAG_HASH_SIZE = 1024,          /**< Hash buckets for UA lookup      */
+	UAG_EVQ_SIZE  = 256,           /**< Event queue slots, power of 2   */
+	UAG_EVQ_BATCH = 32,            /**< Events delivered per batch      */
+};
+
+/** One queued UA event */
+struct ua_evrec {
+	struct ua *ua;                 /**< User-Agent (referenced)         */
+	struct call *call;             /**< Call object (referenced)        */
+	enum ua_event ev;              /**< Event type                      */
+	char prm[256];                 /**< Event parameters                */
+};
+
+/** Event queue of the asynchronous event handlers */
+static struct {
+	struct ua_evrec *ringv;        /**< Preallocated ring of events     */
+	uint32_t head;                 /**< Write position                  */
+	uint32_t tail;                 /**< Read position                   */
+	struct tmr tmr;                /**< Delivers from the main loop     */
+	uint64_t ndeliv;               /**< Number of events delivered      */
+	uint64_t ndrop;                /**< Number of events dropped        */
+} evq;
+
 static struct {
 	struct config_sip *cfg;        /**< SIP configuration               */
 	struct list ual;               /**< List of User-Agents (struct ua) */
+	struct hash *ht_cuser;         /**< UAs indexed by contact username */
+	struct hash *ht_user;          /**< UAs indexed by AOR username     */
+	struct hash *ht_aor;           /**< UAs indexed by AOR              */
+	struct hash *ht_call;          /**< Calls indexed by call id        */
 	struct list ehl;               /**< Event handlers (struct ua_eh)   */
 	struct sip *sip;               /**< SIP Stack                       */
 	struct sip_lsnr *lsnr;         /**< SIP Listener                    */
@@ -66,6 +103,9 @@ static struct {
 } uag = {
 	NULL,
 	LIST_INIT,
+	NULL,
+	NULL,
+	NULL,
 	LIST_INIT,
 	NULL,
 	NULL,
@@ -119,9 +159,120 @@ void ua_printf(const struct ua *ua, const char *fmt, ...)
 }
 
 
+static void evq_deliver(uint32_t max)
+{
+	uint32_t n = 0;
+
+	while (evq.tail != evq.head && n++ < max) {
+
+		struct ua_evrec *rec;
+		struct le *le;
+
+		rec = &evq.ringv[evq.tail & (UAG_EVQ_SIZE - 1)];
+
+		le = uag.ehl.head;
+		while (le) {
+			struct ua_eh *eh = le->data;
+			le = le->next;
+
+			if (eh->async && (eh->mask & UA_EVENT_MASK(rec->ev)))
+				eh->h(rec->ua, rec->ev, rec->call, rec->prm,
+				      eh->arg);
+		}
+
+		rec->call = mem_deref(rec->call);
+		rec->ua   = mem_deref(rec->ua);
+		++evq.tail;
+		++evq.ndeliv;
+	}
+}
+
+
+static void evq_handler(void *arg)
+{
+	(void)arg;
+
+	evq_deliver(UAG_EVQ_BATCH);
+
+	/* yield to the main loop between batches */
+	if (evq.tail != evq.head)
+		tmr_start(&evq.tmr, 0, evq_handler, NULL);
+}
+
+
+/* Deliver all queued events now, and release their references */
+static void evq_drain(void)
+{
+	tmr_cancel(&evq.tmr);
+
+	while (evq.tail != evq.head)
+		evq_deliver(UAG_EVQ_BATCH);
+}
+
+
+static void evq_push(struct ua *ua, enum ua_event ev, struct call *call,
+		     const char *prm)
+{
+	struct ua_evrec *rec;
+
+	if (evq.head - evq.tail >= UAG_EVQ_SIZE) {
+		struct le *le;
+
+		++evq.ndrop;
+
+		for (le = uag.ehl.head; le; le = le->next) {
+			struct ua_eh *eh = le->data;
+
+			if (eh->async && (eh->mask & UA_EVENT_MASK(ev)))
+				++eh->ndrop;
+		}
+
+		return;
+	}
+
+	rec = &evq.ringv[evq.head & (UAG_EVQ_SIZE - 1)];
+
+	rec->ua   = mem_ref(ua);
+	rec->call = mem_ref(call);
+	rec->ev   = ev;
+	str_ncpy(rec->prm, prm, sizeof(rec->prm));
+
+	++evq.head;
+
+	if (!tmr_isrunning(&evq.tmr))
+		tmr_start(&evq.tmr, 0, evq_handler, NULL);
+}
+
+
+static void evq_flush(void)
+{
+	tmr_cancel(&evq.tmr);
+
+	while (evq.tail != evq.head) {
+		struct ua_evrec *rec;
+
+		rec = &evq.ringv[evq.tail++ & (UAG_EVQ_SIZE - 1)];
+		mem_deref(rec->call);
+		mem_deref(rec->ua);
+	}
+
+	evq.ringv = mem_deref(evq.ringv);
+	evq.head = evq.tail = 0;
+}
+
+
+/*
+ * Synchronous handlers are called directly, asynchronous handlers
+ * get the event from the queue. Events on an object that is being
+ * destroyed cannot be queued, and are delivered directly to all
+ * subscribed handlers.
+ */
 void ua_event(struct ua *ua, enum ua_event ev, struct call *call,
 	      const char *fmt, ...)
 {
+	const uint32_t evmask = UA_EVENT_MASK(ev);
+	uint32_t amask = 0;
+	bool dying;
 	struct le *le;
 	char buf[256];
 	va_list ap;
@@ -130,14 +281,27 @@ void ua_event(struct ua *ua, enum ua_event ev, struct call *call,
 	(void)re_vsnprintf(buf, sizeof(buf), fmt, ap);
 	va_end(ap);
 
+	dying = (ua && !mem_nrefs(ua)) || (call && !mem_nrefs(call));
+
 	/* send event to all clients */
 	le = uag.ehl.head;
 	while (le) {
 		struct ua_eh *eh = le->data;
 		le = le->next;
 
+		if (!(eh->mask & evmask))
+			continue;
+
+		if (eh->async && evq.ringv && !dying) {
+			amask |= evmask;
+			continue;
+		}
+
 		eh->h(ua, ev, call, buf, eh->arg);
 	}
+
+	if (amask)
+		evq_push(ua, ev, call, buf);
 }
 
 
@@ -441,26 +605,140 @@ static int ua_call_alloc(struct call **callp, struct ua *ua,
 }
 
 
+/*
+ * Encode an SDP with the capabilities of a User-Agent, for replies to
+ * OPTIONS (RFC 3264 section 9). No media streams are allocated, so
+ * the media lines use the discard port.
+ */
+static int options_sdp_encode(struct mbuf **mbp, const struct ua *ua,
+			      const struct sa *laddr)
+{
+	const struct config *cfg = conf_config();
+	const struct account *acc = ua->acc;
+	const char *proto = sdp_proto_rtpavp;
+	struct sdp_session *sess;
+	struct sdp_media *m;
+	struct le *le;
+	int err;
+
+	if (acc->menc && acc->menc->sdp_proto)
+		proto = acc->menc->sdp_proto;
+
+	err = sdp_session_alloc(&sess, laddr);
+	if (err)
+		return err;
+
+	err = sdp_session_set_lattr(sess, true,
+				    "tool", "baresip " BARESIP_VERSION);
+	if (err)
+		goto out;
+
+	err = sdp_media_add(&m, sess, "audio", 9, proto);
+	if (err)
+		goto out;
+
+	err = sdp_media_set_lattr(m, true, "ptime", "%u", acc->ptime);
+
+	for (le = list_head(account_aucodecl(acc)); le; le = le->next) {
+		struct aucodec *ac = le->data;
+
+		if (!in_range(&cfg->audio.srate, ac->srate) ||
+		    !in_range(&cfg->audio.channels, ac->ch))
+			continue;
+
+		err |= sdp_format_add(NULL, m, false, ac->pt, ac->name,
+				      ac->crate, ac->ch, ac->fmtp_ench,
+				      ac->fmtp_cmph, ac, false,
+				      "%s", ac->fmtp);
+	}
+
+	err |= sdp_format_add(NULL, m, false, "101", telev_rtpfmt,
+			      TELEV_SRATE, 1, NULL, NULL, NULL, false,
+			      "0-15");
+	if (err)
+		goto out;
+
+#ifdef USE_VIDEO
+	if (list_head(account_vidcodecl(acc)) &&
+	    (vidsrc_find(NULL) || vidisp_find(NULL))) {
+
+		err = sdp_media_add(&m, sess, "video", 9, proto);
+		if (err)
+			goto out;
+
+		for (le = list_head(account_vidcodecl(acc)); le;
+		     le = le->next) {
+			struct vidcodec *vc = le->data;
+
+			err |= sdp_format_add(NULL, m, false, vc->pt,
+					      vc->name, 90000, 1,
+					      vc->fmtp_ench, vc->fmtp_cmph,
+					      vc, false, "%s", vc->fmtp);
+		}
+		if (err)
+			goto out;
+	}
+#endif
+
+	err = sdp_encode(mbp, sess, true);
+
+ out:
+	mem_deref(sess);
+
+	return err;
+}
+
+
+/*
+ * Get the cached OPTIONS SDP of a User-Agent. The SDP is encoded
+ * again when the local address or the set of codecs has changed.
+ */
+static int options_sdp(struct mbuf **mbp, struct ua *ua)
+{
+	const struct sa *laddr;
+	const uint32_t gen = sdp_tmpl_gen();
+	int err;
+
+	laddr = net_laddr_af(baresip_network(),
+			     ua->af_media ? ua->af_media : ua->af);
+	if (!laddr)
+		return EADDRNOTAVAIL;
+
+	if (!ua->opt_sdp || gen != ua->opt_gen ||
+	    !sa_cmp(laddr, &ua->opt_laddr, SA_ADDR)) {
+
+		ua->opt_sdp = mem_deref(ua->opt_sdp);
+
+		err = options_sdp_encode(&ua->opt_sdp, ua, laddr);
+		if (err)
+			return err;
+
+		sa_cpy(&ua->opt_laddr, laddr);
+		ua->opt_gen = gen;
+	}
+
+	*mbp = ua->opt_sdp;
+
+	return 0;
+}
+
+
 static void handle_options(struct ua *ua, const struct sip_msg *msg)
 {
 	struct sip_contact contact;
-	struct call *call = NULL;
-	struct mbuf *desc = NULL;
+	struct mbuf *desc;
 	int err;
 
 	debug("ua: incoming OPTIONS message from %r (%J)\n",
 	      &msg->from.auri, &msg->src);
 
-	err = ua_call_alloc(&call, ua, VIDMODE_ON, NULL, NULL, NULL);
+	err = options_sdp(&desc, ua);
 	if (err) {
-		(void)sip_treply(NULL, uag.sip, msg, 500, "Call Error");
+		warning("ua: options: sdp: %m\n", err);
+		(void)sip_treply(NULL, uag.sip, msg, 500, "SDP Error");
 		return;
 	}
 
-	err = call_sdp_get(call, &desc, true);
-	if (err)
-		goto out;
-
 	sip_contact_set(&contact, ua_cuser(ua), &msg->dst, msg->tp);
 
 	err = sip_treplyf(NULL, NULL, uag.sip,
@@ -481,10 +759,73 @@ static void handle_options(struct ua *ua, const struct sip_msg *msg)
 	if (err) {
 		warning("ua: options: sip_treplyf: %m\n", err);
 	}
+}
 
- out:
-	mem_deref(desc);
-	mem_deref(call);
+
+static void uag_hash_free(void)
+{
+	/* UAs with external references may outlive the hash tables */
+	hash_clear(uag.ht_cuser);
+	hash_clear(uag.ht_user);
+	hash_clear(uag.ht_aor);
+	hash_clear(uag.ht_call);
+	uag.ht_cuser = mem_deref(uag.ht_cuser);
+	uag.ht_user  = mem_deref(uag.ht_user);
+	uag.ht_aor   = mem_deref(uag.ht_aor);
+	uag.ht_call  = mem_deref(uag.ht_call);
+}
+
+
+/*
+ * The hash tables are allocated with the first UA, and not in
+ * ua_init(), which may be called several times (e.g. by the selftests)
+ */
+static int uag_hash_alloc(void)
+{
+	int err = 0;
+
+	if (!uag.ht_cuser)
+		err = hash_alloc(&uag.ht_cuser, UAG_HASH_SIZE);
+	if (!err && !uag.ht_user)
+		err = hash_alloc(&uag.ht_user, UAG_HASH_SIZE);
+	if (!err && !uag.ht_aor)
+		err = hash_alloc(&uag.ht_aor, UAG_HASH_SIZE);
+	if (!err && !uag.ht_call)
+		err = hash_alloc(&uag.ht_call, UAG_HASH_SIZE);
+
+	/* all or none of the tables are allocated */
+	if (err)
+		uag_hash_free();
+
+	return err;
+}
+
+
+static int ua_index(struct ua *ua)
+{
+	const struct pl *user = &ua->acc->luri.user;
+	int err;
+
+	err = uag_hash_alloc();
+	if (err)
+		return err;
+
+	hash_append(uag.ht_cuser, hash_joaat_str_ci(ua->cuser),
+		    &ua->he_cuser, ua);
+	hash_append(uag.ht_user, hash_joaat_ci(user->p, user->l),
+		    &ua->he_user, ua);
+	hash_append(uag.ht_aor, hash_joaat_str(ua->acc->aor),
+		    &ua->he_aor, ua);
+
+	return 0;
+}
+
+
+static void ua_unindex(struct ua *ua)
+{
+	hash_unlink(&ua->he_cuser);
+	hash_unlink(&ua->he_user);
+	hash_unlink(&ua->he_aor);
 }
 
 
@@ -498,6 +839,7 @@ static void ua_destructor(void *arg)
 	}
 
 	list_unlink(&ua->le);
+	ua_unindex(ua);
 
 	if (!list_isempty(&ua->regl))
 		ua_event(ua, UA_EVENT_UNREGISTERING, NULL, NULL);
@@ -506,6 +848,7 @@ static void ua_destructor(void *arg)
 	list_flush(&ua->regl);
 	mem_deref(ua->cuser);
 	mem_deref(ua->pub_gruu);
+	mem_deref(ua->opt_sdp);
 	mem_deref(ua->acc);
 
 	if (list_isempty(&uag.ual)) {
@@ -649,6 +992,10 @@ int ua_alloc(struct ua **uap, const char *aor)
 	if (err)
 		goto out;
 
+	err = ua_index(ua);
+	if (err)
+		goto out;
+
 	list_append(&uag.ual, &ua->le, ua);
 
 	if (ua->acc->regint) {
@@ -1191,6 +1538,7 @@ static void sipsess_conn_handler(const struct sip_msg *msg, void *arg)
 	const struct sip_hdr *hdr;
 	struct ua *ua;
 	struct call *call = NULL;
+	uint32_t retry_after = 0;
 	char to_uri[256];
 	int err;
 
@@ -1212,6 +1560,18 @@ static void sipsess_conn_handler(const struct sip_msg *msg, void *arg)
 		return;
 	}
 
+	/* reject new calls while the media load is too high */
+	if (!admit_check(&retry_after)) {
+		info("ua: rejected call from %r (load score %u%%)\n",
+		     &msg->from.auri, admit_score());
+		(void)sip_treplyf(NULL, NULL, uag.sip, msg, false,
+				  503, "Service Unavailable",
+				  "Retry-After: %u\r\n"
+				  "Content-Length: 0\r\n\r\n",
+				  retry_after);
+		return;
+	}
+
 	/* Handle Require: header, check for any required extensions */
 	hdr = sip_msg_hdr_apply(msg, true, SIP_HDR_REQUIRE,
 				require_handler, ua);
@@ -1256,6 +1616,8 @@ static void net_change_handler(void *arg)
 	     net_laddr_af(baresip_network(), AF_INET));
 
 	(void)uag_reset_transp(true, true);
+
+	natcache_net_change();
 }
 
 
@@ -1367,6 +1729,14 @@ int ua_init(const char *software, bool udp, bool tcp, bool tls,
 	if (err)
 		goto out;
 
+	err = admit_init(&cfg->call);
+	if (err)
+		goto out;
+
+	err = sipflow_init(&cfg->sip);
+	if (err)
+		goto out;
+
 	net_change(net, 60, net_change_handler, NULL);
 
  out:
@@ -1384,6 +1754,9 @@ int ua_init(const char *software, bool udp, bool tcp, bool tls,
 void ua_close(void)
 {
 	cmd_unregister(cmdv);
+	admit_close();
+	natcache_close();
+	sipflow_close();
 	play_close();
 	ui_reset();
 	contact_close();
@@ -1398,9 +1771,14 @@ void ua_close(void)
 	uag.tls = mem_deref(uag.tls);
 #endif
 
+	/* queued events hold references to UAs and calls */
+	evq_flush();
+
 	list_flush(&uag.ual);
 	list_flush(&uag.ehl);
 
+	uag_hash_free();
+
 	/* note: must be done before mod_close() */
 	module_app_unload();
 }
@@ -1418,6 +1796,9 @@ void ua_stop_all(bool forced)
 
 	info("ua: stop all (forced=%d)\n", forced);
 
+	/* queued events hold a reference to the ua */
+	evq_drain();
+
 	/* check if someone else has grabbed a ref to ua */
 	le = uag.ual.head;
 	while (le) {
@@ -1428,6 +1809,7 @@ void ua_stop_all(bool forced)
 		if (mem_nrefs(ua) > 1) {
 
 			list_unlink(&ua->le);
+			ua_unindex(ua);
 			list_flush(&ua->calls);
 			mem_deref(ua);
 
@@ -1437,6 +1819,9 @@ void ua_stop_all(bool forced)
 		ua_event(ua, UA_EVENT_SHUTDOWN, NULL, NULL);
 	}
 
+	/* deliver the shutdown events before the modules are unloaded */
+	evq_drain();
+
 	if (ext_ref) {
 		info("ua: ext_ref -> cannot unload mods\n");
 		return;
@@ -1489,6 +1874,7 @@ int uag_reset_transp(bool reg, bool reinvite)
 	int err;
 
 	/* Update SIP transports */
+	sipflow_reset();
 	sip_transp_flush(uag.sip);
 
 	(void)net_check(net);
@@ -1530,8 +1916,68 @@ int uag_reset_transp(bool reg, bool reinvite)
  */
 int ua_print_sip_status(struct re_printf *pf, void *unused)
 {
+	int err;
+
+	(void)unused;
+
+	err  = sip_debug(pf, uag.sip);
+	err |= reg_sched_debug(pf, NULL);
+	err |= sipflow_debug(pf, NULL);
+	err |= re_hprintf(pf, "event queue: %u/%u queued, %llu delivered,"
+			  " %llu dropped\n",
+			  evq.head - evq.tail, UAG_EVQ_SIZE,
+			  evq.ndeliv, evq.ndrop);
+
+	return err;
+}
+
+
+/**
+ * Print the memory usage of all calls, by component
+ *
+ * @param pf     Print handler for debug output
+ * @param unused Unused parameter
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int uag_memstat(struct re_printf *pf, void *unused)
+{
+	struct call_memstat ms;
+	uint32_t n = 0;
+	struct le *le;
+	int err;
+
 	(void)unused;
-	return sip_debug(pf, uag.sip);
+
+	memset(&ms, 0, sizeof(ms));
+
+	for (le = uag.ual.head; le; le = le->next) {
+		const struct ua *ua = le->data;
+		struct le *lec;
+
+		for (lec = ua->calls.head; lec; lec = lec->next) {
+			call_memstat(lec->data, &ms);
+			++n;
+		}
+	}
+
+	err  = re_hprintf(pf, "\n--- Memory per call (%u calls) ---\n", n);
+	err |= re_hprintf(pf, " call:    %8zu bytes  %6zu bytes/call\n",
+			  ms.call, n ? ms.call / n : 0);
+	err |= re_hprintf(pf, " audio:   %8zu bytes  %6zu bytes/call\n",
+			  ms.audio, n ? ms.audio / n : 0);
+	err |= re_hprintf(pf, " buffers: %8zu bytes  %6zu bytes/call\n",
+			  ms.aubuf, n ? ms.aubuf / n : 0);
+	err |= re_hprintf(pf, " video:   %8zu bytes  %6zu bytes/call\n",
+			  ms.video, n ? ms.video / n : 0);
+	err |= re_hprintf(pf, " vidbufs: %8zu bytes  %6zu bytes/call\n",
+			  ms.vidbuf, n ? ms.vidbuf / n : 0);
+	err |= re_hprintf(pf, " streams: %8zu bytes  %6zu bytes/call\n",
+			  ms.stream, n ? ms.stream / n : 0);
+	err |= re_hprintf(pf, " jitter buffers: %u (count only,"
+			  " packet memory not included)\n", ms.jbufc);
+
+	return err;
 }
 
 
@@ -1631,6 +2077,7 @@ const char *uag_event_str(enum ua_event ev)
 	case UA_EVENT_CALL_TRANSFER_FAILED: return "TRANSFER_FAILED";
 	case UA_EVENT_CALL_DTMF_START:      return "CALL_DTMF_START";
 	case UA_EVENT_CALL_DTMF_END:        return "CALL_DTMF_END";
+	case UA_EVENT_CALL_VIDEO_ADAPT:     return "CALL_VIDEO_ADAPT";
 	default: return "?";
 	}
 }
@@ -1664,6 +2111,102 @@ int ua_sipfd(const struct ua *ua)
 }
 
 
+static bool cuser_cmp_handler(struct le *le, void *arg)
+{
+	const struct ua *ua = le->data;
+
+	return 0 == pl_strcasecmp(arg, ua->cuser);
+}
+
+
+static bool user_cmp_handler(struct le *le, void *arg)
+{
+	const struct ua *ua = le->data;
+
+	return 0 == pl_casecmp(arg, &ua->acc->luri.user);
+}
+
+
+static bool aor_cmp_handler(struct le *le, void *arg)
+{
+	const struct ua *ua = le->data;
+
+	return 0 == str_cmp(ua->acc->aor, arg);
+}
+
+
+struct call_match {
+	const struct ua *ua;
+	const char *id;
+};
+
+
+static bool call_cmp_handler(struct le *le, void *arg)
+{
+	const struct call_match *cm = arg;
+	const struct call *call = le->data;
+
+	if (cm->ua && call_get_ua(call) != cm->ua)
+		return false;
+
+	return 0 == str_cmp(call_id(call), cm->id);
+}
+
+
+/**
+ * Add a call to the global call table
+ *
+ * The table is keyed by the Call-ID only, the dialog tags are not
+ * available from the SIP stack. See uag_call_find() for how calls
+ * sharing a Call-ID are told apart.
+ *
+ * @param he   Hash element of the call
+ * @param call Call object
+ */
+void uag_call_index(struct le *he, struct call *call)
+{
+	const char *id = call_id(call);
+
+	if (!he || !id)
+		return;
+
+	hash_unlink(he);
+	hash_append(uag.ht_call, hash_joaat_str(id), he, call);
+}
+
+
+/**
+ * Find a call from its identifier
+ *
+ * A Call-ID is not unique in the process when a call loops back to
+ * another local User-Agent, both call legs then share it. Pass the
+ * User-Agent to pick the leg of that User-Agent. Without a User-Agent
+ * the first matching call is returned, and the result is ambiguous
+ * for looped calls.
+ *
+ * @param ua User-Agent, or NULL to search all User-Agents
+ * @param id Call identifier, see call_id()
+ *
+ * @return Call object if found, otherwise NULL
+ */
+struct call *uag_call_find(const struct ua *ua, const char *id)
+{
+	struct call_match cm;
+	struct le *le;
+
+	if (!str_isset(id))
+		return NULL;
+
+	cm.ua = ua;
+	cm.id = id;
+
+	le = hash_lookup(uag.ht_call, hash_joaat_str(id),
+			 call_cmp_handler, &cm);
+
+	return list_ledata(le);
+}
+
+
 /**
  * Find the correct UA from the contact user
  *
@@ -1675,22 +2218,19 @@ struct ua *uag_find(const struct pl *cuser)
 {
 	struct le *le;
 
-	for (le = uag.ual.head; le; le = le->next) {
-		struct ua *ua = le->data;
+	if (!cuser)
+		return NULL;
 
-		if (0 == pl_strcasecmp(cuser, ua->cuser))
-			return ua;
-	}
+	le = hash_lookup(uag.ht_cuser, hash_joaat_ci(cuser->p, cuser->l),
+			 cuser_cmp_handler, (void *)cuser);
+	if (le)
+		return le->data;
 
 	/* Try also matching by AOR, for better interop */
-	for (le = uag.ual.head; le; le = le->next) {
-		struct ua *ua = le->data;
+	le = hash_lookup(uag.ht_user, hash_joaat_ci(cuser->p, cuser->l),
+			 user_cmp_handler, (void *)cuser);
 
-		if (0 == pl_casecmp(cuser, &ua->acc->luri.user))
-			return ua;
-	}
-
-	return NULL;
+	return list_ledata(le);
 }
 
 
@@ -1705,16 +2245,13 @@ struct ua *uag_find_aor(const char *aor)
 {
 	struct le *le;
 
-	for (le = uag.ual.head; le; le = le->next) {
-		struct ua *ua = le->data;
+	if (!str_isset(aor))
+		return list_ledata(uag.ual.head);
 
-		if (str_isset(aor) && str_cmp(ua->acc->aor, aor))
-			continue;
-
-		return ua;
-	}
+	le = hash_lookup(uag.ht_aor, hash_joaat_str(aor),
+			 aor_cmp_handler, (void *)aor);
 
-	return NULL;
+	return list_ledata(le);
 }
 
 
@@ -1865,7 +2402,8 @@ static void eh_destructor(void *arg)
 }
 
 
-int uag_event_register(ua_event_h *h, void *arg)
+static int event_register(ua_event_h *h, void *arg, uint32_t mask,
+			  bool async)
 {
 	struct ua_eh *eh;
 
@@ -1874,12 +2412,21 @@ int uag_event_register(ua_event_h *h, void *arg)
 
 	uag_event_unregister(h);
 
+	if (async && !evq.ringv) {
+		evq.ringv = mem_zalloc(UAG_EVQ_SIZE * sizeof(*evq.ringv),
+				       NULL);
+		if (!evq.ringv)
+			return ENOMEM;
+	}
+
 	eh = mem_zalloc(sizeof(*eh), eh_destructor);
 	if (!eh)
 		return ENOMEM;
 
 	eh->h = h;
 	eh->arg = arg;
+	eh->mask = mask;
+	eh->async = async;
 
 	list_append(&uag.ehl, &eh->le, eh);
 
@@ -1887,6 +2434,39 @@ int uag_event_register(ua_event_h *h, void *arg)
 }
 
 
+/**
+ * Register a User-Agent event handler, which is called directly
+ * for all events
+ *
+ * @param h   Event handler
+ * @param arg Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int uag_event_register(ua_event_h *h, void *arg)
+{
+	return event_register(h, arg, UA_EVENT_MASK_ALL, false);
+}
+
+
+/**
+ * Register a User-Agent event handler, which is called in batches
+ * from the main loop. The User-Agent and call objects are kept
+ * alive until the event is delivered. Events are dropped if the
+ * event queue is full.
+ *
+ * @param h    Event handler
+ * @param arg  Handler argument
+ * @param mask Subscribed events, see UA_EVENT_MASK()
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int uag_event_register_async(ua_event_h *h, void *arg, uint32_t mask)
+{
+	return event_register(h, arg, mask, true);
+}
+
+
 void uag_event_unregister(ua_event_h *h)
 {
 	struct le *le;
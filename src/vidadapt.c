@@ -0,0 +1,155 @@
+/**
+ * @file src/vidadapt.c  Video CPU-overuse adaptation
+ *
+ * Copyright (C) 2010 - 2016 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+
+
+/** CPU-overuse detection parameters */
+enum {
+	OVERUSE_HIGH    = 85,  /**< Step down above this usage in [%]   */
+	OVERUSE_LOW     = 60,  /**< Step up below this usage in [%]     */
+	OVERUSE_HOLDOFF = 2,   /**< Windows with headroom before step up */
+};
+
+/**
+ * Adaptation levels, from full quality and downwards. Each level
+ * defines the resolution and framerate relative to the configured values.
+ */
+static const struct vidadapt_level adapt_levels[] = {
+	{100, 100},
+	{ 75, 100},
+	{ 50, 100},
+	{ 50,  67},
+	{ 50,  50},
+	{ 25,  50},
+};
+
+
+/**
+ * Reset the measurement window and the hysteresis of a detector. The
+ * adaptation level is kept.
+ *
+ * @param va CPU-overuse detector
+ */
+void vidadapt_reset(struct vidadapt *va)
+{
+	if (!va)
+		return;
+
+	va->enc_us   = 0;
+	va->frames   = 0;
+	va->usage    = 0;
+	va->headroom = 0;
+}
+
+
+/**
+ * Add the encode time of one frame to the measurement window
+ *
+ * @param va     CPU-overuse detector
+ * @param enc_us Time spent in the encoder in [us]
+ */
+void vidadapt_encoded(struct vidadapt *va, uint64_t enc_us)
+{
+	if (!va)
+		return;
+
+	va->enc_us += enc_us;
+	++va->frames;
+}
+
+
+/**
+ * Check the encode usage of a measurement window, and start a new
+ * window.
+ *
+ * The encode time per frame is measured relative to the frame interval.
+ * If the encoder uses too much of the frame interval, step down the
+ * resolution and framerate. Step up again when the estimated usage at
+ * the next level leaves enough headroom, for a number of windows.
+ *
+ * @param va  CPU-overuse detector
+ * @param fps Current framerate
+ *
+ * @return The adaptation level to use, the caller sets va->level when
+ *         the encoder is switched to it
+ */
+unsigned vidadapt_check(struct vidadapt *va, unsigned fps)
+{
+	const struct vidadapt_level *al, *up;
+	unsigned usage;
+
+	if (!va)
+		return 0;
+
+	if (!va->frames || !fps)
+		return va->level;
+
+	usage = (unsigned)(va->enc_us * 100 * fps / (va->frames * 1000000ULL));
+
+	va->usage  = usage;
+	va->enc_us = 0;
+	va->frames = 0;
+
+	if (usage > OVERUSE_HIGH) {
+
+		va->headroom = 0;
+
+		if (va->level + 1 >= ARRAY_SIZE(adapt_levels))
+			return va->level;
+
+		return va->level + 1;
+	}
+
+	if (va->level == 0)
+		return 0;
+
+	/* Encoding cost scales with the number of pixels per second */
+	al = &adapt_levels[va->level];
+	up = &adapt_levels[va->level - 1];
+
+	usage = usage * up->scale * up->scale * up->fps
+		/ (al->scale * al->scale * al->fps);
+
+	if (usage >= OVERUSE_LOW) {
+		va->headroom = 0;
+		return va->level;
+	}
+
+	if (++va->headroom < OVERUSE_HOLDOFF)
+		return va->level;
+
+	va->headroom = 0;
+
+	return va->level - 1;
+}
+
+
+/**
+ * Get an adaptation level
+ *
+ * @param level Adaptation level, 0 is full quality
+ *
+ * @return Adaptation level, or the lowest level if out of range
+ */
+const struct vidadapt_level *vidadapt_level(unsigned level)
+{
+	if (level >= ARRAY_SIZE(adapt_levels))
+		level = ARRAY_SIZE(adapt_levels) - 1;
+
+	return &adapt_levels[level];
+}
+
+
+/**
+ * Get the number of adaptation levels
+ *
+ * @return Number of adaptation levels
+ */
+unsigned vidadapt_level_count(void)
+{
+	return ARRAY_SIZE(adapt_levels);
+}
@@ -6,6 +6,7 @@
 
 #include <re.h>
 #include <baresip.h>
+#include "core.h"
 
 
 static struct list vidcodecl;
@@ -22,6 +23,7 @@ void vidcodec_register(struct vidcodec *vc)
 		return;
 
 	list_append(&vidcodecl, &vc->le, vc);
+	sdp_tmpl_flush();
 
 	info("vidcodec: %s\n", vc->name);
 }
@@ -38,6 +40,7 @@ void vidcodec_unregister(struct vidcodec *vc)
 		return;
 
 	list_unlink(&vc->le);
+	sdp_tmpl_flush();
 }
 
 
@@ -53,6 +56,8 @@ const struct vidcodec *vidcodec_find(const char *name, const char *variant)
 {
 	struct le *le;
 
+	module_lazy_load("vidcodec");
+
 	for (le=vidcodecl.head; le; le=le->next) {
 
 		struct vidcodec *vc = le->data;
@@ -81,6 +86,8 @@ const struct vidcodec *vidcodec_find_encoder(const char *name)
 {
 	struct le *le;
 
+	module_lazy_load("vidcodec");
+
 	for (le=vidcodecl.head; le; le=le->next) {
 
 		struct vidcodec *vc = le->data;
@@ -107,6 +114,8 @@ const struct vidcodec *vidcodec_find_decoder(const char *name)
 {
 	struct le *le;
 
+	module_lazy_load("vidcodec");
+
 	for (le=vidcodecl.head; le; le=le->next) {
 
 		struct vidcodec *vc = le->data;
@@ -96,6 +96,7 @@ struct vtx {
 	struct tmr tmr_rtp;                /**< Timer for sending RTP     */
 	unsigned skipc;                    /**< Number of frames skipped */
 	struct list filtl;                 /**< Filters in encoding order */
+	char *params;                      /**< Encoder format parameters */
 	char device[64];
 	int muted_frames;                  /**< # of muted frames sent    */
 	uint32_t ts_tx;                    /**< Outgoing RTP timestamp    */
@@ -103,6 +104,10 @@ struct vtx {
 	bool muted;                        /**< Muted flag                */
 	int frames;                        /**< Number of frames sent     */
 	int efps;                          /**< Estimated frame-rate      */
+
+	struct vidadapt ovu;               /**< CPU-overuse detector      */
+	unsigned n_down;                   /**< Number of step-downs      */
+	unsigned n_up;                     /**< Number of step-ups        */
 };
 
 
@@ -297,6 +302,7 @@ static void video_destructor(void *arg)
 	list_flush(&vtx->filtl);
 	lock_rel(vtx->lock);
 	mem_deref(vtx->lock);
+	mem_deref(vtx->params);
 
 	/* receive */
 	lock_write_get(vrx->lock);
@@ -328,6 +334,15 @@ static int get_fps(const struct video *v)
 }
 
 
+/* Framerate for the current adaptation level */
+static int vtx_fps(const struct vtx *vtx)
+{
+	const struct vidadapt_level *al = vidadapt_level(vtx->ovu.level);
+
+	return max(get_fps(vtx->video) * (int)al->fps / 100, 1);
+}
+
+
 static int packet_handler(bool marker, const uint8_t *hdr, size_t hdr_len,
 			  const uint8_t *pld, size_t pld_len, void *arg)
 {
@@ -361,6 +376,7 @@ static int packet_handler(bool marker, const uint8_t *hdr, size_t hdr_len,
 static void encode_rtp_send(struct vtx *vtx, struct vidframe *frame)
 {
 	struct le *le;
+	uint64_t t0, dt;
 	int err = 0;
 	bool sendq_empty;
 
@@ -383,6 +399,9 @@ static void encode_rtp_send(struct vtx *vtx, struct vidframe *frame)
 
 		vtx->vsrc_size = frame->size;
 
+		if (vtx->frame && !vidsz_cmp(&vtx->frame->size, &frame->size))
+			vtx->frame = mem_deref(vtx->frame);
+
 		if (!vtx->frame) {
 
 			err = vidframe_alloc(&vtx->frame, VIDENC_INTERNAL_FMT,
@@ -404,14 +423,22 @@ static void encode_rtp_send(struct vtx *vtx, struct vidframe *frame)
 			err |= st->vf->ench(st, frame);
 	}
 
- unlock:
-	lock_rel(vtx->lock);
-
 	if (err)
-		return;
+		goto unlock;
 
 	/* Encode the whole picture frame */
+	t0 = realtime_clock_us();
 	err = vtx->vc->ench(vtx->enc, vtx->picup, frame);
+	dt = realtime_clock_us() - t0;
+	stream_cpu_add(vtx->video->strm, true, dt);
+	if (err)
+		goto unlock;
+
+	vidadapt_encoded(&vtx->ovu, dt);
+
+ unlock:
+	lock_rel(vtx->lock);
+
 	if (err)
 		return;
 
@@ -515,6 +542,7 @@ static int video_stream_decode(struct vrx *vrx, const struct rtp_header *hdr,
 	struct vidframe *frame_filt = NULL;
 	struct vidframe frame_store, *frame = &frame_store;
 	struct le *le;
+	uint64_t t0;
 	int err = 0;
 
 	if (!hdr || !mbuf_get_left(mb))
@@ -529,7 +557,9 @@ static int video_stream_decode(struct vrx *vrx, const struct rtp_header *hdr,
 	}
 
 	frame->data[0] = NULL;
+	t0 = realtime_clock_us();
 	err = vrx->vc->dech(vrx->dec, frame, hdr->m, hdr->seq, mb);
+	stream_cpu_add(v->strm, false, realtime_clock_us() - t0);
 	if (err) {
 
 		if (err != EPROTO) {
@@ -719,13 +749,53 @@ static int vrx_print_pipeline(struct re_printf *pf, const struct vrx *vrx)
 }
 
 
+/*
+ * Get the SDP template with the video codecs. The cached template is
+ * updated if it is no longer valid.
+ */
+static int video_sdp_tmpl(struct sdp_tmpl **tmplp,
+			  const struct list *vidcodecl)
+{
+	struct sdp_tmpl *tmpl;
+	struct le *le;
+	int err = 0;
+
+	if (sdp_tmpl_isvalid(*tmplp, vidcodecl, 0))
+		return 0;
+
+	err = sdp_tmpl_alloc(&tmpl, vidcodecl, 0);
+	if (err)
+		return err;
+
+	for (le = list_head(vidcodecl); le; le = le->next) {
+		struct vidcodec *vc = le->data;
+
+		err |= sdp_tmpl_add(tmpl, vc->pt, vc->name, 90000, 1,
+				    vc->fmtp_ench, vc->fmtp_cmph, vc,
+				    vc->fmtp);
+	}
+
+	if (err) {
+		mem_deref(tmpl);
+		return err;
+	}
+
+	mem_deref(*tmplp);
+	*tmplp = tmpl;
+
+	return 0;
+}
+
+
 int video_alloc(struct video **vp, const struct config *cfg,
 		struct call *call, struct sdp_session *sdp_sess, int label,
 		const struct mnat *mnat, struct mnat_sess *mnat_sess,
 		const struct menc *menc, struct menc_sess *menc_sess,
 		const char *content, const struct list *vidcodecl,
+		struct sdp_tmpl **tmplp,
 		video_err_h *errh, void *arg)
 {
+	struct sdp_tmpl *tmpl = NULL;
 	struct video *v;
 	struct le *le;
 	int err = 0;
@@ -778,13 +848,16 @@ int video_alloc(struct video **vp, const struct config *cfg,
 		goto out;
 
 	/* Video codecs */
-	for (le = list_head(vidcodecl); le; le = le->next) {
-		struct vidcodec *vc = le->data;
-		err |= sdp_format_add(NULL, stream_sdpmedia(v->strm), false,
-				      vc->pt, vc->name, 90000, 1,
-				      vc->fmtp_ench, vc->fmtp_cmph, vc, false,
-				      "%s", vc->fmtp);
-	}
+	if (!tmplp)
+		tmplp = &tmpl;
+
+	err = video_sdp_tmpl(tmplp, vidcodecl);
+	if (err)
+		goto out;
+
+	err = sdp_tmpl_apply(*tmplp, stream_sdpmedia(v->strm));
+	if (err)
+		goto out;
 
 	/* Video filters */
 	for (le = list_head(vidfilt_list()); le; le = le->next) {
@@ -801,6 +874,8 @@ int video_alloc(struct video **vp, const struct config *cfg,
 	}
 
  out:
+	mem_deref(tmpl);
+
 	if (err)
 		mem_deref(v);
 	else
@@ -838,6 +913,15 @@ static int set_vidisp(struct vrx *vrx)
 }
 
 
+static void vidsrc_update(struct vtx *vtx, const char *dev)
+{
+	struct vidsrc *vs = vidsrc_get(vtx->vsrc);
+
+	if (vs && vs->updateh)
+		vs->updateh(vtx->vsrc, &vtx->vsrc_prm, dev);
+}
+
+
 /* Set the encoder format - can be called multiple times */
 static int set_encoder_format(struct vtx *vtx, const char *src,
 			      const char *dev, struct vidsz *size)
@@ -849,7 +933,7 @@ static int set_encoder_format(struct vtx *vtx, const char *src,
 		return ENOENT;
 
 	vtx->vsrc_size       = *size;
-	vtx->vsrc_prm.fps    = get_fps(vtx->video);
+	vtx->vsrc_prm.fps    = vtx_fps(vtx);
 	vtx->vsrc_prm.orient = VIDORIENT_PORTRAIT;
 
 	vtx->vsrc = mem_deref(vtx->vsrc);
@@ -873,6 +957,107 @@ static int set_encoder_format(struct vtx *vtx, const char *src,
 }
 
 
+static int vtx_encoder_update(struct vtx *vtx, const struct vidcodec *vc)
+{
+	struct videnc_param prm;
+
+	prm.bitrate = vtx->video->cfg.bitrate;
+	prm.pktsize = 1024;
+	prm.fps     = vtx_fps(vtx);
+	prm.max_fs  = -1;
+
+	return vc->encupdh(&vtx->enc, vc, &prm, vtx->params,
+			   packet_handler, vtx);
+}
+
+
+/* Switch the video source and encoder to a new adaptation level */
+static int vtx_adapt(struct vtx *vtx, unsigned level)
+{
+	struct video *v = vtx->video;
+	const struct vidadapt_level *al = vidadapt_level(level);
+	const struct vidadapt_level *prev = vidadapt_level(vtx->ovu.level);
+	struct vidsz size;
+	int err = 0;
+
+	size.w = (v->cfg.width  * al->scale / 100) & ~1u;
+	size.h = (v->cfg.height * al->scale / 100) & ~1u;
+
+	lock_write_get(vtx->lock);
+
+	vtx->ovu.level = level;
+
+	if (vtx->vc)
+		err = vtx_encoder_update(vtx, vtx->vc);
+
+	lock_rel(vtx->lock);
+
+	if (err) {
+		warning("video: adapt: encoder update failed (%m)\n", err);
+		return err;
+	}
+
+	/* only the framerate changed, no need to re-open the source */
+	if (al->scale == prev->scale && vtx->vsrc) {
+		vtx->vsrc_prm.fps = vtx_fps(vtx);
+		vidsrc_update(vtx, NULL);
+	}
+	else {
+		err = set_encoder_format(vtx, v->cfg.src_mod,
+					 vtx->device, &size);
+		if (err) {
+			warning("video: adapt: could not set encoder format"
+				" to [%u x %u] %m\n", size.w, size.h, err);
+			return err;
+		}
+	}
+
+	info("video: adapted to level %u: %u x %u, %d fps"
+	     " (encode usage %u%%)\n",
+	     level, size.w, size.h, vtx->vsrc_prm.fps, vtx->ovu.usage);
+
+	ua_event(call_get_ua(v->strm->call), UA_EVENT_CALL_VIDEO_ADAPT,
+		 v->strm->call, "%ux%u@%d", size.w, size.h,
+		 vtx->vsrc_prm.fps);
+
+	return 0;
+}
+
+
+/*
+ * CPU-overuse detection, from the time spent in the encoder. Frames
+ * skipped because the send-queue is not drained are a pacing issue,
+ * and are not counted as CPU overuse.
+ */
+static void vtx_overuse_check(struct vtx *vtx, unsigned interval)
+{
+	unsigned level;
+	int fps;
+
+	fps = vtx->vsrc_prm.fps ? vtx->vsrc_prm.fps : vtx_fps(vtx);
+
+	lock_write_get(vtx->lock);
+	level = vidadapt_check(&vtx->ovu, fps);
+	lock_rel(vtx->lock);
+
+	if (!vtx->video->cfg.adapt || !vtx->enc || level == vtx->ovu.level)
+		return;
+
+	if (level > vtx->ovu.level) {
+
+		info("video: overuse detected (usage=%u%% in %u sec)\n",
+		     vtx->ovu.usage, interval);
+
+		if (0 == vtx_adapt(vtx, level))
+			++vtx->n_down;
+	}
+	else {
+		if (0 == vtx_adapt(vtx, level))
+			++vtx->n_up;
+	}
+}
+
+
 enum {TMR_INTERVAL = 5};
 static void tmr_handler(void *arg)
 {
@@ -886,6 +1071,8 @@ static void tmr_handler(void *arg)
 
 	v->vtx.frames = 0;
 	v->vrx.frames = 0;
+
+	vtx_overuse_check(&v->vtx, TMR_INTERVAL);
 }
 
 
@@ -999,15 +1186,6 @@ int video_set_fullscreen(struct video *v, bool fs)
 }
 
 
-static void vidsrc_update(struct vtx *vtx, const char *dev)
-{
-	struct vidsrc *vs = vidsrc_get(vtx->vsrc);
-
-	if (vs && vs->updateh)
-		vs->updateh(vtx->vsrc, &vtx->vsrc_prm, dev);
-}
-
-
 /**
  * Set the orientation of the Video source and display
  *
@@ -1040,25 +1218,36 @@ int video_encoder_set(struct video *v, struct vidcodec *vc,
 
 	if (vc != vtx->vc) {
 
-		struct videnc_param prm;
-
-		prm.bitrate = v->cfg.bitrate;
-		prm.pktsize = 1024;
-		prm.fps     = get_fps(v);
-		prm.max_fs  = -1;
-
 		info("Set video encoder: %s %s (%u bit/s, %u fps)\n",
-		     vc->name, vc->variant, prm.bitrate, prm.fps);
+		     vc->name, vc->variant, v->cfg.bitrate, vtx_fps(vtx));
+
+		vtx->params = mem_deref(vtx->params);
+		if (params) {
+			err = str_dup(&vtx->params, params);
+			if (err)
+				return err;
+		}
 
+		lock_write_get(vtx->lock);
 		vtx->enc = mem_deref(vtx->enc);
-		err = vc->encupdh(&vtx->enc, vc, &prm, params,
-				  packet_handler, vtx);
+		err = vtx_encoder_update(vtx, vc);
+		lock_rel(vtx->lock);
 		if (err) {
 			warning("video: encoder alloc: %m\n", err);
 			return err;
 		}
 
 		vtx->vc = vc;
+
+		/* a new encoder starts at full quality, with a new window */
+		lock_write_get(vtx->lock);
+		vidadapt_reset(&vtx->ovu);
+		if (!vtx->vsrc)
+			vtx->ovu.level = 0;
+		lock_rel(vtx->lock);
+
+		if (vtx->ovu.level)
+			(void)vtx_adapt(vtx, 0);
 	}
 
 	stream_update_encoder(v->strm, pt_tx);
@@ -1137,6 +1326,38 @@ void video_encoder_cycle(struct video *video)
 }
 
 
+/**
+ * Add the memory usage of a video object
+ *
+ * @param v  Video object
+ * @param ms Memory statistics to add to
+ */
+void video_memstat(const struct video *v, struct call_memstat *ms)
+{
+	struct le *le;
+
+	if (!v || !ms)
+		return;
+
+	ms->video += sizeof(*v);
+
+	if (v->vtx.frame)
+		ms->vidbuf += vidframe_size(v->vtx.frame->fmt,
+					    &v->vtx.frame->size);
+	if (v->vtx.mute_frame)
+		ms->vidbuf += vidframe_size(v->vtx.mute_frame->fmt,
+					    &v->vtx.mute_frame->size);
+
+	lock_read_get(v->vtx.lock_tx);
+	for (le = v->vtx.sendq.head; le; le = le->next) {
+		const struct vidqent *qent = le->data;
+
+		ms->vidbuf += qent->mb ? qent->mb->size : 0;
+	}
+	lock_rel(v->vtx.lock_tx);
+}
+
+
 struct stream *video_strm(const struct video *v)
 {
 	return v ? v->strm : NULL;
@@ -1217,6 +1438,10 @@ int video_debug(struct re_printf *pf, const struct video *v)
 			  vtx->vsrc_size.w,
 			  vtx->vsrc_size.h, vtx->vsrc_prm.fps);
 	err |= re_hprintf(pf, "     skipc=%u\n", vtx->skipc);
+	err |= re_hprintf(pf, "     adapt: level=%u usage=%u%%"
+			  " down=%u up=%u\n",
+			  vtx->ovu.level, vtx->ovu.usage,
+			  vtx->n_down, vtx->n_up);
 	err |= re_hprintf(pf, " rx: pt=%d\n", vrx->pt_rx);
 
 	if (!list_isempty(vidfilt_list())) {
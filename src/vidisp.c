@@ -69,6 +69,8 @@ const struct vidisp *vidisp_find(const char *name)
 {
 	struct le *le;
 
+	module_lazy_load("vidisp");
+
 	for (le = vidispl.head; le; le = le->next) {
 		struct vidisp *vd = le->data;
 
@@ -73,6 +73,8 @@ const struct vidsrc *vidsrc_find(const char *name)
 {
 	struct le *le;
 
+	module_lazy_load("vidsrc");
+
 	for (le=vidsrcl.head; le; le=le->next) {
 
 		struct vidsrc *vs = le->data;
@@ -20,7 +20,8 @@ enum behaviour {
 enum action {
 	ACTION_RECANCEL = 0,
 	ACTION_HANGUP_A,
-	ACTION_HANGUP_B
+	ACTION_HANGUP_B,
+	ACTION_NOTHING
 };
 
 struct agent {
@@ -45,7 +46,7 @@ struct fixture {
 };
 
 
-#define fixture_init(f)							\
+#define fixture_init_prm(f, prm)					\
 	memset(f, 0, sizeof(*f));					\
 									\
 	err = ua_init("test", true, true, true, false);			\
@@ -54,9 +55,11 @@ struct fixture {
 	f->magic = MAGIC;						\
 	aucodec_register(&dummy_pcma);					\
 									\
-	err = ua_alloc(&f->a.ua, "A <sip:a:xxx@127.0.0.1>;regint=0");	\
+	err = ua_alloc(&f->a.ua,					\
+		       "A <sip:a:xxx@127.0.0.1>;regint=0" prm);		\
 	TEST_ERR(err);							\
-	err = ua_alloc(&f->b.ua, "B <sip:b:xxx@127.0.0.1>;regint=0");	\
+	err = ua_alloc(&f->b.ua,					\
+		       "B <sip:b:xxx@127.0.0.1>;regint=0" prm);		\
 	TEST_ERR(err);							\
 									\
 	f->a.peer = &f->b;						\
@@ -71,6 +74,8 @@ struct fixture {
 									\
 	re_snprintf(f->buri, sizeof(f->buri), "sip:b@%J", &f->laddr_sip);
 
+#define fixture_init(f) fixture_init_prm((f), "")
+
 
 #define fixture_close(f)			\
 	mem_deref(f->b.ua);			\
@@ -84,12 +89,56 @@ struct fixture {
 	ua_close();
 
 
+/* Number of decoded frames with 120 ms of audio */
+static unsigned n_dec_120ms;
+
+
+/* One byte per sample, like G.711 */
+static int dummy_encode(struct auenc_state *aes, uint8_t *buf, size_t *len,
+			const int16_t *sampv, size_t sampc)
+{
+	(void)aes;
+	(void)sampv;
+
+	if (*len < sampc)
+		return ENOMEM;
+
+	memset(buf, 0xd5, sampc);
+	*len = sampc;
+
+	return 0;
+}
+
+
+static int dummy_decode(struct audec_state *ads, int16_t *sampv,
+			size_t *sampc, const uint8_t *buf, size_t len)
+{
+	(void)ads;
+	(void)buf;
+
+	if (*sampc < len)
+		return ENOMEM;
+
+	memset(sampv, 0, len * 2);
+	*sampc = len;
+
+	if (len == 8000 * 120 / 1000) {
+		++n_dec_120ms;
+		re_cancel();
+	}
+
+	return 0;
+}
+
+
 static struct aucodec dummy_pcma = {
 	.pt = "8",
 	.name = "PCMA",
 	.srate = 8000,
 	.crate = 8000,
 	.ch = 1,
+	.ench = dummy_encode,
+	.dech = dummy_decode,
 };
 
 
@@ -146,6 +195,16 @@ static void event_handler(struct ua *ua, enum ua_event ev,
 	case UA_EVENT_CALL_ESTABLISHED:
 		++ag->n_established;
 
+		ASSERT_TRUE(str_isset(call_id(call)));
+		ASSERT_TRUE(NULL != uag_call_find(NULL, call_id(call)));
+		ASSERT_TRUE(call == uag_call_find(ag->ua, call_id(call)));
+
+		/* both local call legs share the Call-ID */
+		if (ag->peer->ua != ag->ua) {
+			ASSERT_TRUE(call != uag_call_find(ag->peer->ua,
+							  call_id(call)));
+		}
+
 		/* are both agents established? */
 		if (ag->peer->n_established) {
 
@@ -164,6 +223,9 @@ static void event_handler(struct ua *ua, enum ua_event ev,
 				f->b.failed = true;
 				ua_hangup(f->b.ua, NULL, 0, 0);
 				break;
+
+			case ACTION_NOTHING:
+				break;
 			}
 		}
 		break;
@@ -364,3 +426,79 @@ int test_call_answer_hangup_b(void)
 
 	return err;
 }
+
+
+int test_call_admission(void)
+{
+	struct fixture fix, *f = &fix;
+	struct config *cfg = conf_config();
+	int err = 0;
+
+	/* the stream of the outgoing call reaches the limit */
+	cfg->call.max_streams = 1;
+
+	fixture_init(f);
+
+	cfg->call.max_streams = 0;
+
+	/* B never sees the call */
+	f->b.failed = true;
+
+	/* Make a call from A to B */
+	err = ua_connect(f->a.ua, 0, NULL, f->buri, NULL, VIDMODE_OFF);
+	TEST_ERR(err);
+
+	/* run main-loop with timeout, wait for events */
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	ASSERT_EQ(0, fix.a.n_established);
+	ASSERT_EQ(1, fix.a.n_closed);
+	ASSERT_EQ(503, fix.a.close_scode);
+
+	ASSERT_EQ(0, fix.b.n_incoming);
+
+ out:
+	cfg->call.max_streams = 0;
+	fixture_close(f);
+
+	return err;
+}
+
+
+/* A peer may send packets of up to 120 ms, longer than we send */
+int test_call_decode_ptime_120(void)
+{
+	struct fixture fix, *f = &fix;
+	struct ausrc *ausrc = NULL;
+	int err = 0;
+
+	fixture_init_prm(f, ";ptime=120");
+
+	err = mock_ausrc_register(&ausrc);
+	TEST_ERR(err);
+
+	f->behaviour = BEHAVIOUR_ANSWER;
+	f->estab_action = ACTION_NOTHING;
+	n_dec_120ms = 0;
+
+	/* Make a call from A to B */
+	err = ua_connect(f->a.ua, 0, NULL, f->buri, NULL, VIDMODE_OFF);
+	TEST_ERR(err);
+
+	/* run main-loop with timeout, until a 120 ms frame is decoded */
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	ASSERT_EQ(1, fix.a.n_established);
+	ASSERT_EQ(1, fix.b.n_established);
+	ASSERT_TRUE(n_dec_120ms > 0);
+
+ out:
+	fixture_close(f);
+	mem_deref(ausrc);
+
+	return err;
+}
@@ -0,0 +1,501 @@
+/**
+ * @file test/h264.c  Baresip selftest -- H.264 packetization
+ *
+ * Copyright (C) 2010 - 2016 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+
+
+enum {
+	PKTSIZE = 1024,
+};
+
+
+/*
+ * Reference implementation of the start code search. Note that
+ * a start code must be followed by at least one byte.
+ */
+static const uint8_t *ref_startcode(const uint8_t *p, const uint8_t *end)
+{
+	for (; p + 3 < end; p++) {
+		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+			return p;
+	}
+
+	return end;
+}
+
+
+/* Fill with random bytes that never produce a start code */
+static void fill_random(uint8_t *p, size_t len)
+{
+	size_t i;
+
+	for (i=0; i<len; i++)
+		p[i] = (uint8_t)(rand_u32() | 0x02);
+}
+
+
+/* Append one NAL unit with 4-byte start code to the byte stream */
+static int append_nal(struct mbuf *mb, uint8_t hdr, size_t size)
+{
+	static const uint8_t sc[4] = {0, 0, 0, 1};
+	size_t pos;
+	int err;
+
+	err  = mbuf_write_mem(mb, sc, sizeof(sc));
+	err |= mbuf_write_u8(mb, hdr);
+	if (err)
+		return err;
+
+	pos = mb->pos;
+	err = mbuf_fill(mb, 0, size - 1);
+	if (err)
+		return err;
+
+	fill_random(mb->buf + pos, size - 1);
+
+	return 0;
+}
+
+
+/*
+ * A synthetic access unit, with NAL unit sizes typical for a
+ * 640x480 video stream.
+ */
+static int make_access_unit(struct mbuf *mb, bool idr, size_t slice_sz)
+{
+	int err = 0;
+
+	if (idr) {
+		err |= append_nal(mb, 0x67, 12);         /* SPS */
+		err |= append_nal(mb, 0x68, 4);          /* PPS */
+		err |= append_nal(mb, 0x06, 24);         /* SEI */
+		err |= append_nal(mb, 0x65, slice_sz);   /* IDR slice */
+	}
+	else {
+		err |= append_nal(mb, 0x41, slice_sz / 2);
+		err |= append_nal(mb, 0x41, slice_sz / 2);
+	}
+
+	return err;
+}
+
+
+struct pktstat {
+	unsigned n_pkt;
+	unsigned n_marker;
+	unsigned n_stap;
+	unsigned n_fua;
+	unsigned n_single;
+	unsigned n_nal;        /* NAL units recovered */
+	size_t bytes;
+	bool last_marker;
+	int err;
+};
+
+
+static int packet_handler(bool marker, const uint8_t *hdr, size_t hdr_len,
+			  const uint8_t *pld, size_t pld_len, void *arg)
+{
+	struct pktstat *stat = arg;
+	uint8_t type;
+
+	if (!hdr_len || hdr_len + pld_len > PKTSIZE + 1) {
+		stat->err = EOVERFLOW;
+		return EOVERFLOW;
+	}
+
+	++stat->n_pkt;
+	stat->bytes += hdr_len + pld_len;
+	stat->last_marker = marker;
+	if (marker)
+		++stat->n_marker;
+
+	type = hdr[0] & 0x1f;
+
+	switch (type) {
+
+	case H264_NAL_STAP_A:
+		++stat->n_stap;
+
+		/* walk the aggregated NAL units */
+		while (pld_len >= 2) {
+			size_t sz = pld[0]<<8 | pld[1];
+
+			if (sz == 0 || sz + 2 > pld_len) {
+				stat->err = EBADMSG;
+				return EBADMSG;
+			}
+
+			++stat->n_nal;
+			pld     += 2 + sz;
+			pld_len -= 2 + sz;
+		}
+
+		if (pld_len) {
+			stat->err = EBADMSG;
+			return EBADMSG;
+		}
+		break;
+
+	case H264_NAL_FU_A:
+		++stat->n_fua;
+		if (hdr[1] & 0x40)
+			++stat->n_nal;
+		break;
+
+	default:
+		++stat->n_single;
+		++stat->n_nal;
+		break;
+	}
+
+	return 0;
+}
+
+
+int test_h264_startcode(void)
+{
+	static const size_t sizev[] = {0, 1, 2, 3, 4, 5, 15, 16, 17, 18,
+				       31, 32, 33, 34, 35, 63, 64, 100, 1000};
+	uint8_t buf[1024 + 8];
+	size_t i, pos;
+	int err = 0;
+
+	for (i=0; i<ARRAY_SIZE(sizev); i++) {
+
+		const size_t len = sizev[i];
+		unsigned align;
+
+		for (align=0; align<8; align++) {
+
+			uint8_t *p = &buf[align];
+
+			/* no start code */
+			fill_random(p, len);
+			ASSERT_TRUE(h264_find_startcode(p, p+len) == p+len);
+
+			/* start code at every possible position */
+			for (pos=0; pos + 3 <= len; pos++) {
+
+				fill_random(p, len);
+				p[pos] = 0;
+				p[pos+1] = 0;
+				p[pos+2] = 1;
+
+				ASSERT_TRUE(h264_find_startcode(p, p+len)
+					    == ref_startcode(p, p+len));
+			}
+
+			/* truncated start code at the end */
+			if (len >= 2) {
+				fill_random(p, len);
+				p[len-2] = 0;
+				p[len-1] = 0;
+				ASSERT_TRUE(h264_find_startcode(p, p+len)
+					    == p+len);
+			}
+		}
+	}
+
+ out:
+	return err;
+}
+
+
+int test_h264_packetize(void)
+{
+	struct pktstat stat;
+	struct mbuf *mb;
+	int err = 0;
+
+	mb = mbuf_alloc(8192);
+	if (!mb)
+		return ENOMEM;
+
+	/* SPS, PPS and SEI are aggregated with the small IDR slice */
+	memset(&stat, 0, sizeof(stat));
+	err = make_access_unit(mb, true, 200);
+	if (err)
+		goto out;
+
+	err = h264_packetize(mb->buf, mb->end, PKTSIZE, 1,
+			     packet_handler, &stat);
+	TEST_ERR(err);
+	TEST_ERR(stat.err);
+
+	ASSERT_EQ(1, stat.n_pkt);
+	ASSERT_EQ(1, stat.n_stap);
+	ASSERT_EQ(4, stat.n_nal);
+	ASSERT_EQ(1, stat.n_marker);
+	ASSERT_TRUE(stat.last_marker);
+
+	/* SPS, PPS and SEI are aggregated, large IDR slice is fragmented */
+	mbuf_rewind(mb);
+	memset(&stat, 0, sizeof(stat));
+	err = make_access_unit(mb, true, 3000);
+	if (err)
+		goto out;
+
+	err = h264_packetize(mb->buf, mb->end, PKTSIZE, 1,
+			     packet_handler, &stat);
+	TEST_ERR(err);
+	TEST_ERR(stat.err);
+
+	ASSERT_EQ(1, stat.n_stap);
+	ASSERT_EQ(3, stat.n_fua);
+	ASSERT_EQ(4, stat.n_nal);
+	ASSERT_EQ(1, stat.n_marker);
+	ASSERT_TRUE(stat.last_marker);
+
+	/* two slices that do not fit into one packet */
+	mbuf_rewind(mb);
+	memset(&stat, 0, sizeof(stat));
+	err = make_access_unit(mb, false, 1600);
+	if (err)
+		goto out;
+
+	err = h264_packetize(mb->buf, mb->end, PKTSIZE, 1,
+			     packet_handler, &stat);
+	TEST_ERR(err);
+	TEST_ERR(stat.err);
+
+	ASSERT_EQ(2, stat.n_pkt);
+	ASSERT_EQ(2, stat.n_single);
+	ASSERT_EQ(0, stat.n_stap);
+	ASSERT_EQ(1, stat.n_marker);
+	ASSERT_TRUE(stat.last_marker);
+
+	/* packetization-mode 0 sends single NAL unit packets only */
+	mbuf_rewind(mb);
+	memset(&stat, 0, sizeof(stat));
+	err = make_access_unit(mb, true, 200);
+	if (err)
+		goto out;
+
+	err = h264_packetize(mb->buf, mb->end, PKTSIZE, 0,
+			     packet_handler, &stat);
+	TEST_ERR(err);
+	TEST_ERR(stat.err);
+
+	ASSERT_EQ(4, stat.n_pkt);
+	ASSERT_EQ(4, stat.n_single);
+	ASSERT_EQ(0, stat.n_stap);
+	ASSERT_EQ(1, stat.n_marker);
+	ASSERT_TRUE(stat.last_marker);
+
+ out:
+	mem_deref(mb);
+	return err;
+}
+
+
+/* Add a packet with a one-byte payload to the reassembly buffer */
+static int reasm_put(struct h264_reasm *ra, uint16_t seq, bool marker)
+{
+	uint8_t tag = (uint8_t)seq;
+	struct mbuf mb;
+
+	mb.buf = &tag;
+	mb.pos = 0;
+	mb.end = mb.size = 1;
+
+	return h264_reasm_put(ra, marker, seq, &mb);
+}
+
+
+/* Take the access unit at the head, and check that it starts at seq */
+static unsigned reasm_take(struct h264_reasm *ra, uint16_t seq)
+{
+	unsigned i, n;
+
+	n = h264_reasm_complete(ra);
+
+	for (i=0; i<n; i++) {
+		struct mbuf mb;
+
+		h264_reasm_packet(ra, i, &mb);
+
+		if (mb.end != 1 || mb.buf[0] != (uint8_t)(seq + i))
+			return 0;
+	}
+
+	h264_reasm_release(ra, n);
+
+	return n;
+}
+
+
+int test_h264_reasm(void)
+{
+	struct h264_reasm *ra = NULL;
+	uint16_t seq;
+	unsigned n = 0;
+	int err;
+
+	err = h264_reasm_alloc(&ra);
+	if (err)
+		return err;
+
+	/* in order */
+	err |= reasm_put(ra, 100, false);
+	err |= reasm_put(ra, 101, false);
+	ASSERT_EQ(0, h264_reasm_complete(ra));
+	err |= reasm_put(ra, 102, true);
+	TEST_ERR(err);
+	ASSERT_EQ(3, reasm_take(ra, 100));
+	ASSERT_EQ(0, h264_reasm_lost(ra));
+
+	/* reordered within the window */
+	err |= reasm_put(ra, 105, true);
+	err |= reasm_put(ra, 103, false);
+	TEST_ERR(err);
+	ASSERT_EQ(0, h264_reasm_complete(ra));
+	err = reasm_put(ra, 104, false);
+	TEST_ERR(err);
+	ASSERT_EQ(3, reasm_take(ra, 103));
+
+	/* a late duplicate is ignored */
+	err = reasm_put(ra, 104, false);
+	TEST_ERR(err);
+	ASSERT_EQ(0, h264_reasm_complete(ra));
+	ASSERT_EQ(0, h264_reasm_lost(ra));
+
+	/* packet 106 is lost, the access unit is dropped after the window */
+	err = reasm_put(ra, 107, true);
+	TEST_ERR(err);
+	for (seq = 108; seq < 108 + 20; seq++) {
+		err = reasm_put(ra, seq, true);
+		TEST_ERR(err);
+	}
+	ASSERT_EQ(1, reasm_take(ra, 108));
+	ASSERT_EQ(1, h264_reasm_lost(ra));
+	for (seq = 109; seq < 108 + 20; seq++)
+		ASSERT_EQ(1, reasm_take(ra, seq));
+
+	/* the marker of 128-130 is lost, and 131-132 is dropped with it */
+	err |= reasm_put(ra, 128, false);
+	err |= reasm_put(ra, 129, false);
+	err |= reasm_put(ra, 131, false);
+	err |= reasm_put(ra, 132, true);
+	for (seq = 133; seq < 133 + 20; seq++)
+		err |= reasm_put(ra, seq, true);
+	TEST_ERR(err);
+	ASSERT_EQ(1, reasm_take(ra, 133));
+	ASSERT_TRUE(h264_reasm_lost(ra) > 0);
+
+	for (seq = 134; seq < 133 + 20; seq++)
+		ASSERT_EQ(1, reasm_take(ra, seq));
+
+	/* forward jump, the buffer starts over */
+	err = reasm_put(ra, 65534, false);
+	TEST_ERR(err);
+	ASSERT_EQ(1, h264_reasm_lost(ra));
+
+	/* wrap-around of the sequence number */
+	err |= reasm_put(ra, 65535, false);
+	err |= reasm_put(ra, 0, true);
+	TEST_ERR(err);
+	ASSERT_EQ(3, reasm_take(ra, 65534));
+
+	for (seq = 1; seq < 200; seq++) {
+		err = reasm_put(ra, seq, true);
+		TEST_ERR(err);
+		n += reasm_take(ra, seq);
+	}
+	ASSERT_EQ(199, n);
+
+	/* backward jump, the sender restarted */
+	err = reasm_put(ra, 10, true);
+	TEST_ERR(err);
+	ASSERT_EQ(1, reasm_take(ra, 10));
+	ASSERT_EQ(1, h264_reasm_lost(ra));
+
+	err = reasm_put(ra, 11, true);
+	TEST_ERR(err);
+	ASSERT_EQ(1, reasm_take(ra, 11));
+	ASSERT_EQ(0, h264_reasm_lost(ra));
+
+ out:
+	mem_deref(ra);
+	return err;
+}
+
+
+/*
+ * Packetization throughput, over a bitstream with one IDR frame
+ * followed by P-frames of varying size.
+ */
+int test_h264_perf(void)
+{
+	enum {FRAMES = 60, ROUNDS = 200};
+	struct pktstat stat;
+	struct mbuf *mb;
+	size_t framev[FRAMES + 1];
+	uint64_t t0, t1, t2;
+	unsigned i, j;
+	int err = 0;
+
+	mb = mbuf_alloc(512 * 1024);
+	if (!mb)
+		return ENOMEM;
+
+	framev[0] = 0;
+	for (i=0; i<FRAMES; i++) {
+
+		err = make_access_unit(mb, i == 0,
+				       i == 0 ? 40000 : 300 + 97 * (i % 50));
+		if (err)
+			goto out;
+
+		framev[i+1] = mb->end;
+	}
+
+	memset(&stat, 0, sizeof(stat));
+
+	t0 = tmr_jiffies();
+
+	for (j=0; j<ROUNDS; j++) {
+		for (i=0; i<FRAMES; i++) {
+
+			err = h264_packetize(mb->buf + framev[i],
+					     framev[i+1] - framev[i],
+					     PKTSIZE, 1, packet_handler,
+					     &stat);
+			TEST_ERR(err);
+		}
+	}
+
+	t1 = tmr_jiffies();
+
+	for (j=0; j<ROUNDS * 10; j++) {
+		const uint8_t *p   = mb->buf + 4;
+		const uint8_t *end = mb->buf + mb->end;
+
+		while (p < end)
+			p = h264_find_startcode(p, end) + 3;
+	}
+
+	t2 = tmr_jiffies();
+
+	TEST_ERR(stat.err);
+
+	re_printf("h264 packetize: %zu bytes in %u frames,"
+		  " %u packets (%u STAP-A, %u FU-A, %u single)\n",
+		  mb->end * ROUNDS, FRAMES * ROUNDS, stat.n_pkt,
+		  stat.n_stap, stat.n_fua, stat.n_single);
+	re_printf("h264 packetize: %.1f MB/s, %.1f frames/ms\n",
+		  (double)mb->end * ROUNDS / 1000.0 / max(t1 - t0, 1),
+		  (double)FRAMES * ROUNDS / max(t1 - t0, 1));
+	re_printf("h264 startcode: %.1f MB/s\n",
+		  (double)mb->end * ROUNDS * 10 / 1000.0 / max(t2 - t1, 1));
+
+ out:
+	mem_deref(mb);
+	return err;
+}
@@ -0,0 +1,244 @@
+/**
+ * @file test/json.c  Baresip selftest -- JSON support
+ *
+ * Copyright (C) 2010 - 2016 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+struct members {
+	char id[32];
+	enum json_type id_type;
+	char command[32];
+	char params[64];
+	unsigned n;
+};
+
+
+static int member_handler(const struct pl *key, enum json_type type,
+			  const struct pl *val, void *arg)
+{
+	struct members *m = arg;
+
+	++m->n;
+
+	if (!pl_strcmp(key, "id")) {
+		m->id_type = type;
+		return pl_strcpy(val, m->id, sizeof(m->id));
+	}
+	else if (!pl_strcmp(key, "command")) {
+		return json_unescape(m->command, sizeof(m->command), val);
+	}
+	else if (!pl_strcmp(key, "params")) {
+		return json_unescape(m->params, sizeof(m->params), val);
+	}
+
+	return 0;
+}
+
+
+static int decode(struct members *m, const char *str)
+{
+	struct pl pl;
+
+	memset(m, 0, sizeof(*m));
+	pl_set_str(&pl, str);
+
+	return json_decode_flat(&pl, member_handler, m);
+}
+
+
+int test_json_decode(void)
+{
+	static const struct {
+		const char *str;
+		int err;
+	} malformedv[] = {
+		{"",                                     EBADMSG},
+		{"[1]",                                  EBADMSG},
+		{"{",                                    EBADMSG},
+		{"{\"id\"}",                             EBADMSG},
+		{"{\"id\":}",                            EBADMSG},
+		{"{\"id\":1,}",                          EBADMSG},
+		{"{\"id\":]}",                           EBADMSG},
+		{"{\"id\":tru}",                         EBADMSG},
+		{"{\"id\":1 \"command\":\"x\"}",         EBADMSG},
+		{"{\"command\":\"dial}",                 EBADMSG},
+		{"{\"id\":1} x",                         EBADMSG},
+		{"{id:1}",                               EBADMSG},
+		{"{\"id\":{\"a\":1}}",                   EPROTO},
+		{"{\"id\":[1,2]}",                       EPROTO},
+		{"{\"params\":\"\\x\"}",                 EBADMSG},
+		{"{\"params\":\"\\u12\"}",               EBADMSG},
+		{"{\"params\":\"\\u12g4\"}",             EBADMSG},
+		{"{\"params\":\"\\u0000\"}",             EBADMSG},
+		{"{\"params\":\"0123456789012345678901234567890123456789"
+		 "012345678901234567890123\"}",         ENOMEM},
+	};
+	struct members m;
+	size_t i;
+	int err;
+
+	/* flat object with whitespace and both value types */
+	err = decode(&m, " { \"id\" : 42 ,\t\"command\":\"dial\" ,"
+		     "\"params\":\"sip:bob@example.com\", \"x\":null } ");
+	TEST_ERR(err);
+	ASSERT_EQ(4, m.n);
+	ASSERT_STREQ("42", m.id);
+	ASSERT_EQ(JSON_LITERAL, m.id_type);
+	ASSERT_STREQ("dial", m.command);
+	ASSERT_STREQ("sip:bob@example.com", m.params);
+
+	err = decode(&m, "{}");
+	TEST_ERR(err);
+	ASSERT_EQ(0, m.n);
+
+	/* escapes, and a string value with braces and commas */
+	err = decode(&m, "{\"id\":\"a\\\"b\",\"params\":"
+		     "\"\\\"q\\\" \\\\ \\/ \\t\\n {x},[y]\"}");
+	TEST_ERR(err);
+	ASSERT_EQ(JSON_STRING, m.id_type);
+	ASSERT_STREQ("a\\\"b", m.id);
+	ASSERT_STREQ("\"q\" \\ / \t\n {x},[y]", m.params);
+
+	/* \u escapes are written as UTF-8 */
+	err = decode(&m, "{\"params\":\"\\u0041\\u00e9\\u20AC\"}");
+	TEST_ERR(err);
+	ASSERT_STREQ("A\xc3\xa9\xe2\x82\xac", m.params);
+
+	for (i=0; i<ARRAY_SIZE(malformedv); i++) {
+
+		err = decode(&m, malformedv[i].str);
+		if (err != malformedv[i].err) {
+			warning("selftest: json case %u: expected %m,"
+				" got %m\n", i, malformedv[i].err, err);
+			err = EINVAL;
+			goto out;
+		}
+	}
+
+	err = 0;
+
+ out:
+	return err;
+}
+
+
+int test_json_number(void)
+{
+	static const struct {
+		const char *str;
+		bool valid;
+	} numberv[] = {
+		{"0",       true},
+		{"-1",      true},
+		{"42",      true},
+		{"1.5",     true},
+		{"-0.5e-3", true},
+		{"1E+10",   true},
+		{"",        false},
+		{"-",       false},
+		{"01",      false},
+		{"1.",      false},
+		{".5",      false},
+		{"1e",      false},
+		{"0x10",    false},
+		{"]",       false},
+		{"null",    false},
+		{"true",    false},
+	};
+	size_t i;
+	int err = 0;
+
+	for (i=0; i<ARRAY_SIZE(numberv); i++) {
+		struct pl pl;
+
+		pl_set_str(&pl, numberv[i].str);
+
+		ASSERT_EQ(numberv[i].valid, json_is_number(&pl));
+	}
+
+ out:
+	return err;
+}
+
+
+struct lines {
+	char linev[4][64];
+	unsigned n;
+};
+
+
+static int line_handler(const struct pl *line, void *arg)
+{
+	struct lines *l = arg;
+
+	if (l->n >= ARRAY_SIZE(l->linev))
+		return EOVERFLOW;
+
+	return pl_strcpy(line, l->linev[l->n++], sizeof(l->linev[0]));
+}
+
+
+static int feed(struct mbuf *mb, struct lines *l, const char *str)
+{
+	int err;
+
+	mb->pos = mb->end;
+	err = mbuf_write_str(mb, str);
+	if (err)
+		return err;
+
+	return json_decode_lines(mb, 32, line_handler, l);
+}
+
+
+int test_json_lines(void)
+{
+	struct lines l;
+	struct mbuf *mb;
+	int err;
+
+	memset(&l, 0, sizeof(l));
+
+	mb = mbuf_alloc(64);
+	if (!mb)
+		return ENOMEM;
+
+	/* pipelined requests in one read, blank lines are skipped */
+	err = feed(mb, &l, "{\"id\":1}\n\n \t\n{\"id\":2}\r\n{\"id\"");
+	TEST_ERR(err);
+	ASSERT_EQ(2, l.n);
+	ASSERT_STREQ("{\"id\":1}", l.linev[0]);
+	ASSERT_STREQ("{\"id\":2}\r", l.linev[1]);
+
+	/* the incomplete request is kept */
+	ASSERT_EQ(5, mb->end);
+	ASSERT_EQ(0, mb->pos);
+
+	/* a request split over several reads */
+	err = feed(mb, &l, ":3");
+	TEST_ERR(err);
+	ASSERT_EQ(2, l.n);
+
+	err = feed(mb, &l, "}\n");
+	TEST_ERR(err);
+	ASSERT_EQ(3, l.n);
+	ASSERT_STREQ("{\"id\":3}", l.linev[2]);
+	ASSERT_EQ(0, mb->end);
+
+	/* an incomplete request longer than the maximum */
+	err = feed(mb, &l, "{\"params\":\"0123456789012345678901234");
+	ASSERT_EQ(EOVERFLOW, err);
+	ASSERT_EQ(3, l.n);
+
+	err = 0;
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
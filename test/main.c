@@ -19,22 +19,42 @@ struct test {
 #define TEST(a) {a, #a}
 
 static const struct test tests[] = {
+	TEST(test_call_admission),
 	TEST(test_call_af_mismatch),
+	TEST(test_call_decode_ptime_120),
 	TEST(test_call_answer),
 	TEST(test_call_answer_hangup_a),
 	TEST(test_call_answer_hangup_b),
 	TEST(test_call_reject),
 	TEST(test_cmd),
 	TEST(test_cplusplus),
+	TEST(test_h264_packetize),
+	TEST(test_h264_reasm),
+	TEST(test_h264_startcode),
+	TEST(test_json_decode),
+	TEST(test_json_lines),
+	TEST(test_json_number),
 	TEST(test_mos),
 	TEST(test_network),
+	TEST(test_network_dns_cache),
+	TEST(test_sdp_tmpl),
+	TEST(test_srtp_gcm),
 	TEST(test_ua_alloc),
 	TEST(test_ua_options),
 	TEST(test_ua_register),
 	TEST(test_ua_register_dns),
 	TEST(test_ua_register_auth),
 	TEST(test_ua_register_auth_dns),
+	TEST(test_uag_find),
 	TEST(test_uag_find_param),
+	TEST(test_vidadapt),
+};
+
+static const struct test tests_perf[] = {
+	TEST(test_h264_perf),
+	TEST(test_sdp_tmpl_perf),
+	TEST(test_srtp_perf),
+	TEST(test_uag_find_perf),
 };
 
 
@@ -57,23 +77,16 @@ static int run_one_test(const struct test *test)
 }
 
 
-static int run_tests(void)
+static int run_tests(const struct test *testv, size_t n)
 {
 	size_t i;
 	int err;
 
-	for (i=0; i<ARRAY_SIZE(tests); i++) {
-
-		re_printf("[ RUN      ] %s\n", tests[i].name);
+	for (i=0; i<n; i++) {
 
-		err = tests[i].exec();
-		if (err) {
-			warning("%s: test failed (%m)\n",
-				tests[i].name, err);
+		err = run_one_test(&testv[i]);
+		if (err)
 			return err;
-		}
-
-		re_printf("[       OK ]\n");
 	}
 
 	return 0;
@@ -109,6 +122,12 @@ static const struct test *find_test(const char *name)
 			return &tests[i];
 	}
 
+	for (i=0; i<ARRAY_SIZE(tests_perf); i++) {
+
+		if (0 == str_casecmp(name, tests_perf[i].name))
+			return &tests_perf[i];
+	}
+
 	return NULL;
 }
 
@@ -128,6 +147,7 @@ static void usage(void)
 			 "Usage: selftest [options] <testcases..>\n"
 			 "options:\n"
 			 "\t-l               List all testcases and exit\n"
+			 "\t-p               Run performance tests\n"
 			 "\t-v               Verbose output (INFO level)\n"
 			 );
 }
@@ -138,6 +158,7 @@ int main(int argc, char *argv[])
 	struct config *config;
 	size_t i, ntests;
 	bool verbose = false;
+	bool perf = false;
 	int err;
 
 	err = libre_init();
@@ -147,7 +168,7 @@ int main(int argc, char *argv[])
 	log_enable_info(false);
 
 	for (;;) {
-		const int c = getopt(argc, argv, "hlv");
+		const int c = getopt(argc, argv, "hlpv");
 		if (0 > c)
 			break;
 
@@ -162,6 +183,10 @@ int main(int argc, char *argv[])
 			test_listcases();
 			return 0;
 
+		case 'p':
+			perf = true;
+			break;
+
 		case 'v':
 			if (verbose)
 				log_enable_debug(true);
@@ -177,6 +202,8 @@ int main(int argc, char *argv[])
 
 	if (argc >= (optind + 1))
 		ntests = argc - optind;
+	else if (perf)
+		ntests = ARRAY_SIZE(tests_perf);
 	else
 		ntests = ARRAY_SIZE(tests);
 
@@ -219,8 +246,13 @@ int main(int argc, char *argv[])
 			}
 		}
 	}
+	else if (perf) {
+		err = run_tests(tests_perf, ARRAY_SIZE(tests_perf));
+		if (err)
+			goto out;
+	}
 	else {
-		err = run_tests();
+		err = run_tests(tests, ARRAY_SIZE(tests));
 		if (err)
 			goto out;
 	}
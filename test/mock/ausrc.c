@@ -0,0 +1,88 @@
+/**
+ * @file mock/ausrc.c Mock audio source
+ *
+ * Copyright (C) 2010 - 2016 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "../test.h"
+
+
+/* Sends one frame of silence every packet time, from the main thread */
+struct ausrc_st {
+	const struct ausrc *as;  /* base class */
+	struct tmr tmr;
+	struct ausrc_prm prm;
+	int16_t *sampv;
+	size_t sampc;
+	ausrc_read_h *rh;
+	void *arg;
+};
+
+
+static void ausrc_destructor(void *arg)
+{
+	struct ausrc_st *st = arg;
+
+	tmr_cancel(&st->tmr);
+	mem_deref(st->sampv);
+}
+
+
+static void timeout(void *arg)
+{
+	struct ausrc_st *st = arg;
+
+	tmr_start(&st->tmr, st->prm.ptime, timeout, st);
+
+	if (st->rh)
+		st->rh(st->sampv, st->sampc, st->arg);
+}
+
+
+static int src_alloc(struct ausrc_st **stp, const struct ausrc *as,
+		     struct media_ctx **ctx,
+		     struct ausrc_prm *prm, const char *device,
+		     ausrc_read_h *rh, ausrc_error_h *errh, void *arg)
+{
+	struct ausrc_st *st;
+	int err = 0;
+	(void)ctx;
+	(void)device;
+	(void)errh;
+
+	if (!stp || !as || !prm || !prm->ptime)
+		return EINVAL;
+
+	st = mem_zalloc(sizeof(*st), ausrc_destructor);
+	if (!st)
+		return ENOMEM;
+
+	st->as  = as;
+	st->prm = *prm;
+	st->rh  = rh;
+	st->arg = arg;
+
+	st->sampc = prm->srate * prm->ch * prm->ptime / 1000;
+	st->sampv = mem_zalloc(st->sampc * 2, NULL);
+	if (!st->sampv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	tmr_start(&st->tmr, 0, timeout, st);
+
+ out:
+	if (err)
+		mem_deref(st);
+	else
+		*stp = st;
+
+	return err;
+}
+
+
+int mock_ausrc_register(struct ausrc **ausrcp)
+{
+	return ausrc_register(ausrcp, "mock-ausrc", src_alloc);
+}
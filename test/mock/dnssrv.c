@@ -82,6 +82,8 @@ static void decode_dns_query(struct dns_server *srv,
 	DEBUG_INFO("dnssrv: type=%s query-name='%s'\n",
 		   dns_rr_typename(type), qname);
 
+	++srv->n_queries;
+
 	if (dnsclass == DNS_CLASS_IN) {
 		dns_server_match(srv, &rrl, qname, type);
 	}
@@ -44,3 +44,127 @@ int test_network(void)
 	mem_deref(net);
 	return err;
 }
+
+
+struct dns_test {
+	unsigned n_reply;
+	unsigned n_wait;
+	unsigned n_answers;
+	uint32_t addr;
+	int err;
+};
+
+
+static void dns_query_handler(int err, const struct dnshdr *hdr,
+			      struct list *ansl, struct list *authl,
+			      struct list *addl, void *arg)
+{
+	struct dns_test *t = arg;
+	struct le *le;
+	(void)hdr;
+	(void)authl;
+	(void)addl;
+
+	if (err)
+		t->err = err;
+
+	for (le = list_head(ansl); le; le = le->next) {
+		const struct dnsrr *rr = le->data;
+
+		if (rr->type == DNS_TYPE_A) {
+			t->addr = rr->rdata.a.addr;
+			++t->n_answers;
+		}
+	}
+
+	if (++t->n_reply >= t->n_wait)
+		re_cancel();
+}
+
+
+static int dns_resolve(struct network *net, struct dns_test *t,
+		       const char *name, unsigned count)
+{
+	struct dns_query *qv[2] = {NULL, NULL};
+	unsigned i;
+	int err = 0;
+
+	memset(t, 0, sizeof(*t));
+	t->n_wait = count;
+
+	for (i=0; i<count && i<ARRAY_SIZE(qv); i++) {
+		err = dnsc_query(&qv[i], net_dnsc(net), name, DNS_TYPE_A,
+				 DNS_CLASS_IN, true, dns_query_handler, t);
+		if (err)
+			goto out;
+	}
+
+	err = re_main_timeout(5000);
+	if (err)
+		goto out;
+
+	err = t->err;
+
+ out:
+	for (i=0; i<ARRAY_SIZE(qv); i++)
+		mem_deref(qv[i]);
+
+	return err;
+}
+
+
+int test_network_dns_cache(void)
+{
+	struct config_net cfg;
+	struct dns_server *dnssrv = NULL;
+	struct network *net = NULL;
+	struct dns_test t;
+	const uint32_t addr = 0x7f000001;
+	int err;
+
+	memset(&cfg, 0, sizeof(cfg));
+
+	err = dns_server_alloc(&dnssrv, false);
+	TEST_ERR(err);
+
+	err = dns_server_add_a(dnssrv, "alpha.test.invalid", addr);
+	TEST_ERR(err);
+
+	re_snprintf(cfg.nsv[0].addr, sizeof(cfg.nsv[0].addr),
+		    "%J", &dnssrv->addr);
+	cfg.nsc = 1;
+	cfg.dns_cache = true;
+
+	err = net_alloc(&net, &cfg, AF_INET);
+	TEST_ERR(err);
+
+	/* identical queries are sent to the server only once */
+	err = dns_resolve(net, &t, "alpha.test.invalid", 2);
+	TEST_ERR(err);
+	ASSERT_EQ(2, t.n_answers);
+	ASSERT_EQ(addr, t.addr);
+	ASSERT_EQ(1, dnssrv->n_queries);
+
+	/* the answer is cached */
+	err = dns_resolve(net, &t, "alpha.test.invalid", 1);
+	TEST_ERR(err);
+	ASSERT_EQ(1, t.n_answers);
+	ASSERT_EQ(addr, t.addr);
+	ASSERT_EQ(1, dnssrv->n_queries);
+
+	/* an empty answer is cached */
+	err = dns_resolve(net, &t, "beta.test.invalid", 1);
+	TEST_ERR(err);
+	ASSERT_EQ(0, t.n_answers);
+	ASSERT_EQ(2, dnssrv->n_queries);
+
+	err = dns_resolve(net, &t, "beta.test.invalid", 1);
+	TEST_ERR(err);
+	ASSERT_EQ(0, t.n_answers);
+	ASSERT_EQ(2, dnssrv->n_queries);
+
+ out:
+	mem_deref(net);
+	mem_deref(dnssrv);
+	return err;
+}
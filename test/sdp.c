@@ -0,0 +1,259 @@
+/**
+ * @file test/sdp.c  Baresip selftest -- SDP templates
+ *
+ * Copyright (C) 2010 - 2016 Creytiv.com
+ */
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+/* Audio codecs of a typical account with many codecs */
+static struct aucodec codecv[] = {
+	{.name="opus",  .srate=48000, .crate=48000, .ch=2,
+	 .fmtp="stereo=1;sprop-stereo=1"},
+	{.name="AMR-WB",.srate=16000, .crate=16000, .ch=1,
+	 .fmtp="octet-align=1"},
+	{.name="AMR",   .srate=8000,  .crate=8000,  .ch=1,
+	 .fmtp="octet-align=1"},
+	{.name="speex", .srate=32000, .crate=32000, .ch=1,
+	 .fmtp="mode=\"7\";vbr=on;cng=on"},
+	{.name="speex", .srate=16000, .crate=16000, .ch=1,
+	 .fmtp="mode=\"7\";vbr=on;cng=on"},
+	{.name="speex", .srate=8000,  .crate=8000,  .ch=1,
+	 .fmtp="mode=\"7\";vbr=on;cng=on"},
+	{.name="iLBC",  .srate=8000,  .crate=8000,  .ch=1,
+	 .fmtp="mode=20"},
+	{.name="G7221", .srate=32000, .crate=32000, .ch=1,
+	 .fmtp="bitrate=48000"},
+	{.name="G7221", .srate=16000, .crate=16000, .ch=1,
+	 .fmtp="bitrate=32000"},
+	{.name="L16",   .srate=44100, .crate=44100, .ch=2},
+	{.pt="9", .name="G722", .srate=16000, .crate=8000, .ch=1},
+	{.pt="3", .name="GSM",  .srate=8000,  .crate=8000, .ch=1},
+	{.pt="0", .name="PCMU", .srate=8000,  .crate=8000, .ch=1},
+	{.pt="8", .name="PCMA", .srate=8000,  .crate=8000, .ch=1},
+};
+
+static const struct range srate_range = {8000, 48000};
+
+
+static void codecl_init(struct list *codecl)
+{
+	size_t i;
+
+	list_init(codecl);
+
+	for (i=0; i<ARRAY_SIZE(codecv); i++)
+		list_append(codecl, &codecv[i].le, &codecv[i]);
+}
+
+
+/* Add the payload formats the same way as without templates */
+static int add_formats(struct sdp_media *m, const struct list *codecl)
+{
+	struct le *le;
+	int err;
+
+	for (le = list_head(codecl); le; le = le->next) {
+		struct aucodec *ac = le->data;
+
+		if (!in_range(&srate_range, ac->srate))
+			continue;
+
+		err = sdp_format_add(NULL, m, false, ac->pt, ac->name,
+				     ac->crate, ac->ch, ac->fmtp_ench,
+				     ac->fmtp_cmph, ac, false, "%s", ac->fmtp);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+
+/* The selection key, computed for each offer as in audio.c */
+static uint32_t tmpl_key(void)
+{
+	const uint32_t rangev[2] = {srate_range.min, srate_range.max};
+
+	return hash_joaat((const uint8_t *)rangev, sizeof(rangev));
+}
+
+
+static int make_tmpl(struct sdp_tmpl **tmplp, const struct list *codecl)
+{
+	struct sdp_tmpl *tmpl;
+	struct le *le;
+	int err;
+
+	err = sdp_tmpl_alloc(&tmpl, codecl, tmpl_key());
+	if (err)
+		return err;
+
+	for (le = list_head(codecl); le; le = le->next) {
+		struct aucodec *ac = le->data;
+
+		if (!in_range(&srate_range, ac->srate))
+			continue;
+
+		err = sdp_tmpl_add(tmpl, ac->pt, ac->name, ac->crate, ac->ch,
+				   ac->fmtp_ench, ac->fmtp_cmph, ac, ac->fmtp);
+		if (err) {
+			mem_deref(tmpl);
+			return err;
+		}
+	}
+
+	*tmplp = tmpl;
+
+	return 0;
+}
+
+
+/* Encode an SDP offer, with or without a template */
+static int make_offer(struct mbuf **mbp, const struct sa *laddr,
+		      const struct list *codecl, const struct sdp_tmpl *tmpl)
+{
+	struct sdp_session *sess;
+	struct sdp_media *m;
+	int err;
+
+	err = sdp_session_alloc(&sess, laddr);
+	if (err)
+		return err;
+
+	err = sdp_media_add(&m, sess, "audio", 5004, sdp_proto_rtpavp);
+	if (err)
+		goto out;
+
+	err = sdp_media_set_lattr(m, true, "ptime", "%u", 20);
+	if (err)
+		goto out;
+
+	if (tmpl)
+		err = sdp_tmpl_apply(tmpl, m);
+	else
+		err = add_formats(m, codecl);
+	if (err)
+		goto out;
+
+	err = sdp_encode(mbp, sess, true);
+
+ out:
+	mem_deref(sess);
+	return err;
+}
+
+
+/* Get the media part of an SDP, the session part has a random id */
+static int sdp_media_part(struct pl *pl, const struct mbuf *mb)
+{
+	return re_regex((char *)mb->buf, mb->end, "m=[^]+", pl);
+}
+
+
+int test_sdp_tmpl(void)
+{
+	struct sdp_tmpl *tmpl = NULL;
+	struct mbuf *mb1 = NULL, *mb2 = NULL;
+	struct list codecl;
+	struct sa laddr;
+	struct pl m1, m2;
+	int err;
+
+	codecl_init(&codecl);
+	sa_set_str(&laddr, "127.0.0.1", 0);
+
+	err = make_tmpl(&tmpl, &codecl);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(sdp_tmpl_isvalid(tmpl, &codecl, tmpl_key()));
+	ASSERT_TRUE(!sdp_tmpl_isvalid(tmpl, &codecl, tmpl_key() + 1));
+	ASSERT_TRUE(!sdp_tmpl_isvalid(tmpl, NULL, tmpl_key()));
+	ASSERT_TRUE(!sdp_tmpl_isvalid(NULL, &codecl, tmpl_key()));
+
+	/* the template gives the same payload formats */
+	err  = make_offer(&mb1, &laddr, &codecl, NULL);
+	err |= make_offer(&mb2, &laddr, &codecl, tmpl);
+	TEST_ERR(err);
+
+	err  = sdp_media_part(&m1, mb1);
+	err |= sdp_media_part(&m2, mb2);
+	TEST_ERR(err);
+
+	ASSERT_EQ(0, pl_cmp(&m1, &m2));
+
+	/* registering a codec invalidates all templates */
+	sdp_tmpl_flush();
+	ASSERT_TRUE(!sdp_tmpl_isvalid(tmpl, &codecl, tmpl_key()));
+
+ out:
+	mem_deref(mb2);
+	mem_deref(mb1);
+	mem_deref(tmpl);
+
+	return err;
+}
+
+
+/*
+ * Cost of generating SDP offers for an account with 14 audio codecs,
+ * with and without a cached SDP template.
+ */
+int test_sdp_tmpl_perf(void)
+{
+	enum {ROUNDS = 20000};
+	struct sdp_tmpl *tmpl = NULL;
+	struct mbuf *mb = NULL;
+	struct list codecl;
+	struct sa laddr;
+	uint64_t t0, t1, t2;
+	unsigned i;
+	int err = 0;
+
+	codecl_init(&codecl);
+	sa_set_str(&laddr, "127.0.0.1", 0);
+
+	t0 = tmr_jiffies();
+
+	for (i=0; i<ROUNDS; i++) {
+
+		err = make_offer(&mb, &laddr, &codecl, NULL);
+		TEST_ERR(err);
+
+		mb = mem_deref(mb);
+	}
+
+	t1 = tmr_jiffies();
+
+	for (i=0; i<ROUNDS; i++) {
+
+		if (!sdp_tmpl_isvalid(tmpl, &codecl, tmpl_key())) {
+			mem_deref(tmpl);
+			tmpl = NULL;
+			err = make_tmpl(&tmpl, &codecl);
+			TEST_ERR(err);
+		}
+
+		err = make_offer(&mb, &laddr, &codecl, tmpl);
+		TEST_ERR(err);
+
+		mb = mem_deref(mb);
+	}
+
+	t2 = tmr_jiffies();
+
+	re_printf("sdp offer: %u codecs, %u offers\n",
+		  (unsigned)ARRAY_SIZE(codecv), ROUNDS);
+	re_printf("sdp offer: without template %.2f us/offer\n",
+		  1000.0 * (double)(t1 - t0) / ROUNDS);
+	re_printf("sdp offer: with template    %.2f us/offer\n",
+		  1000.0 * (double)(t2 - t1) / ROUNDS);
+
+ out:
+	mem_deref(mb);
+	mem_deref(tmpl);
+
+	return err;
+}
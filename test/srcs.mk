@@ -12,13 +12,19 @@ TEST_SRCS	+= cmd.c
 TEST_SRCS	+= ua.c
 TEST_SRCS	+= cplusplus.c
 TEST_SRCS	+= call.c
+TEST_SRCS	+= h264.c
+TEST_SRCS	+= json.c
 TEST_SRCS	+= mos.c
 TEST_SRCS	+= net.c
+TEST_SRCS	+= sdp.c
+TEST_SRCS	+= srtp.c
+TEST_SRCS	+= vidadapt.c
 
 
 #
 # Mocks
 #
+TEST_SRCS	+= mock/ausrc.c
 TEST_SRCS	+= mock/dnssrv.c
 
 TEST_SRCS	+= sip/aor.c
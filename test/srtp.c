@@ -0,0 +1,726 @@
+/**
+ * @file test/srtp.c  Baresip selftest -- SRTP
+ *
+ * Copyright (C) 2010 - 2016 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+enum {
+	SSRC = 0x11223344,
+	PAYLOAD_LEN = 160,     /* 20 ms of G.711 */
+	PKT_MAX = 1500,
+};
+
+
+typedef int (srtp_alloc_h)(void **ctxp, const uint8_t *key);
+typedef int (srtp_crypt_h)(void *ctx, struct mbuf *mb);
+
+struct bench_suite {
+	const char *name;
+	srtp_alloc_h *alloch;
+	srtp_crypt_h *ench;
+	srtp_crypt_h *dech;
+	srtp_crypt_h *rtcp_ench;
+	srtp_crypt_h *rtcp_dech;
+};
+
+
+static int make_rtp(struct mbuf *mb, uint32_t ssrc, uint16_t seq,
+		    const uint8_t *pld, size_t len)
+{
+	int err;
+
+	mbuf_rewind(mb);
+
+	err  = mbuf_write_u8(mb, 0x80);
+	err |= mbuf_write_u8(mb, 0);
+	err |= mbuf_write_u16(mb, htons(seq));
+	err |= mbuf_write_u32(mb, htonl(seq * PAYLOAD_LEN));
+	err |= mbuf_write_u32(mb, htonl(ssrc));
+	err |= mbuf_write_mem(mb, pld, len);
+
+	mb->pos = 0;
+
+	return err;
+}
+
+
+static int make_rtcp(struct mbuf *mb, uint32_t ssrc, const uint8_t *pld,
+		     size_t len)
+{
+	int err;
+
+	mbuf_rewind(mb);
+
+	err  = mbuf_write_u8(mb, 0x80);
+	err |= mbuf_write_u8(mb, 200);
+	err |= mbuf_write_u16(mb, htons((uint16_t)(1 + len / 4)));
+	err |= mbuf_write_u32(mb, htonl(ssrc));
+	err |= mbuf_write_mem(mb, pld, len);
+
+	mb->pos = 0;
+
+	return err;
+}
+
+
+static int cm_alloc(void **ctxp, const uint8_t *key, enum srtp_suite suite)
+{
+	struct srtp *srtp;
+	int err;
+
+	err = srtp_alloc(&srtp, suite, key, 30, 0);
+	if (!err)
+		*ctxp = srtp;
+
+	return err;
+}
+
+
+static int cm_80_alloc(void **ctxp, const uint8_t *key)
+{
+	return cm_alloc(ctxp, key, SRTP_AES_CM_128_HMAC_SHA1_80);
+}
+
+
+static int cm_32_alloc(void **ctxp, const uint8_t *key)
+{
+	return cm_alloc(ctxp, key, SRTP_AES_CM_128_HMAC_SHA1_32);
+}
+
+
+static int cm_encrypt(void *ctx, struct mbuf *mb)
+{
+	return srtp_encrypt(ctx, mb);
+}
+
+
+static int cm_decrypt(void *ctx, struct mbuf *mb)
+{
+	return srtp_decrypt(ctx, mb);
+}
+
+
+static int cm_rtcp_encrypt(void *ctx, struct mbuf *mb)
+{
+	return srtcp_encrypt(ctx, mb);
+}
+
+
+static int cm_rtcp_decrypt(void *ctx, struct mbuf *mb)
+{
+	return srtcp_decrypt(ctx, mb);
+}
+
+
+#ifdef USE_OPENSSL
+static int gcm_alloc(void **ctxp, const uint8_t *key, size_t key_size)
+{
+	struct srtp_gcm *sg;
+	int err;
+
+	err = srtp_gcm_alloc(&sg, key, key_size);
+	if (!err)
+		*ctxp = sg;
+
+	return err;
+}
+
+
+static int gcm_128_alloc(void **ctxp, const uint8_t *key)
+{
+	return gcm_alloc(ctxp, key, 28);
+}
+
+
+static int gcm_256_alloc(void **ctxp, const uint8_t *key)
+{
+	return gcm_alloc(ctxp, key, 44);
+}
+
+
+static int gcm_encrypt(void *ctx, struct mbuf *mb)
+{
+	return srtp_gcm_encrypt(ctx, mb);
+}
+
+
+static int gcm_decrypt(void *ctx, struct mbuf *mb)
+{
+	return srtp_gcm_decrypt(ctx, mb);
+}
+
+
+static int gcm_rtcp_encrypt(void *ctx, struct mbuf *mb)
+{
+	return srtcp_gcm_encrypt(ctx, mb);
+}
+
+
+static int gcm_rtcp_decrypt(void *ctx, struct mbuf *mb)
+{
+	return srtcp_gcm_decrypt(ctx, mb);
+}
+
+
+static int test_gcm_suite(size_t key_size)
+{
+	struct srtp_gcm *tx = NULL, *rx = NULL;
+	uint8_t key[44], pld[PAYLOAD_LEN], saved[PKT_MAX];
+	static const uint16_t seqv[] = {65533, 65534, 65535, 0, 1, 2};
+	struct mbuf *mb;
+	size_t i, len;
+	int err;
+
+	mb = mbuf_alloc(PKT_MAX);
+	if (!mb)
+		return ENOMEM;
+
+	rand_bytes(key, sizeof(key));
+	rand_bytes(pld, sizeof(pld));
+
+	err  = srtp_gcm_alloc(&tx, key, key_size);
+	err |= srtp_gcm_alloc(&rx, key, key_size);
+	TEST_ERR(err);
+
+	/* the sequence number wraps, and the rollover counter follows */
+	for (i=0; i<ARRAY_SIZE(seqv); i++) {
+
+		err = make_rtp(mb, SSRC, seqv[i], pld, sizeof(pld));
+		TEST_ERR(err);
+
+		err = srtp_gcm_encrypt(tx, mb);
+		TEST_ERR(err);
+
+		ASSERT_EQ(12 + PAYLOAD_LEN + 16, mbuf_get_left(mb));
+		ASSERT_TRUE(0 != memcmp(mb->buf + 12, pld, sizeof(pld)));
+
+		len = mbuf_get_left(mb);
+		memcpy(saved, mb->buf, len);
+
+		err = srtp_gcm_decrypt(rx, mb);
+		TEST_ERR(err);
+
+		ASSERT_EQ(12 + PAYLOAD_LEN, mbuf_get_left(mb));
+		ASSERT_EQ(0, memcmp(mb->buf + 12, pld, sizeof(pld)));
+
+		/* a replayed packet is rejected */
+		mbuf_rewind(mb);
+		(void)mbuf_write_mem(mb, saved, len);
+		mb->pos = 0;
+		ASSERT_EQ(EALREADY, srtp_gcm_decrypt(rx, mb));
+	}
+
+	/* a modified packet fails authentication */
+	err = make_rtp(mb, SSRC, 3, pld, sizeof(pld));
+	TEST_ERR(err);
+	err = srtp_gcm_encrypt(tx, mb);
+	TEST_ERR(err);
+
+	mb->buf[20] ^= 0x01;
+	ASSERT_EQ(EBADMSG, srtp_gcm_decrypt(rx, mb));
+
+	/* SRTCP */
+	err = make_rtcp(mb, SSRC, pld, 20);
+	TEST_ERR(err);
+
+	err = srtcp_gcm_encrypt(tx, mb);
+	TEST_ERR(err);
+
+	ASSERT_EQ(8 + 20 + 16 + 4, mbuf_get_left(mb));
+
+	err = srtcp_gcm_decrypt(rx, mb);
+	TEST_ERR(err);
+
+	ASSERT_EQ(8 + 20, mbuf_get_left(mb));
+	ASSERT_EQ(0, memcmp(mb->buf + 8, pld, 20));
+
+ out:
+	mem_deref(tx);
+	mem_deref(rx);
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/*
+ * Test vectors of RFC 7714, sections 16 and 17. The session keys are
+ * used directly, without key derivation. The same key and salt are
+ * used for SRTP and SRTCP.
+ */
+static const uint8_t kat_key[44] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+	0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+};
+
+/* "Quid pro quo" */
+static const uint8_t kat_salt[12] = {
+	0x51, 0x75, 0x69, 0x64, 0x20, 0x70, 0x72, 0x6f,
+	0x20, 0x71, 0x75, 0x6f,
+};
+
+/* SSRC 0x5501a0b2, sequence number 0xf17b, ROC 0 */
+static const uint8_t kat_rtp_hdr[12] = {
+	0x80, 0x40, 0xf1, 0x7b, 0x80, 0x41, 0xf8, 0xd3,
+	0x55, 0x01, 0xa0, 0xb2,
+};
+
+static const char kat_rtp_pld[] = "Gallia est omnis divisa in partes tres";
+
+/* Sender report from SSRC 0x4d617273, SRTCP index 0x5d4 */
+static const uint8_t kat_rtcp_hdr[8] = {
+	0x81, 0xc8, 0x00, 0x0d, 0x4d, 0x61, 0x72, 0x73,
+};
+
+static const char kat_rtcp_pld[] =
+	"NTP1NTP2NTP3NTP4NTP5NTP6NTP7NTP8NTP9NTQ0NTQ1NTQ2NTQ3";
+
+enum {
+	KAT_RTCP_INDEX = 0x5d4,
+};
+
+/* Encrypted payload followed by the tag (and the E-flag and index) */
+static const uint8_t kat_srtp_128[] = {
+	0xf2, 0x4d, 0xe3, 0xa3, 0xfb, 0x34, 0xde, 0x6c,
+	0xac, 0xba, 0x86, 0x1c, 0x9d, 0x7e, 0x4b, 0xca,
+	0xbe, 0x63, 0x3b, 0xd5, 0x0d, 0x29, 0x4e, 0x6f,
+	0x42, 0xa5, 0xf4, 0x7a, 0x51, 0xc7, 0xd1, 0x9b,
+	0x36, 0xde, 0x3a, 0xdf, 0x88, 0x33, 0x89, 0x9d,
+	0x7f, 0x27, 0xbe, 0xb1, 0x6a, 0x91, 0x52, 0xcf,
+	0x76, 0x5e, 0xe4, 0x39, 0x0c, 0xce,
+};
+
+static const uint8_t kat_srtp_256[] = {
+	0x32, 0xb1, 0xde, 0x78, 0xa8, 0x22, 0xfe, 0x12,
+	0xef, 0x9f, 0x78, 0xfa, 0x33, 0x2e, 0x33, 0xaa,
+	0xb1, 0x80, 0x12, 0x38, 0x9a, 0x58, 0xe2, 0xf3,
+	0xb5, 0x0b, 0x2a, 0x02, 0x76, 0xff, 0xae, 0x0f,
+	0x1b, 0xa6, 0x37, 0x99, 0xb8, 0x7b, 0x7a, 0xa3,
+	0xdb, 0x36, 0xdf, 0xff, 0xd6, 0xb0, 0xf9, 0xbb,
+	0x78, 0x78, 0xd7, 0xa7, 0x6c, 0x13,
+};
+
+static const uint8_t kat_srtcp_128[] = {
+	0x63, 0xe9, 0x48, 0x85, 0xdc, 0xda, 0xb6, 0x7c,
+	0xbb, 0x27, 0xd7, 0x75, 0x61, 0x3f, 0x2a, 0x87,
+	0x31, 0xa1, 0x79, 0xf2, 0x6e, 0x27, 0xcd, 0x7a,
+	0x56, 0x8f, 0x4b, 0x29, 0xe3, 0xf4, 0x81, 0x0d,
+	0xdc, 0x19, 0x75, 0x90, 0x16, 0xc9, 0xd2, 0x32,
+	0x9b, 0x40, 0xc8, 0x85, 0xae, 0x40, 0x29, 0x27,
+	0x6e, 0x5b, 0xc8, 0x95, 0xa5, 0x12, 0xbb, 0xdc,
+	0xe6, 0x55, 0xf5, 0x41, 0xbe, 0x65, 0xe2, 0x28,
+	0xa3, 0x91, 0x10, 0x74,
+};
+
+static const uint8_t kat_srtcp_256[] = {
+	0xd5, 0x0a, 0xe4, 0xd1, 0xf5, 0xce, 0x5d, 0x30,
+	0x57, 0xa2, 0x97, 0xf7, 0x33, 0x13, 0x58, 0x36,
+	0x62, 0x6a, 0x77, 0x58, 0xbd, 0xdf, 0x34, 0x07,
+	0x32, 0x13, 0x4b, 0x19, 0x81, 0xfc, 0xbb, 0x69,
+	0x14, 0xec, 0x18, 0x8e, 0x56, 0xe4, 0x0f, 0x98,
+	0xff, 0xe2, 0x80, 0x73, 0x75, 0x20, 0x68, 0x67,
+	0x3f, 0x55, 0x42, 0xa0, 0x12, 0x35, 0xb2, 0xc4,
+	0x1a, 0x2a, 0x25, 0x25, 0x1d, 0xf3, 0x4f, 0x08,
+	0x74, 0x9f, 0xef, 0xb6,
+};
+
+
+static int test_gcm_kat(size_t key_size, const uint8_t *srtp_exp,
+			size_t srtp_len, const uint8_t *srtcp_exp,
+			size_t srtcp_len)
+{
+	static const uint8_t trailer[4] = {0x80, 0x00, 0x05, 0xd4};
+	const size_t klen = key_size - sizeof(kat_salt);
+	const size_t rtp_len  = sizeof(kat_rtp_pld) - 1;
+	const size_t rtcp_len = sizeof(kat_rtcp_pld) - 1;
+	struct srtp_gcm *tx = NULL, *rx = NULL;
+	uint8_t key[44];
+	struct mbuf *mb;
+	unsigned i;
+	int err;
+
+	mb = mbuf_alloc(PKT_MAX);
+	if (!mb)
+		return ENOMEM;
+
+	memcpy(key, kat_key, klen);
+	memcpy(key + klen, kat_salt, sizeof(kat_salt));
+
+	err  = srtp_gcm_alloc_session(&tx, key, key, key_size);
+	err |= srtp_gcm_alloc_session(&rx, key, key, key_size);
+	TEST_ERR(err);
+
+	/* SRTP */
+	err  = mbuf_write_mem(mb, kat_rtp_hdr, sizeof(kat_rtp_hdr));
+	err |= mbuf_write_mem(mb, (uint8_t *)kat_rtp_pld, rtp_len);
+	TEST_ERR(err);
+	mb->pos = 0;
+
+	err = srtp_gcm_encrypt(tx, mb);
+	TEST_ERR(err);
+
+	ASSERT_EQ(sizeof(kat_rtp_hdr) + srtp_len, mbuf_get_left(mb));
+	ASSERT_EQ(0, memcmp(mb->buf, kat_rtp_hdr, sizeof(kat_rtp_hdr)));
+	ASSERT_EQ(0, memcmp(mb->buf + sizeof(kat_rtp_hdr), srtp_exp,
+			    srtp_len));
+
+	err = srtp_gcm_decrypt(rx, mb);
+	TEST_ERR(err);
+
+	ASSERT_EQ(sizeof(kat_rtp_hdr) + rtp_len, mbuf_get_left(mb));
+	ASSERT_EQ(0, memcmp(mb->buf + sizeof(kat_rtp_hdr), kat_rtp_pld,
+			    rtp_len));
+
+	/* SRTCP, the sender index starts at 0 */
+	for (i=0; i<=KAT_RTCP_INDEX; i++) {
+
+		mbuf_rewind(mb);
+		err  = mbuf_write_mem(mb, kat_rtcp_hdr, sizeof(kat_rtcp_hdr));
+		err |= mbuf_write_mem(mb, (uint8_t *)kat_rtcp_pld, rtcp_len);
+		TEST_ERR(err);
+		mb->pos = 0;
+
+		err = srtcp_gcm_encrypt(tx, mb);
+		TEST_ERR(err);
+	}
+
+	ASSERT_EQ(sizeof(kat_rtcp_hdr) + srtcp_len + sizeof(trailer),
+		  mbuf_get_left(mb));
+	ASSERT_EQ(0, memcmp(mb->buf, kat_rtcp_hdr, sizeof(kat_rtcp_hdr)));
+	ASSERT_EQ(0, memcmp(mb->buf + sizeof(kat_rtcp_hdr), srtcp_exp,
+			    srtcp_len));
+	ASSERT_EQ(0, memcmp(mb->buf + sizeof(kat_rtcp_hdr) + srtcp_len,
+			    trailer, sizeof(trailer)));
+
+	err = srtcp_gcm_decrypt(rx, mb);
+	TEST_ERR(err);
+
+	ASSERT_EQ(sizeof(kat_rtcp_hdr) + rtcp_len, mbuf_get_left(mb));
+	ASSERT_EQ(0, memcmp(mb->buf + sizeof(kat_rtcp_hdr), kat_rtcp_pld,
+			    rtcp_len));
+
+ out:
+	mem_deref(tx);
+	mem_deref(rx);
+	mem_deref(mb);
+
+	return err;
+}
+#endif
+
+
+int test_srtp_gcm(void)
+{
+	int err = 0;
+
+#ifdef USE_OPENSSL
+	err = test_gcm_suite(28);
+	TEST_ERR(err);
+
+	err = test_gcm_suite(44);
+	TEST_ERR(err);
+
+	err = test_gcm_kat(28, kat_srtp_128, sizeof(kat_srtp_128),
+			   kat_srtcp_128, sizeof(kat_srtcp_128));
+	TEST_ERR(err);
+
+	err = test_gcm_kat(44, kat_srtp_256, sizeof(kat_srtp_256),
+			   kat_srtcp_256, sizeof(kat_srtcp_256));
+	TEST_ERR(err);
+
+	ASSERT_EQ(EINVAL, srtp_gcm_alloc(NULL, NULL, 28));
+
+ out:
+#endif
+	return err;
+}
+
+
+static const struct bench_suite suitev[] = {
+	{"AES_CM_128_HMAC_SHA1_80", cm_80_alloc, cm_encrypt, cm_decrypt,
+	 cm_rtcp_encrypt, cm_rtcp_decrypt},
+	{"AES_CM_128_HMAC_SHA1_32", cm_32_alloc, cm_encrypt, cm_decrypt,
+	 cm_rtcp_encrypt, cm_rtcp_decrypt},
+#ifdef USE_OPENSSL
+	{"AEAD_AES_128_GCM", gcm_128_alloc, gcm_encrypt, gcm_decrypt,
+	 gcm_rtcp_encrypt, gcm_rtcp_decrypt},
+	{"AEAD_AES_256_GCM", gcm_256_alloc, gcm_encrypt, gcm_decrypt,
+	 gcm_rtcp_encrypt, gcm_rtcp_decrypt},
+#endif
+};
+
+
+/* RTP payload sizes of typical media streams */
+static const struct bench_size {
+	const char *name;
+	size_t pld_len;
+} sizev[] = {
+	{"G.711",  160},       /* 20 ms at 64 kbit/s */
+	{"Opus",    80},       /* 20 ms at 32 kbit/s */
+	{"video", 1200},
+};
+
+
+enum {
+	BENCH_SSRCS  = 32,     /* Concurrent media streams              */
+	BENCH_PKTS   = 2048,   /* Distinct packets per round            */
+	BENCH_ROUNDS = 50,
+	REORDER      = 16,     /* Packets per stream sent in reverse    */
+	DUP_INTERVAL = 8,      /* Every n-th packet is also replayed    */
+	RTCP_LEN     = 44,     /* Payload of an SR with one report block */
+};
+
+struct bench {
+	const struct bench_suite *bs;
+	const char *size;
+	size_t pld_len;
+	uint8_t key[44];
+	uint8_t *pktv;         /* Encrypted packets, PKT_MAX apart      */
+	size_t lenv[BENCH_PKTS];
+	struct mbuf *mb;
+};
+
+
+/*
+ * Number of memory blocks in use, only with a debug build of libre.
+ * libre has no counter of allocations, so the benchmark can only see
+ * blocks that are allocated and kept, not short-lived ones.
+ */
+static ssize_t mem_blocks(void)
+{
+	struct memstat mstat;
+
+	if (mem_get_stat(&mstat))
+		return 0;
+
+	return (ssize_t)mstat.blocks_cur;
+}
+
+
+static void bench_print(const struct bench *b, const char *op,
+			uint64_t ms, unsigned npkt, ssize_t retained)
+{
+	ms = max(ms, 1);
+
+	re_printf("srtp %-23s %-5s %-8s %9.0f packets/s %6.0f ns/packet"
+		  " %.3f retained blocks/packet\n",
+		  b->bs->name, b->size, op,
+		  1000.0 * npkt / ms, 1000000.0 * ms / npkt,
+		  (double)retained / npkt);
+}
+
+
+static void bench_load(struct bench *b, size_t i)
+{
+	mbuf_rewind(b->mb);
+	(void)mbuf_write_mem(b->mb, &b->pktv[i * PKT_MAX], b->lenv[i]);
+	b->mb->pos = 0;
+}
+
+
+/* Packet i belongs to stream i % BENCH_SSRCS */
+static int bench_encrypt(struct bench *b)
+{
+	uint8_t pld[PKT_MAX];
+	void *tx = NULL;
+	uint64_t t0;
+	ssize_t blocks;
+	unsigned i, j;
+	int err;
+
+	rand_bytes(pld, b->pld_len);
+
+	err = b->bs->alloch(&tx, b->key);
+	TEST_ERR(err);
+
+	blocks = mem_blocks();
+	t0 = tmr_jiffies();
+
+	for (j=0; j<BENCH_ROUNDS; j++) {
+		for (i=0; i<BENCH_PKTS; i++) {
+
+			err  = make_rtp(b->mb, SSRC + i % BENCH_SSRCS,
+					i / BENCH_SSRCS, pld, b->pld_len);
+			err |= b->bs->ench(tx, b->mb);
+			TEST_ERR(err);
+
+			if (j == 0) {
+				b->lenv[i] = b->mb->end;
+				memcpy(&b->pktv[i * PKT_MAX], b->mb->buf,
+				       b->mb->end);
+			}
+		}
+	}
+
+	bench_print(b, "encrypt", tmr_jiffies() - t0,
+		    BENCH_PKTS * BENCH_ROUNDS, mem_blocks() - blocks);
+
+ out:
+	mem_deref(tx);
+	return err;
+}
+
+
+/* Each stream sends blocks of REORDER packets in reverse order */
+static size_t reorder_index(size_t i)
+{
+	const size_t block = REORDER * BENCH_SSRCS;
+	const size_t base = i - i % block;
+	const size_t ix = i % block;
+
+	return base + (REORDER - 1 - ix / BENCH_SSRCS) * BENCH_SSRCS
+		+ ix % BENCH_SSRCS;
+}
+
+
+/*
+ * Decrypt the packets from bench_encrypt(), in order or reordered
+ * with replayed duplicates. A new session per round passes the
+ * replay protection.
+ */
+static int bench_decrypt(struct bench *b, bool reorder)
+{
+	void *rx = NULL;
+	unsigned i, j, n = 0;
+	uint64_t t0;
+	ssize_t blocks;
+	int err = 0;
+
+	blocks = mem_blocks();
+	t0 = tmr_jiffies();
+
+	for (j=0; j<BENCH_ROUNDS; j++) {
+
+		rx = mem_deref(rx);
+		err = b->bs->alloch(&rx, b->key);
+		TEST_ERR(err);
+
+		for (i=0; i<BENCH_PKTS; i++) {
+
+			const size_t k = reorder ? reorder_index(i) : i;
+
+			bench_load(b, k);
+			err = b->bs->dech(rx, b->mb);
+			TEST_ERR(err);
+			++n;
+
+			if (!reorder || i % DUP_INTERVAL)
+				continue;
+
+			bench_load(b, k);
+			ASSERT_TRUE(0 != b->bs->dech(rx, b->mb));
+			++n;
+		}
+	}
+
+	rx = mem_deref(rx);
+
+	bench_print(b, reorder ? "reorder" : "decrypt", tmr_jiffies() - t0,
+		    n, mem_blocks() - blocks);
+
+ out:
+	mem_deref(rx);
+	return err;
+}
+
+
+static int bench_rtcp(struct bench *b)
+{
+	uint8_t pld[RTCP_LEN];
+	void *tx = NULL, *rx = NULL;
+	uint64_t t0;
+	ssize_t blocks;
+	unsigned i;
+	int err;
+
+	rand_bytes(pld, sizeof(pld));
+
+	err  = b->bs->alloch(&tx, b->key);
+	err |= b->bs->alloch(&rx, b->key);
+	TEST_ERR(err);
+
+	blocks = mem_blocks();
+	t0 = tmr_jiffies();
+
+	for (i=0; i<BENCH_PKTS * BENCH_ROUNDS; i++) {
+
+		err  = make_rtcp(b->mb, SSRC + i % BENCH_SSRCS,
+				 pld, sizeof(pld));
+		err |= b->bs->rtcp_ench(tx, b->mb);
+		err |= b->bs->rtcp_dech(rx, b->mb);
+		TEST_ERR(err);
+	}
+
+	bench_print(b, "srtcp", tmr_jiffies() - t0,
+		    BENCH_PKTS * BENCH_ROUNDS, mem_blocks() - blocks);
+
+ out:
+	mem_deref(tx);
+	mem_deref(rx);
+	return err;
+}
+
+
+/*
+ * SRTP throughput of each crypto-suite, for typical packet sizes and
+ * many concurrent streams. The cost of SRTCP is for one encrypt and
+ * decrypt. The retained blocks/packet are memory blocks that are
+ * allocated and not freed, divided by the number of packets. Blocks
+ * that are allocated and freed again within a packet are not counted.
+ */
+int test_srtp_perf(void)
+{
+	struct bench b;
+	size_t i, j;
+	int err = 0;
+
+	memset(&b, 0, sizeof(b));
+
+	b.pktv = mem_alloc(BENCH_PKTS * PKT_MAX, NULL);
+	b.mb   = mbuf_alloc(PKT_MAX);
+	if (!b.pktv || !b.mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	rand_bytes(b.key, sizeof(b.key));
+
+	re_printf("srtp: %u streams, %u packets per test\n",
+		  BENCH_SSRCS, BENCH_PKTS * BENCH_ROUNDS);
+
+	for (i=0; i<ARRAY_SIZE(suitev); i++) {
+
+		b.bs = &suitev[i];
+
+		for (j=0; j<ARRAY_SIZE(sizev); j++) {
+
+			b.size    = sizev[j].name;
+			b.pld_len = sizev[j].pld_len;
+
+			err  = bench_encrypt(&b);
+			err |= bench_decrypt(&b, false);
+			err |= bench_decrypt(&b, true);
+			if (err)
+				goto out;
+		}
+
+		b.size = "RTCP";
+
+		err = bench_rtcp(&b);
+		if (err)
+			goto out;
+	}
+
+ out:
+	mem_deref(b.mb);
+	mem_deref(b.pktv);
+
+	return err;
+}
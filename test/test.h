@@ -74,6 +74,7 @@ struct dns_server {
 	struct sa addr;
 	struct list rrl;
 	bool rotate;
+	unsigned n_queries;
 };
 
 int dns_server_alloc(struct dns_server **srvp, bool rotate);
@@ -84,24 +85,50 @@ int dns_server_add_srv(struct dns_server *srv, const char *name,
 		       const char *target);
 
 
+/*
+ * Mock Audio-source
+ */
+
+struct ausrc;
+
+int mock_ausrc_register(struct ausrc **ausrcp);
+
+
 /* test cases */
 
 int test_cmd(void);
 int test_ua_alloc(void);
+int test_uag_find(void);
 int test_uag_find_param(void);
+int test_uag_find_perf(void);
 int test_ua_register(void);
 int test_ua_register_dns(void);
 int test_ua_register_auth(void);
 int test_ua_register_auth_dns(void);
 int test_ua_options(void);
 int test_mos(void);
+int test_h264_startcode(void);
+int test_h264_packetize(void);
+int test_h264_reasm(void);
+int test_h264_perf(void);
+int test_json_decode(void);
+int test_json_lines(void);
+int test_json_number(void);
 int test_network(void);
+int test_network_dns_cache(void);
+int test_sdp_tmpl(void);
+int test_sdp_tmpl_perf(void);
+int test_srtp_gcm(void);
+int test_srtp_perf(void);
+int test_vidadapt(void);
 
 int test_call_answer(void);
 int test_call_reject(void);
 int test_call_af_mismatch(void);
 int test_call_answer_hangup_a(void);
 int test_call_answer_hangup_b(void);
+int test_call_admission(void);
+int test_call_decode_ptime_120(void);
 
 
 #ifdef __cplusplus
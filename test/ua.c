@@ -219,6 +219,104 @@ int test_uag_find_param(void)
 }
 
 
+int test_uag_find(void)
+{
+	struct ua *ua1 = NULL, *ua2 = NULL;
+	struct pl pl;
+	int err = 0;
+
+	err  = ua_alloc(&ua1, "<sip:alice@127.0.0.1>;regint=0");
+	err |= ua_alloc(&ua2, "<sip:bob@127.0.0.1>;regint=0");
+	if (err)
+		goto out;
+
+	/* contact username */
+	pl_set_str(&pl, ua_local_cuser(ua2));
+	ASSERT_TRUE(ua2 == uag_find(&pl));
+
+	/* AOR username, case-insensitive */
+	pl_set_str(&pl, "ALICE");
+	ASSERT_TRUE(ua1 == uag_find(&pl));
+
+	pl_set_str(&pl, "carol");
+	ASSERT_TRUE(NULL == uag_find(&pl));
+
+	ASSERT_TRUE(ua1  == uag_find_aor("sip:alice@127.0.0.1"));
+	ASSERT_TRUE(ua2  == uag_find_aor("sip:bob@127.0.0.1"));
+	ASSERT_TRUE(NULL == uag_find_aor("sip:carol@127.0.0.1"));
+
+	mem_deref(ua1);
+	ua1 = NULL;
+
+	pl_set_str(&pl, "alice");
+	ASSERT_TRUE(NULL == uag_find(&pl));
+	ASSERT_TRUE(NULL == uag_find_aor("sip:alice@127.0.0.1"));
+
+ out:
+	mem_deref(ua2);
+	mem_deref(ua1);
+
+	return err;
+}
+
+
+/*
+ * Lookup of User-Agents, with many accounts
+ */
+int test_uag_find_perf(void)
+{
+	enum {NUM_UAS = 10000, LOOKUPS = 100000};
+	struct ua **uav;
+	char aor[64];
+	struct pl pl;
+	uint64_t t0, t1, t2;
+	unsigned i;
+	int err = 0;
+
+	uav = mem_zalloc(NUM_UAS * sizeof(*uav), NULL);
+	if (!uav)
+		return ENOMEM;
+
+	t0 = tmr_jiffies();
+
+	for (i=0; i<NUM_UAS; i++) {
+
+		re_snprintf(aor, sizeof(aor),
+			    "<sip:user%u@127.0.0.1>;regint=0", i);
+
+		err = ua_alloc(&uav[i], aor);
+		TEST_ERR(err);
+	}
+
+	t1 = tmr_jiffies();
+
+	for (i=0; i<LOOKUPS; i++) {
+
+		struct ua *ua = uav[(i * 7919) % NUM_UAS];
+
+		pl_set_str(&pl, ua_local_cuser(ua));
+		ASSERT_TRUE(ua == uag_find(&pl));
+
+		ASSERT_TRUE(ua == uag_find_aor(ua_aor(ua)));
+	}
+
+	t2 = tmr_jiffies();
+
+	re_printf("uag: %u UAs allocated in %u ms\n",
+		  NUM_UAS, (unsigned)(t1 - t0));
+	re_printf("uag: %u lookups in %u ms (%.1f lookups/ms)\n",
+		  2 * LOOKUPS, (unsigned)(t2 - t1),
+		  2.0 * LOOKUPS / max(t2 - t1, 1));
+
+ out:
+	for (i=0; i<NUM_UAS; i++)
+		mem_deref(uav[i]);
+	mem_deref(uav);
+
+	return err;
+}
+
+
 static const char *_sip_transp_srvid(enum sip_transp tp)
 {
 	switch (tp) {
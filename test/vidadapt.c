@@ -0,0 +1,85 @@
+/**
+ * @file test/vidadapt.c  Baresip selftest -- video CPU-overuse adaptation
+ *
+ * Copyright (C) 2010 - 2016 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+enum {FPS = 25, WINDOW = 5};
+
+
+/* Encode one window of frames, each using a share of the frame interval */
+static unsigned window(struct vidadapt *va, unsigned usage)
+{
+	unsigned i;
+
+	for (i=0; i<FPS * WINDOW; i++)
+		vidadapt_encoded(va, 1000000ULL * usage / 100 / FPS);
+
+	return vidadapt_check(va, FPS);
+}
+
+
+int test_vidadapt(void)
+{
+	const unsigned n = vidadapt_level_count();
+	struct vidadapt va;
+	unsigned level, i;
+	int err = 0;
+
+	memset(&va, 0, sizeof(va));
+
+	ASSERT_TRUE(n >= 2);
+	ASSERT_EQ(100, vidadapt_level(0)->scale);
+	ASSERT_EQ(100, vidadapt_level(0)->fps);
+	ASSERT_TRUE(vidadapt_level(n) == vidadapt_level(n - 1));
+
+	/* no frames, no decision */
+	ASSERT_EQ(0, vidadapt_check(&va, FPS));
+
+	/* full quality with headroom stays */
+	ASSERT_EQ(0, window(&va, 50));
+	ASSERT_EQ(50, va.usage);
+
+	/* overuse steps down one level at a time */
+	for (i=1; i<n; i++) {
+		level = window(&va, 90);
+		ASSERT_EQ(i, level);
+		va.level = level;
+	}
+
+	/* the lowest level is kept under overuse */
+	ASSERT_EQ(n - 1, window(&va, 95));
+
+	/* step up after two windows with headroom at the next level */
+	va.level = 1;
+	ASSERT_EQ(1, window(&va, 10));
+	ASSERT_EQ(0, window(&va, 10));
+
+	/* usage estimated at the next level breaks the hysteresis */
+	va.headroom = 0;
+	ASSERT_EQ(1, window(&va, 10));
+	ASSERT_EQ(1, window(&va, 50));
+	ASSERT_EQ(1, window(&va, 10));
+	ASSERT_EQ(0, window(&va, 10));
+
+	/* overuse resets the hysteresis */
+	ASSERT_EQ(1, window(&va, 10));
+	ASSERT_EQ(2, window(&va, 90));
+	ASSERT_EQ(1, window(&va, 10));
+
+	/* a reset starts a new window and keeps the level */
+	vidadapt_encoded(&va, 1000000);
+	vidadapt_reset(&va);
+	ASSERT_EQ(1, va.level);
+	ASSERT_EQ(0, va.frames);
+	ASSERT_EQ(0, va.headroom);
+	ASSERT_EQ(1, window(&va, 10));
+
+ out:
+	return err;
+}